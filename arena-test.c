@@ -0,0 +1,53 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <string.h>
+
+#include "test.h"
+#include "util.h"
+
+TEST(Arena, Alloc) {
+  struct Arena arena;
+  arena_init(&arena);
+  ASSERT(arena.num_pages == 0);
+  char* a = arena_alloc(&arena, 3);
+  char* b = arena_alloc(&arena, 5);
+  ASSERT(a != b);
+  ASSERT((uintptr_t) a % alignof(max_align_t) == 0);
+  ASSERT((uintptr_t) b % alignof(max_align_t) == 0);
+  ASSERT(arena.num_pages == 1);
+  arena_fini(&arena);
+  ASSERT(arena.num_pages == 0);
+}
+
+TEST(Arena, ManyPages) {
+  struct Arena arena;
+  arena_init(&arena);
+  for (size_t i = 0; i < 4 * ARENA_PAGE_SIZE / 64; i++) {
+    memset(arena_alloc(&arena, 64), 0xab, 64);
+  }
+  ASSERT(arena.num_pages == 4);
+  // Large allocations get their own page, without wasting the current one
+  char* big = arena_alloc(&arena, 2 * ARENA_PAGE_SIZE);
+  memset(big, 0xcd, 2 * ARENA_PAGE_SIZE);
+  ASSERT(arena.num_pages == 5);
+  arena_alloc(&arena, 64);
+  ASSERT(arena.num_pages == 6);
+  arena_fini(&arena);
+}
+
+TEST(Arena, Realloc) {
+  struct Arena arena;
+  arena_init(&arena);
+  char* a = arena_realloc(&arena, NULL, 0, 16);
+  memcpy(a, "hello", 6);
+  // The last allocation grows in place
+  ASSERT(arena_realloc(&arena, a, 16, 64) == a);
+  char* b = arena_alloc(&arena, 16);
+  UNUSED(b);
+  // Anything else is copied
+  char* c = arena_realloc(&arena, a, 64, 128);
+  ASSERT(c != a);
+  ASSERT(!strcmp(c, "hello"));
+  arena_fini(&arena);
+}
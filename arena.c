@@ -0,0 +1,80 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define ALIGNMENT alignof(max_align_t)
+#define ALIGN_UP(X) (((X) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+// Header at the start of every page. Data follows right after it.
+struct ArenaPage {
+  struct ArenaPage* next;
+};
+
+#define PAGE_HEADER_SIZE ALIGN_UP(sizeof(struct ArenaPage))
+
+void arena_init(struct Arena* arena) {
+  arena->pages = NULL;
+  arena->next = arena->end = NULL;
+  arena->last = NULL;
+  arena->num_pages = 0;
+}
+
+void arena_fini(struct Arena* arena) {
+  struct ArenaPage* page = arena->pages;
+  while (page) {
+    struct ArenaPage* next = page->next;
+    free(page);
+    page = next;
+  }
+  arena_init(arena);
+}
+
+static uint8_t* page_alloc(struct Arena* arena, size_t data_size) {
+  struct ArenaPage* page = malloc(PAGE_HEADER_SIZE + data_size);
+  if (!page) {
+    DIE_ERR("malloc()");
+  }
+  arena->num_pages++;
+  // Oversized pages are linked in behind the current page, so that we keep
+  // bumping from the current one
+  if (data_size > ARENA_PAGE_SIZE && arena->pages) {
+    page->next = arena->pages->next;
+    arena->pages->next = page;
+  } else {
+    page->next = arena->pages;
+    arena->pages = page;
+  }
+  return (uint8_t*) page + PAGE_HEADER_SIZE;
+}
+
+void* arena_alloc(struct Arena* arena, size_t size) {
+  size = ALIGN_UP(size);
+  if (size > (size_t) (arena->end - arena->next)) {
+    if (size > ARENA_PAGE_SIZE) {
+      return arena->last = page_alloc(arena, size);
+    }
+    arena->next = page_alloc(arena, ARENA_PAGE_SIZE);
+    arena->end = arena->next + ARENA_PAGE_SIZE;
+  }
+  void* ret = arena->next;
+  arena->next += size;
+  return arena->last = ret;
+}
+
+void* arena_realloc(struct Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+  if (ptr == NULL) {
+    return arena_alloc(arena, new_size);
+  }
+  if (ptr == arena->last && (uint8_t*) ptr + ALIGN_UP(old_size) == arena->next
+      && ALIGN_UP(new_size) <= (size_t) (arena->end - (uint8_t*) ptr)) {
+    arena->next = (uint8_t*) ptr + ALIGN_UP(new_size);
+    return ptr;
+  }
+  void* ret = arena_alloc(arena, new_size);
+  memcpy(ret, ptr, old_size < new_size ? old_size : new_size);
+  return ret;
+}
@@ -0,0 +1,36 @@
+#ifndef __BS_ARENA_H__
+#define __BS_ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of a regular arena page. Larger allocations get a page of their own.
+#define ARENA_PAGE_SIZE (64 * 1024)
+
+struct ArenaPage;
+
+// Bump allocator. Memory is handed out from large pages, and is only freed
+// all at once, when the arena is destroyed.
+struct Arena {
+  struct ArenaPage* pages; // List of allocated pages, most recent first
+  uint8_t* next;           // Next free byte in the current page
+  uint8_t* end;            // End of the current page
+  void* last;              // Most recent allocation, which can be grown in place
+  size_t num_pages;        // Number of allocated pages
+};
+
+// Initialize an empty arena. This doesn't allocate anything.
+void arena_init(struct Arena* arena);
+
+// Free all memory allocated from the arena
+void arena_fini(struct Arena* arena);
+
+// Allocate `size` bytes from the arena, suitably aligned for any type
+void* arena_alloc(struct Arena* arena, size_t size);
+
+// Resize an allocation from this arena. The most recent allocation is grown
+// in place if there's room, anything else is copied to a new allocation. Old
+// memory is not reclaimed until the arena is destroyed.
+void* arena_realloc(struct Arena* arena, void* ptr, size_t old_size, size_t new_size);
+
+#endif  // __BS_ARENA_H__
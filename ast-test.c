@@ -3,8 +3,10 @@
 #include "test.h"
 
 TEST(Ast, Vec) {
+  struct Arena arena;
   struct AstVec vec;
-  ast_vec_init(&vec);
+  arena_init(&arena);
+  ast_vec_init(&vec, &arena);
   ast_vec_push(&vec, NULL);
   ast_vec_push(&vec, NULL);
   ast_vec_push(&vec, NULL);
@@ -12,12 +14,14 @@ TEST(Ast, Vec) {
   ASSERT(vec.data[0] == NULL);
   ASSERT(vec.data[1] == NULL);
   ASSERT(vec.data[2] == NULL);
-  ast_vec_fini(&vec);
+  arena_fini(&arena);
 }
 
 TEST(Ast, PairVec) {
+  struct Arena arena;
   struct AstPairVec vec;
-  ast_pair_vec_init(&vec);
+  arena_init(&arena);
+  ast_pair_vec_init(&vec, &arena);
   ast_pair_vec_push(&vec, NULL, NULL);
   ast_pair_vec_push(&vec, NULL, NULL);
   ast_pair_vec_push(&vec, NULL, NULL);
@@ -28,52 +32,54 @@ TEST(Ast, PairVec) {
   ASSERT(vec.data[1].value == NULL);
   ASSERT(vec.data[2].key == NULL);
   ASSERT(vec.data[2].value == NULL);
-  ast_pair_vec_fini(&vec);
+  arena_fini(&arena);
 }
 
 TEST(Ast, PrintFunction) {
+  struct Arena arena;
   struct Str fib, n;
+  arena_init(&arena);
   struct AstVec params, fib_body, if_body, else_body, first_args, second_args;
-  ast_vec_init(&params);
-  ast_vec_init(&fib_body);
-  ast_vec_init(&if_body);
-  ast_vec_init(&else_body);
-  ast_vec_init(&first_args);
-  ast_vec_init(&second_args);
+  ast_vec_init(&params, &arena);
+  ast_vec_init(&fib_body, &arena);
+  ast_vec_init(&if_body, &arena);
+  ast_vec_init(&else_body, &arena);
+  ast_vec_init(&first_args, &arena);
+  ast_vec_init(&second_args, &arena);
 
   str_init(&fib, "fib", SIZE_MAX);
   str_init(&n, "n", SIZE_MAX);
 
-  ast_vec_push(&params, ast_identifier_create(0, n));
-  ast_vec_push(&if_body, ast_return_create(0, ast_integer_create(0, 1)));
+  ast_vec_push(&params, ast_identifier_create(&arena, 0, n, SYMBOL_NONE));
+  ast_vec_push(&if_body, ast_return_create(&arena, 0, ast_integer_create(&arena, 0, 1)));
 
   ast_vec_push(&first_args,
-               ast_binary_create(0, BO_Subtract,
-                                 ast_identifier_create(0, n),
-                                 ast_integer_create(0, 1)));
+               ast_binary_create(&arena, 0, BO_Subtract,
+                                 ast_identifier_create(&arena, 0, n, SYMBOL_NONE),
+                                 ast_integer_create(&arena, 0, 1)));
   ast_vec_push(&second_args,
-               ast_binary_create(0, BO_Subtract,
-                                 ast_identifier_create(0, n),
-                                 ast_integer_create(0, 2)));
+               ast_binary_create(&arena, 0, BO_Subtract,
+                                 ast_identifier_create(&arena, 0, n, SYMBOL_NONE),
+                                 ast_integer_create(&arena, 0, 2)));
   ast_vec_push(&else_body,
-               ast_return_create(0,
-                                 ast_binary_create(0, BO_Add,
-                                                   ast_call_create(0,
-                                                                   ast_identifier_create(0, fib),
+               ast_return_create(&arena, 0,
+                                 ast_binary_create(&arena, 0, BO_Add,
+                                                   ast_call_create(&arena, 0,
+                                                                   ast_identifier_create(&arena, 0, fib, SYMBOL_NONE),
                                                                    first_args),
-                                                   ast_call_create(0,
-                                                                   ast_identifier_create(0, fib),
+                                                   ast_call_create(&arena, 0,
+                                                                   ast_identifier_create(&arena, 0, fib, SYMBOL_NONE),
                                                                    second_args))));
   ast_vec_push(&fib_body,
-               ast_if_create(0,
-                             ast_binary_create(0, BO_LessEqual,
-                                               ast_identifier_create(0, n),
-                                               ast_integer_create(0, 1)),
-                             ast_block_create(0, if_body, true),
-                             ast_block_create(0, else_body, true)));
-  struct Ast* ast = ast_let_create(0, true, fib,
-                                   ast_function_create(0, params,
-                                                       ast_block_create(0, fib_body, false)));
+               ast_if_create(&arena, 0,
+                             ast_binary_create(&arena, 0, BO_LessEqual,
+                                               ast_identifier_create(&arena, 0, n, SYMBOL_NONE),
+                                               ast_integer_create(&arena, 0, 1)),
+                             ast_block_create(&arena, 0, if_body, true),
+                             ast_block_create(&arena, 0, else_body, true)));
+  struct Ast* ast = ast_let_create(&arena, 0, true, fib, SYMBOL_NONE,
+                                   ast_function_create(&arena, 0, params,
+                                                       ast_block_create(&arena, 0, fib_body, false)));
 
   struct String buffer;
   string_init(&buffer, "");
@@ -88,5 +94,33 @@ TEST(Ast, PrintFunction) {
            "2))))))))))", SIZE_MAX);
   ASSERT_STR_EQ(slice, target);
 
-  ast_free(ast);
+  arena_fini(&arena);
+}
+
+TEST(Ast, CloneAcrossArenas) {
+  struct Arena source_arena, target_arena;
+  arena_init(&source_arena);
+  arena_init(&target_arena);
+  struct AstVec elements;
+  ast_vec_init(&elements, &source_arena);
+  ast_vec_push(&elements, ast_integer_create(&source_arena, 0, 1));
+  ast_vec_push(&elements, ast_unary_create(&source_arena, 0, UO_Minus,
+                                           ast_float_create(&source_arena, 0, 2.5)));
+  struct Ast* original = ast_array_create(&source_arena, 0, elements);
+  struct Ast* clone = ast_clone(&target_arena, original);
+  arena_fini(&source_arena);
+
+  struct String buffer;
+  string_init(&buffer, "");
+  struct Writer* writer = (struct Writer*) string_writer_create(&buffer);
+  ASSERT(ast_print(clone, writer) > 0);
+  string_writer_free((struct StringWriter*) writer);
+
+  struct Str slice = { buffer.data, buffer.length };
+  struct Str target;
+  str_init(&target, "(arr 1 (- 2.500000))", SIZE_MAX);
+  ASSERT_STR_EQ(slice, target);
+
+  string_fini(&buffer);
+  arena_fini(&target_arena);
 }
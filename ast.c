@@ -1,17 +1,10 @@
 #include "ast.h"
 
-#include <stdlib.h>
-
+#include "arena.h"
 #include "log.h"
 #include "string.h"
 #include "util.h"
 
-#define REALLOC(PTR, SIZE) do {        \
-    if (!(PTR = realloc(PTR, SIZE))) { \
-      DIE_ERR("realloc()");            \
-    }                                  \
-  } while (0)
-
 #define TRY_ACCUM(ACCUM, ACTION) do { \
     int __tmp = ACTION;               \
     if (__tmp < 0) {                  \
@@ -51,22 +44,17 @@ const char* unary_op_to_str(enum UnaryOp op) {
   }
 }
 
-void ast_vec_init(struct AstVec* vec) {
+void ast_vec_init(struct AstVec* vec, struct Arena* arena) {
+  vec->arena = arena;
   vec->data = NULL;
   vec->length = vec->capacity = 0;
 }
 
-void ast_vec_fini(struct AstVec* vec) {
-  for (size_t i = 0; i < vec->length; i++) {
-    ast_free(vec->data[i]);
-  }
-  free(vec->data);
-}
-
 void ast_vec_push(struct AstVec* vec, struct Ast* ast) {
   if (vec->length == vec->capacity) {
     size_t new_capacity = vec->capacity == 0 ? 8 : vec->capacity * 2;
-    REALLOC(vec->data, new_capacity * sizeof(struct Ast*));
+    vec->data = arena_realloc(vec->arena, vec->data, vec->capacity * sizeof(struct Ast*),
+                              new_capacity * sizeof(struct Ast*));
     vec->capacity = new_capacity;
   }
   vec->data[vec->length++] = ast;
@@ -81,71 +69,60 @@ static int ast_vec_print(const struct AstVec* vec, struct Writer* writer) {
   return ret;
 }
 
-static struct AstVec ast_vec_clone(const struct AstVec* vec) {
+static struct AstVec ast_vec_clone(struct Arena* arena, const struct AstVec* vec) {
   struct AstVec ret;
-  ret.length = vec->length;
-  ret.capacity = vec->capacity;
-  ret.data = NULL;
-  REALLOC(ret.data, ret.capacity * sizeof(struct Ast*));
+  ret.arena = arena;
+  ret.length = ret.capacity = vec->length;
+  ret.data = arena_alloc(arena, ret.capacity * sizeof(struct Ast*));
   for (size_t i = 0; i < ret.length; i++) {
-    ret.data[i] = ast_clone(vec->data[i]);
+    ret.data[i] = ast_clone(arena, vec->data[i]);
   }
   return ret;
 }
 
-void ast_pair_vec_init(struct AstPairVec* vec) {
+void ast_pair_vec_init(struct AstPairVec* vec, struct Arena* arena) {
+  vec->arena = arena;
   vec->data = NULL;
   vec->length = vec->capacity = 0;
 }
 
-void ast_pair_vec_fini(struct AstPairVec* vec) {
-  for (size_t i = 0; i < vec->length; i++) {
-    ast_free(vec->data[i].key);
-    ast_free(vec->data[i].value);
-  }
-  free(vec->data);
-}
-
 void ast_pair_vec_push(struct AstPairVec* vec, struct Ast* key, struct Ast* value) {
   if (vec->length == vec->capacity) {
     size_t new_capacity = vec->capacity == 0 ? 8 : vec->capacity * 2;
-    REALLOC(vec->data, new_capacity * sizeof(struct AstPair));
+    vec->data = arena_realloc(vec->arena, vec->data, vec->capacity * sizeof(struct AstPair),
+                              new_capacity * sizeof(struct AstPair));
     vec->capacity = new_capacity;
   }
   struct AstPair pair = { key, value };
   vec->data[vec->length++] = pair;
 }
 
-static struct AstPairVec ast_pair_vec_clone(const struct AstPairVec* vec) {
+static struct AstPairVec ast_pair_vec_clone(struct Arena* arena, const struct AstPairVec* vec) {
   struct AstPairVec ret;
-  ret.length = vec->length;
-  ret.capacity = vec->capacity;
-  ret.data = NULL;
-  REALLOC(ret.data, ret.capacity * sizeof(struct AstPair*));
+  ret.arena = arena;
+  ret.length = ret.capacity = vec->length;
+  ret.data = arena_alloc(arena, ret.capacity * sizeof(struct AstPair));
   for (size_t i = 0; i < ret.length; i++) {
-    ret.data[i].key = ast_clone(vec->data[i].key);
-    ret.data[i].value = ast_clone(vec->data[i].value);
+    ret.data[i].key = ast_clone(arena, vec->data[i].key);
+    ret.data[i].value = ast_clone(arena, vec->data[i].value);
   }
   return ret;
 }
 
-#define ALLOC_AST(TYPE, VAR, LINE)                  \
-  struct Ast##TYPE* VAR;                            \
-  if (!(VAR = malloc(sizeof(struct Ast##TYPE)))) {  \
-    DIE_ERR("malloc()");                            \
-  }                                                 \
-  VAR->ast.type = AST_##TYPE;                       \
-  VAR->ast.line_num = LINE;                         \
+#define ALLOC_AST(TYPE, VAR, LINE)                                        \
+  struct Ast##TYPE* VAR = arena_alloc(arena, sizeof(struct Ast##TYPE));   \
+  VAR->ast.type = AST_##TYPE;                                             \
+  VAR->ast.line_num = LINE;                                               \
 
-struct Ast* ast_program_create(size_t line_num, struct AstVec statements) {
+struct Ast* ast_program_create(struct Arena* arena, size_t line_num, struct AstVec statements) {
   ALLOC_AST(Program, program, line_num);
   program->statements = statements;
   return (struct Ast*) program;
 }
 
-static struct Ast* ast_program_clone(const struct AstProgram* ast) {
+static struct Ast* ast_program_clone(struct Arena* arena, const struct AstProgram* ast) {
   ALLOC_AST(Program, program, ast->ast.line_num);
-  program->statements = ast_vec_clone(&ast->statements);
+  program->statements = ast_vec_clone(arena, &ast->statements);
   return (struct Ast*) program;
 }
 
@@ -157,22 +134,17 @@ static int ast_program_print(const struct AstProgram *ast, struct Writer* writer
   return ret;
 }
 
-static void ast_program_free(struct AstProgram* ast) {
-  ast_vec_fini(&ast->statements);
-  free(ast);
-}
-
-struct Ast* ast_block_create(size_t line_num, struct AstVec statements, bool last_had_semicolon) {
+struct Ast* ast_block_create(struct Arena* arena, size_t line_num, struct AstVec statements, bool last_had_semicolon) {
   ALLOC_AST(Block, block, line_num);
   block->last_had_semicolon = last_had_semicolon;
   block->statements = statements;
   return (struct Ast*) block;
 }
 
-static struct Ast* ast_block_clone(const struct AstBlock* ast) {
+static struct Ast* ast_block_clone(struct Arena* arena, const struct AstBlock* ast) {
   ALLOC_AST(Block, block, ast->ast.line_num);
   block->last_had_semicolon = ast->last_had_semicolon;
-  block->statements = ast_vec_clone(&ast->statements);
+  block->statements = ast_vec_clone(arena, &ast->statements);
   return (struct Ast*) block;
 }
 
@@ -184,12 +156,7 @@ static int ast_block_print(const struct AstBlock *ast, struct Writer* writer) {
   return ret;
 }
 
-static void ast_block_free(struct AstBlock* ast) {
-  ast_vec_fini(&ast->statements);
-  free(ast);
-}
-
-struct Ast* ast_struct_create(size_t line_num, const struct Str* opt_parent, struct Ast* body) {
+struct Ast* ast_struct_create(struct Arena* arena, size_t line_num, const struct Str* opt_parent, struct Ast* body) {
   ALLOC_AST(Struct, struct_node, line_num);
   if (!opt_parent) {
     struct_node->has_parent = false;
@@ -202,11 +169,11 @@ struct Ast* ast_struct_create(size_t line_num, const struct Str* opt_parent, str
   return (struct Ast*) struct_node;
 }
 
-static struct Ast* ast_struct_clone(const struct AstStruct* ast) {
+static struct Ast* ast_struct_clone(struct Arena* arena, const struct AstStruct* ast) {
   ALLOC_AST(Struct, struct_node, ast->ast.line_num);
   struct_node->has_parent = ast->has_parent;
   struct_node->opt_parent = ast->opt_parent;
-  struct_node->body = ast_clone(ast->body);
+  struct_node->body = ast_clone(arena, ast->body);
   return (struct Ast*) struct_node;
 }
 
@@ -223,22 +190,30 @@ static int ast_struct_print(const struct AstStruct* ast, struct Writer* writer)
   return ret;
 }
 
-static void ast_struct_free(struct AstStruct* ast) {
-  ast_free(ast->body);
-  free(ast);
+struct Ast* ast_function_create(struct Arena* arena, size_t line_num, struct AstVec parameters, struct Ast* body) {
+  ALLOC_AST(Function, function, line_num);
+  function->parameters = parameters;
+  function->body = body;
+  function->lazy_body = (struct Str) { NULL, 0 };
+  function->lazy_line_num = 0;
+  return (struct Ast*) function;
 }
 
-struct Ast* ast_function_create(size_t line_num, struct AstVec parameters, struct Ast* body) {
+struct Ast* ast_lazy_function_create(struct Arena* arena, size_t line_num, struct AstVec parameters, struct Str body, size_t body_line_num) {
   ALLOC_AST(Function, function, line_num);
   function->parameters = parameters;
-  function->body = body;
+  function->body = NULL;
+  function->lazy_body = body;
+  function->lazy_line_num = body_line_num;
   return (struct Ast*) function;
 }
 
-static struct Ast* ast_function_clone(const struct AstFunction* ast) {
+static struct Ast* ast_function_clone(struct Arena* arena, const struct AstFunction* ast) {
   ALLOC_AST(Function, function, ast->ast.line_num);
-  function->parameters = ast_vec_clone(&ast->parameters);
-  function->body = ast_clone(ast->body);
+  function->parameters = ast_vec_clone(arena, &ast->parameters);
+  function->body = ast_clone(arena, ast->body);
+  function->lazy_body = ast->lazy_body;
+  function->lazy_line_num = ast->lazy_line_num;
   return (struct Ast*) function;
 }
 
@@ -247,18 +222,16 @@ static int ast_function_print(const struct AstFunction* ast, struct Writer* writ
   TRY_ACCUM(ret, writer->writef(writer, "(fn (params"));
   TRY_ACCUM(ret, ast_vec_print(&ast->parameters, writer));
   TRY_ACCUM(ret, writer->writef(writer, ") "));
-  TRY_ACCUM(ret, ast_print(ast->body, writer));
+  if (ast->body) {
+    TRY_ACCUM(ret, ast_print(ast->body, writer));
+  } else {
+    TRY_ACCUM(ret, writer->writef(writer, "<lazy>"));
+  }
   TRY_ACCUM(ret, writer->writef(writer, ")"));
   return ret;
 }
 
-static void ast_function_free(struct AstFunction* ast) {
-  ast_vec_fini(&ast->parameters);
-  ast_free(ast->body);
-  free(ast);
-}
-
-struct Ast* ast_if_create(size_t line_num, struct Ast* condition, struct Ast* body, struct Ast* else_part) {
+struct Ast* ast_if_create(struct Arena* arena, size_t line_num, struct Ast* condition, struct Ast* body, struct Ast* else_part) {
   ALLOC_AST(If, if_statement, line_num);
   if_statement->condition = condition;
   if_statement->body = body;
@@ -266,11 +239,11 @@ struct Ast* ast_if_create(size_t line_num, struct Ast* condition, struct Ast* bo
   return (struct Ast*) if_statement;
 }
 
-static struct Ast* ast_if_clone(const struct AstIf* ast) {
+static struct Ast* ast_if_clone(struct Arena* arena, const struct AstIf* ast) {
   ALLOC_AST(If, if_statement, ast->ast.line_num);
-  if_statement->condition = ast_clone(ast->condition);
-  if_statement->body = ast_clone(ast->body);
-  if_statement->else_part = ast_clone(ast->else_part);
+  if_statement->condition = ast_clone(arena, ast->condition);
+  if_statement->body = ast_clone(arena, ast->body);
+  if_statement->else_part = ast_clone(arena, ast->else_part);
   return (struct Ast*) if_statement;
 }
 
@@ -290,24 +263,17 @@ static int ast_if_print(const struct AstIf* ast, struct Writer* writer) {
   return ret;
 }
 
-static void ast_if_free(struct AstIf* ast) {
-  ast_free(ast->condition);
-  ast_free(ast->body);
-  ast_free(ast->else_part);
-  free(ast);
-}
-
-struct Ast* ast_while_create(size_t line_num, struct Ast* condition, struct Ast* body) {
+struct Ast* ast_while_create(struct Arena* arena, size_t line_num, struct Ast* condition, struct Ast* body) {
   ALLOC_AST(While, while_loop, line_num);
   while_loop->condition = condition;
   while_loop->body = body;
   return (struct Ast*) while_loop;
 }
 
-static struct Ast* ast_while_clone(const struct AstWhile* ast) {
+static struct Ast* ast_while_clone(struct Arena* arena, const struct AstWhile* ast) {
   ALLOC_AST(While, while_loop, ast->ast.line_num);
-  while_loop->condition = ast_clone(ast->condition);
-  while_loop->body = ast_clone(ast->body);
+  while_loop->condition = ast_clone(arena, ast->condition);
+  while_loop->body = ast_clone(arena, ast->body);
   return (struct Ast*) while_loop;
 }
 
@@ -321,25 +287,52 @@ static int ast_while_print(const struct AstWhile* ast, struct Writer* writer) {
   return ret;
 }
 
-static void ast_while_free(struct AstWhile* ast) {
-  ast_free(ast->condition);
-  ast_free(ast->body);
-  free(ast);
+struct Ast* ast_for_create(struct Arena* arena, size_t line_num, struct Str variable, uint32_t symbol,
+                           struct Ast* iterable, struct Ast* body) {
+  ALLOC_AST(For, for_loop, line_num);
+  for_loop->variable = variable;
+  for_loop->symbol = symbol;
+  for_loop->iterable = iterable;
+  for_loop->body = body;
+  return (struct Ast*) for_loop;
 }
 
-struct Ast* ast_let_create(size_t line_num, bool public, struct Str variable, struct Ast* rhs) {
+static struct Ast* ast_for_clone(struct Arena* arena, const struct AstFor* ast) {
+  ALLOC_AST(For, for_loop, ast->ast.line_num);
+  for_loop->variable = ast->variable;
+  for_loop->symbol = ast->symbol;
+  for_loop->iterable = ast_clone(arena, ast->iterable);
+  for_loop->body = ast_clone(arena, ast->body);
+  return (struct Ast*) for_loop;
+}
+
+static int ast_for_print(const struct AstFor* ast, struct Writer* writer) {
+  int ret = 0;
+  TRY_ACCUM(ret, writer->writef(writer, "(for "));
+  TRY_ACCUM(ret, str_print(&ast->variable, writer));
+  TRY_ACCUM(ret, writer->writef(writer, " "));
+  TRY_ACCUM(ret, ast_print(ast->iterable, writer));
+  TRY_ACCUM(ret, writer->writef(writer, " "));
+  TRY_ACCUM(ret, ast_print(ast->body, writer));
+  TRY_ACCUM(ret, writer->writef(writer, ")"));
+  return ret;
+}
+
+struct Ast* ast_let_create(struct Arena* arena, size_t line_num, bool public, struct Str variable, uint32_t symbol, struct Ast* rhs) {
   ALLOC_AST(Let, let, line_num);
   let->public = public;
   let->variable = variable;
+  let->symbol = symbol;
   let->rhs = rhs;
   return (struct Ast*) let;
 }
 
-static struct Ast* ast_let_clone(const struct AstLet* ast) {
+static struct Ast* ast_let_clone(struct Arena* arena, const struct AstLet* ast) {
   ALLOC_AST(Let, let, ast->ast.line_num);
   let->public = ast->public;
   let->variable = ast->variable;
-  let->rhs = ast_clone(ast->rhs);
+  let->symbol = ast->symbol;
+  let->rhs = ast_clone(arena, ast->rhs);
   return (struct Ast*) let;
 }
 
@@ -353,18 +346,13 @@ static int ast_let_print(const struct AstLet* ast, struct Writer* writer) {
   return ret;
 }
 
-static void ast_let_free(struct AstLet* ast) {
-  ast_free(ast->rhs);
-  free(ast);
-}
-
-struct Ast* ast_require_create(size_t line_num, struct Str module) {
+struct Ast* ast_require_create(struct Arena* arena, size_t line_num, struct Str module) {
   ALLOC_AST(Require, require, line_num);
   require->module = module;
   return (struct Ast*) require;
 }
 
-static struct Ast* ast_require_clone(const struct AstRequire* ast) {
+static struct Ast* ast_require_clone(struct Arena* arena, const struct AstRequire* ast) {
   ALLOC_AST(Require, require, ast->ast.line_num);
   require->module = ast->module;
   return (struct Ast*) require;
@@ -378,19 +366,15 @@ static int ast_require_print(const struct AstRequire* ast, struct Writer* writer
   return ret;
 }
 
-static void ast_require_free(struct AstRequire* ast) {
-  free(ast);
-}
-
-struct Ast* ast_yield_create(size_t line_num, struct Ast* value) {
+struct Ast* ast_yield_create(struct Arena* arena, size_t line_num, struct Ast* value) {
   ALLOC_AST(Yield, yield, line_num);
   yield->value = value;
   return (struct Ast*) yield;
 }
 
-static struct Ast* ast_yield_clone(const struct AstYield* ast) {
+static struct Ast* ast_yield_clone(struct Arena* arena, const struct AstYield* ast) {
   ALLOC_AST(Yield, yield, ast->ast.line_num);
-  yield->value = ast_clone(ast->value);
+  yield->value = ast_clone(arena, ast->value);
   return (struct Ast*) yield;
 }
 
@@ -402,17 +386,12 @@ static int ast_yield_print(const struct AstYield* ast, struct Writer* writer) {
   return ret;
 }
 
-static void ast_yield_free(struct AstYield* ast) {
-  ast_free(ast->value);
-  free(ast);
-}
-
-struct Ast* ast_break_create(size_t line_num) {
+struct Ast* ast_break_create(struct Arena* arena, size_t line_num) {
   ALLOC_AST(Break, break_statement, line_num);
   return (struct Ast*) break_statement;
 }
 
-static struct Ast* ast_break_clone(const struct AstBreak* ast) {
+static struct Ast* ast_break_clone(struct Arena* arena, const struct AstBreak* ast) {
   ALLOC_AST(Break, break_statement, ast->ast.line_num);
   return (struct Ast*) break_statement;
 }
@@ -422,16 +401,12 @@ static int ast_break_print(const struct AstBreak* ast, struct Writer* writer) {
   return writer->writef(writer, "(break)");
 }
 
-static void ast_break_free(struct AstBreak* ast) {
-  free(ast);
-}
-
-struct Ast* ast_continue_create(size_t line_num) {
+struct Ast* ast_continue_create(struct Arena* arena, size_t line_num) {
   ALLOC_AST(Continue, continue_statement, line_num);
   return (struct Ast*) continue_statement;
 }
 
-static struct Ast* ast_continue_clone(const struct AstContinue* ast) {
+static struct Ast* ast_continue_clone(struct Arena* arena, const struct AstContinue* ast) {
   ALLOC_AST(Continue, continue_statement, ast->ast.line_num);
   return (struct Ast*) continue_statement;
 }
@@ -441,19 +416,15 @@ static int ast_continue_print(const struct AstContinue* ast, struct Writer* writ
   return writer->writef(writer, "(continue)");
 }
 
-static void ast_continue_free(struct AstContinue* ast) {
-  free(ast);
-}
-
-struct Ast* ast_return_create(size_t line_num, struct Ast* value) {
+struct Ast* ast_return_create(struct Arena* arena, size_t line_num, struct Ast* value) {
   ALLOC_AST(Return, return_statement, line_num);
   return_statement->value = value;
   return (struct Ast*) return_statement;
 }
 
-static struct Ast* ast_return_clone(const struct AstReturn* ast) {
+static struct Ast* ast_return_clone(struct Arena* arena, const struct AstReturn* ast) {
   ALLOC_AST(Return, return_statement, ast->ast.line_num);
-  return_statement->value = ast_clone(ast->value);
+  return_statement->value = ast_clone(arena, ast->value);
   return (struct Ast*) return_statement;
 }
 
@@ -469,22 +440,19 @@ static int ast_return_print(const struct AstReturn* ast, struct Writer* writer)
   }
 }
 
-static void ast_return_free(struct AstReturn* ast) {
-  ast_free(ast->value);
-  free(ast);
-}
-
-struct Ast* ast_member_create(size_t line_num, struct Ast* lhs, struct Str member) {
+struct Ast* ast_member_create(struct Arena* arena, size_t line_num, struct Ast* lhs, struct Str member, uint32_t symbol) {
   ALLOC_AST(Member, member_ref, line_num);
   member_ref->lhs = lhs;
   member_ref->member = member;
+  member_ref->symbol = symbol;
   return (struct Ast*) member_ref;
 }
 
-static struct Ast* ast_member_clone(const struct AstMember* ast) {
+static struct Ast* ast_member_clone(struct Arena* arena, const struct AstMember* ast) {
   ALLOC_AST(Member, member_ref, ast->ast.line_num);
-  member_ref->lhs = ast_clone(ast->lhs);
+  member_ref->lhs = ast_clone(arena, ast->lhs);
   member_ref->member = ast->member;
+  member_ref->symbol = ast->symbol;
   return (struct Ast*) member_ref;
 }
 
@@ -498,22 +466,17 @@ static int ast_member_print(const struct AstMember* ast, struct Writer* writer)
   return ret;
 }
 
-static void ast_member_free(struct AstMember* ast) {
-  ast_free(ast->lhs);
-  free(ast);
-}
-
-struct Ast* ast_index_create(size_t line_num, struct Ast* lhs, struct Ast* index) {
+struct Ast* ast_index_create(struct Arena* arena, size_t line_num, struct Ast* lhs, struct Ast* index) {
   ALLOC_AST(Index, index_op, line_num);
   index_op->lhs = lhs;
   index_op->index = index;
   return (struct Ast*) index_op;
 }
 
-static struct Ast* ast_index_clone(const struct AstIndex* ast) {
+static struct Ast* ast_index_clone(struct Arena* arena, const struct AstIndex* ast) {
   ALLOC_AST(Index, index_op, ast->ast.line_num);
-  index_op->lhs = ast_clone(ast->lhs);
-  index_op->index = ast_clone(ast->index);
+  index_op->lhs = ast_clone(arena, ast->lhs);
+  index_op->index = ast_clone(arena, ast->index);
   return (struct Ast*) index_op;
 }
 
@@ -527,13 +490,7 @@ static int ast_index_print(const struct AstIndex* ast, struct Writer* writer) {
   return ret;
 }
 
-static void ast_index_free(struct AstIndex* ast) {
-  ast_free(ast->lhs);
-  ast_free(ast->index);
-  free(ast);
-}
-
-struct Ast* ast_binary_create(size_t line_num, enum BinaryOp operation, struct Ast* lhs, struct Ast* rhs) {
+struct Ast* ast_binary_create(struct Arena* arena, size_t line_num, enum BinaryOp operation, struct Ast* lhs, struct Ast* rhs) {
   ALLOC_AST(Binary, binary, line_num);
   binary->operation = operation;
   binary->lhs = lhs;
@@ -541,11 +498,11 @@ struct Ast* ast_binary_create(size_t line_num, enum BinaryOp operation, struct A
   return (struct Ast*) binary;
 }
 
-static struct Ast* ast_binary_clone(const struct AstBinary* ast) {
+static struct Ast* ast_binary_clone(struct Arena* arena, const struct AstBinary* ast) {
   ALLOC_AST(Binary, binary, ast->ast.line_num);
   binary->operation = ast->operation;
-  binary->lhs = ast_clone(ast->lhs);
-  binary->rhs = ast_clone(ast->rhs);
+  binary->lhs = ast_clone(arena, ast->lhs);
+  binary->rhs = ast_clone(arena, ast->rhs);
   return (struct Ast*) binary;
 }
 
@@ -559,23 +516,17 @@ static int ast_binary_print(const struct AstBinary* ast, struct Writer* writer)
   return ret;
 }
 
-static void ast_binary_free(struct AstBinary* ast) {
-  ast_free(ast->lhs);
-  ast_free(ast->rhs);
-  free(ast);
-}
-
-struct Ast* ast_assignment_create(size_t line_num, struct Ast* lhs, struct Ast* rhs) {
+struct Ast* ast_assignment_create(struct Arena* arena, size_t line_num, struct Ast* lhs, struct Ast* rhs) {
   ALLOC_AST(Assignment, assignment, line_num);
   assignment->lhs = lhs;
   assignment->rhs = rhs;
   return (struct Ast*) assignment;
 }
 
-static struct Ast* ast_assignment_clone(const struct AstAssignment* ast) {
+static struct Ast* ast_assignment_clone(struct Arena* arena, const struct AstAssignment* ast) {
   ALLOC_AST(Assignment, assignment, ast->ast.line_num);
-  assignment->lhs = ast_clone(ast->lhs);
-  assignment->rhs = ast_clone(ast->rhs);
+  assignment->lhs = ast_clone(arena, ast->lhs);
+  assignment->rhs = ast_clone(arena, ast->rhs);
   return (struct Ast*) assignment;
 }
 
@@ -589,23 +540,46 @@ static int ast_assignment_print(const struct AstAssignment* ast, struct Writer*
   return ret;
 }
 
-static void ast_assignment_free(struct AstAssignment* ast) {
-  ast_free(ast->lhs);
-  ast_free(ast->rhs);
-  free(ast);
+struct Ast* ast_compound_assignment_create(struct Arena* arena, size_t line_num,
+                                          enum BinaryOp operation, struct Ast* lhs, struct Ast* rhs) {
+  ALLOC_AST(CompoundAssignment, compound_assignment, line_num);
+  compound_assignment->operation = operation;
+  compound_assignment->lhs = lhs;
+  compound_assignment->rhs = rhs;
+  return (struct Ast*) compound_assignment;
 }
 
-struct Ast* ast_unary_create(size_t line_num, enum UnaryOp operation, struct Ast* rhs) {
+static struct Ast* ast_compound_assignment_clone(struct Arena* arena,
+                                                 const struct AstCompoundAssignment* ast) {
+  ALLOC_AST(CompoundAssignment, compound_assignment, ast->ast.line_num);
+  compound_assignment->operation = ast->operation;
+  compound_assignment->lhs = ast_clone(arena, ast->lhs);
+  compound_assignment->rhs = ast_clone(arena, ast->rhs);
+  return (struct Ast*) compound_assignment;
+}
+
+static int ast_compound_assignment_print(const struct AstCompoundAssignment* ast,
+                                         struct Writer* writer) {
+  int ret = 0;
+  TRY_ACCUM(ret, writer->writef(writer, "(%s= ", binary_op_to_str(ast->operation)));
+  TRY_ACCUM(ret, ast_print(ast->lhs, writer));
+  TRY_ACCUM(ret, writer->writef(writer, " "));
+  TRY_ACCUM(ret, ast_print(ast->rhs, writer));
+  TRY_ACCUM(ret, writer->writef(writer, ")"));
+  return ret;
+}
+
+struct Ast* ast_unary_create(struct Arena* arena, size_t line_num, enum UnaryOp operation, struct Ast* rhs) {
   ALLOC_AST(Unary, unary, line_num);
   unary->operation = operation;
   unary->rhs = rhs;
   return (struct Ast*) unary;
 }
 
-static struct Ast* ast_unary_clone(const struct AstUnary* ast) {
+static struct Ast* ast_unary_clone(struct Arena* arena, const struct AstUnary* ast) {
   ALLOC_AST(Unary, unary, ast->ast.line_num);
   unary->operation = ast->operation;
-  unary->rhs = ast_clone(ast->rhs);
+  unary->rhs = ast_clone(arena, ast->rhs);
   return (struct Ast*) unary;
 }
 
@@ -617,22 +591,17 @@ static int ast_unary_print(const struct AstUnary* ast, struct Writer* writer) {
   return ret;
 }
 
-static void ast_unary_free(struct AstUnary* ast) {
-  ast_free(ast->rhs);
-  free(ast);
-}
-
-struct Ast* ast_call_create(size_t line_num, struct Ast* function, struct AstVec arguments) {
+struct Ast* ast_call_create(struct Arena* arena, size_t line_num, struct Ast* function, struct AstVec arguments) {
   ALLOC_AST(Call, call, line_num);
   call->function = function;
   call->arguments = arguments;
   return (struct Ast*) call;
 }
 
-static struct Ast* ast_call_clone(const struct AstCall* ast) {
+static struct Ast* ast_call_clone(struct Arena* arena, const struct AstCall* ast) {
   ALLOC_AST(Call, call, ast->ast.line_num);
-  call->function = ast_clone(ast->function);
-  call->arguments = ast_vec_clone(&ast->arguments);
+  call->function = ast_clone(arena, ast->function);
+  call->arguments = ast_vec_clone(arena, &ast->arguments);
   return (struct Ast*) call;
 }
 
@@ -645,18 +614,12 @@ static int ast_call_print(const struct AstCall* ast, struct Writer* writer) {
   return ret;
 }
 
-static void ast_call_free(struct AstCall* ast) {
-  ast_free(ast->function);
-  ast_vec_fini(&ast->arguments);
-  free(ast);
-}
-
-struct Ast* ast_self_create(size_t line_num) {
+struct Ast* ast_self_create(struct Arena* arena, size_t line_num) {
   ALLOC_AST(Self, self, line_num);
   return (struct Ast*) self;
 }
 
-struct Ast* ast_self_clone(const struct AstSelf* ast) {
+struct Ast* ast_self_clone(struct Arena* arena, const struct AstSelf* ast) {
   ALLOC_AST(Self, self, ast->ast.line_num);
   return (struct Ast*) self;
 }
@@ -666,16 +629,12 @@ static int ast_self_print(const struct AstSelf* ast, struct Writer* writer) {
   return writer->writef(writer, "self");
 }
 
-static void ast_self_free(struct AstSelf* ast) {
-  free(ast);
-}
-
-struct Ast* ast_varargs_create(size_t line_num) {
+struct Ast* ast_varargs_create(struct Arena* arena, size_t line_num) {
   ALLOC_AST(Varargs, varargs, line_num);
   return (struct Ast*) varargs;
 }
 
-static struct Ast* ast_varargs_clone(const struct AstVarargs* ast) {
+static struct Ast* ast_varargs_clone(struct Arena* arena, const struct AstVarargs* ast) {
   ALLOC_AST(Varargs, varargs, ast->ast.line_num);
   return (struct Ast*) varargs;
 }
@@ -685,19 +644,15 @@ static int ast_varargs_print(const struct AstVarargs* ast, struct Writer* writer
   return writer->writef(writer, "varargs");
 }
 
-static void ast_varargs_free(struct AstVarargs* ast) {
-  free(ast);
-}
-
-struct Ast* ast_array_create(size_t line_num, struct AstVec elements) {
+struct Ast* ast_array_create(struct Arena* arena, size_t line_num, struct AstVec elements) {
   ALLOC_AST(Array, array, line_num);
   array->elements = elements;
   return (struct Ast*) array;
 }
 
-static struct Ast* ast_array_clone(const struct AstArray* ast) {
+static struct Ast* ast_array_clone(struct Arena* arena, const struct AstArray* ast) {
   ALLOC_AST(Array, array, ast->ast.line_num);
-  array->elements = ast_vec_clone(&ast->elements);
+  array->elements = ast_vec_clone(arena, &ast->elements);
   return (struct Ast*) array;
 }
 
@@ -709,20 +664,15 @@ static int ast_array_print(const struct AstArray* ast, struct Writer* writer) {
   return ret;
 }
 
-static void ast_array_free(struct AstArray* ast) {
-  ast_vec_fini(&ast->elements);
-  free(ast);
-}
-
-struct Ast* ast_set_create(size_t line_num, struct AstVec elements) {
+struct Ast* ast_set_create(struct Arena* arena, size_t line_num, struct AstVec elements) {
   ALLOC_AST(Set, set, line_num);
   set->elements = elements;
   return (struct Ast*) set;
 }
 
-static struct Ast* ast_set_clone(const struct AstSet* ast) {
+static struct Ast* ast_set_clone(struct Arena* arena, const struct AstSet* ast) {
   ALLOC_AST(Set, set, ast->ast.line_num);
-  set->elements = ast_vec_clone(&ast->elements);
+  set->elements = ast_vec_clone(arena, &ast->elements);
   return (struct Ast*) set;
 }
 
@@ -734,20 +684,15 @@ static int ast_set_print(const struct AstSet* ast, struct Writer* writer) {
   return ret;
 }
 
-static void ast_set_free(struct AstSet* ast) {
-  ast_vec_fini(&ast->elements);
-  free(ast);
-}
-
-struct Ast* ast_dictionary_create(size_t line_num, struct AstPairVec kvpairs) {
+struct Ast* ast_dictionary_create(struct Arena* arena, size_t line_num, struct AstPairVec kvpairs) {
   ALLOC_AST(Dictionary, dict, line_num);
   dict->pairs = kvpairs;
   return (struct Ast*) dict;
 }
 
-static struct Ast* ast_dictionary_clone(const struct AstDictionary* ast) {
+static struct Ast* ast_dictionary_clone(struct Arena* arena, const struct AstDictionary* ast) {
   ALLOC_AST(Dictionary, dict, ast->ast.line_num);
-  dict->pairs = ast_pair_vec_clone(&ast->pairs);
+  dict->pairs = ast_pair_vec_clone(arena, &ast->pairs);
   return (struct Ast*) dict;
 }
 
@@ -765,18 +710,13 @@ static int ast_dictionary_print(const struct AstDictionary* ast, struct Writer*
   return ret;
 }
 
-static void ast_dictionary_free(struct AstDictionary* ast) {
-  ast_pair_vec_fini(&ast->pairs);
-  free(ast);
-}
-
-struct Ast* ast_string_create(size_t line_num, struct Str str) {
+struct Ast* ast_string_create(struct Arena* arena, size_t line_num, struct Str str) {
   ALLOC_AST(String, string, line_num);
   string->string = str;
   return (struct Ast*) string;
 }
 
-static struct Ast* ast_string_clone(const struct AstString* ast) {
+static struct Ast* ast_string_clone(struct Arena* arena, const struct AstString* ast) {
   ALLOC_AST(String, string, ast->ast.line_num);
   string->string = ast->string;
   return (struct Ast*) string;
@@ -790,19 +730,17 @@ static int ast_string_print(const struct AstString* ast, struct Writer* writer)
   return ret;
 }
 
-static void ast_string_free(struct AstString* ast) {
-  free(ast);
-}
-
-struct Ast* ast_identifier_create(size_t line_num, struct Str str) {
+struct Ast* ast_identifier_create(struct Arena* arena, size_t line_num, struct Str str, uint32_t symbol) {
   ALLOC_AST(Identifier, identifier, line_num);
   identifier->identifier = str;
+  identifier->symbol = symbol;
   return (struct Ast*) identifier;
 }
 
-static struct Ast* ast_identifier_clone(const struct AstIdentifier* ast) {
+static struct Ast* ast_identifier_clone(struct Arena* arena, const struct AstIdentifier* ast) {
   ALLOC_AST(Identifier, identifier, ast->ast.line_num);
   identifier->identifier = ast->identifier;
+  identifier->symbol = ast->symbol;
   return (struct Ast*) identifier;
 }
 
@@ -810,17 +748,13 @@ static int ast_identifier_print(const struct AstIdentifier* ast, struct Writer*
   return str_print(&ast->identifier, writer);
 }
 
-static void ast_identifier_free(struct AstIdentifier* ast) {
-  free(ast);
-}
-
-struct Ast* ast_float_create(size_t line_num, double f) {
+struct Ast* ast_float_create(struct Arena* arena, size_t line_num, double f) {
   ALLOC_AST(Float, float_node, line_num);
   float_node->f = f;
   return (struct Ast*) float_node;
 }
 
-static struct Ast* ast_float_clone(const struct AstFloat* ast) {
+static struct Ast* ast_float_clone(struct Arena* arena, const struct AstFloat* ast) {
   ALLOC_AST(Float, float_node, ast->ast.line_num);
   float_node->f = ast->f;
   return (struct Ast*) float_node;
@@ -830,17 +764,13 @@ static int ast_float_print(const struct AstFloat* ast, struct Writer* writer) {
   return writer->writef(writer, "%lf", ast->f);
 }
 
-static void ast_float_free(struct AstFloat* ast) {
-  free(ast);
-}
-
-struct Ast* ast_integer_create(size_t line_num, int64_t i) {
+struct Ast* ast_integer_create(struct Arena* arena, size_t line_num, int64_t i) {
   ALLOC_AST(Integer, integer_node, line_num);
   integer_node->i = i;
   return (struct Ast*) integer_node;
 }
 
-static struct Ast* ast_integer_clone(const struct AstInteger* ast) {
+static struct Ast* ast_integer_clone(struct Arena* arena, const struct AstInteger* ast) {
   ALLOC_AST(Integer, integer_node, ast->ast.line_num);
   integer_node->i = ast->i;
   return (struct Ast*) integer_node;
@@ -850,17 +780,13 @@ static int ast_integer_print(const struct AstInteger* ast, struct Writer* writer
   return writer->writef(writer, "%ld", ast->i);
 }
 
-static void ast_integer_free(struct AstInteger* ast) {
-  free(ast);
-}
-
-struct Ast* ast_boolean_create(size_t line_num, bool b) {
+struct Ast* ast_boolean_create(struct Arena* arena, size_t line_num, bool b) {
   ALLOC_AST(Boolean, bool_node, line_num);
   bool_node->b = b;
   return (struct Ast*) bool_node;
 }
 
-static struct Ast* ast_boolean_clone(const struct AstBoolean* ast) {
+static struct Ast* ast_boolean_clone(struct Arena* arena, const struct AstBoolean* ast) {
   ALLOC_AST(Boolean, bool_node, ast->ast.line_num);
   bool_node->b = ast->b;
   return (struct Ast*) bool_node;
@@ -870,16 +796,12 @@ static int ast_boolean_print(const struct AstBoolean* ast, struct Writer* writer
   return writer->writef(writer, ast->b ? "true" : "false");
 }
 
-static void ast_boolean_free(struct AstBoolean* ast) {
-  free(ast);
-}
-
-struct Ast* ast_ellipsis_create(size_t line_num) {
+struct Ast* ast_ellipsis_create(struct Arena* arena, size_t line_num) {
   ALLOC_AST(Ellipsis, ellipsis, line_num);
   return (struct Ast*) ellipsis;
 }
 
-static struct Ast* ast_ellipsis_clone(const struct AstEllipsis* ast) {
+static struct Ast* ast_ellipsis_clone(struct Arena* arena, const struct AstEllipsis* ast) {
   ALLOC_AST(Ellipsis, ellipsis_node, ast->ast.line_num);
   return (struct Ast*) ellipsis_node;
 }
@@ -889,16 +811,12 @@ static int ast_ellipsis_print(const struct AstEllipsis* ast, struct Writer* writ
   return writer->writef(writer, "...");
 }
 
-static void ast_ellipsis_free(struct AstEllipsis* ast) {
-  free(ast);
-}
-
-struct Ast* ast_nil_create(size_t line_num) {
+struct Ast* ast_nil_create(struct Arena* arena, size_t line_num) {
   ALLOC_AST(Nil, nil, line_num);
   return (struct Ast*) nil;
 }
 
-static struct Ast* ast_nil_clone(const struct AstNil* ast) {
+static struct Ast* ast_nil_clone(struct Arena* arena, const struct AstNil* ast) {
   ALLOC_AST(Nil, nil_node, ast->ast.line_num);
   return (struct Ast*) nil_node;
 }
@@ -908,10 +826,6 @@ static int ast_nil_print(const struct AstNil* ast, struct Writer* writer) {
   return writer->writef(writer, "nil");
 }
 
-static void ast_nil_free(struct AstNil* ast) {
-  free(ast);
-}
-
 #undef ALLOC_AST
 
 int ast_print(const struct Ast* ast, struct Writer* writer) {
@@ -929,6 +843,7 @@ int ast_print(const struct Ast* ast, struct Writer* writer) {
   REDIRECT_PRINT(Function, function)
   REDIRECT_PRINT(If, if)
   REDIRECT_PRINT(While, while)
+  REDIRECT_PRINT(For, for)
   REDIRECT_PRINT(Let, let)
   REDIRECT_PRINT(Require, require)
   REDIRECT_PRINT(Yield, yield)
@@ -938,6 +853,7 @@ int ast_print(const struct Ast* ast, struct Writer* writer) {
   REDIRECT_PRINT(Member, member)
   REDIRECT_PRINT(Index, index)
   REDIRECT_PRINT(Assignment, assignment)
+  REDIRECT_PRINT(CompoundAssignment, compound_assignment)
   REDIRECT_PRINT(Binary, binary)
   REDIRECT_PRINT(Unary, unary)
   REDIRECT_PRINT(Call, call)
@@ -959,9 +875,9 @@ int ast_print(const struct Ast* ast, struct Writer* writer) {
 #undef REDIRECT_PRINT
 }
 
-struct Ast* ast_clone(const struct Ast* ast) {
+struct Ast* ast_clone(struct Arena* arena, const struct Ast* ast) {
 #define REDIRECT_CLONE(TYPE, NAME) \
-  case AST_##TYPE: return ast_##NAME##_clone((struct Ast##TYPE *) ast);
+  case AST_##TYPE: return ast_##NAME##_clone(arena, (struct Ast##TYPE *) ast);
 
   if (!ast) {
     return NULL;
@@ -974,6 +890,7 @@ struct Ast* ast_clone(const struct Ast* ast) {
   REDIRECT_CLONE(Function, function)
   REDIRECT_CLONE(If, if)
   REDIRECT_CLONE(While, while)
+  REDIRECT_CLONE(For, for)
   REDIRECT_CLONE(Let, let)
   REDIRECT_CLONE(Require, require)
   REDIRECT_CLONE(Yield, yield)
@@ -983,6 +900,7 @@ struct Ast* ast_clone(const struct Ast* ast) {
   REDIRECT_CLONE(Member, member)
   REDIRECT_CLONE(Index, index)
   REDIRECT_CLONE(Assignment, assignment)
+  REDIRECT_CLONE(CompoundAssignment, compound_assignment)
   REDIRECT_CLONE(Binary, binary)
   REDIRECT_CLONE(Unary, unary)
   REDIRECT_CLONE(Call, call)
@@ -1004,49 +922,148 @@ struct Ast* ast_clone(const struct Ast* ast) {
 #undef REDIRECT_CLONE
 }
 
-void ast_free(struct Ast* ast) {
-#define REDIRECT_FREE(TYPE, NAME) \
-  case AST_##TYPE: ast_##NAME##_free((struct Ast##TYPE *) ast); break;
+
+static void str_relocate(struct Str* str, const uint8_t* from, size_t length, const uint8_t* to) {
+  if (str->data >= from && str->data < from + length) {
+    str->data = to + (str->data - from);
+  }
+}
+
+static void ast_vec_relocate(struct AstVec* vec, size_t line_delta, const uint8_t* from,
+                             size_t length, const uint8_t* to) {
+  for (size_t i = 0; i < vec->length; i++) {
+    ast_relocate(vec->data[i], line_delta, from, length, to);
+  }
+}
+
+void ast_relocate(struct Ast* ast, size_t line_delta, const uint8_t* from, size_t length,
+                  const uint8_t* to) {
+#define RELOCATE(AST) ast_relocate(AST, line_delta, from, length, to)
+#define RELOCATE_VEC(VEC) ast_vec_relocate(VEC, line_delta, from, length, to)
 
   if (!ast) {
     return;
   }
+  ast->line_num += line_delta;
 
   switch (ast->type) {
-  REDIRECT_FREE(Program, program)
-  REDIRECT_FREE(Block, block)
-  REDIRECT_FREE(Struct, struct)
-  REDIRECT_FREE(Function, function)
-  REDIRECT_FREE(If, if)
-  REDIRECT_FREE(While, while)
-  REDIRECT_FREE(Let, let)
-  REDIRECT_FREE(Require, require)
-  REDIRECT_FREE(Yield, yield)
-  REDIRECT_FREE(Break, break)
-  REDIRECT_FREE(Continue, continue)
-  REDIRECT_FREE(Return, return)
-  REDIRECT_FREE(Member, member)
-  REDIRECT_FREE(Index, index)
-  REDIRECT_FREE(Assignment, assignment)
-  REDIRECT_FREE(Binary, binary)
-  REDIRECT_FREE(Unary, unary)
-  REDIRECT_FREE(Call, call)
-  REDIRECT_FREE(Self, self)
-  REDIRECT_FREE(Varargs, varargs)
-  REDIRECT_FREE(Array, array)
-  REDIRECT_FREE(Set, set)
-  REDIRECT_FREE(Dictionary, dictionary)
-  REDIRECT_FREE(String, string)
-  REDIRECT_FREE(Identifier, identifier)
-  REDIRECT_FREE(Float, float)
-  REDIRECT_FREE(Integer, integer)
-  REDIRECT_FREE(Boolean, boolean)
-  REDIRECT_FREE(Ellipsis, ellipsis)
-  REDIRECT_FREE(Nil, nil)
+  case AST_Program: RELOCATE_VEC(&((struct AstProgram*) ast)->statements); break;
+  case AST_Block:   RELOCATE_VEC(&((struct AstBlock*) ast)->statements); break;
+  case AST_Struct: {
+    struct AstStruct* node = (struct AstStruct*) ast;
+    if (node->has_parent) {
+      str_relocate(&node->opt_parent, from, length, to);
+    }
+    RELOCATE(node->body);
+    break;
+  }
+  case AST_Function: {
+    struct AstFunction* node = (struct AstFunction*) ast;
+    RELOCATE_VEC(&node->parameters);
+    RELOCATE(node->body);
+    if (!node->body) {
+      str_relocate(&node->lazy_body, from, length, to);
+      node->lazy_line_num += line_delta;
+    }
+    break;
+  }
+  case AST_If: {
+    struct AstIf* node = (struct AstIf*) ast;
+    RELOCATE(node->condition);
+    RELOCATE(node->body);
+    RELOCATE(node->else_part);
+    break;
+  }
+  case AST_While: {
+    struct AstWhile* node = (struct AstWhile*) ast;
+    RELOCATE(node->condition);
+    RELOCATE(node->body);
+    break;
+  }
+  case AST_For: {
+    struct AstFor* node = (struct AstFor*) ast;
+    str_relocate(&node->variable, from, length, to);
+    RELOCATE(node->iterable);
+    RELOCATE(node->body);
+    break;
+  }
+  case AST_Let: {
+    struct AstLet* node = (struct AstLet*) ast;
+    str_relocate(&node->variable, from, length, to);
+    RELOCATE(node->rhs);
+    break;
+  }
+  case AST_Require:
+    str_relocate(&((struct AstRequire*) ast)->module, from, length, to);
+    break;
+  case AST_Yield:  RELOCATE(((struct AstYield*) ast)->value); break;
+  case AST_Return: RELOCATE(((struct AstReturn*) ast)->value); break;
+  case AST_Member: {
+    struct AstMember* node = (struct AstMember*) ast;
+    RELOCATE(node->lhs);
+    str_relocate(&node->member, from, length, to);
+    break;
+  }
+  case AST_Index: {
+    struct AstIndex* node = (struct AstIndex*) ast;
+    RELOCATE(node->lhs);
+    RELOCATE(node->index);
+    break;
+  }
+  case AST_Assignment: {
+    struct AstAssignment* node = (struct AstAssignment*) ast;
+    RELOCATE(node->lhs);
+    RELOCATE(node->rhs);
+    break;
+  }
+  case AST_CompoundAssignment: {
+    struct AstCompoundAssignment* node = (struct AstCompoundAssignment*) ast;
+    RELOCATE(node->lhs);
+    RELOCATE(node->rhs);
+    break;
+  }
+  case AST_Binary: {
+    struct AstBinary* node = (struct AstBinary*) ast;
+    RELOCATE(node->lhs);
+    RELOCATE(node->rhs);
+    break;
+  }
+  case AST_Unary: RELOCATE(((struct AstUnary*) ast)->rhs); break;
+  case AST_Call: {
+    struct AstCall* node = (struct AstCall*) ast;
+    RELOCATE(node->function);
+    RELOCATE_VEC(&node->arguments);
+    break;
+  }
+  case AST_Array: RELOCATE_VEC(&((struct AstArray*) ast)->elements); break;
+  case AST_Set:   RELOCATE_VEC(&((struct AstSet*) ast)->elements); break;
+  case AST_Dictionary: {
+    struct AstPairVec* pairs = &((struct AstDictionary*) ast)->pairs;
+    for (size_t i = 0; i < pairs->length; i++) {
+      RELOCATE(pairs->data[i].key);
+      RELOCATE(pairs->data[i].value);
+    }
+    break;
+  }
+  case AST_String:
+    str_relocate(&((struct AstString*) ast)->string, from, length, to);
+    break;
+  case AST_Identifier:
+    str_relocate(&((struct AstIdentifier*) ast)->identifier, from, length, to);
+    break;
+  case AST_Break:
+  case AST_Continue:
+  case AST_Self:
+  case AST_Varargs:
+  case AST_Float:
+  case AST_Integer:
+  case AST_Boolean:
+  case AST_Ellipsis:
+  case AST_Nil:
+    break;
   default: UNREACHABLE();
-  };
+  }
 
-#undef REDIRECT_FREE
+#undef RELOCATE_VEC
+#undef RELOCATE
 }
-
-#undef REALLOC
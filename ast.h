@@ -5,7 +5,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "arena.h"
 #include "string.h"
+#include "symbol.h"
 #include "writer.h"
 
 enum BinaryOp {
@@ -47,6 +49,7 @@ enum AstType {
   AST_Function,
   AST_If,
   AST_While,
+  AST_For,
   AST_Let,
   AST_Require,
   AST_Yield,
@@ -56,6 +59,7 @@ enum AstType {
   AST_Member,
   AST_Index,
   AST_Assignment,
+  AST_CompoundAssignment,
   AST_Binary,
   AST_Unary,
   AST_Call,
@@ -80,18 +84,17 @@ struct Ast {
   size_t line_num;   // Source line number for this AST node
 };
 
-// Growable array of AST pointers
+// Growable array of AST pointers. Storage is allocated from an arena, so
+// there's no need to free it.
 struct AstVec {
-  struct Ast** data; // Pointer to data
-  size_t length;     // Current number of filled slots
-  size_t capacity;   // Maximum allocated capacity
+  struct Arena* arena; // Arena to allocate storage from
+  struct Ast** data;   // Pointer to data
+  size_t length;       // Current number of filled slots
+  size_t capacity;     // Maximum allocated capacity
 };
 
 // Initialize an empty vector of AST nodes.
-void ast_vec_init(struct AstVec* vec);
-
-// Free memory for an AST vector
-void ast_vec_fini(struct AstVec* vec);
+void ast_vec_init(struct AstVec* vec, struct Arena* arena);
 
 // Push an AST node to the end of the vector
 void ast_vec_push(struct AstVec* vec, struct Ast* ast);
@@ -121,7 +124,11 @@ struct AstStruct {
 struct AstFunction {
   struct Ast ast;
   struct AstVec parameters; // Function parameters (identifier or ellipsis)
-  struct Ast* body;         // Block statement for the function body
+  struct Ast* body;         // Block statement for the function body, or NULL if not parsed yet
+  // If the body was skipped by a lazy parse, its source text (including the
+  // braces) and the line it starts on. See `parse_function_body`.
+  struct Str lazy_body;
+  size_t lazy_line_num;
 };
 
 // If statement
@@ -139,11 +146,21 @@ struct AstWhile {
   struct Ast* body;      // Loop body (block statement)
 };
 
+// "for" loop over the values produced by an iterable
+struct AstFor {
+  struct Ast ast;
+  struct Str variable;   // Loop variable
+  uint32_t symbol;       // Symbol ID of the variable, or SYMBOL_NONE if not interned
+  struct Ast* iterable;  // Expression producing the values to loop over
+  struct Ast* body;      // Loop body (block statement)
+};
+
 // "let" declarations
 struct AstLet {
   struct Ast ast;
   bool public;         // Whether this is a public declaration
   struct Str variable; // Variable being assigned to
+  uint32_t symbol;     // Symbol ID of the variable, or SYMBOL_NONE if not interned
   struct Ast* rhs;     // Optional RHS (if NULL, variable is set to `nil`)
 };
 
@@ -180,6 +197,7 @@ struct AstMember {
   struct Ast ast;
   struct Ast* lhs;   // Entity whose member we're accessing
   struct Str member; // Member name
+  uint32_t symbol;   // Symbol ID of the member name, or SYMBOL_NONE if not interned
 };
 
 // Indexing operation (array, dictionary, etc.)
@@ -196,6 +214,15 @@ struct AstAssignment {
   struct Ast* rhs;
 };
 
+// Compound assignment, like "a += b". The target only appears once, so its
+// receiver and key are only evaluated once.
+struct AstCompoundAssignment {
+  struct Ast ast;
+  enum BinaryOp operation; // Operation combining the old value with the RHS
+  struct Ast* lhs;         // Target (identifier, member or index)
+  struct Ast* rhs;
+};
+
 // Binary operation
 struct AstBinary {
   struct Ast ast;
@@ -246,18 +273,16 @@ struct AstPair {
   struct Ast* value;
 };
 
-// Growable array of key-value AST pairs
+// Growable array of key-value AST pairs, allocated from an arena
 struct AstPairVec {
+  struct Arena* arena;  // Arena to allocate storage from
   struct AstPair* data; // Pointer to data
   size_t length;        // Current number of filled slots
   size_t capacity;      // Maximum allocated capacity
 };
 
 // Initialize an empty vector of pairs of AST nodes.
-void ast_pair_vec_init(struct AstPairVec* vec);
-
-// Free memory for an AST pair vector
-void ast_pair_vec_fini(struct AstPairVec* vec);
+void ast_pair_vec_init(struct AstPairVec* vec, struct Arena* arena);
 
 // Push a pair of key-value nodes to the end of the vector
 void ast_pair_vec_push(struct AstPairVec* vec, struct Ast* key, struct Ast* value);
@@ -278,6 +303,7 @@ struct AstString {
 struct AstIdentifier {
   struct Ast ast;
   struct Str identifier;
+  uint32_t symbol; // Symbol ID of the identifier, or SYMBOL_NONE if not interned
 };
 
 // Floating point number
@@ -308,46 +334,53 @@ struct AstNil {
   struct Ast ast;
 };
 
-// Functions to create (allocate) and return different ASTs
-struct Ast* ast_program_create(size_t line_num, struct AstVec statements);
-struct Ast* ast_block_create(size_t line_num, struct AstVec statements, bool last_had_semicolon);
-struct Ast* ast_struct_create(size_t line_num, const struct Str* opt_parent, struct Ast* body);
-struct Ast* ast_function_create(size_t line_num, struct AstVec parameters, struct Ast* body);
-struct Ast* ast_if_create(size_t line_num, struct Ast* condition, struct Ast* body, struct Ast* else_part);
-struct Ast* ast_while_create(size_t line_num, struct Ast* condition, struct Ast* body);
-struct Ast* ast_let_create(size_t line_num, bool public, struct Str variable, struct Ast* rhs);
-struct Ast* ast_require_create(size_t line_num, struct Str module);
-struct Ast* ast_yield_create(size_t line_num, struct Ast* value);
-struct Ast* ast_break_create(size_t line_num);
-struct Ast* ast_continue_create(size_t line_num);
-struct Ast* ast_return_create(size_t line_num, struct Ast* value);
-struct Ast* ast_member_create(size_t line_num, struct Ast* lhs, struct Str member);
-struct Ast* ast_index_create(size_t line_num, struct Ast* lhs, struct Ast* index);
-struct Ast* ast_assignment_create(size_t line_num, struct Ast* lhs, struct Ast* rhs);
-struct Ast* ast_binary_create(size_t line_num, enum BinaryOp operation, struct Ast* lhs, struct Ast* rhs);
-struct Ast* ast_unary_create(size_t line_num, enum UnaryOp operation, struct Ast* rhs);
-struct Ast* ast_call_create(size_t line_num, struct Ast* function, struct AstVec arguments);
-struct Ast* ast_self_create(size_t line_num);
-struct Ast* ast_varargs_create(size_t line_num);
-struct Ast* ast_array_create(size_t line_num, struct AstVec elements);
-struct Ast* ast_set_create(size_t line_num, struct AstVec elements);
-struct Ast* ast_dictionary_create(size_t line_num, struct AstPairVec kvpairs);
-struct Ast* ast_string_create(size_t line_num, struct Str str);
-struct Ast* ast_identifier_create(size_t line_num, struct Str str);
-struct Ast* ast_float_create(size_t line_num, double f);
-struct Ast* ast_integer_create(size_t line_num, int64_t i);
-struct Ast* ast_boolean_create(size_t line_num, bool b);
-struct Ast* ast_ellipsis_create(size_t line_num);
-struct Ast* ast_nil_create(size_t line_num);
+// Functions to create (allocate) and return different ASTs. Nodes are
+// allocated from the arena, and freed all at once along with it.
+struct Ast* ast_program_create(struct Arena* arena, size_t line_num, struct AstVec statements);
+struct Ast* ast_block_create(struct Arena* arena, size_t line_num, struct AstVec statements, bool last_had_semicolon);
+struct Ast* ast_struct_create(struct Arena* arena, size_t line_num, const struct Str* opt_parent, struct Ast* body);
+struct Ast* ast_function_create(struct Arena* arena, size_t line_num, struct AstVec parameters, struct Ast* body);
+struct Ast* ast_lazy_function_create(struct Arena* arena, size_t line_num, struct AstVec parameters, struct Str body, size_t body_line_num);
+struct Ast* ast_if_create(struct Arena* arena, size_t line_num, struct Ast* condition, struct Ast* body, struct Ast* else_part);
+struct Ast* ast_while_create(struct Arena* arena, size_t line_num, struct Ast* condition, struct Ast* body);
+struct Ast* ast_for_create(struct Arena* arena, size_t line_num, struct Str variable, uint32_t symbol, struct Ast* iterable, struct Ast* body);
+struct Ast* ast_let_create(struct Arena* arena, size_t line_num, bool public, struct Str variable, uint32_t symbol, struct Ast* rhs);
+struct Ast* ast_require_create(struct Arena* arena, size_t line_num, struct Str module);
+struct Ast* ast_yield_create(struct Arena* arena, size_t line_num, struct Ast* value);
+struct Ast* ast_break_create(struct Arena* arena, size_t line_num);
+struct Ast* ast_continue_create(struct Arena* arena, size_t line_num);
+struct Ast* ast_return_create(struct Arena* arena, size_t line_num, struct Ast* value);
+struct Ast* ast_member_create(struct Arena* arena, size_t line_num, struct Ast* lhs, struct Str member, uint32_t symbol);
+struct Ast* ast_index_create(struct Arena* arena, size_t line_num, struct Ast* lhs, struct Ast* index);
+struct Ast* ast_assignment_create(struct Arena* arena, size_t line_num, struct Ast* lhs, struct Ast* rhs);
+struct Ast* ast_compound_assignment_create(struct Arena* arena, size_t line_num, enum BinaryOp operation, struct Ast* lhs, struct Ast* rhs);
+struct Ast* ast_binary_create(struct Arena* arena, size_t line_num, enum BinaryOp operation, struct Ast* lhs, struct Ast* rhs);
+struct Ast* ast_unary_create(struct Arena* arena, size_t line_num, enum UnaryOp operation, struct Ast* rhs);
+struct Ast* ast_call_create(struct Arena* arena, size_t line_num, struct Ast* function, struct AstVec arguments);
+struct Ast* ast_self_create(struct Arena* arena, size_t line_num);
+struct Ast* ast_varargs_create(struct Arena* arena, size_t line_num);
+struct Ast* ast_array_create(struct Arena* arena, size_t line_num, struct AstVec elements);
+struct Ast* ast_set_create(struct Arena* arena, size_t line_num, struct AstVec elements);
+struct Ast* ast_dictionary_create(struct Arena* arena, size_t line_num, struct AstPairVec kvpairs);
+struct Ast* ast_string_create(struct Arena* arena, size_t line_num, struct Str str);
+struct Ast* ast_identifier_create(struct Arena* arena, size_t line_num, struct Str str, uint32_t symbol);
+struct Ast* ast_float_create(struct Arena* arena, size_t line_num, double f);
+struct Ast* ast_integer_create(struct Arena* arena, size_t line_num, int64_t i);
+struct Ast* ast_boolean_create(struct Arena* arena, size_t line_num, bool b);
+struct Ast* ast_ellipsis_create(struct Arena* arena, size_t line_num);
+struct Ast* ast_nil_create(struct Arena* arena, size_t line_num);
 
 // Print AST recursively. Return the number of bytes written, and -1 on error.
 int ast_print(const struct Ast* ast, struct Writer* writer);
 
-// Recursively clone an AST
-struct Ast* ast_clone(const struct Ast* ast);
+// Recursively clone an AST into the given arena, which need not be the one
+// the original was allocated from.
+struct Ast* ast_clone(struct Arena* arena, const struct Ast* ast);
 
-// Free root AST node. This internally figures out which type of node it is, and
-// recursively frees all child nodes.
-void ast_free(struct Ast* ast);
+// Move an AST in place: add `line_delta` to all line numbers, and re-point
+// strings which lie within `length` bytes at `from` to the same offset at `to`.
+// Strings outside that range are left alone.
+void ast_relocate(struct Ast* ast, size_t line_delta, const uint8_t* from, size_t length,
+                  const uint8_t* to);
 
 #endif  // __BS_AST_H__
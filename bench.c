@@ -0,0 +1,71 @@
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct Benches {
+  struct Bench* benches; // List of benchmarks
+  size_t num_benches;    // Number of benchmarks
+};
+
+static struct Benches BENCHES = { NULL, 0 };
+
+// The benchmark that is currently running, used to prefix reports
+static const struct Bench* CURRENT = NULL;
+
+void bench_add(struct Bench bench) {
+  BENCHES.num_benches++;
+  BENCHES.benches = realloc(BENCHES.benches, BENCHES.num_benches * sizeof(struct Bench));
+  BENCHES.benches[BENCHES.num_benches - 1] = bench;
+}
+
+uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+void bench_report(const char* label, double value, const char* unit) {
+  fprintf(stderr, "  \x1b[1m%s.%s\x1b[0m %-32s %12.3f %s\n", CURRENT->suite_name,
+          CURRENT->bench_name, label, value, unit);
+}
+
+void bench_consume(const void* ptr) {
+  __asm__ volatile("" : : "r"(ptr) : "memory");
+}
+
+// Check if a benchmark matches a "Suite" or "Suite.Name" filter
+static bool bench_matches(const struct Bench* bench, const char* filter) {
+  size_t suite_len = strlen(bench->suite_name);
+  if (strncmp(bench->suite_name, filter, suite_len)) {
+    return false;
+  }
+  if (filter[suite_len] == '\0') {
+    return true;
+  }
+  return filter[suite_len] == '.' && !strcmp(bench->bench_name, filter + suite_len + 1);
+}
+
+int main(int argc, char *const *argv) {
+  size_t num_run = 0;
+  for (size_t i = 0; i < BENCHES.num_benches; i++) {
+    CURRENT = &BENCHES.benches[i];
+    if (argc == 2 && !bench_matches(CURRENT, argv[1])) {
+      continue;
+    }
+    fprintf(stderr, "\x1b[1;34mBENCH\x1b[0m \x1b[1m%s.%s\x1b[0m\n", CURRENT->suite_name,
+            CURRENT->bench_name);
+    CURRENT->bench_function();
+    num_run++;
+  }
+  if (num_run == 0 && argc == 2) {
+    fprintf(stderr, "Could not find benchmark: %s\n", argv[1]);
+    free(BENCHES.benches);
+    return 1;
+  }
+  free(BENCHES.benches);
+  return 0;
+}
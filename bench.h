@@ -0,0 +1,37 @@
+#ifndef __BS_BENCH_H__
+#define __BS_BENCH_H__
+
+#include <stdint.h>
+
+// Encapsulates information about a single benchmark
+struct Bench {
+  const char* suite_name;   // Benchmark-suite name
+  const char* bench_name;   // Benchmark name
+  void (*bench_function)(); // Benchmark function to run
+};
+
+// Add a new benchmark - this is called _before_ main by the BENCH macro.
+void bench_add(struct Bench bench);
+
+// Monotonic timestamp in nanoseconds
+uint64_t bench_now_ns();
+
+// Report a measurement for the currently running benchmark
+void bench_report(const char* label, double value, const char* unit);
+
+// Keep the compiler from optimizing away a computed result
+void bench_consume(const void* ptr);
+
+// Add a new benchmark
+#define BENCH(SUITE, NAME)                                              \
+  void bench_fn_##SUITE##_##NAME();                                     \
+  void __attribute__ ((constructor)) add_bench_fn_##SUITE##_##NAME() {  \
+    bench_add((struct Bench) {                                          \
+        .suite_name = #SUITE,                                           \
+        .bench_name = #NAME,                                            \
+        .bench_function = bench_fn_##SUITE##_##NAME,                    \
+      });                                                               \
+  }                                                                     \
+  void bench_fn_##SUITE##_##NAME()                                      \
+
+#endif  // __BS_BENCH_H__
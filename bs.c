@@ -1,44 +1,96 @@
 #include "bs.h"
 
+#include "arena.h"
 #include "ast.h"
 #include "bytecode.h"
 #include "code-gen.h"
+#include "fold.h"
+#include "lexer.h"
 #include "memory.h"
 #include "parser.h"
+#include "peephole.h"
+#include "symbol.h"
+#include "value.h"
+#include "vm.h"
 #include "writer.h"
 
 void bs_init(struct Bs* bs, struct Writer* writer) {
   mem_init(&bs->mem);
   bs->writer = writer;
+  vm_init(&bs->vm, &bs->mem, writer);
+  line_lexer_init(&bs->line_lexer);
+  symbol_table_init(&bs->symbols);
+  module_globals_init(&bs->globals);
 }
 
 void bs_fini(struct Bs* bs) {
-  UNUSED(bs);
+  module_globals_fini(&bs->globals);
+  symbol_table_fini(&bs->symbols);
+  vm_fini(&bs->vm);
+  mem_fini(&bs->mem);
 }
 
 enum BsStatus bs_interpret(struct Bs* bs, const char *source) {
   bool incomplete_input = false;
 
-  struct Ast* ast = parse(source, bs->writer, &incomplete_input);
+  struct Arena arena;
+  arena_init(&arena);
+  struct ParseOptions options = { &bs->symbols, false };
+  struct Ast* ast = parse_with_options(&arena, source, &options, bs->writer, &incomplete_input);
   if (ast) {
+    struct FoldStats stats = { 0, 0, 0 };
+    ast = fold_ast(&arena, ast, &stats);
     ast_print(ast, bs->writer);
     bs->writer->writef(bs->writer, "\n");
+    fold_stats_print(&stats, bs->writer);
+    bs->writer->writef(bs->writer, "\n");
   }
   bool ok = ast != NULL;
 
   if (ok) {
+    // Globals declared by code which fails are forgotten, along with their
+    // values, so later lines can't refer to them
+    size_t num_globals = bs->globals.length;
     struct Chunk chunk;
     chunk_init(&chunk, &bs->mem);
-    if (generate_bytecode(ast, &chunk, bs->writer)) {
+    ok = generate_module_bytecode(ast, &bs->globals, &chunk, bs->writer);
+    if (ok) {
+      struct PeepholeStats stats = { { 0 } };
+      peephole_optimize(&chunk, &stats);
       chunk_disassemble(&chunk, "__main__", bs->writer);
+      peephole_stats_print(&stats, bs->writer);
+      bs->writer->writef(bs->writer, "\n");
+      struct Value result;
+      ok = vm_run(&bs->vm, &chunk, &result);
+      if (ok) {
+        value_print(result, bs->writer);
+        bs->writer->writef(bs->writer, "\n");
+      }
+    }
+    if (!ok) {
+      module_globals_truncate(&bs->globals, num_globals);
+      if (bs->vm.globals.length > num_globals) {
+        bs->vm.globals.length = num_globals;
+      }
     }
     chunk_fini(&chunk);
   }
 
-  ast_free(ast);
+  arena_fini(&arena);
 
   if (incomplete_input) {
     return BS_Incomplete;
   }
   return ok ? BS_Ok : BS_Error;
 }
+
+enum BsStatus bs_interpret_line(struct Bs* bs, const char *source) {
+  if (!line_lexer_feed(&bs->line_lexer, source)) {
+    return BS_Incomplete;
+  }
+  enum BsStatus status = bs_interpret(bs, source);
+  if (status != BS_Incomplete) {
+    line_lexer_init(&bs->line_lexer);
+  }
+  return status;
+}
@@ -1,7 +1,11 @@
 #ifndef __BS_BS_H__
 #define __BS_BS_H__
 
+#include "code-gen.h"
+#include "lexer.h"
 #include "memory.h"
+#include "symbol.h"
+#include "vm.h"
 #include "writer.h"
 
 enum BsStatus {
@@ -14,6 +18,10 @@ enum BsStatus {
 struct Bs {
   struct Memory mem;
   struct Writer* writer;
+  struct Vm vm;
+  struct LineLexer line_lexer;
+  struct SymbolTable symbols; // Names in all the code run so far, so IDs stay the same across lines
+  struct ModuleGlobals globals; // Globals declared so far, which later lines can refer to
 };
 
 // Initialize BS state
@@ -22,6 +30,12 @@ void bs_init(struct Bs* bs, struct Writer* writer);
 // Interpret source code in this BS instance
 enum BsStatus bs_interpret(struct Bs* bs, const char *source);
 
+// Interpret source code which is typed in line by line, like in a REPL.
+// `source` is all the input since the last call that didn't return
+// BS_Incomplete. While brackets or strings are still open, this returns
+// BS_Incomplete without parsing, so input is only lexed once as it grows.
+enum BsStatus bs_interpret_line(struct Bs* bs, const char *source);
+
 // Free memory for BS state
 void bs_fini(struct Bs* bs);
 
@@ -65,7 +65,7 @@ static int repl() {
     printf("%s ", prompt);
     fflush(stdout);
     line_buffer_read(&buffer, stdin);
-    enum BsStatus status = bs_interpret(&bs, buffer.data);
+    enum BsStatus status = bs_interpret_line(&bs, buffer.data);
     switch (status) {
     case BS_Ok:
       prompt = ">>>";
@@ -1,6 +1,8 @@
 #include "bytecode.h"
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "log.h"
 #include "value.h"
@@ -35,11 +37,17 @@ static void code_vec_fini(struct CodeVec* code) {
 void chunk_init(struct Chunk* chunk, struct Memory* mem) {
   code_vec_init(&chunk->code, mem);
   value_vec_init(&chunk->values, mem);
+  chunk->encoding = CE_Stack;
+  chunk->num_registers = 0;
+  chunk->num_globals = 0;
+  chunk->value_slots = NULL;
+  chunk->value_slots_capacity = 0;
 }
 
 void chunk_fini(struct Chunk* chunk) {
   code_vec_fini(&chunk->code);
   value_vec_fini(&chunk->values);
+  MEM_FREE(chunk->code.mem, chunk->value_slots, chunk->value_slots_capacity * sizeof(uint32_t));
 }
 
 void chunk_push_byte(struct Chunk* chunk, uint8_t byte) {
@@ -58,12 +66,185 @@ void chunk_push_dword(struct Chunk* chunk, uint32_t dword) {
   code_vec_push(&chunk->code, (dword >> 24) & 0xff);
 }
 
+void chunk_patch_word(struct Chunk* chunk, size_t offset, uint16_t word) {
+  CHECK(offset + 1 < chunk->code.length);
+  chunk->code.code[offset] = word & 0xff;
+  chunk->code.code[offset + 1] = (word >> 8) & 0xff;
+}
+
+// Marks an empty slot in the constant index
+#define VALUE_SLOT_NONE UINT32_MAX
+
+// The bits which identify a constant, along with its type. Floats compare by
+// bit pattern, so 0.0 and -0.0 stay apart, and so do 1 and 1.0. Integers
+// compare by value, because they might be boxed.
+static uint64_t value_bits(struct Value value) {
+  uint64_t bits = 0;
+  switch (VALUE_TYPE(value)) {
+  case V_Nil:
+    break;
+  case V_Boolean:
+    bits = AS_BOOL(value);
+    break;
+  case V_Integer:
+    bits = (uint64_t) AS_INT(value);
+    break;
+  case V_Float: {
+    double f = AS_FLOAT(value);
+    memcpy(&bits, &f, sizeof(double));
+    break;
+  }
+  }
+  return bits;
+}
+
+static size_t value_hash(enum ValueType type, uint64_t bits) {
+  // Multiplicative hashing, mixing the high bits down to where the mask is
+  uint64_t hash = (bits ^ ((uint64_t) type << 60)) * 0x9e3779b97f4a7c15ull;
+  return (size_t) (hash ^ (hash >> 32));
+}
+
+// Find the slot for a value, which is either the slot holding its index or
+// the empty slot where it would go. There must be at least one empty slot.
+static size_t find_value_slot(const struct Chunk* chunk, enum ValueType type, uint64_t bits) {
+  size_t mask = chunk->value_slots_capacity - 1;
+  for (size_t slot = value_hash(type, bits) & mask;; slot = (slot + 1) & mask) {
+    uint32_t index = chunk->value_slots[slot];
+    if (index == VALUE_SLOT_NONE) {
+      return slot;
+    }
+    struct Value other = chunk->values.values[index];
+    if (VALUE_TYPE(other) == type && value_bits(other) == bits) {
+      return slot;
+    }
+  }
+}
+
+// Double the number of slots, and place the values again
+static void grow_value_slots(struct Chunk* chunk) {
+  size_t old_capacity = chunk->value_slots_capacity;
+  size_t new_capacity = old_capacity == 0 ? 16 : old_capacity * 2;
+  chunk->value_slots = MEM_REALLOC(chunk->code.mem, chunk->value_slots,
+                                   old_capacity * sizeof(uint32_t),
+                                   new_capacity * sizeof(uint32_t));
+  chunk->value_slots_capacity = new_capacity;
+  for (size_t i = 0; i < new_capacity; i++) {
+    chunk->value_slots[i] = VALUE_SLOT_NONE;
+  }
+  for (size_t index = 0; index < chunk->values.length; index++) {
+    struct Value value = chunk->values.values[index];
+    size_t slot = find_value_slot(chunk, VALUE_TYPE(value), value_bits(value));
+    chunk->value_slots[slot] = index;
+  }
+}
+
 size_t chunk_push_value(struct Chunk* chunk, struct Value value) {
+  // Keep the load factor at most 1/2
+  if (2 * (chunk->values.length + 1) > chunk->value_slots_capacity) {
+    grow_value_slots(chunk);
+  }
+  enum ValueType type = VALUE_TYPE(value);
+  size_t slot = find_value_slot(chunk, type, value_bits(value));
+  if (chunk->value_slots[slot] != VALUE_SLOT_NONE) {
+    return chunk->value_slots[slot];
+  }
+  CHECK(chunk->values.length < VALUE_SLOT_NONE);
   size_t ret = chunk->values.length;
   value_vec_push(&chunk->values, value);
+  chunk->value_slots[slot] = ret;
   return ret;
 }
 
+static const char* const opcode_names[] = {
+  [OP_Nil]                    = "OP_Nil",
+  [OP_True]                   = "OP_True",
+  [OP_False]                  = "OP_False",
+  [OP_Const1B]                = "OP_Const1B",
+  [OP_Const2B]                = "OP_Const2B",
+  [OP_Const4B]                = "OP_Const4B",
+  [OP_Equal]                  = "OP_Equal",
+  [OP_NotEqual]               = "OP_NotEqual",
+  [OP_LessEqual]              = "OP_LessEqual",
+  [OP_LessThan]               = "OP_LessThan",
+  [OP_GreaterEqual]           = "OP_GreaterEqual",
+  [OP_GreaterThan]            = "OP_GreaterThan",
+  [OP_ShiftLeft]              = "OP_ShiftLeft",
+  [OP_ShiftRight]             = "OP_ShiftRight",
+  [OP_Add]                    = "OP_Add",
+  [OP_Subtract]               = "OP_Subtract",
+  [OP_Multiply]               = "OP_Multiply",
+  [OP_Divide]                 = "OP_Divide",
+  [OP_Modulo]                 = "OP_Modulo",
+  [OP_BitOr]                  = "OP_BitOr",
+  [OP_BitAnd]                 = "OP_BitAnd",
+  [OP_BitXor]                 = "OP_BitXor",
+  [OP_Minus]                  = "OP_Minus",
+  [OP_BitNot]                 = "OP_BitNot",
+  [OP_LogicalNot]             = "OP_LogicalNot",
+  [OP_Pop]                    = "OP_Pop",
+  [OP_GetLocal]               = "OP_GetLocal",
+  [OP_SetLocal]               = "OP_SetLocal",
+  [OP_GetGlobal]              = "OP_GetGlobal",
+  [OP_SetGlobal]              = "OP_SetGlobal",
+  [OP_UpdateLocal]            = "OP_UpdateLocal",
+  [OP_UpdateGlobal]           = "OP_UpdateGlobal",
+  [OP_Jump]                   = "OP_Jump",
+  [OP_JumpBack]               = "OP_JumpBack",
+  [OP_JumpIfFalse]            = "OP_JumpIfFalse",
+  [OP_JumpIfTrue]             = "OP_JumpIfTrue",
+  [OP_JumpIfFalseOrPop]       = "OP_JumpIfFalseOrPop",
+  [OP_JumpIfTrueOrPop]        = "OP_JumpIfTrueOrPop",
+  [OP_RangeStart]             = "OP_RangeStart",
+  [OP_RangeLoop]              = "OP_RangeLoop",
+  [OP_AddConst]               = "OP_AddConst",
+  [OP_AddLocalConst]          = "OP_AddLocalConst",
+  [OP_GetLocal2]              = "OP_GetLocal2",
+  [OP_PopRangeLoop]           = "OP_PopRangeLoop",
+  [OP_LessThanJumpIfFalse]    = "OP_LessThanJumpIfFalse",
+  [OP_LessEqualIntInt]        = "OP_LessEqualIntInt",
+  [OP_LessEqualFloatFloat]    = "OP_LessEqualFloatFloat",
+  [OP_LessThanIntInt]         = "OP_LessThanIntInt",
+  [OP_LessThanFloatFloat]     = "OP_LessThanFloatFloat",
+  [OP_GreaterEqualIntInt]     = "OP_GreaterEqualIntInt",
+  [OP_GreaterEqualFloatFloat] = "OP_GreaterEqualFloatFloat",
+  [OP_GreaterThanIntInt]      = "OP_GreaterThanIntInt",
+  [OP_GreaterThanFloatFloat]  = "OP_GreaterThanFloatFloat",
+  [OP_AddIntInt]              = "OP_AddIntInt",
+  [OP_AddFloatFloat]          = "OP_AddFloatFloat",
+  [OP_SubtractIntInt]         = "OP_SubtractIntInt",
+  [OP_SubtractFloatFloat]     = "OP_SubtractFloatFloat",
+  [OP_MultiplyIntInt]         = "OP_MultiplyIntInt",
+  [OP_MultiplyFloatFloat]     = "OP_MultiplyFloatFloat",
+  [OP_Return]                 = "OP_Return",
+  [OP_REqual]                 = "OP_REqual",
+  [OP_RNotEqual]              = "OP_RNotEqual",
+  [OP_RLessEqual]             = "OP_RLessEqual",
+  [OP_RLessThan]              = "OP_RLessThan",
+  [OP_RGreaterEqual]          = "OP_RGreaterEqual",
+  [OP_RGreaterThan]           = "OP_RGreaterThan",
+  [OP_RShiftLeft]             = "OP_RShiftLeft",
+  [OP_RShiftRight]            = "OP_RShiftRight",
+  [OP_RAdd]                   = "OP_RAdd",
+  [OP_RSubtract]              = "OP_RSubtract",
+  [OP_RMultiply]              = "OP_RMultiply",
+  [OP_RDivide]                = "OP_RDivide",
+  [OP_RModulo]                = "OP_RModulo",
+  [OP_RBitOr]                 = "OP_RBitOr",
+  [OP_RBitAnd]                = "OP_RBitAnd",
+  [OP_RBitXor]                = "OP_RBitXor",
+  [OP_RMinus]                 = "OP_RMinus",
+  [OP_RBitNot]                = "OP_RBitNot",
+  [OP_RLogicalNot]            = "OP_RLogicalNot",
+  [OP_RReturn]                = "OP_RReturn",
+};
+
+const char* opcode_to_str(uint8_t op) {
+  if (op == 0 || op >= OP_NumOpcodes) {
+    return "<invalid>";
+  }
+  return opcode_names[op];
+}
+
 static size_t disassemble_simple_instruction(const char *name, struct Writer* writer) {
   writer->writef(writer, "  %s\n", name);
   return 1;
@@ -103,8 +284,99 @@ static size_t disassemble_const4_instruction(const struct Chunk* chunk, size_t o
   return 5;
 }
 
+// Print an instruction with any number of 1-byte operands, which are slots
+// (`s`) or constant indices (`k`), as given by `operands`
+static size_t disassemble_byte_operands_instruction(const char* name, const char* operands,
+                                                    const struct Chunk* chunk, size_t offset,
+                                                    struct Writer* writer) {
+  size_t length = 1 + strlen(operands);
+  CHECK(offset + length - 1 < chunk->code.length);
+  writer->writef(writer, "  %-16s", name);
+  for (size_t i = 0; operands[i]; i++) {
+    size_t operand = chunk->code.code[offset + 1 + i];
+    if (operands[i] == 'k') {
+      CHECK(operand < chunk->values.length);
+      writer->writef(writer, " (%lu) ", operand);
+      value_print(chunk->values.values[operand], writer);
+    } else if (operands[i] == 'o') {
+      writer->writef(writer, " %s", opcode_to_str(operand));
+    } else {
+      writer->writef(writer, " s%lu", operand);
+    }
+  }
+  writer->writef(writer, "\n");
+  return length;
+}
+
+static size_t disassemble_slot_instruction(const char* name, const struct Chunk* chunk,
+                                           size_t offset, struct Writer* writer) {
+  CHECK(offset + 1 < chunk->code.length);
+  writer->writef(writer, "  %-16s s%u\n", name, chunk->code.code[offset + 1]);
+  return 2;
+}
+
+static size_t disassemble_global_instruction(const char* name, const struct Chunk* chunk,
+                                             size_t offset, struct Writer* writer) {
+  CHECK(offset + 2 < chunk->code.length);
+  writer->writef(writer, "  %-16s g%lu\n", name, read_u16(chunk->code.code + offset + 1));
+  return 3;
+}
+
+static size_t disassemble_update_global_instruction(const struct Chunk* chunk, size_t offset,
+                                                    struct Writer* writer) {
+  CHECK(offset + 3 < chunk->code.length);
+  writer->writef(writer, "  %-16s g%lu %s\n", "OP_UpdateGlobal",
+                 read_u16(chunk->code.code + offset + 1),
+                 opcode_to_str(chunk->code.code[offset + 3]));
+  return 4;
+}
+
+// Print a jump along with the offset of its target. `has_slot` is set for
+// jumps which also take a 1-byte slot operand.
+static size_t disassemble_jump_instruction(const char* name, const struct Chunk* chunk,
+                                           size_t offset, bool has_slot, bool backward,
+                                           struct Writer* writer) {
+  size_t length = has_slot ? 4 : 3;
+  CHECK(offset + length - 1 < chunk->code.length);
+  size_t jump = read_u16(chunk->code.code + offset + length - 2);
+  size_t target = backward ? offset + length - jump : offset + length + jump;
+  writer->writef(writer, "  %-16s", name);
+  if (has_slot) {
+    writer->writef(writer, " s%u", chunk->code.code[offset + 1]);
+  }
+  writer->writef(writer, " -> %lu\n", target);
+  return length;
+}
+
+// Print a register operand. Slots below the number of constants hold
+// constants, so print the value as well.
+static void disassemble_register(const struct Chunk* chunk, size_t slot, struct Writer* writer) {
+  if (slot < chunk->values.length) {
+    writer->writef(writer, " k%lu(", slot);
+    value_print(chunk->values.values[slot], writer);
+    writer->writef(writer, ")");
+  } else {
+    writer->writef(writer, " r%lu", slot - chunk->values.length);
+  }
+}
+
+static size_t disassemble_register_instruction(const char* name, const struct Chunk* chunk,
+                                               size_t offset, size_t num_operands,
+                                               struct Writer* writer) {
+  CHECK(offset + 2 * num_operands < chunk->code.length);
+  writer->writef(writer, "  %-16s", name);
+  for (size_t i = 0; i < num_operands; i++) {
+    disassemble_register(chunk, read_u16(chunk->code.code + offset + 1 + 2 * i), writer);
+  }
+  writer->writef(writer, "\n");
+  return 1 + 2 * num_operands;
+}
+
 static size_t disassemble_instruction(const struct Chunk* chunk, size_t offset,
                                       struct Writer* writer) {
+#define REGISTER_INSTRUCTION(NAME, NUM_OPERANDS) \
+  return disassemble_register_instruction(NAME, chunk, offset, NUM_OPERANDS, writer)
+
   uint8_t b = chunk->code.code[offset];
   switch (b) {
   case OP_Nil:          return disassemble_simple_instruction("OP_Nil", writer);
@@ -132,15 +404,90 @@ static size_t disassemble_instruction(const struct Chunk* chunk, size_t offset,
   case OP_Minus:        return disassemble_simple_instruction("OP_Minus", writer);
   case OP_BitNot:       return disassemble_simple_instruction("OP_BitNot", writer);
   case OP_LogicalNot:   return disassemble_simple_instruction("OP_LogicalNot", writer);
+  case OP_Pop:          return disassemble_simple_instruction("OP_Pop", writer);
+  case OP_GetLocal:     return disassemble_slot_instruction("OP_GetLocal", chunk, offset, writer);
+  case OP_SetLocal:     return disassemble_slot_instruction("OP_SetLocal", chunk, offset, writer);
+  case OP_GetGlobal:
+    return disassemble_global_instruction("OP_GetGlobal", chunk, offset, writer);
+  case OP_SetGlobal:
+    return disassemble_global_instruction("OP_SetGlobal", chunk, offset, writer);
+  case OP_UpdateLocal:
+    return disassemble_byte_operands_instruction("OP_UpdateLocal", "so", chunk, offset, writer);
+  case OP_UpdateGlobal:
+    return disassemble_update_global_instruction(chunk, offset, writer);
+  case OP_Jump:
+    return disassemble_jump_instruction("OP_Jump", chunk, offset, false, false, writer);
+  case OP_JumpBack:
+    return disassemble_jump_instruction("OP_JumpBack", chunk, offset, false, true, writer);
+  case OP_JumpIfFalse:
+  case OP_JumpIfTrue:
+  case OP_JumpIfFalseOrPop:
+  case OP_JumpIfTrueOrPop:
+    return disassemble_jump_instruction(opcode_to_str(b), chunk, offset, false, false, writer);
+  case OP_RangeStart:
+    return disassemble_jump_instruction("OP_RangeStart", chunk, offset, true, false, writer);
+  case OP_RangeLoop:
+    return disassemble_jump_instruction("OP_RangeLoop", chunk, offset, true, true, writer);
+  case OP_AddConst:
+    return disassemble_byte_operands_instruction("OP_AddConst", "k", chunk, offset, writer);
+  case OP_AddLocalConst:
+    return disassemble_byte_operands_instruction("OP_AddLocalConst", "sk", chunk, offset, writer);
+  case OP_GetLocal2:
+    return disassemble_byte_operands_instruction("OP_GetLocal2", "ss", chunk, offset, writer);
+  case OP_PopRangeLoop:
+    return disassemble_jump_instruction("OP_PopRangeLoop", chunk, offset, true, true, writer);
+  case OP_LessThanJumpIfFalse:
+    return disassemble_jump_instruction("OP_LessThanJumpIfFalse", chunk, offset, false, false,
+                                        writer);
+  case OP_LessEqualIntInt:
+  case OP_LessEqualFloatFloat:
+  case OP_LessThanIntInt:
+  case OP_LessThanFloatFloat:
+  case OP_GreaterEqualIntInt:
+  case OP_GreaterEqualFloatFloat:
+  case OP_GreaterThanIntInt:
+  case OP_GreaterThanFloatFloat:
+  case OP_AddIntInt:
+  case OP_AddFloatFloat:
+  case OP_SubtractIntInt:
+  case OP_SubtractFloatFloat:
+  case OP_MultiplyIntInt:
+  case OP_MultiplyFloatFloat:
+    return disassemble_simple_instruction(opcode_to_str(b), writer);
+  case OP_Return:       return disassemble_simple_instruction("OP_Return", writer);
+  case OP_REqual:        REGISTER_INSTRUCTION("OP_REqual", 3);
+  case OP_RNotEqual:     REGISTER_INSTRUCTION("OP_RNotEqual", 3);
+  case OP_RLessEqual:    REGISTER_INSTRUCTION("OP_RLessEqual", 3);
+  case OP_RLessThan:     REGISTER_INSTRUCTION("OP_RLessThan", 3);
+  case OP_RGreaterEqual: REGISTER_INSTRUCTION("OP_RGreaterEqual", 3);
+  case OP_RGreaterThan:  REGISTER_INSTRUCTION("OP_RGreaterThan", 3);
+  case OP_RShiftLeft:    REGISTER_INSTRUCTION("OP_RShiftLeft", 3);
+  case OP_RShiftRight:   REGISTER_INSTRUCTION("OP_RShiftRight", 3);
+  case OP_RAdd:          REGISTER_INSTRUCTION("OP_RAdd", 3);
+  case OP_RSubtract:     REGISTER_INSTRUCTION("OP_RSubtract", 3);
+  case OP_RMultiply:     REGISTER_INSTRUCTION("OP_RMultiply", 3);
+  case OP_RDivide:       REGISTER_INSTRUCTION("OP_RDivide", 3);
+  case OP_RModulo:       REGISTER_INSTRUCTION("OP_RModulo", 3);
+  case OP_RBitOr:        REGISTER_INSTRUCTION("OP_RBitOr", 3);
+  case OP_RBitAnd:       REGISTER_INSTRUCTION("OP_RBitAnd", 3);
+  case OP_RBitXor:       REGISTER_INSTRUCTION("OP_RBitXor", 3);
+  case OP_RMinus:        REGISTER_INSTRUCTION("OP_RMinus", 2);
+  case OP_RBitNot:       REGISTER_INSTRUCTION("OP_RBitNot", 2);
+  case OP_RLogicalNot:   REGISTER_INSTRUCTION("OP_RLogicalNot", 2);
+  case OP_RReturn:       REGISTER_INSTRUCTION("OP_RReturn", 1);
   default:
     DIE("unexpected byte: %u", b);
   }
+
+#undef REGISTER_INSTRUCTION
 }
 
 void chunk_disassemble(const struct Chunk* chunk, const char* name, struct Writer* writer) {
   writer->writef(writer, "%s:\n", name);
   size_t offset = 0;
   while (offset < chunk->code.length) {
+    // Offsets are printed so that jump targets can be found
+    writer->writef(writer, "%04lu", offset);
     offset += disassemble_instruction(chunk, offset, writer);
   }
 }
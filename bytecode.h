@@ -37,6 +37,100 @@ enum OpCode {
   OP_Minus,
   OP_BitNot,
   OP_LogicalNot,
+  // Stack manipulation
+  OP_Pop,     // Discard the value on top of the stack
+  // Local variables, which live in frame slots at the bottom of the stack
+  OP_GetLocal, // Push the value in the frame slot given by a 1-byte operand
+  OP_SetLocal, // Store the value on top of the stack in the frame slot, without popping it
+  // Globals of the module, which live in the VM's globals array, at the index
+  // given by a 2-byte operand
+  OP_GetGlobal, // Push the value of the global
+  OP_SetGlobal, // Store the value on top of the stack in the global, without popping it
+  // Compound assignments to a variable, with a 1-byte binary opcode after the
+  // slot or index. The variable and the value on top of the stack are combined
+  // with it, and the result replaces the value and is stored in the variable.
+  OP_UpdateLocal,
+  OP_UpdateGlobal,
+  // Control flow. Jump offsets are 2 bytes, counted from the end of the
+  // instruction.
+  OP_Jump,       // Jump forward by the offset
+  OP_JumpBack,   // Jump back by the offset
+  // Conditional jumps, which only go forward. Nil and false are falsey, and
+  // everything else is truthy. The plain ones pop the condition either way,
+  // and the "OrPop" ones keep it when they jump, which gives "and" and "or"
+  // the value of the operand which decided them.
+  OP_JumpIfFalse,      // Pop the value, and jump if it's falsey
+  OP_JumpIfTrue,       // Pop the value, and jump if it's truthy
+  OP_JumpIfFalseOrPop, // Jump if the value is falsey, otherwise pop it
+  OP_JumpIfTrueOrPop,  // Jump if the value is truthy, otherwise pop it
+  // Counting loops over an integer range use three frame slots, starting at
+  // the 1-byte slot operand: the counter, the (exclusive) end of the range,
+  // and the loop variable. The counter is copied to the loop variable before
+  // every run of the body, so the body can't change the number of runs.
+  OP_RangeStart, // Check the bounds, and jump forward by the offset if the range is empty
+  OP_RangeLoop,  // Increment the counter, and jump back by the offset if it's below the end
+  // Superinstructions, which the peephole optimizer fuses from the most common
+  // pairs in the VM's opcode-pair histogram. Each one does exactly what the
+  // sequence in brackets does, with one dispatch instead of several.
+  OP_AddConst,            // [OP_Const1B k, OP_Add], with the 1-byte constant index
+  OP_AddLocalConst,       // [OP_GetLocal s, OP_Const1B k, OP_Add], with a 1-byte slot and index
+  OP_GetLocal2,           // [OP_GetLocal s, OP_GetLocal t], with two 1-byte slots
+  OP_PopRangeLoop,        // [OP_Pop, OP_RangeLoop s offset], ending a loop body in a statement
+  OP_LessThanJumpIfFalse, // [OP_LessThan, OP_JumpIfFalse offset], testing a loop or if condition
+  // Quickened binary operations. The VM rewrites a generic operation in place
+  // into the variant for the operand types it has just seen, when there is
+  // one. A variant checks that its operands still have those types, and if
+  // they don't, rewrites itself back to the generic operation.
+  OP_LessEqualIntInt,
+  OP_LessEqualFloatFloat,
+  OP_LessThanIntInt,
+  OP_LessThanFloatFloat,
+  OP_GreaterEqualIntInt,
+  OP_GreaterEqualFloatFloat,
+  OP_GreaterThanIntInt,
+  OP_GreaterThanFloatFloat,
+  OP_AddIntInt,
+  OP_AddFloatFloat,
+  OP_SubtractIntInt,
+  OP_SubtractFloatFloat,
+  OP_MultiplyIntInt,
+  OP_MultiplyFloatFloat,
+  // Control flow, continued. This stays the last stack-machine opcode, since
+  // CE_Stack code is OP_Nil .. OP_Return.
+  OP_Return, // Stop execution, and return the value on top of the stack
+  // Register-machine encoding. Every operand is a 2-byte frame slot. The
+  // chunk's constants are copied into the first slots of the frame, so
+  // literals can be used directly as operands, and temporaries follow them.
+  // Binary operations: slot[dst] = slot[lhs] OP slot[rhs]
+  OP_REqual,
+  OP_RNotEqual,
+  OP_RLessEqual,
+  OP_RLessThan,
+  OP_RGreaterEqual,
+  OP_RGreaterThan,
+  OP_RShiftLeft,
+  OP_RShiftRight,
+  OP_RAdd,
+  OP_RSubtract,
+  OP_RMultiply,
+  OP_RDivide,
+  OP_RModulo,
+  OP_RBitOr,
+  OP_RBitAnd,
+  OP_RBitXor,
+  // Unary operations: slot[dst] = OP slot[rhs]
+  OP_RMinus,
+  OP_RBitNot,
+  OP_RLogicalNot,
+  // Stop execution, and return slot[src]
+  OP_RReturn,
+  OP_NumOpcodes, // Not an opcode, but one more than the last one
+};
+
+// How the instructions in a chunk are encoded
+enum ChunkEncoding {
+  CE_Stack,    // Stack-machine code (OP_Nil .. OP_Return)
+  CE_Register, // Register-machine code (OP_REqual .. OP_RReturn)
 };
 
 struct CodeVec {
@@ -49,9 +143,14 @@ struct CodeVec {
 struct Chunk {
   struct CodeVec code;
   struct ValueVec values;
+  enum ChunkEncoding encoding; // Instruction encoding, pick before generating code
+  size_t num_registers;        // Frame size for register code, including constants
+  size_t num_globals;          // Number of module globals the code may refer to
+  uint32_t* value_slots;       // Open-addressed hash index into `values`
+  size_t value_slots_capacity; // Power of 2, or 0 before the first value
 };
 
-// Initialize an empty chunk of bytecode
+// Initialize an empty chunk of stack-machine bytecode
 void chunk_init(struct Chunk* chunk, struct Memory* mem);
 
 // Free memory for a chunk of bytecode
@@ -66,9 +165,18 @@ void chunk_push_word(struct Chunk* chunk, uint16_t word);
 // Push a little-endian uint32_t to the chunk
 void chunk_push_dword(struct Chunk* chunk, uint32_t dword);
 
-// Push a value to the chunk array and return its index
+// Overwrite a little-endian uint16_t at `offset`, like a jump offset which
+// wasn't known when the instruction was pushed
+void chunk_patch_word(struct Chunk* chunk, size_t offset, uint16_t word);
+
+// Push a value to the chunk array and return its index. Identical values, of
+// the same type and with the same bits, share one index, so that repeated
+// literals don't spill into the wider constant instructions.
 size_t chunk_push_value(struct Chunk* chunk, struct Value value);
 
+// Get the name of an opcode, like "OP_Add"
+const char* opcode_to_str(uint8_t op);
+
 // Disassemble a chunk of bytecode
 void chunk_disassemble(const struct Chunk* chunk, const char* name, struct Writer* writer);
 
@@ -1,132 +1,942 @@
 #include "code-gen.h"
 
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "bytecode.h"
+#include "flat-ast.h"
 #include "log.h"
+#include "string.h"
+#include "symbol.h"
 #include "value.h"
 
+#define REALLOC(PTR, SIZE) do {        \
+    if (!(PTR = realloc(PTR, SIZE))) { \
+      DIE_ERR("realloc()");            \
+    }                                  \
+  } while (0)
+
+// Maximum number of locals in scope, since slots are 1-byte operands
+#define MAX_LOCALS 256
+
+// Local variable, which lives in a frame slot
+struct Local {
+  struct Str name;    // Name of the variable, empty for slots the program can't refer to
+  uint32_t symbol;    // Symbol ID of the name, or SYMBOL_NONE
+  size_t slot;        // Frame slot, which is where its value was when it was declared
+  bool is_std_module; // Whether it was declared by `let <name> = require("std")`
+};
+
+// "break" or "continue", which is patched once the end of its loop is known
+struct LoopJump {
+  size_t offset; // Offset of the jump's operand
+  bool is_break; // Jumps out of the loop if set, otherwise to the next iteration
+};
+
+// Loop which is being compiled
+struct Loop {
+  struct Loop* enclosing; // Loop this one is nested in, or NULL
+  size_t num_locals;      // Number of locals in scope at the start of the body
+  size_t depth;           // Stack depth at the start of the body
+  size_t first_jump;      // Index of the loop's first jump in `State::jumps`
+};
+
 // State for the code generator
 struct State {
-  struct Chunk* chunk;   // Chunk that we're writing to
-  struct Writer* writer; // Sink for error messages
+  struct Chunk* chunk;             // Chunk that we're writing to
+  struct Writer* writer;           // Sink for error messages
+  struct ModuleGlobals* globals;   // Globals of the module the code is part of
+  struct Local locals[MAX_LOCALS]; // Locals in scope, innermost last
+  size_t num_locals;               // Number of locals in scope
+  size_t depth;                    // Number of values on the stack at this point in the code
+  size_t scope_depth;              // Number of blocks around this point, 0 for globals
+  struct Loop* loop;               // Innermost loop being compiled, or NULL
+  struct LoopJump* jumps;          // Jumps out of loop bodies, waiting to be patched
+  size_t num_jumps;                // Number of jumps waiting to be patched
+  size_t jumps_capacity;           // Allocated capacity of `jumps`
+  size_t* branches;                // Operands of jumps out of conditions, waiting to be patched
+  size_t num_branches;             // Number of jumps out of conditions
+  size_t branches_capacity;        // Allocated capacity of `branches`
 };
 
-static void state_init(struct State* state, struct Chunk* chunk, struct Writer* writer) {
+static void state_init(struct State* state, struct ModuleGlobals* globals, struct Chunk* chunk,
+                       struct Writer* writer) {
   state->chunk = chunk;
   state->writer = writer;
+  state->globals = globals;
+  state->num_locals = 0;
+  state->depth = 0;
+  state->scope_depth = 0;
+  state->loop = NULL;
+  state->jumps = NULL;
+  state->num_jumps = state->jumps_capacity = 0;
+  state->branches = NULL;
+  state->num_branches = state->branches_capacity = 0;
+}
+
+static void state_fini(struct State* state) {
+  free(state->jumps);
+  free(state->branches);
+}
+
+static bool error(struct State* state, size_t line_num, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  state->writer->writef(state->writer, "\x1b[1;31mERROR\x1b[0m: [%lu]: ", line_num);
+  state->writer->vwritef(state->writer, fmt, ap);
+  state->writer->writef(state->writer, "\n");
+  va_end(ap);
+  return false;
+}
+
+// How many values an instruction adds to the stack, or removes if it's
+// negative. Jumps which only pop on one path count as popping, and the callers
+// fix up the depth where the paths meet.
+static int stack_effect(enum OpCode op) {
+  switch (op) {
+  case OP_Nil:
+  case OP_True:
+  case OP_False:
+  case OP_Const1B:
+  case OP_Const2B:
+  case OP_Const4B:
+  case OP_GetLocal:
+  case OP_GetGlobal:
+    return 1;
+  case OP_Equal:
+  case OP_NotEqual:
+  case OP_LessEqual:
+  case OP_LessThan:
+  case OP_GreaterEqual:
+  case OP_GreaterThan:
+  case OP_ShiftLeft:
+  case OP_ShiftRight:
+  case OP_Add:
+  case OP_Subtract:
+  case OP_Multiply:
+  case OP_Divide:
+  case OP_Modulo:
+  case OP_BitOr:
+  case OP_BitAnd:
+  case OP_BitXor:
+  case OP_Pop:
+  case OP_JumpIfFalse:
+  case OP_JumpIfTrue:
+  case OP_JumpIfFalseOrPop:
+  case OP_JumpIfTrueOrPop:
+  case OP_Return:
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+// Push an opcode, keeping track of the stack depth. Operands are pushed
+// separately.
+static void emit_op(struct State* state, enum OpCode op) {
+  chunk_push_byte(state->chunk, op);
+  state->depth += stack_effect(op);
 }
 
 // Forward declaration
 static bool emit(struct State* state, const struct Ast* ast);
 
+// Every statement leaves a value on the stack. All but the last one are
+// discarded, and the last one is returned as the result of the program.
 static bool emit_program(struct State* state, const struct AstProgram* ast) {
+  if (ast->statements.length == 0) {
+    emit_op(state, OP_Nil);
+  }
   for (size_t i = 0; i < ast->statements.length; i++) {
+    if (i > 0) {
+      emit_op(state, OP_Pop);
+    }
     if (!emit(state, ast->statements.data[i])) {
       return false;
     }
   }
+  emit_op(state, OP_Return);
   return true;
 }
 
-static void emit_const(struct Chunk* chunk, size_t index) {
+static void emit_const(struct State* state, size_t index) {
+  struct Chunk* chunk = state->chunk;
   if (index <= 0xff) {
-    chunk_push_byte(chunk, OP_Const1B);
+    emit_op(state, OP_Const1B);
     chunk_push_byte(chunk, index & 0xff);
   } else if (index <= 0xffff) {
-    chunk_push_byte(chunk, OP_Const2B);
+    emit_op(state, OP_Const2B);
     chunk_push_word(chunk, index & 0xffff);
   } else if (index <= 0xffffffff) {
-    chunk_push_byte(chunk, OP_Const4B);
+    emit_op(state, OP_Const4B);
     chunk_push_dword(chunk, index & 0xffffffff);
   } else {
     UNIMPLEMENTED();
   }
 }
 
+// Emit a jump with a placeholder offset, and return the offset of the operand
+static size_t emit_jump(struct State* state, uint8_t op) {
+  emit_op(state, op);
+  chunk_push_word(state->chunk, 0xffff);
+  return state->chunk->code.length - 2;
+}
+
+// Point a forward jump at the end of the code so far
+static bool patch_jump(struct State* state, size_t line_num, size_t offset) {
+  size_t jump = state->chunk->code.length - (offset + 2);
+  if (jump > 0xffff) {
+    return error(state, line_num, "too much code to jump over");
+  }
+  chunk_patch_word(state->chunk, offset, jump);
+  return true;
+}
+
+static enum OpCode binary_opcode(enum BinaryOp op) {
+  switch (op) {
+  case BO_Equal:        return OP_Equal;
+  case BO_NotEqual:     return OP_NotEqual;
+  case BO_LessEqual:    return OP_LessEqual;
+  case BO_LessThan:     return OP_LessThan;
+  case BO_GreaterEqual: return OP_GreaterEqual;
+  case BO_GreaterThan:  return OP_GreaterThan;
+  case BO_ShiftLeft:    return OP_ShiftLeft;
+  case BO_ShiftRight:   return OP_ShiftRight;
+  case BO_Add:          return OP_Add;
+  case BO_Subtract:     return OP_Subtract;
+  case BO_Multiply:     return OP_Multiply;
+  case BO_Divide:       return OP_Divide;
+  case BO_Modulo:       return OP_Modulo;
+  case BO_BitOr:        return OP_BitOr;
+  case BO_BitAnd:       return OP_BitAnd;
+  case BO_BitXor:       return OP_BitXor;
+  case BO_LogicalAnd:
+  case BO_LogicalOr:
+    // These short-circuit, so they're jumps around the right-hand side
+    UNREACHABLE();
+  }
+  UNREACHABLE();
+}
+
+static bool emit_binary_op(struct State* state, enum BinaryOp op) {
+  emit_op(state, binary_opcode(op));
+  return true;
+}
+
+static bool is_short_circuit(enum BinaryOp op) {
+  return op == BO_LogicalAnd || op == BO_LogicalOr;
+}
+
+// "and" and "or" have the value of the operand which decided them. The left
+// one stays on the stack if it decides, and is popped otherwise.
+static size_t emit_short_circuit_jump(struct State* state, enum BinaryOp op) {
+  return emit_jump(state, op == BO_LogicalAnd ? OP_JumpIfFalseOrPop : OP_JumpIfTrueOrPop);
+}
+
 static bool emit_binary(struct State* state, const struct AstBinary* ast) {
   if (!emit(state, ast->lhs)) {
     return false;
   }
+  if (is_short_circuit(ast->operation)) {
+    size_t jump = emit_short_circuit_jump(state, ast->operation);
+    return emit(state, ast->rhs) && patch_jump(state, ast->ast.line_num, jump);
+  }
   if (!emit(state, ast->rhs)) {
     return false;
   }
-  switch (ast->operation) {
-  case BO_Equal:        chunk_push_byte(state->chunk, OP_Equal); break;
-  case BO_NotEqual:     chunk_push_byte(state->chunk, OP_NotEqual); break;
-  case BO_LessEqual:    chunk_push_byte(state->chunk, OP_LessEqual); break;
-  case BO_LessThan:     chunk_push_byte(state->chunk, OP_LessThan); break;
-  case BO_GreaterEqual: chunk_push_byte(state->chunk, OP_GreaterEqual); break;
-  case BO_GreaterThan:  chunk_push_byte(state->chunk, OP_GreaterThan); break;
-  case BO_ShiftLeft:    chunk_push_byte(state->chunk, OP_ShiftLeft); break;
-  case BO_ShiftRight:   chunk_push_byte(state->chunk, OP_ShiftRight); break;
-  case BO_Add:          chunk_push_byte(state->chunk, OP_Add); break;
-  case BO_Subtract:     chunk_push_byte(state->chunk, OP_Subtract); break;
-  case BO_Multiply:     chunk_push_byte(state->chunk, OP_Multiply); break;
-  case BO_Divide:       chunk_push_byte(state->chunk, OP_Divide); break;
-  case BO_Modulo:       chunk_push_byte(state->chunk, OP_Modulo); break;
-  case BO_BitOr:        chunk_push_byte(state->chunk, OP_BitOr); break;
-  case BO_BitAnd:       chunk_push_byte(state->chunk, OP_BitAnd); break;
-  case BO_BitXor:       chunk_push_byte(state->chunk, OP_BitXor); break;
-  case BO_LogicalAnd:
-    // TODO: Short-circuiting
-    UNIMPLEMENTED();
-  case BO_LogicalOr:
-    // TODO: Short-circuiting
-    UNIMPLEMENTED();
+  return emit_binary_op(state, ast->operation);
+}
+
+static void emit_unary_op(struct State* state, enum UnaryOp op) {
+  switch (op) {
+  case UO_Minus:      emit_op(state, OP_Minus); break;
+  case UO_BitNot:     emit_op(state, OP_BitNot); break;
+  case UO_LogicalNot: emit_op(state, OP_LogicalNot); break;
   }
-  return true;
 }
 
 static bool emit_unary(struct State* state, const struct AstUnary* ast) {
   if (!emit(state, ast->rhs)) {
     return false;
   }
-  switch (ast->operation) {
-  case UO_Minus:      chunk_push_byte(state->chunk, OP_Minus); break;
-  case UO_BitNot:     chunk_push_byte(state->chunk, OP_BitNot); break;
-  case UO_LogicalNot: chunk_push_byte(state->chunk, OP_LogicalNot); break;
+  emit_unary_op(state, ast->operation);
+  return true;
+}
+
+// Check if a literal is always truthy or always falsey
+static bool is_constant_condition(const struct Ast* ast, bool* truthy) {
+  switch (ast->type) {
+  case AST_Boolean: *truthy = ((const struct AstBoolean*) ast)->b; return true;
+  case AST_Nil:     *truthy = false; return true;
+  case AST_Integer:
+  case AST_Float:   *truthy = true; return true;
+  default:          return false;
+  }
+}
+
+static void push_branch(struct State* state, size_t offset) {
+  if (state->num_branches == state->branches_capacity) {
+    state->branches_capacity = state->branches_capacity == 0 ? 8 : state->branches_capacity * 2;
+    REALLOC(state->branches, state->branches_capacity * sizeof(size_t));
+  }
+  state->branches[state->num_branches++] = offset;
+}
+
+// Point the jumps in `branches[start..end)` at the end of the code so far,
+// and remove them from the list
+static bool patch_branches(struct State* state, size_t line_num, size_t start, size_t end) {
+  for (size_t i = start; i < end; i++) {
+    if (!patch_jump(state, line_num, state->branches[i])) {
+      return false;
+    }
+  }
+  memmove(&state->branches[start], &state->branches[end],
+          (state->num_branches - end) * sizeof(size_t));
+  state->num_branches -= end - start;
+  return true;
+}
+
+// Emit a condition which jumps if its truthiness is `jump_if`, and falls
+// through otherwise, leaving nothing on the stack. The jumps are pushed to
+// `state->branches` for the caller to patch. "not", "and" and "or" jump
+// straight to where they're going, instead of computing a value to test.
+static bool emit_branch(struct State* state, const struct Ast* ast, bool jump_if) {
+  bool truthy;
+  if (is_constant_condition(ast, &truthy)) {
+    if (truthy == jump_if) {
+      push_branch(state, emit_jump(state, OP_Jump));
+    }
+    return true;
+  }
+  if (ast->type == AST_Unary && ((const struct AstUnary*) ast)->operation == UO_LogicalNot) {
+    return emit_branch(state, ((const struct AstUnary*) ast)->rhs, !jump_if);
+  }
+  if (ast->type == AST_Binary && is_short_circuit(((const struct AstBinary*) ast)->operation)) {
+    const struct AstBinary* binary = (const struct AstBinary*) ast;
+    // "a and b" is falsey if "a" is, and "a or b" is truthy if "a" is. Then
+    // both operands jump to the same place.
+    bool is_and = binary->operation == BO_LogicalAnd;
+    if (jump_if != is_and) {
+      return emit_branch(state, binary->lhs, jump_if) && emit_branch(state, binary->rhs, jump_if);
+    }
+    // Otherwise, the left operand can only decide against jumping, so it
+    // skips the right one
+    size_t start = state->num_branches;
+    if (!emit_branch(state, binary->lhs, !jump_if)) {
+      return false;
+    }
+    size_t end = state->num_branches;
+    return emit_branch(state, binary->rhs, jump_if) &&
+      patch_branches(state, ast->line_num, start, end);
+  }
+  if (!emit(state, ast)) {
+    return false;
   }
+  push_branch(state, emit_jump(state, jump_if ? OP_JumpIfTrue : OP_JumpIfFalse));
   return true;
 }
 
 static bool emit_float(struct State* state, const struct AstFloat* ast) {
   size_t index = chunk_push_value(state->chunk, FLOAT_VAL(ast->f));
-  emit_const(state->chunk, index);
+  emit_const(state, index);
   return true;
 }
 
 static bool emit_integer(struct State* state, const struct AstInteger* ast) {
-  size_t index = chunk_push_value(state->chunk, INT_VAL(ast->i));
-  emit_const(state->chunk, index);
+  size_t index = chunk_push_value(state->chunk, INT_VAL(state->chunk->values.mem, ast->i));
+  emit_const(state, index);
   return true;
 }
 
 static bool emit_boolean(struct State* state, const struct AstBoolean* ast) {
-  chunk_push_byte(state->chunk, ast->b ? OP_True : OP_False);
+  emit_op(state, ast->b ? OP_True : OP_False);
   return true;
 }
 
 static bool emit_nil(struct State* state, const struct AstNil* ast) {
-  chunk_push_byte(state->chunk, OP_Nil);
+  emit_op(state, OP_Nil);
+  return true;
+}
+
+static bool same_name(const struct Local* local, struct Str name, uint32_t symbol) {
+  if (local->symbol != SYMBOL_NONE && symbol != SYMBOL_NONE) {
+    return local->symbol == symbol;
+  }
+  return str_equal(&local->name, &name);
+}
+
+// Find the innermost local with the given name, or return NULL if there
+// isn't one
+static const struct Local* resolve_local(const struct State* state, struct Str name,
+                                         uint32_t symbol) {
+  for (size_t i = state->num_locals; i-- > 0;) {
+    const struct Local* local = &state->locals[i];
+    if (local->name.length > 0 && same_name(local, name, symbol)) {
+      return local;
+    }
+  }
+  return NULL;
+}
+
+// Declare a local whose value is already on the stack, in `slot`
+static bool add_local(struct State* state, size_t line_num, struct Str name, uint32_t symbol,
+                      size_t slot) {
+  if (state->num_locals == MAX_LOCALS || slot > 0xff) {
+    return error(state, line_num, "too many local variables");
+  }
+  struct Local* local = &state->locals[state->num_locals++];
+  local->name = name;
+  local->symbol = symbol;
+  local->slot = slot;
+  local->is_std_module = false;
+  return true;
+}
+
+static bool same_global_name(const struct GlobalName* global, struct Str name, uint32_t symbol) {
+  if (global->symbol != SYMBOL_NONE && symbol != SYMBOL_NONE) {
+    return global->symbol == symbol;
+  }
+  return global->length == name.length && memcmp(global->name, name.data, name.length) == 0;
+}
+
+// Find the index of the module global with the given name, or return
+// SIZE_MAX if there isn't one. Names are only looked up while compiling, so
+// a linear scan is fine.
+static size_t resolve_global(const struct State* state, struct Str name, uint32_t symbol) {
+  for (size_t i = 0; i < state->globals->length; i++) {
+    if (same_global_name(&state->globals->names[i], name, symbol)) {
+      return i;
+    }
+  }
+  return SIZE_MAX;
+}
+
+// Get the index of a module global, adding it if it isn't declared yet. A
+// global which is declared again keeps its index.
+static size_t declare_global(struct State* state, struct Str name, uint32_t symbol) {
+  size_t index = resolve_global(state, name, symbol);
+  if (index != SIZE_MAX) {
+    return index;
+  }
+  struct ModuleGlobals* globals = state->globals;
+  if (globals->length == globals->capacity) {
+    globals->capacity = globals->capacity == 0 ? 8 : globals->capacity * 2;
+    REALLOC(globals->names, globals->capacity * sizeof(struct GlobalName));
+  }
+  struct GlobalName* global = &globals->names[globals->length];
+  global->name = NULL;
+  REALLOC(global->name, name.length + 1);
+  memcpy(global->name, name.data, name.length);
+  global->name[name.length] = '\0';
+  global->length = name.length;
+  global->symbol = symbol;
+  global->is_std_module = false;
+  return globals->length++;
+}
+
+// Discard the locals declared since `num_locals`, which are on top of the stack
+static void pop_locals(struct State* state, size_t num_locals) {
+  for (; state->num_locals > num_locals; state->num_locals--) {
+    emit_op(state, OP_Pop);
+  }
+}
+
+// Discard the locals declared since `num_locals`, which are right below the
+// value on top of the stack. The value is moved down into the first slot.
+static void end_scope(struct State* state, size_t num_locals) {
+  if (state->num_locals > num_locals) {
+    emit_op(state, OP_SetLocal);
+    chunk_push_byte(state->chunk, state->locals[num_locals].slot);
+    pop_locals(state, num_locals);
+  }
+}
+
+// A block has the value of its last statement, or nil if it's empty or the
+// last statement ends in a semicolon. Its locals go out of scope at the end.
+static bool emit_block(struct State* state, const struct AstBlock* ast) {
+  size_t num_locals = state->num_locals;
+  state->scope_depth++;
+  for (size_t i = 0; i < ast->statements.length; i++) {
+    if (i > 0) {
+      emit_op(state, OP_Pop);
+    }
+    if (!emit(state, ast->statements.data[i])) {
+      return false;
+    }
+  }
+  if (ast->statements.length > 0 && ast->last_had_semicolon) {
+    emit_op(state, OP_Pop);
+  }
+  if (ast->statements.length == 0 || ast->last_had_semicolon) {
+    emit_op(state, OP_Nil);
+  }
+  state->scope_depth--;
+  end_scope(state, num_locals);
   return true;
 }
 
+// The branch which runs leaves its value. Without an "else", the value is nil
+// if the condition is falsey.
+static bool emit_if(struct State* state, const struct AstIf* ast) {
+  size_t line_num = ast->ast.line_num;
+  size_t start = state->num_branches;
+  if (!emit_branch(state, ast->condition, false)) {
+    return false;
+  }
+  size_t depth = state->depth;
+  if (!emit(state, ast->body)) {
+    return false;
+  }
+  size_t end_jump = emit_jump(state, OP_Jump);
+  if (!patch_branches(state, line_num, start, state->num_branches)) {
+    return false;
+  }
+  // Only one of the branches runs
+  state->depth = depth;
+  if (ast->else_part) {
+    if (!emit(state, ast->else_part)) {
+      return false;
+    }
+  } else {
+    emit_op(state, OP_Nil);
+  }
+  return patch_jump(state, line_num, end_jump);
+}
+
+// Modules have no value at runtime yet. A variable bound to "std" is only
+// looked at while compiling, to find loops over "std.range".
+static bool std_module_error(struct State* state, size_t line_num, struct Str name) {
+  return error(state, line_num, "'%.*s' is the std module, which can only be used for "
+               "std.range(...) in for loops so far", (int) name.length, (const char*) name.data);
+}
+
+// Emit a load or store of a variable, which is `local_op` with the slot of a
+// local, or `global_op` with the index of a module global. Locals shadow
+// globals. Nothing is looked up by name at runtime.
+static bool emit_variable_op(struct State* state, size_t line_num, struct Str name,
+                             uint32_t symbol, enum OpCode local_op, enum OpCode global_op) {
+  const struct Local* local = resolve_local(state, name, symbol);
+  if (local) {
+    if (local->is_std_module) {
+      return std_module_error(state, line_num, name);
+    }
+    emit_op(state, local_op);
+    chunk_push_byte(state->chunk, local->slot);
+    return true;
+  }
+  size_t index = resolve_global(state, name, symbol);
+  if (index == SIZE_MAX) {
+    return error(state, line_num, "undefined variable '%.*s'", (int) name.length,
+                 (const char*) name.data);
+  }
+  if (state->globals->names[index].is_std_module) {
+    return std_module_error(state, line_num, name);
+  }
+  emit_op(state, global_op);
+  chunk_push_word(state->chunk, index);
+  return true;
+}
+
+static bool emit_identifier(struct State* state, const struct AstIdentifier* ast) {
+  return emit_variable_op(state, ast->ast.line_num, ast->identifier, ast->symbol, OP_GetLocal,
+                          OP_GetGlobal);
+}
+
+// Declare the variable of a "let" whose RHS is on top of the stack
+static bool emit_declaration(struct State* state, size_t line_num, struct Str name,
+                             uint32_t symbol, bool is_std_module) {
+  if (state->scope_depth == 0) {
+    size_t index = declare_global(state, name, symbol);
+    if (index > 0xffff) {
+      return error(state, line_num, "too many global variables");
+    }
+    state->globals->names[index].is_std_module = is_std_module;
+    emit_op(state, OP_SetGlobal);
+    chunk_push_word(state->chunk, index);
+    emit_op(state, OP_Pop);
+  } else if (!add_local(state, line_num, name, symbol, state->depth - 1)) {
+    return false;
+  } else {
+    state->locals[state->num_locals - 1].is_std_module = is_std_module;
+  }
+  emit_op(state, OP_Nil);
+  return true;
+}
+
+static bool is_name(struct Str str, const char* name) {
+  return str.length == strlen(name) && memcmp(str.data, name, str.length) == 0;
+}
+
+// Only the "std" module can be required so far, and only to bind it with
+// "let". See `std_module_error`.
+static bool require_error(struct State* state, size_t line_num, struct Str module) {
+  return error(state, line_num, "require(\"%.*s\") isn't supported here yet",
+               (int) module.length, (const char*) module.data);
+}
+
+static bool emit_require(struct State* state, const struct AstRequire* ast) {
+  return require_error(state, ast->ast.line_num, ast->module);
+}
+
+// Outside of any block, "let" declares a module global. Otherwise it
+// declares a local, whose slot is where the value of the RHS already is. The
+// RHS is emitted first, so it sees any variable the new one shadows. The
+// declaration itself has no value.
+static bool emit_let(struct State* state, const struct AstLet* ast) {
+  bool is_std_module = ast->rhs && ast->rhs->type == AST_Require &&
+    is_name(((const struct AstRequire*) ast->rhs)->module, "std");
+  if (ast->rhs && !is_std_module) {
+    if (!emit(state, ast->rhs)) {
+      return false;
+    }
+  } else {
+    emit_op(state, OP_Nil);
+  }
+  return emit_declaration(state, ast->ast.line_num, ast->variable, ast->symbol, is_std_module);
+}
+
+// Check that the target of an assignment is a variable
+static bool check_assignable(struct State* state, enum AstType type, size_t line_num) {
+  if (type == AST_Member || type == AST_Index) {
+    // TODO: Objects, along with read-modify-write opcodes for compound
+    // assignments to them, which evaluate the object and key once
+    return error(state, line_num, "assignment to %s isn't supported yet",
+                 type == AST_Member ? "a member" : "an index");
+  }
+  if (type != AST_Identifier) {
+    return error(state, line_num, "invalid assignment target");
+  }
+  return true;
+}
+
+// An assignment has the value which was assigned
+static bool emit_assignment(struct State* state, const struct AstAssignment* ast) {
+  if (!check_assignable(state, ast->lhs->type, ast->lhs->line_num) || !emit(state, ast->rhs)) {
+    return false;
+  }
+  const struct AstIdentifier* variable = (const struct AstIdentifier*) ast->lhs;
+  return emit_variable_op(state, variable->ast.line_num, variable->identifier, variable->symbol,
+                          OP_SetLocal, OP_SetGlobal);
+}
+
+// Check that evaluating an expression can't change any variable
+static bool has_no_effects(const struct Ast* ast) {
+  switch (ast->type) {
+  case AST_Binary: {
+    const struct AstBinary* binary = (const struct AstBinary*) ast;
+    return has_no_effects(binary->lhs) && has_no_effects(binary->rhs);
+  }
+  case AST_Unary:
+    return has_no_effects(((const struct AstUnary*) ast)->rhs);
+  case AST_Identifier:
+  case AST_Float:
+  case AST_Integer:
+  case AST_Boolean:
+  case AST_Nil:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// A compound assignment has the value which was assigned. OP_UpdateLocal and
+// OP_UpdateGlobal read the variable after the RHS, so they're only used when
+// the RHS can't change it. Otherwise, the variable is read first. Member and
+// index targets are rejected by check_assignable until there are objects.
+static bool emit_compound_assignment(struct State* state,
+                                     const struct AstCompoundAssignment* ast) {
+  if (!check_assignable(state, ast->lhs->type, ast->lhs->line_num)) {
+    return false;
+  }
+  const struct AstIdentifier* variable = (const struct AstIdentifier*) ast->lhs;
+  size_t line_num = variable->ast.line_num;
+  struct Str name = variable->identifier;
+  if (has_no_effects(ast->rhs)) {
+    if (!emit(state, ast->rhs) ||
+        !emit_variable_op(state, line_num, name, variable->symbol, OP_UpdateLocal,
+                          OP_UpdateGlobal)) {
+      return false;
+    }
+    chunk_push_byte(state->chunk, binary_opcode(ast->operation));
+    return true;
+  }
+  if (!emit_variable_op(state, line_num, name, variable->symbol, OP_GetLocal, OP_GetGlobal) ||
+      !emit(state, ast->rhs) || !emit_binary_op(state, ast->operation)) {
+    return false;
+  }
+  return emit_variable_op(state, line_num, name, variable->symbol, OP_SetLocal, OP_SetGlobal);
+}
+
+// Check if an identifier refers to a builtin, rather than a variable
+static bool is_builtin_name(const struct State* state, struct Str identifier, uint32_t symbol,
+                            const char* name) {
+  return is_name(identifier, name) && !resolve_local(state, identifier, symbol) &&
+    resolve_global(state, identifier, symbol) == SIZE_MAX;
+}
+
+static bool is_builtin(const struct State* state, const struct Ast* ast, const char* name) {
+  if (ast->type != AST_Identifier) {
+    return false;
+  }
+  const struct AstIdentifier* identifier = (const struct AstIdentifier*) ast;
+  return is_builtin_name(state, identifier->identifier, identifier->symbol, name);
+}
+
+// Check if an identifier refers to the "std" module. That's a variable bound
+// by `let <name> = require("std")`, or "std" itself if it isn't a variable.
+static bool is_std_module(const struct State* state, struct Str identifier, uint32_t symbol) {
+  const struct Local* local = resolve_local(state, identifier, symbol);
+  if (local) {
+    return local->is_std_module;
+  }
+  size_t index = resolve_global(state, identifier, symbol);
+  if (index != SIZE_MAX) {
+    return state->globals->names[index].is_std_module;
+  }
+  return is_name(identifier, "std");
+}
+
+// Check for "range(end)", "range(start, end)", or the same through "std.range"
+// on the std module
+static bool is_range_call(const struct State* state, const struct Ast* ast) {
+  if (ast->type != AST_Call) {
+    return false;
+  }
+  const struct AstCall* call = (const struct AstCall*) ast;
+  if (call->arguments.length < 1 || call->arguments.length > 2) {
+    return false;
+  }
+  if (call->function->type == AST_Member) {
+    const struct AstMember* member = (const struct AstMember*) call->function;
+    if (member->lhs->type != AST_Identifier) {
+      return false;
+    }
+    const struct AstIdentifier* module = (const struct AstIdentifier*) member->lhs;
+    return is_name(member->member, "range") &&
+      is_std_module(state, module->identifier, module->symbol);
+  }
+  return is_builtin(state, call->function, "range");
+}
+
+// Patch the jumps out of the innermost loop which go to the next iteration
+// (`is_break` unset) or out of the loop (`is_break` set)
+static bool patch_loop_jumps(struct State* state, size_t line_num, bool is_break) {
+  for (size_t i = state->loop->first_jump; i < state->num_jumps; i++) {
+    const struct LoopJump* jump = &state->jumps[i];
+    if (jump->is_break == is_break && !patch_jump(state, line_num, jump->offset)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool emit_loop_jump(struct State* state, size_t line_num, bool is_break) {
+  if (!state->loop) {
+    return error(state, line_num, "'%s' outside of a loop", is_break ? "break" : "continue");
+  }
+  // Drop the locals of the body and any temporaries without forgetting them,
+  // since the code after the jump still sees them
+  size_t depth = state->depth;
+  while (state->depth > state->loop->depth) {
+    emit_op(state, OP_Pop);
+  }
+  if (state->num_jumps == state->jumps_capacity) {
+    state->jumps_capacity = state->jumps_capacity == 0 ? 8 : state->jumps_capacity * 2;
+    REALLOC(state->jumps, state->jumps_capacity * sizeof(struct LoopJump));
+  }
+  struct LoopJump* jump = &state->jumps[state->num_jumps++];
+  jump->offset = emit_jump(state, OP_Jump);
+  jump->is_break = is_break;
+  // The code after the jump never runs, but it's compiled as if the jump left
+  // a value like any other expression
+  state->depth = depth + 1;
+  return true;
+}
+
+// The values of the statements in a loop body are discarded, along with any
+// locals declared in it
+static bool emit_loop_body(struct State* state, const struct AstBlock* body) {
+  size_t num_locals = state->num_locals;
+  state->scope_depth++;
+  for (size_t i = 0; i < body->statements.length; i++) {
+    if (!emit(state, body->statements.data[i])) {
+      return false;
+    }
+    emit_op(state, OP_Pop);
+  }
+  state->scope_depth--;
+  pop_locals(state, num_locals);
+  return true;
+}
+
+// Start compiling the body of a loop, which "break" and "continue" jump out of
+static void begin_loop(struct State* state, struct Loop* loop) {
+  loop->enclosing = state->loop;
+  loop->num_locals = state->num_locals;
+  loop->depth = state->depth;
+  loop->first_jump = state->num_jumps;
+  state->loop = loop;
+}
+
+// Stop compiling the body of the innermost loop, whose jumps have been patched
+static void end_loop(struct State* state, const struct Loop* loop) {
+  state->loop = loop->enclosing;
+  state->num_jumps = loop->first_jump;
+}
+
+// Loops over integer ranges count in frame slots, with a single instruction
+// per iteration to step the counter and jump back to the body. There's no
+// iterator, so nothing is allocated and no function is called. The loop starts
+// once the counter, which is the start of the range, and the end are on the
+// stack, and the body is emitted between `begin_range_loop` and
+// `end_range_loop`.
+struct RangeLoop {
+  struct Loop loop;  // Loop which the body is compiled in
+  size_t num_locals; // Number of locals in scope before the loop's own
+  size_t slot;       // Slot of the counter, followed by the end and the variable
+  size_t exit_jump;  // Operand of OP_RangeStart, which skips an empty range
+  size_t body_start; // Offset of the start of the body
+};
+
+static bool begin_range_loop(struct State* state, size_t line_num, struct Str variable,
+                             uint32_t symbol, struct RangeLoop* range) {
+  struct Str hidden = { NULL, 0 };
+  emit_op(state, OP_Nil);
+  range->num_locals = state->num_locals;
+  range->slot = state->depth - 3;
+  if (!add_local(state, line_num, hidden, SYMBOL_NONE, range->slot) ||
+      !add_local(state, line_num, hidden, SYMBOL_NONE, range->slot + 1) ||
+      !add_local(state, line_num, variable, symbol, range->slot + 2)) {
+    return false;
+  }
+
+  emit_op(state, OP_RangeStart);
+  chunk_push_byte(state->chunk, range->slot);
+  chunk_push_word(state->chunk, 0xffff);
+  range->exit_jump = state->chunk->code.length - 2;
+  range->body_start = state->chunk->code.length;
+  begin_loop(state, &range->loop);
+  return true;
+}
+
+// `ok` is whether the body compiled
+static bool end_range_loop(struct State* state, size_t line_num, struct RangeLoop* range,
+                           bool ok) {
+  ok = ok && patch_loop_jumps(state, line_num, false);
+  if (ok) {
+    emit_op(state, OP_RangeLoop);
+    chunk_push_byte(state->chunk, range->slot);
+    size_t jump = state->chunk->code.length + 2 - range->body_start;
+    if (jump > 0xffff) {
+      ok = error(state, line_num, "loop body is too large");
+    } else {
+      chunk_push_word(state->chunk, jump);
+      ok = patch_jump(state, line_num, range->exit_jump) &&
+        patch_loop_jumps(state, line_num, true);
+    }
+  }
+  end_loop(state, &range->loop);
+  if (!ok) {
+    return false;
+  }
+
+  // The loop itself has no value
+  pop_locals(state, range->num_locals);
+  emit_op(state, OP_Nil);
+  return true;
+}
+
+static bool emit_range_loop(struct State* state, const struct AstFor* ast) {
+  const struct AstCall* call = (const struct AstCall*) ast->iterable;
+  size_t line_num = ast->ast.line_num;
+  if (call->arguments.length == 1) {
+    struct Value zero = INT_VAL(state->chunk->values.mem, 0);
+    emit_const(state, chunk_push_value(state->chunk, zero));
+  }
+  for (size_t i = 0; i < call->arguments.length; i++) {
+    if (!emit(state, call->arguments.data[i])) {
+      return false;
+    }
+  }
+  struct RangeLoop range;
+  if (!begin_range_loop(state, line_num, ast->variable, ast->symbol, &range)) {
+    return false;
+  }
+  bool ok = emit_loop_body(state, (const struct AstBlock*) ast->body);
+  return end_range_loop(state, line_num, &range, ok);
+}
+
+// The condition is tested before every run of the body, and jumps out of the
+// loop if it's falsey. "continue" jumps to the end of the body, which jumps
+// back to the condition at `start`. The jumps out of the condition start at
+// `first_branch`, and `ok` is whether the body compiled.
+static bool end_while(struct State* state, size_t line_num, const struct Loop* loop,
+                      size_t start, size_t first_branch, bool ok) {
+  ok = ok && patch_loop_jumps(state, line_num, false);
+  if (ok) {
+    emit_op(state, OP_JumpBack);
+    size_t jump = state->chunk->code.length + 2 - start;
+    if (jump > 0xffff) {
+      ok = error(state, line_num, "loop body is too large");
+    } else {
+      chunk_push_word(state->chunk, jump);
+      ok = patch_branches(state, line_num, first_branch, state->num_branches) &&
+        patch_loop_jumps(state, line_num, true);
+    }
+  }
+  end_loop(state, loop);
+  if (!ok) {
+    return false;
+  }
+
+  // The loop itself has no value
+  emit_op(state, OP_Nil);
+  return true;
+}
+
+static bool emit_while(struct State* state, const struct AstWhile* ast) {
+  CHECK(ast->body->type == AST_Block);
+  size_t start = state->chunk->code.length;
+  size_t first_branch = state->num_branches;
+  if (!emit_branch(state, ast->condition, false)) {
+    return false;
+  }
+  struct Loop loop;
+  begin_loop(state, &loop);
+  bool ok = emit_loop_body(state, (const struct AstBlock*) ast->body);
+  return end_while(state, ast->ast.line_num, &loop, start, first_branch, ok);
+}
+
+static bool emit_for(struct State* state, const struct AstFor* ast) {
+  CHECK(ast->body->type == AST_Block);
+  if (is_range_call(state, ast->iterable)) {
+    return emit_range_loop(state, ast);
+  }
+  // TODO: Iterators, once there are values other than ranges to loop over
+  return error(state, ast->ast.line_num, "for loops only support range(...) so far");
+}
+
 static bool emit(struct State* state, const struct Ast* ast) {
   switch (ast->type) {
   case AST_Program:    return emit_program(state, (const struct AstProgram*) ast);
-  case AST_Block:      UNIMPLEMENTED();
+  case AST_Block:      return emit_block(state, (const struct AstBlock*) ast);
   case AST_Struct:     UNIMPLEMENTED();
   case AST_Function:   UNIMPLEMENTED();
-  case AST_If:         UNIMPLEMENTED();
-  case AST_While:      UNIMPLEMENTED();
-  case AST_Let:        UNIMPLEMENTED();
-  case AST_Require:    UNIMPLEMENTED();
+  case AST_If:         return emit_if(state, (const struct AstIf*) ast);
+  case AST_While:      return emit_while(state, (const struct AstWhile*) ast);
+  case AST_For:        return emit_for(state, (const struct AstFor*) ast);
+  case AST_Let:        return emit_let(state, (const struct AstLet*) ast);
+  case AST_Require:    return emit_require(state, (const struct AstRequire*) ast);
   case AST_Yield:      UNIMPLEMENTED();
-  case AST_Break:      UNIMPLEMENTED();
-  case AST_Continue:   UNIMPLEMENTED();
+  case AST_Break:      return emit_loop_jump(state, ast->line_num, true);
+  case AST_Continue:   return emit_loop_jump(state, ast->line_num, false);
   case AST_Return:     UNIMPLEMENTED();
   case AST_Member:     UNIMPLEMENTED();
   case AST_Index:      UNIMPLEMENTED();
-  case AST_Assignment: UNIMPLEMENTED();
+  case AST_Assignment: return emit_assignment(state, (const struct AstAssignment*) ast);
+  case AST_CompoundAssignment:
+    return emit_compound_assignment(state, (const struct AstCompoundAssignment*) ast);
   case AST_Binary:     return emit_binary(state, (const struct AstBinary*) ast);
   case AST_Unary:      return emit_unary(state, (const struct AstUnary*) ast);
   case AST_Call:       UNIMPLEMENTED();
@@ -136,7 +946,7 @@ static bool emit(struct State* state, const struct Ast* ast) {
   case AST_Set:        UNIMPLEMENTED();
   case AST_Dictionary: UNIMPLEMENTED();
   case AST_String:     UNIMPLEMENTED();
-  case AST_Identifier: UNIMPLEMENTED();
+  case AST_Identifier: return emit_identifier(state, (const struct AstIdentifier*) ast);
   case AST_Float:      return emit_float(state, (const struct AstFloat*) ast);
   case AST_Integer:    return emit_integer(state, (const struct AstInteger*) ast);
   case AST_Boolean:    return emit_boolean(state, (const struct AstBoolean*) ast);
@@ -147,8 +957,396 @@ static bool emit(struct State* state, const struct Ast* ast) {
   }
 }
 
+// Flat AST versions of the above. These walk the node arrays directly, and
+// emit exactly the same code as the tree versions. A flat AST has no symbol
+// IDs, so its names are resolved by their text.
+
+// Forward declaration
+static bool emit_flat(struct State* state, const struct FlatAst* flat, uint32_t node);
+
+static bool emit_flat_program(struct State* state, const struct FlatAst* flat, uint32_t node) {
+  size_t length;
+  const uint32_t* statements = flat_ast_list(flat, flat->lhs[node], &length);
+  if (length == 0) {
+    emit_op(state, OP_Nil);
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (i > 0) {
+      emit_op(state, OP_Pop);
+    }
+    if (!emit_flat(state, flat, statements[i])) {
+      return false;
+    }
+  }
+  emit_op(state, OP_Return);
+  return true;
+}
+
+static bool emit_flat_binary(struct State* state, const struct FlatAst* flat, uint32_t node) {
+  if (!emit_flat(state, flat, flat->lhs[node])) {
+    return false;
+  }
+  if (is_short_circuit(flat->ops[node])) {
+    size_t jump = emit_short_circuit_jump(state, flat->ops[node]);
+    return emit_flat(state, flat, flat->rhs[node]) &&
+      patch_jump(state, flat->lines[node], jump);
+  }
+  if (!emit_flat(state, flat, flat->rhs[node])) {
+    return false;
+  }
+  return emit_binary_op(state, flat->ops[node]);
+}
+
+static bool is_constant_condition_flat(const struct FlatAst* flat, uint32_t node, bool* truthy) {
+  switch ((enum AstType) flat->types[node]) {
+  case AST_Boolean: *truthy = flat->ops[node]; return true;
+  case AST_Nil:     *truthy = false; return true;
+  case AST_Integer:
+  case AST_Float:   *truthy = true; return true;
+  default:          return false;
+  }
+}
+
+static bool emit_flat_branch(struct State* state, const struct FlatAst* flat, uint32_t node,
+                             bool jump_if) {
+  enum AstType type = flat->types[node];
+  bool truthy;
+  if (is_constant_condition_flat(flat, node, &truthy)) {
+    if (truthy == jump_if) {
+      push_branch(state, emit_jump(state, OP_Jump));
+    }
+    return true;
+  }
+  if (type == AST_Unary && flat->ops[node] == UO_LogicalNot) {
+    return emit_flat_branch(state, flat, flat->lhs[node], !jump_if);
+  }
+  if (type == AST_Binary && is_short_circuit(flat->ops[node])) {
+    bool is_and = flat->ops[node] == BO_LogicalAnd;
+    if (jump_if != is_and) {
+      return emit_flat_branch(state, flat, flat->lhs[node], jump_if) &&
+        emit_flat_branch(state, flat, flat->rhs[node], jump_if);
+    }
+    size_t start = state->num_branches;
+    if (!emit_flat_branch(state, flat, flat->lhs[node], !jump_if)) {
+      return false;
+    }
+    size_t end = state->num_branches;
+    return emit_flat_branch(state, flat, flat->rhs[node], jump_if) &&
+      patch_branches(state, flat->lines[node], start, end);
+  }
+  if (!emit_flat(state, flat, node)) {
+    return false;
+  }
+  push_branch(state, emit_jump(state, jump_if ? OP_JumpIfTrue : OP_JumpIfFalse));
+  return true;
+}
+
+static bool emit_flat_block(struct State* state, const struct FlatAst* flat, uint32_t node) {
+  size_t length;
+  const uint32_t* statements = flat_ast_list(flat, flat->lhs[node], &length);
+  bool last_had_semicolon = flat->ops[node];
+  size_t num_locals = state->num_locals;
+  state->scope_depth++;
+  for (size_t i = 0; i < length; i++) {
+    if (i > 0) {
+      emit_op(state, OP_Pop);
+    }
+    if (!emit_flat(state, flat, statements[i])) {
+      return false;
+    }
+  }
+  if (length > 0 && last_had_semicolon) {
+    emit_op(state, OP_Pop);
+  }
+  if (length == 0 || last_had_semicolon) {
+    emit_op(state, OP_Nil);
+  }
+  state->scope_depth--;
+  end_scope(state, num_locals);
+  return true;
+}
+
+static bool emit_flat_if(struct State* state, const struct FlatAst* flat, uint32_t node) {
+  size_t line_num = flat->lines[node];
+  size_t length;
+  const uint32_t* parts = flat_ast_list(flat, flat->rhs[node], &length);
+  size_t start = state->num_branches;
+  if (!emit_flat_branch(state, flat, flat->lhs[node], false)) {
+    return false;
+  }
+  size_t depth = state->depth;
+  if (!emit_flat(state, flat, parts[0])) {
+    return false;
+  }
+  size_t end_jump = emit_jump(state, OP_Jump);
+  if (!patch_branches(state, line_num, start, state->num_branches)) {
+    return false;
+  }
+  // Only one of the branches runs
+  state->depth = depth;
+  if (parts[1] != FLAT_NONE) {
+    if (!emit_flat(state, flat, parts[1])) {
+      return false;
+    }
+  } else {
+    emit_op(state, OP_Nil);
+  }
+  return patch_jump(state, line_num, end_jump);
+}
+
+static bool emit_flat_let(struct State* state, const struct FlatAst* flat, uint32_t node) {
+  uint32_t rhs = flat->rhs[node];
+  bool is_std_module = rhs != FLAT_NONE && flat->types[rhs] == AST_Require &&
+    is_name(flat->strings[flat->lhs[rhs]], "std");
+  if (rhs != FLAT_NONE && !is_std_module) {
+    if (!emit_flat(state, flat, rhs)) {
+      return false;
+    }
+  } else {
+    emit_op(state, OP_Nil);
+  }
+  return emit_declaration(state, flat->lines[node], flat->strings[flat->lhs[node]],
+                          SYMBOL_NONE, is_std_module);
+}
+
+static bool emit_flat_assignment(struct State* state, const struct FlatAst* flat,
+                                 uint32_t node) {
+  uint32_t variable = flat->lhs[node];
+  if (!check_assignable(state, flat->types[variable], flat->lines[variable]) ||
+      !emit_flat(state, flat, flat->rhs[node])) {
+    return false;
+  }
+  return emit_variable_op(state, flat->lines[variable], flat->strings[flat->lhs[variable]],
+                          SYMBOL_NONE, OP_SetLocal, OP_SetGlobal);
+}
+
+static bool has_no_effects_flat(const struct FlatAst* flat, uint32_t node) {
+  switch ((enum AstType) flat->types[node]) {
+  case AST_Binary:
+    return has_no_effects_flat(flat, flat->lhs[node]) && has_no_effects_flat(flat, flat->rhs[node]);
+  case AST_Unary:
+    return has_no_effects_flat(flat, flat->lhs[node]);
+  case AST_Identifier:
+  case AST_Float:
+  case AST_Integer:
+  case AST_Boolean:
+  case AST_Nil:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool emit_flat_compound_assignment(struct State* state, const struct FlatAst* flat,
+                                          uint32_t node) {
+  uint32_t variable = flat->lhs[node], rhs = flat->rhs[node];
+  enum BinaryOp op = flat->ops[node];
+  if (!check_assignable(state, flat->types[variable], flat->lines[variable])) {
+    return false;
+  }
+  size_t line_num = flat->lines[variable];
+  struct Str name = flat->strings[flat->lhs[variable]];
+  if (has_no_effects_flat(flat, rhs)) {
+    if (!emit_flat(state, flat, rhs) ||
+        !emit_variable_op(state, line_num, name, SYMBOL_NONE, OP_UpdateLocal,
+                          OP_UpdateGlobal)) {
+      return false;
+    }
+    chunk_push_byte(state->chunk, binary_opcode(op));
+    return true;
+  }
+  if (!emit_variable_op(state, line_num, name, SYMBOL_NONE, OP_GetLocal, OP_GetGlobal) ||
+      !emit_flat(state, flat, rhs) || !emit_binary_op(state, op)) {
+    return false;
+  }
+  return emit_variable_op(state, line_num, name, SYMBOL_NONE, OP_SetLocal, OP_SetGlobal);
+}
+
+static bool is_builtin_flat(const struct State* state, const struct FlatAst* flat, uint32_t node,
+                            const char* name) {
+  return flat->types[node] == AST_Identifier &&
+    is_builtin_name(state, flat->strings[flat->lhs[node]], SYMBOL_NONE, name);
+}
+
+static bool is_range_call_flat(const struct State* state, const struct FlatAst* flat,
+                               uint32_t node) {
+  if (flat->types[node] != AST_Call) {
+    return false;
+  }
+  size_t length;
+  flat_ast_list(flat, flat->rhs[node], &length);
+  if (length < 1 || length > 2) {
+    return false;
+  }
+  uint32_t function = flat->lhs[node];
+  if (flat->types[function] == AST_Member) {
+    uint32_t module = flat->lhs[function];
+    return flat->types[module] == AST_Identifier &&
+      is_name(flat->strings[flat->rhs[function]], "range") &&
+      is_std_module(state, flat->strings[flat->lhs[module]], SYMBOL_NONE);
+  }
+  return is_builtin_flat(state, flat, function, "range");
+}
+
+static bool emit_flat_loop_body(struct State* state, const struct FlatAst* flat, uint32_t body) {
+  size_t length;
+  const uint32_t* statements = flat_ast_list(flat, flat->lhs[body], &length);
+  size_t num_locals = state->num_locals;
+  state->scope_depth++;
+  for (size_t i = 0; i < length; i++) {
+    if (!emit_flat(state, flat, statements[i])) {
+      return false;
+    }
+    emit_op(state, OP_Pop);
+  }
+  state->scope_depth--;
+  pop_locals(state, num_locals);
+  return true;
+}
+
+static bool emit_flat_range_loop(struct State* state, const struct FlatAst* flat, uint32_t node,
+                                 uint32_t call, uint32_t body) {
+  size_t line_num = flat->lines[node];
+  size_t length;
+  const uint32_t* arguments = flat_ast_list(flat, flat->rhs[call], &length);
+  if (length == 1) {
+    struct Value zero = INT_VAL(state->chunk->values.mem, 0);
+    emit_const(state, chunk_push_value(state->chunk, zero));
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (!emit_flat(state, flat, arguments[i])) {
+      return false;
+    }
+  }
+  struct RangeLoop range;
+  if (!begin_range_loop(state, line_num, flat->strings[flat->lhs[node]], SYMBOL_NONE, &range)) {
+    return false;
+  }
+  bool ok = emit_flat_loop_body(state, flat, body);
+  return end_range_loop(state, line_num, &range, ok);
+}
+
+static bool emit_flat_while(struct State* state, const struct FlatAst* flat, uint32_t node) {
+  CHECK(flat->types[flat->rhs[node]] == AST_Block);
+  size_t start = state->chunk->code.length;
+  size_t first_branch = state->num_branches;
+  if (!emit_flat_branch(state, flat, flat->lhs[node], false)) {
+    return false;
+  }
+  struct Loop loop;
+  begin_loop(state, &loop);
+  bool ok = emit_flat_loop_body(state, flat, flat->rhs[node]);
+  return end_while(state, flat->lines[node], &loop, start, first_branch, ok);
+}
+
+static bool emit_flat_for(struct State* state, const struct FlatAst* flat, uint32_t node) {
+  size_t length;
+  const uint32_t* parts = flat_ast_list(flat, flat->rhs[node], &length);
+  CHECK(flat->types[parts[1]] == AST_Block);
+  if (is_range_call_flat(state, flat, parts[0])) {
+    return emit_flat_range_loop(state, flat, node, parts[0], parts[1]);
+  }
+  // TODO: Iterators, once there are values other than ranges to loop over
+  return error(state, flat->lines[node], "for loops only support range(...) so far");
+}
+
+static bool emit_flat(struct State* state, const struct FlatAst* flat, uint32_t node) {
+  size_t line_num = flat->lines[node];
+  switch ((enum AstType) flat->types[node]) {
+  case AST_Program:    return emit_flat_program(state, flat, node);
+  case AST_Block:      return emit_flat_block(state, flat, node);
+  case AST_If:         return emit_flat_if(state, flat, node);
+  case AST_While:      return emit_flat_while(state, flat, node);
+  case AST_For:        return emit_flat_for(state, flat, node);
+  case AST_Let:        return emit_flat_let(state, flat, node);
+  case AST_Require:    return require_error(state, line_num, flat->strings[flat->lhs[node]]);
+  case AST_Break:      return emit_loop_jump(state, line_num, true);
+  case AST_Continue:   return emit_loop_jump(state, line_num, false);
+  case AST_Assignment: return emit_flat_assignment(state, flat, node);
+  case AST_CompoundAssignment:
+    return emit_flat_compound_assignment(state, flat, node);
+  case AST_Binary:     return emit_flat_binary(state, flat, node);
+  case AST_Unary:
+    if (!emit_flat(state, flat, flat->lhs[node])) {
+      return false;
+    }
+    emit_unary_op(state, flat->ops[node]);
+    return true;
+  case AST_Identifier:
+    return emit_variable_op(state, line_num, flat->strings[flat->lhs[node]], SYMBOL_NONE,
+                            OP_GetLocal, OP_GetGlobal);
+  case AST_Float:
+    emit_const(state, chunk_push_value(state->chunk, FLOAT_VAL(flat_ast_float(flat, node))));
+    return true;
+  case AST_Integer: {
+    int64_t i = flat_ast_integer(flat, node);
+    emit_const(state, chunk_push_value(state->chunk, INT_VAL(state->chunk->values.mem, i)));
+    return true;
+  }
+  case AST_Boolean:
+    emit_op(state, flat->ops[node] ? OP_True : OP_False);
+    return true;
+  case AST_Nil:
+    emit_op(state, OP_Nil);
+    return true;
+  default:
+    // Objects and functions aren't supported by either form yet
+    return error(state, line_num, "this expression isn't supported yet");
+  }
+}
+
+void module_globals_init(struct ModuleGlobals* globals) {
+  globals->names = NULL;
+  globals->length = globals->capacity = 0;
+}
+
+void module_globals_fini(struct ModuleGlobals* globals) {
+  module_globals_truncate(globals, 0);
+  free(globals->names);
+}
+
+void module_globals_truncate(struct ModuleGlobals* globals, size_t length) {
+  for (; globals->length > length; globals->length--) {
+    free(globals->names[globals->length - 1].name);
+  }
+}
+
 bool generate_bytecode(const struct Ast* ast, struct Chunk* chunk, struct Writer* writer) {
+  struct ModuleGlobals globals;
+  module_globals_init(&globals);
+  bool ok = generate_module_bytecode(ast, &globals, chunk, writer);
+  module_globals_fini(&globals);
+  return ok;
+}
+
+bool generate_module_bytecode(const struct Ast* ast, struct ModuleGlobals* globals,
+                              struct Chunk* chunk, struct Writer* writer) {
+  if (chunk->encoding == CE_Register) {
+    return generate_register_bytecode(ast, chunk, writer);
+  }
+  struct State state;
+  state_init(&state, globals, chunk, writer);
+  bool ok = emit(&state, ast);
+  state_fini(&state);
+  chunk->num_globals = globals->length;
+  return ok;
+}
+
+bool generate_bytecode_flat(const struct FlatAst* flat, struct Chunk* chunk,
+                            struct Writer* writer) {
+  if (chunk->encoding == CE_Register) {
+    return generate_register_bytecode_flat(flat, chunk, writer);
+  }
+  // The program is a module of its own, like in `generate_bytecode`
+  struct ModuleGlobals globals;
+  module_globals_init(&globals);
   struct State state;
-  state_init(&state, chunk, writer);
-  return emit(&state, ast);
+  state_init(&state, &globals, chunk, writer);
+  bool ok = emit_flat(&state, flat, flat->root);
+  chunk->num_globals = globals.length;
+  module_globals_fini(&globals);
+  state_fini(&state);
+  return ok;
 }
+
+#undef REALLOC
@@ -2,13 +2,65 @@
 #define __BS_CODE_GEN_H__
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "ast.h"
 #include "bytecode.h"
+#include "flat-ast.h"
 #include "writer.h"
 
-// Generate bytecode for the stack-based VM from an AST. Returns `false` on
-// failure, `true` on success.
+// Name of a module global
+struct GlobalName {
+  char* name;         // Copy of the name, since it outlives the source
+  size_t length;      // Length of the name
+  uint32_t symbol;    // Symbol ID of the name, or SYMBOL_NONE
+  bool is_std_module; // Whether it was declared by `let <name> = require("std")`
+};
+
+// Globals of a module, which are the variables declared by "let" outside of
+// any block. They're numbered in the order they're declared, which is their
+// index in the VM's globals array, so the names are only needed to compile
+// code. Code for one module can be compiled in pieces, like the lines typed
+// into the REPL, and every piece sees the globals declared before it.
+struct ModuleGlobals {
+  struct GlobalName* names;
+  size_t length;
+  size_t capacity;
+};
+
+// Initialize a module without any globals
+void module_globals_init(struct ModuleGlobals* globals);
+
+// Free memory for the names of a module's globals
+void module_globals_fini(struct ModuleGlobals* globals);
+
+// Forget every global after the first `length`, like the ones declared by a
+// piece of code which failed
+void module_globals_truncate(struct ModuleGlobals* globals, size_t length);
+
+// Generate bytecode from an AST, in the encoding selected by
+// `chunk->encoding`. Returns `false` on failure, `true` on success.
 bool generate_bytecode(const struct Ast* ast, struct Chunk* chunk, struct Writer* writer);
 
+// Same as `generate_bytecode`, as part of a module whose globals are in
+// `globals`. New globals are added to it, even if this fails, so a caller
+// which throws the code away should truncate it again.
+bool generate_module_bytecode(const struct Ast* ast, struct ModuleGlobals* globals,
+                              struct Chunk* chunk, struct Writer* writer);
+
+// Generate register-machine bytecode from an AST. This is what
+// `generate_bytecode` does for CE_Register chunks.
+bool generate_register_bytecode(const struct Ast* ast, struct Chunk* chunk,
+                                struct Writer* writer);
+
+// Same as `generate_bytecode`, but from the root of a flat AST. The generated
+// code is identical to what the tree it was built from would produce.
+bool generate_bytecode_flat(const struct FlatAst* flat, struct Chunk* chunk,
+                            struct Writer* writer);
+
+// Register-machine counterpart of `generate_bytecode_flat`
+bool generate_register_bytecode_flat(const struct FlatAst* flat, struct Chunk* chunk,
+                                     struct Writer* writer);
+
 #endif  // __BS_CODE_GEN_H__
@@ -0,0 +1,98 @@
+#include "flat-ast.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "bench.h"
+#include "code-gen.h"
+#include "log.h"
+#include "parser.h"
+#include "writer.h"
+
+#define NUM_STATEMENTS 20000
+#define NUM_RUNS 20
+
+// Generate a long script of arithmetic, which both forms can compile
+static char* build_arithmetic_source(void) {
+  size_t capacity = NUM_STATEMENTS * 64, length = 0;
+  char* source = malloc(capacity);
+  CHECK(source != NULL);
+  for (size_t i = 0; i < NUM_STATEMENTS; i++) {
+    length += snprintf(source + length, capacity - length,
+                       "(%zu + 2) * -(3 - %zu.5) < %zu << 2;\n", i, i, i);
+    CHECK(length < capacity);
+  }
+  return source;
+}
+
+// Writer which throws everything away, so printing measures the AST walk
+static int null_writef(struct Writer* writer, const char* fmt, ...) {
+  UNUSED(writer);
+  UNUSED(fmt);
+  return 0;
+}
+
+static int null_vwritef(struct Writer* writer, const char* fmt, va_list ap) {
+  UNUSED(writer);
+  UNUSED(fmt);
+  UNUSED(ap);
+  return 0;
+}
+
+static uint64_t time_code_gen(const struct Ast* ast, const struct FlatAst* flat,
+                              struct Writer* writer) {
+  struct Memory mem;
+  struct Chunk chunk;
+  mem_init(&mem);
+  chunk_init(&chunk, &mem);
+  uint64_t start = bench_now_ns();
+  CHECK(ast ? generate_bytecode(ast, &chunk, writer)
+            : generate_bytecode_flat(flat, &chunk, writer));
+  uint64_t end = bench_now_ns();
+  bench_consume(chunk.code.code);
+  chunk_fini(&chunk);
+  mem_fini(&mem);
+  return end - start;
+}
+
+BENCH(FlatAst, TreeVsFlat) {
+  char* source = build_arithmetic_source();
+  struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);
+  struct Writer null_writer = { null_writef, null_vwritef, NULL };
+  struct Arena arena;
+  struct FlatAst flat;
+  bool incomplete_input = false;
+  arena_init(&arena);
+  flat_ast_init(&flat);
+  struct Ast* ast = parse(&arena, source, err_writer, &incomplete_input);
+  CHECK(ast != NULL);
+  flat_ast_build(&flat, ast);
+
+  uint64_t tree_print_ns = 0, flat_print_ns = 0, tree_gen_ns = 0, flat_gen_ns = 0;
+  for (size_t i = 0; i < NUM_RUNS; i++) {
+    uint64_t start = bench_now_ns();
+    ast_print(ast, &null_writer);
+    uint64_t mid = bench_now_ns();
+    flat_ast_print(&flat, flat.root, &null_writer);
+    uint64_t end = bench_now_ns();
+    tree_print_ns += mid - start;
+    flat_print_ns += end - mid;
+    tree_gen_ns += time_code_gen(ast, NULL, err_writer);
+    flat_gen_ns += time_code_gen(NULL, &flat, err_writer);
+  }
+
+  // The tree uses (nearly) all of its arena pages, so that is a fair measure
+  double num_nodes = (double) flat.num_nodes;
+  bench_report("tree size", arena.num_pages * ARENA_PAGE_SIZE / num_nodes, "bytes/node");
+  bench_report("flat size", flat_ast_size(&flat) / num_nodes, "bytes/node");
+  bench_report("tree print", (double) tree_print_ns / NUM_RUNS / 1000.0, "us");
+  bench_report("flat print", (double) flat_print_ns / NUM_RUNS / 1000.0, "us");
+  bench_report("tree code gen", (double) tree_gen_ns / NUM_RUNS / 1000.0, "us");
+  bench_report("flat code gen", (double) flat_gen_ns / NUM_RUNS / 1000.0, "us");
+
+  flat_ast_fini(&flat);
+  arena_fini(&arena);
+  file_writer_free((struct FileWriter*) err_writer);
+  free(source);
+}
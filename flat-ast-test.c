@@ -0,0 +1,145 @@
+#include "flat-ast.h"
+
+#include "code-gen.h"
+#include "parser.h"
+#include "test.h"
+#include "writer.h"
+
+// Both forms of the AST must print the same
+#define ASSERT_SAME_PRINT_LAZY(SOURCE, LAZY) do {                                 \
+    struct Arena arena;                                                           \
+    struct FlatAst flat;                                                          \
+    struct String tree_buf, flat_buf;                                             \
+    bool incomplete_input = false;                                                \
+    arena_init(&arena);                                                           \
+    flat_ast_init(&flat);                                                         \
+    string_init(&tree_buf, "");                                                   \
+    string_init(&flat_buf, "");                                                   \
+    struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);      \
+    struct Writer* tree_writer = (struct Writer*) string_writer_create(&tree_buf); \
+    struct Writer* flat_writer = (struct Writer*) string_writer_create(&flat_buf); \
+    struct ParseOptions options = { NULL, LAZY };                                 \
+    struct Ast* ast = parse_with_options(&arena, SOURCE, &options, err_writer,    \
+                                         &incomplete_input);                      \
+    ASSERT(ast != NULL);                                                          \
+    ast_print(ast, tree_writer);                                                  \
+    flat_ast_print(&flat, flat_ast_build(&flat, ast), flat_writer);               \
+    ASSERT_STR_EQ(((struct Str) { tree_buf.data, tree_buf.length }),              \
+                  ((struct Str) { flat_buf.data, flat_buf.length }));             \
+    string_writer_free((struct StringWriter*) flat_writer);                       \
+    string_writer_free((struct StringWriter*) tree_writer);                       \
+    file_writer_free((struct FileWriter*) err_writer);                            \
+    string_fini(&flat_buf);                                                       \
+    string_fini(&tree_buf);                                                       \
+    flat_ast_fini(&flat);                                                         \
+    arena_fini(&arena);                                                           \
+  } while (0)
+
+#define ASSERT_SAME_PRINT(SOURCE) ASSERT_SAME_PRINT_LAZY(SOURCE, false)
+
+TEST(FlatAst, PrintStatements) {
+  ASSERT_SAME_PRINT("if n < 1 { 1 } else { 2 }");
+  ASSERT_SAME_PRINT("for i in range(10) { print(i); }");
+  ASSERT_SAME_PRINT("while true { break; continue; }");
+  ASSERT_SAME_PRINT("pub let x = require(\"foo\"); let y = x.bar[2];");
+  ASSERT_SAME_PRINT("a += 1; b = -a; fn f() { yield(a); return; return not b; }");
+}
+
+TEST(FlatAst, PrintExpressions) {
+  ASSERT_SAME_PRINT("fn fib(n) { if n < 2 { return n; } fib(n - 1) + fib(n - 2) }");
+  ASSERT_SAME_PRINT("struct S : Base { fn f(self, a, ...) { self.x + 1.5 } }");
+  ASSERT_SAME_PRINT_LAZY("struct S { fn f(self) { 1 } } let g = fn(x) { x };", true);
+  ASSERT_SAME_PRINT("[1, 2, \"three\"]; {4, 5}; {\"a\": 1, 2: [false]}; 9223372036854775807;");
+  ASSERT_SAME_PRINT("");
+}
+
+// Generate code from both forms of the AST, and check that it's identical
+static void compare_code_gen(const char* source, enum ChunkEncoding encoding) {
+  struct Arena arena;
+  struct FlatAst flat;
+  struct Memory mem;
+  struct Chunk tree_chunk, flat_chunk;
+  bool incomplete_input = false;
+  struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);
+  arena_init(&arena);
+  flat_ast_init(&flat);
+  mem_init(&mem);
+  chunk_init(&tree_chunk, &mem);
+  chunk_init(&flat_chunk, &mem);
+  tree_chunk.encoding = flat_chunk.encoding = encoding;
+  struct Ast* ast = parse(&arena, source, err_writer, &incomplete_input);
+  ASSERT(ast != NULL);
+  flat_ast_build(&flat, ast);
+  ASSERT(generate_bytecode(ast, &tree_chunk, err_writer));
+  ASSERT(generate_bytecode_flat(&flat, &flat_chunk, err_writer));
+  ASSERT(tree_chunk.code.length == flat_chunk.code.length);
+  ASSERT(!memcmp(tree_chunk.code.code, flat_chunk.code.code, tree_chunk.code.length));
+  ASSERT(tree_chunk.values.length == flat_chunk.values.length);
+  for (size_t i = 0; i < tree_chunk.values.length; i++) {
+    ASSERT(value_equal(tree_chunk.values.values[i], flat_chunk.values.values[i]));
+  }
+  ASSERT(tree_chunk.num_registers == flat_chunk.num_registers);
+  chunk_fini(&flat_chunk);
+  chunk_fini(&tree_chunk);
+  mem_fini(&mem);
+  flat_ast_fini(&flat);
+  arena_fini(&arena);
+  file_writer_free((struct FileWriter*) err_writer);
+}
+
+TEST(FlatAst, CodeGen) {
+  const char* sources[] = {
+    "1 + 2 * 3 / 4 - 5 % 6",
+    "-(3 - 10) * 2; not true; 1.5 < 2",
+    "(1 << 10) | 3 ^ !1 == 1026.0",
+    "9223372036854775807 + 140737488355328",
+    "",
+  };
+  for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+    compare_code_gen(sources[i], CE_Stack);
+    compare_code_gen(sources[i], CE_Register);
+  }
+  // Register code has no jumps or variables yet, so these are stack-only
+  const char* stack_sources[] = {
+    "1 and nil or 2.5; not (false or 0)",
+    "let x = 1; let y = nil; x = x + 2; x += 3; x *= if x { x = 1 } else { 2 }; y",
+    "let x = 0; 1 + if 1 < 2 and not nil { 1 } else { if x { 2 } }; if true { let a = 1; a }",
+    "let n = 0; while n < 10 or false { let m = n; n += 1; if m > 3 { break; } continue; }",
+    "for i in range(3) { for j in range(i, 5) { i + j; } } for i in std.range(2) { }",
+    "let s = require(\"std\"); for i in s.range(2) { if true { let std = require(\"std\"); } }",
+  };
+  for (size_t i = 0; i < sizeof(stack_sources) / sizeof(stack_sources[0]); i++) {
+    compare_code_gen(stack_sources[i], CE_Stack);
+  }
+}
+
+// A program which can't be compiled from a flat AST gives an error, not an abort
+TEST(FlatAst, CodeGenErrors) {
+  const char* sources[] = { "x", "let a = 1; a.b = 2", "for i in 3 { }",
+                            "if true { break; }", "[1, 2]" };
+  for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+    struct Arena arena;
+    struct FlatAst flat;
+    struct Memory mem;
+    struct Chunk chunk;
+    bool incomplete_input = false;
+    struct String errors;
+    string_init(&errors, "");
+    struct Writer* err_writer = (struct Writer*) string_writer_create(&errors);
+    arena_init(&arena);
+    flat_ast_init(&flat);
+    mem_init(&mem);
+    chunk_init(&chunk, &mem);
+    struct Ast* ast = parse(&arena, sources[i], err_writer, &incomplete_input);
+    ASSERT(ast != NULL);
+    flat_ast_build(&flat, ast);
+    ASSERT(!generate_bytecode_flat(&flat, &chunk, err_writer));
+    ASSERT(errors.length > 0);
+    chunk_fini(&chunk);
+    mem_fini(&mem);
+    flat_ast_fini(&flat);
+    arena_fini(&arena);
+    string_writer_free((struct StringWriter*) err_writer);
+    string_fini(&errors);
+  }
+}
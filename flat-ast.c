@@ -0,0 +1,497 @@
+#include "flat-ast.h"
+
+#include <stdlib.h>
+
+#include "log.h"
+#include "util.h"
+
+#define REALLOC(PTR, SIZE) do {        \
+    if (!(PTR = realloc(PTR, SIZE))) { \
+      DIE_ERR("realloc()");            \
+    }                                  \
+  } while (0)
+
+#define TRY_ACCUM(ACCUM, ACTION) do { \
+    int __tmp = ACTION;               \
+    if (__tmp < 0) {                  \
+      return __tmp;                   \
+    }                                 \
+    ACCUM += __tmp;                   \
+} while (0)
+
+// External definitions for the inline functions in the header
+const uint32_t* flat_ast_list(const struct FlatAst* flat, uint32_t list, size_t* length);
+int64_t flat_ast_integer(const struct FlatAst* flat, uint32_t node);
+double flat_ast_float(const struct FlatAst* flat, uint32_t node);
+
+void flat_ast_init(struct FlatAst* flat) {
+  flat->types = flat->ops = NULL;
+  flat->lines = flat->lhs = flat->rhs = NULL;
+  flat->num_nodes = flat->capacity = 0;
+  flat->extra = NULL;
+  flat->extra_length = flat->extra_capacity = 0;
+  flat->strings = NULL;
+  flat->num_strings = flat->strings_capacity = 0;
+  flat->root = FLAT_NONE;
+}
+
+void flat_ast_fini(struct FlatAst* flat) {
+  free(flat->types);
+  free(flat->ops);
+  free(flat->lines);
+  free(flat->lhs);
+  free(flat->rhs);
+  free(flat->extra);
+  free(flat->strings);
+}
+
+size_t flat_ast_size(const struct FlatAst* flat) {
+  size_t node_size = 2 * sizeof(uint8_t) + 3 * sizeof(uint32_t);
+  return flat->capacity * node_size + flat->extra_capacity * sizeof(uint32_t)
+    + flat->strings_capacity * sizeof(struct Str);
+}
+
+static uint32_t push_node(struct FlatAst* flat, enum AstType type, size_t line_num, uint8_t op,
+                          uint32_t lhs, uint32_t rhs) {
+  if (flat->num_nodes == flat->capacity) {
+    flat->capacity = flat->capacity == 0 ? 64 : flat->capacity * 2;
+    REALLOC(flat->types, flat->capacity * sizeof(uint8_t));
+    REALLOC(flat->ops, flat->capacity * sizeof(uint8_t));
+    REALLOC(flat->lines, flat->capacity * sizeof(uint32_t));
+    REALLOC(flat->lhs, flat->capacity * sizeof(uint32_t));
+    REALLOC(flat->rhs, flat->capacity * sizeof(uint32_t));
+  }
+  CHECK(flat->num_nodes < FLAT_NONE);
+  size_t node = flat->num_nodes++;
+  flat->types[node] = type;
+  flat->ops[node] = op;
+  flat->lines[node] = line_num;
+  flat->lhs[node] = lhs;
+  flat->rhs[node] = rhs;
+  return node;
+}
+
+static void push_extra(struct FlatAst* flat, uint32_t value) {
+  if (flat->extra_length == flat->extra_capacity) {
+    flat->extra_capacity = flat->extra_capacity == 0 ? 64 : flat->extra_capacity * 2;
+    REALLOC(flat->extra, flat->extra_capacity * sizeof(uint32_t));
+  }
+  flat->extra[flat->extra_length++] = value;
+}
+
+static uint32_t push_string(struct FlatAst* flat, struct Str str) {
+  if (flat->num_strings == flat->strings_capacity) {
+    flat->strings_capacity = flat->strings_capacity == 0 ? 16 : flat->strings_capacity * 2;
+    REALLOC(flat->strings, flat->strings_capacity * sizeof(struct Str));
+  }
+  flat->strings[flat->num_strings] = str;
+  return flat->num_strings++;
+}
+
+// Lists are written out after all of their items have been built, so the
+// indices of items are kept on a stack in the meantime.
+struct Builder {
+  struct FlatAst* flat;
+  uint32_t* stack;
+  size_t stack_length;
+  size_t stack_capacity;
+};
+
+static void builder_push(struct Builder* builder, uint32_t node) {
+  if (builder->stack_length == builder->stack_capacity) {
+    builder->stack_capacity = builder->stack_capacity == 0 ? 64 : builder->stack_capacity * 2;
+    REALLOC(builder->stack, builder->stack_capacity * sizeof(uint32_t));
+  }
+  builder->stack[builder->stack_length++] = node;
+}
+
+// Move the top `length` entries of the stack into a list
+static uint32_t builder_pop_list(struct Builder* builder, size_t length) {
+  struct FlatAst* flat = builder->flat;
+  uint32_t list = flat->extra_length;
+  push_extra(flat, length);
+  builder->stack_length -= length;
+  for (size_t i = 0; i < length; i++) {
+    push_extra(flat, builder->stack[builder->stack_length + i]);
+  }
+  return list;
+}
+
+// Forward declaration
+static uint32_t build(struct Builder* builder, const struct Ast* ast);
+
+static uint32_t build_list(struct Builder* builder, const struct AstVec* vec) {
+  for (size_t i = 0; i < vec->length; i++) {
+    builder_push(builder, build(builder, vec->data[i]));
+  }
+  return builder_pop_list(builder, vec->length);
+}
+
+static uint32_t build_literal(struct Builder* builder, const struct Ast* ast, uint64_t bits) {
+  return push_node(builder->flat, ast->type, ast->line_num, 0, bits & 0xffffffff, bits >> 32);
+}
+
+static uint32_t build(struct Builder* builder, const struct Ast* ast) {
+  struct FlatAst* flat = builder->flat;
+  if (!ast) {
+    return FLAT_NONE;
+  }
+  uint32_t lhs = FLAT_NONE, rhs = FLAT_NONE;
+  uint8_t op = 0;
+  switch (ast->type) {
+  case AST_Program:
+    lhs = build_list(builder, &((const struct AstProgram*) ast)->statements);
+    break;
+  case AST_Block: {
+    const struct AstBlock* block = (const struct AstBlock*) ast;
+    lhs = build_list(builder, &block->statements);
+    op = block->last_had_semicolon;
+    break;
+  }
+  case AST_Struct: {
+    const struct AstStruct* struct_node = (const struct AstStruct*) ast;
+    lhs = build(builder, struct_node->body);
+    op = struct_node->has_parent;
+    if (struct_node->has_parent) {
+      rhs = push_string(flat, struct_node->opt_parent);
+    }
+    break;
+  }
+  case AST_Function: {
+    const struct AstFunction* function = (const struct AstFunction*) ast;
+    lhs = build_list(builder, &function->parameters);
+    op = function->body == NULL;
+    rhs = op ? push_string(flat, function->lazy_body) : build(builder, function->body);
+    break;
+  }
+  case AST_If: {
+    const struct AstIf* if_statement = (const struct AstIf*) ast;
+    lhs = build(builder, if_statement->condition);
+    builder_push(builder, build(builder, if_statement->body));
+    builder_push(builder, build(builder, if_statement->else_part));
+    rhs = builder_pop_list(builder, 2);
+    break;
+  }
+  case AST_While: {
+    const struct AstWhile* while_loop = (const struct AstWhile*) ast;
+    lhs = build(builder, while_loop->condition);
+    rhs = build(builder, while_loop->body);
+    break;
+  }
+  case AST_For: {
+    const struct AstFor* for_loop = (const struct AstFor*) ast;
+    lhs = push_string(flat, for_loop->variable);
+    builder_push(builder, build(builder, for_loop->iterable));
+    builder_push(builder, build(builder, for_loop->body));
+    rhs = builder_pop_list(builder, 2);
+    break;
+  }
+  case AST_Let: {
+    const struct AstLet* let = (const struct AstLet*) ast;
+    lhs = push_string(flat, let->variable);
+    rhs = build(builder, let->rhs);
+    op = let->public;
+    break;
+  }
+  case AST_Require:
+    lhs = push_string(flat, ((const struct AstRequire*) ast)->module);
+    break;
+  case AST_Yield:
+    lhs = build(builder, ((const struct AstYield*) ast)->value);
+    break;
+  case AST_Return:
+    lhs = build(builder, ((const struct AstReturn*) ast)->value);
+    break;
+  case AST_Member: {
+    const struct AstMember* member = (const struct AstMember*) ast;
+    lhs = build(builder, member->lhs);
+    rhs = push_string(flat, member->member);
+    break;
+  }
+  case AST_Index: {
+    const struct AstIndex* index = (const struct AstIndex*) ast;
+    lhs = build(builder, index->lhs);
+    rhs = build(builder, index->index);
+    break;
+  }
+  case AST_Assignment: {
+    const struct AstAssignment* assignment = (const struct AstAssignment*) ast;
+    lhs = build(builder, assignment->lhs);
+    rhs = build(builder, assignment->rhs);
+    break;
+  }
+  case AST_CompoundAssignment: {
+    const struct AstCompoundAssignment* assignment = (const struct AstCompoundAssignment*) ast;
+    lhs = build(builder, assignment->lhs);
+    rhs = build(builder, assignment->rhs);
+    op = assignment->operation;
+    break;
+  }
+  case AST_Binary: {
+    const struct AstBinary* binary = (const struct AstBinary*) ast;
+    lhs = build(builder, binary->lhs);
+    rhs = build(builder, binary->rhs);
+    op = binary->operation;
+    break;
+  }
+  case AST_Unary: {
+    const struct AstUnary* unary = (const struct AstUnary*) ast;
+    lhs = build(builder, unary->rhs);
+    op = unary->operation;
+    break;
+  }
+  case AST_Call: {
+    const struct AstCall* call = (const struct AstCall*) ast;
+    lhs = build(builder, call->function);
+    rhs = build_list(builder, &call->arguments);
+    break;
+  }
+  case AST_Array:
+    lhs = build_list(builder, &((const struct AstArray*) ast)->elements);
+    break;
+  case AST_Set:
+    lhs = build_list(builder, &((const struct AstSet*) ast)->elements);
+    break;
+  case AST_Dictionary: {
+    const struct AstPairVec* pairs = &((const struct AstDictionary*) ast)->pairs;
+    for (size_t i = 0; i < pairs->length; i++) {
+      builder_push(builder, build(builder, pairs->data[i].key));
+      builder_push(builder, build(builder, pairs->data[i].value));
+    }
+    lhs = builder_pop_list(builder, 2 * pairs->length);
+    break;
+  }
+  case AST_String:
+    lhs = push_string(flat, ((const struct AstString*) ast)->string);
+    break;
+  case AST_Identifier:
+    lhs = push_string(flat, ((const struct AstIdentifier*) ast)->identifier);
+    break;
+  case AST_Float: {
+    uint64_t bits;
+    memcpy(&bits, &((const struct AstFloat*) ast)->f, sizeof(double));
+    return build_literal(builder, ast, bits);
+  }
+  case AST_Integer:
+    return build_literal(builder, ast, (uint64_t) ((const struct AstInteger*) ast)->i);
+  case AST_Boolean:
+    op = ((const struct AstBoolean*) ast)->b;
+    break;
+  case AST_Break:
+  case AST_Continue:
+  case AST_Self:
+  case AST_Varargs:
+  case AST_Ellipsis:
+  case AST_Nil:
+    break;
+  default:
+    UNREACHABLE();
+  }
+  return push_node(flat, ast->type, ast->line_num, op, lhs, rhs);
+}
+
+uint32_t flat_ast_build(struct FlatAst* flat, const struct Ast* ast) {
+  struct Builder builder = { flat, NULL, 0, 0 };
+  flat->root = build(&builder, ast);
+  free(builder.stack);
+  return flat->root;
+}
+
+static int print_list(const struct FlatAst* flat, uint32_t list, struct Writer* writer) {
+  int ret = 0;
+  size_t length;
+  const uint32_t* items = flat_ast_list(flat, list, &length);
+  for (size_t i = 0; i < length; i++) {
+    TRY_ACCUM(ret, writer->writef(writer, " "));
+    TRY_ACCUM(ret, flat_ast_print(flat, items[i], writer));
+  }
+  return ret;
+}
+
+// Print "(<prefix><lhs> <rhs>)", which is what most nodes with two children
+// look like
+static int print_pair(const struct FlatAst* flat, const char* prefix, uint32_t lhs,
+                      uint32_t rhs, struct Writer* writer) {
+  int ret = 0;
+  TRY_ACCUM(ret, writer->writef(writer, "(%s", prefix));
+  TRY_ACCUM(ret, flat_ast_print(flat, lhs, writer));
+  TRY_ACCUM(ret, writer->writef(writer, " "));
+  TRY_ACCUM(ret, flat_ast_print(flat, rhs, writer));
+  TRY_ACCUM(ret, writer->writef(writer, ")"));
+  return ret;
+}
+
+int flat_ast_print(const struct FlatAst* flat, uint32_t node, struct Writer* writer) {
+  if (node == FLAT_NONE) {
+    return 0;
+  }
+  int ret = 0;
+  uint32_t lhs = flat->lhs[node], rhs = flat->rhs[node];
+  uint8_t op = flat->ops[node];
+  switch ((enum AstType) flat->types[node]) {
+  case AST_Program:
+    TRY_ACCUM(ret, writer->writef(writer, "(program"));
+    TRY_ACCUM(ret, print_list(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Block:
+    TRY_ACCUM(ret, writer->writef(writer, "(block <%s>", op ? "noret" : "ret"));
+    TRY_ACCUM(ret, print_list(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Struct:
+    TRY_ACCUM(ret, writer->writef(writer, "(struct "));
+    if (op) {
+      TRY_ACCUM(ret, writer->writef(writer, "(parent "));
+      TRY_ACCUM(ret, str_print(&flat->strings[rhs], writer));
+      TRY_ACCUM(ret, writer->writef(writer, ") "));
+    }
+    TRY_ACCUM(ret, flat_ast_print(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Function:
+    TRY_ACCUM(ret, writer->writef(writer, "(fn (params"));
+    TRY_ACCUM(ret, print_list(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ") "));
+    if (op) {
+      TRY_ACCUM(ret, writer->writef(writer, "<lazy>"));
+    } else {
+      TRY_ACCUM(ret, flat_ast_print(flat, rhs, writer));
+    }
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_If: {
+    size_t length;
+    const uint32_t* parts = flat_ast_list(flat, rhs, &length);
+    TRY_ACCUM(ret, writer->writef(writer, "(if "));
+    TRY_ACCUM(ret, flat_ast_print(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, " "));
+    TRY_ACCUM(ret, flat_ast_print(flat, parts[0], writer));
+    if (parts[1] != FLAT_NONE) {
+      TRY_ACCUM(ret, writer->writef(writer, " (else "));
+      TRY_ACCUM(ret, flat_ast_print(flat, parts[1], writer));
+      TRY_ACCUM(ret, writer->writef(writer, "))"));
+    } else {
+      TRY_ACCUM(ret, writer->writef(writer, ")"));
+    }
+    return ret;
+  }
+  case AST_While:
+    return print_pair(flat, "while ", lhs, rhs, writer);
+  case AST_For: {
+    size_t length;
+    const uint32_t* parts = flat_ast_list(flat, rhs, &length);
+    TRY_ACCUM(ret, writer->writef(writer, "(for "));
+    TRY_ACCUM(ret, str_print(&flat->strings[lhs], writer));
+    TRY_ACCUM(ret, writer->writef(writer, " "));
+    TRY_ACCUM(ret, flat_ast_print(flat, parts[0], writer));
+    TRY_ACCUM(ret, writer->writef(writer, " "));
+    TRY_ACCUM(ret, flat_ast_print(flat, parts[1], writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  }
+  case AST_Let:
+    TRY_ACCUM(ret, writer->writef(writer, "(let "));
+    TRY_ACCUM(ret, str_print(&flat->strings[lhs], writer));
+    TRY_ACCUM(ret, writer->writef(writer, " <%s> ", op ? "public" : "private"));
+    TRY_ACCUM(ret, flat_ast_print(flat, rhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Require:
+    TRY_ACCUM(ret, writer->writef(writer, "(require \""));
+    TRY_ACCUM(ret, str_print(&flat->strings[lhs], writer));
+    TRY_ACCUM(ret, writer->writef(writer, "\")"));
+    return ret;
+  case AST_Yield:
+    TRY_ACCUM(ret, writer->writef(writer, "(yield "));
+    TRY_ACCUM(ret, flat_ast_print(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Break:    return writer->writef(writer, "(break)");
+  case AST_Continue: return writer->writef(writer, "(continue)");
+  case AST_Return:
+    if (lhs == FLAT_NONE) {
+      return writer->writef(writer, "(return)");
+    }
+    TRY_ACCUM(ret, writer->writef(writer, "(return "));
+    TRY_ACCUM(ret, flat_ast_print(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Member:
+    TRY_ACCUM(ret, writer->writef(writer, "(. "));
+    TRY_ACCUM(ret, flat_ast_print(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, " "));
+    TRY_ACCUM(ret, str_print(&flat->strings[rhs], writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Index:      return print_pair(flat, "[] ", lhs, rhs, writer);
+  case AST_Assignment: return print_pair(flat, "= ", lhs, rhs, writer);
+  case AST_CompoundAssignment:
+    TRY_ACCUM(ret, writer->writef(writer, "(%s= ", binary_op_to_str(op)));
+    TRY_ACCUM(ret, flat_ast_print(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, " "));
+    TRY_ACCUM(ret, flat_ast_print(flat, rhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Binary:
+    TRY_ACCUM(ret, writer->writef(writer, "(%s ", binary_op_to_str(op)));
+    TRY_ACCUM(ret, flat_ast_print(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, " "));
+    TRY_ACCUM(ret, flat_ast_print(flat, rhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Unary:
+    TRY_ACCUM(ret, writer->writef(writer, "(%s ", unary_op_to_str(op)));
+    TRY_ACCUM(ret, flat_ast_print(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Call:
+    TRY_ACCUM(ret, writer->writef(writer, "(call "));
+    TRY_ACCUM(ret, flat_ast_print(flat, lhs, writer));
+    TRY_ACCUM(ret, print_list(flat, rhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Self:    return writer->writef(writer, "self");
+  case AST_Varargs: return writer->writef(writer, "varargs");
+  case AST_Array:
+    TRY_ACCUM(ret, writer->writef(writer, "(arr"));
+    TRY_ACCUM(ret, print_list(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Set:
+    TRY_ACCUM(ret, writer->writef(writer, "(set"));
+    TRY_ACCUM(ret, print_list(flat, lhs, writer));
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  case AST_Dictionary: {
+    size_t length;
+    const uint32_t* items = flat_ast_list(flat, lhs, &length);
+    TRY_ACCUM(ret, writer->writef(writer, "(dict"));
+    for (size_t i = 0; i < length; i += 2) {
+      TRY_ACCUM(ret, writer->writef(writer, " (kvpair "));
+      TRY_ACCUM(ret, flat_ast_print(flat, items[i], writer));
+      TRY_ACCUM(ret, writer->writef(writer, " "));
+      TRY_ACCUM(ret, flat_ast_print(flat, items[i + 1], writer));
+      TRY_ACCUM(ret, writer->writef(writer, ")"));
+    }
+    TRY_ACCUM(ret, writer->writef(writer, ")"));
+    return ret;
+  }
+  case AST_String:
+    TRY_ACCUM(ret, writer->writef(writer, "\""));
+    TRY_ACCUM(ret, str_print(&flat->strings[lhs], writer));
+    TRY_ACCUM(ret, writer->writef(writer, "\""));
+    return ret;
+  case AST_Identifier: return str_print(&flat->strings[lhs], writer);
+  case AST_Float:      return writer->writef(writer, "%lf", flat_ast_float(flat, node));
+  case AST_Integer:    return writer->writef(writer, "%ld", flat_ast_integer(flat, node));
+  case AST_Boolean:    return writer->writef(writer, op ? "true" : "false");
+  case AST_Ellipsis:   return writer->writef(writer, "...");
+  case AST_Nil:        return writer->writef(writer, "nil");
+  default:
+    UNREACHABLE();
+  }
+}
+
+#undef TRY_ACCUM
+#undef REALLOC
@@ -0,0 +1,92 @@
+#ifndef __BS_FLAT_AST_H__
+#define __BS_FLAT_AST_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ast.h"
+#include "string.h"
+#include "writer.h"
+
+// Index of a node which stands in for a missing (NULL) child
+#define FLAT_NONE UINT32_MAX
+
+// Alternative AST layout, for keeping parsed code resident. Nodes live in
+// parallel arrays, and refer to each other by 32-bit indices. Children are
+// always stored before their parents. What the two operands of a node mean
+// depends on its type:
+//   Program, Array, Set      - lhs: list of children
+//   Block                    - lhs: list of statements, op: last_had_semicolon
+//   Struct                   - lhs: body, rhs: parent string, op: has_parent
+//   Function                 - lhs: list of parameters, rhs: body, or body string if op (lazy)
+//   If                       - lhs: condition, rhs: list of [body, else_part]
+//   For                      - lhs: variable string, rhs: list of [iterable, body]
+//   While, Index, Assignment - lhs, rhs: the two children
+//   Let                      - lhs: variable string, rhs: value, op: public
+//   Require                  - lhs: module string
+//   Yield, Return            - lhs: value
+//   Member                   - lhs: entity, rhs: member string
+//   Binary                   - lhs, rhs: operands, op: BinaryOp
+//   CompoundAssignment       - lhs: target, rhs: value, op: BinaryOp
+//   Unary                    - lhs: operand, op: UnaryOp
+//   Call                     - lhs: function, rhs: list of arguments
+//   Dictionary               - lhs: list of alternating keys and values
+//   String, Identifier       - lhs: string
+//   Float, Integer           - lhs, rhs: low and high 32 bits of the value
+//   Boolean                  - op: value
+// A list is an index into `extra`, where its length is followed by its items.
+// A string is an index into `strings`.
+struct FlatAst {
+  uint8_t* types;          // Type of each node (enum AstType)
+  uint8_t* ops;            // Operator or flag of each node
+  uint32_t* lines;         // Source line number of each node
+  uint32_t* lhs;           // First operand of each node
+  uint32_t* rhs;           // Second operand of each node
+  size_t num_nodes;        // Number of nodes
+  size_t capacity;         // Allocated capacity of the node arrays
+  uint32_t* extra;         // Storage for lists
+  size_t extra_length;     // Number of filled slots in `extra`
+  size_t extra_capacity;   // Allocated capacity of `extra`
+  struct Str* strings;     // Identifiers and string literals
+  size_t num_strings;      // Number of strings
+  size_t strings_capacity; // Allocated capacity of `strings`
+  uint32_t root;           // Root node, or FLAT_NONE if empty
+};
+
+// Initialize an empty flat AST
+void flat_ast_init(struct FlatAst* flat);
+
+// Free memory for a flat AST
+void flat_ast_fini(struct FlatAst* flat);
+
+// Append a flattened copy of a tree, and make it the root. Strings still
+// point into the source code, just like in the tree. Returns the root.
+uint32_t flat_ast_build(struct FlatAst* flat, const struct Ast* ast);
+
+// Print a node in the same format as `ast_print`. Return the number of bytes
+// written, and -1 on error.
+int flat_ast_print(const struct FlatAst* flat, uint32_t node, struct Writer* writer);
+
+// Number of bytes allocated for a flat AST
+size_t flat_ast_size(const struct FlatAst* flat);
+
+// Get the length of a list, and a pointer to its items
+inline const uint32_t* flat_ast_list(const struct FlatAst* flat, uint32_t list, size_t* length) {
+  *length = flat->extra[list];
+  return &flat->extra[list + 1];
+}
+
+inline int64_t flat_ast_integer(const struct FlatAst* flat, uint32_t node) {
+  return (int64_t) (((uint64_t) flat->rhs[node] << 32) | flat->lhs[node]);
+}
+
+inline double flat_ast_float(const struct FlatAst* flat, uint32_t node) {
+  uint64_t bits = ((uint64_t) flat->rhs[node] << 32) | flat->lhs[node];
+  double f;
+  memcpy(&f, &bits, sizeof(double));
+  return f;
+}
+
+#endif  // __BS_FLAT_AST_H__
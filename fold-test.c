@@ -0,0 +1,126 @@
+#include "fold.h"
+
+#include <stdio.h>
+
+#include "parser.h"
+#include "test-util.h"
+#include "test.h"
+#include "vm.h"
+#include "writer.h"
+
+// Fold a program, and compare the printed result. The counts from the pass
+// are left in `stats`.
+#define ASSERT_FOLDS_TO(SOURCE, TARGET) do {                                      \
+    struct Arena arena;                                                           \
+    struct String buf;                                                            \
+    bool incomplete_input = false;                                                \
+    arena_init(&arena);                                                           \
+    string_init(&buf, "");                                                        \
+    struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);      \
+    struct Writer* writer = (struct Writer*) string_writer_create(&buf);          \
+    struct Ast* ast = parse(&arena, SOURCE, err_writer, &incomplete_input);       \
+    ASSERT(ast != NULL);                                                          \
+    stats = (struct FoldStats) { 0, 0, 0 };                                       \
+    ast_print(fold_ast(&arena, ast, &stats), writer);                             \
+    struct Str target;                                                            \
+    str_init(&target, TARGET, SIZE_MAX);                                          \
+    ASSERT_STR_EQ(((struct Str) { buf.data, buf.length }), target);               \
+    string_writer_free((struct StringWriter*) writer);                            \
+    file_writer_free((struct FileWriter*) err_writer);                            \
+    string_fini(&buf);                                                            \
+    arena_fini(&arena);                                                           \
+  } while (0)
+
+TEST(Fold, Constants) {
+  struct FoldStats stats;
+  ASSERT_FOLDS_TO("1024 * 1024; -(3); 1 + 2 * 3; 7 / 2; 7.0 / 2; !0",
+                  "(program 1048576 -3 7 3 3.500000 -1)");
+  ASSERT_INT_EQ(stats.folded, 7);
+  ASSERT_FOLDS_TO("1 < 2.5; 1 == 1.0; nil == false; not nil; not 0; 2 != 2",
+                  "(program true true false true false false)");
+  ASSERT_INT_EQ(stats.folded, 6);
+  // Integers wrap around, like they do at runtime
+  ASSERT_FOLDS_TO("9223372036854775807 + 1 == -9223372036854775807 - 1", "(program true)");
+}
+
+// Anything which fails at runtime has to keep failing there
+TEST(Fold, LeavesErrorsToRuntime) {
+  struct FoldStats stats;
+  ASSERT_FOLDS_TO("1 / 0; 1 % 0; 1 << 64; 1 >> -1; 1 + true; -nil; !1.5; 2.5 % 2",
+                  "(program (/ 1 0) (% 1 0) (<< 1 64) (>> 1 -1) (+ 1 true) (- nil) (! 1.500000) "
+                  "(% 2.500000 2))");
+  ASSERT_INT_EQ(stats.folded, 1);
+}
+
+TEST(Fold, DeadBranches) {
+  struct FoldStats stats;
+  ASSERT_FOLDS_TO("if 1 < 2 { a } else { b } if false { a } while nil { a } while x { a }",
+                  "(program (block <ret> a) nil nil (while x (block <ret> a)))");
+  ASSERT_INT_EQ(stats.branches, 3);
+  ASSERT_FOLDS_TO("if false { a } else { if 0 { b } else { c } }", "(program (block <ret> (block <ret> b)))");
+  ASSERT_INT_EQ(stats.branches, 2);
+}
+
+// The type of a variable isn't known, so identities only apply to operands
+// whose type follows from the expression
+TEST(Fold, Identities) {
+  struct FoldStats stats;
+  ASSERT_FOLDS_TO("x * 1; x + 0; -x - 0; not not x",
+                  "(program (* x 1) (+ x 0) (- (- x) 0) (not (not x)))");
+  ASSERT_INT_EQ(stats.simplified, 0);
+  ASSERT_FOLDS_TO("(1 << 64) | 0; 1 * (2 / 0); (x < y) == true; false != (x < y); "
+                  "not not (x < y)",
+                  "(program (<< 1 64) (/ 2 0) (< x y) (< x y) (< x y))");
+  ASSERT_INT_EQ(stats.simplified, 5);
+  // Adding zero isn't an identity for floats: -0.0 + 0 is 0.0
+  ASSERT_FOLDS_TO("(2.5 * (1 / 0)) + 0; (2.5 * (1 / 0)) - 0; (2.5 * (1 / 0)) * 1",
+                  "(program (+ (* 2.500000 (/ 1 0)) 0) (* 2.500000 (/ 1 0)) (* 2.500000 (/ 1 0)))");
+  ASSERT_INT_EQ(stats.simplified, 2);
+  ASSERT_FOLDS_TO("true and x; nil and x; 0 or x; false or x",
+                  "(program x nil 0 x)");
+  ASSERT_INT_EQ(stats.simplified, 4);
+}
+
+// Run a program, with or without folding. Runtime errors are expected, so
+// they aren't printed.
+static bool run(struct Memory* mem, const char* source, bool fold, struct Value* result) {
+  unsigned flags = TF_QuietErrors | (fold ? TF_Fold : 0);
+  return test_run(mem, source, CE_Stack, VM_DispatchThreaded, flags, result);
+}
+
+// Every operation on every pair of interesting literals gives the same
+// result, or the same failure, with and without folding
+TEST(Fold, SameResultsAsVm) {
+  static const char* const operands[] = {
+    "0", "1", "(-1)", "3", "64", "9223372036854775807", "(-9223372036854775807 - 1)",
+    "0.0", "(-0.0)", "2.5", "(0.0 / 0)", "true", "false", "nil",
+  };
+  static const char* const binary_ops[] = {
+    "==", "!=", "<=", "<", ">=", ">", "<<", ">>", "+", "-", "*", "/", "%", "|", "&", "^",
+    "and", "or",
+  };
+  static const char* const unary_ops[] = { "-", "!", "not " };
+  size_t num_operands = sizeof(operands) / sizeof(operands[0]);
+  char source[128];
+  struct Memory mem;
+  mem_init(&mem);
+  for (size_t i = 0; i < num_operands; i++) {
+    for (size_t j = 0; j < num_operands; j++) {
+      for (size_t k = 0; k < sizeof(binary_ops) / sizeof(binary_ops[0]); k++) {
+        snprintf(source, sizeof(source), "%s %s %s", operands[i], binary_ops[k], operands[j]);
+        struct Value unfolded, folded;
+        bool ok = run(&mem, source, false, &unfolded);
+        ASSERT(ok == run(&mem, source, true, &folded));
+        ASSERT(!ok || test_same_value(unfolded, folded));
+      }
+    }
+    for (size_t k = 0; k < sizeof(unary_ops) / sizeof(unary_ops[0]); k++) {
+      snprintf(source, sizeof(source), "%s%s", unary_ops[k], operands[i]);
+      struct Value unfolded, folded;
+      bool ok = run(&mem, source, false, &unfolded);
+      ASSERT(ok == run(&mem, source, true, &folded));
+      ASSERT(!ok || test_same_value(unfolded, folded));
+    }
+  }
+  mem_fini(&mem);
+}
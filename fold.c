@@ -0,0 +1,504 @@
+#include "fold.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "log.h"
+
+// State for a folding pass
+struct Folder {
+  struct Arena* arena;    // Arena to allocate new nodes from
+  struct FoldStats stats; // What the pass has changed so far
+};
+
+// Value of a literal node
+struct Constant {
+  enum AstType type; // AST_Integer, AST_Float, AST_Boolean or AST_Nil
+  union {
+    int64_t i;
+    double f;
+    bool b;
+  };
+};
+
+static bool as_constant(const struct Ast* ast, struct Constant* out) {
+  out->type = ast->type;
+  switch (ast->type) {
+  case AST_Integer: out->i = ((const struct AstInteger*) ast)->i; return true;
+  case AST_Float:   out->f = ((const struct AstFloat*) ast)->f; return true;
+  case AST_Boolean: out->b = ((const struct AstBoolean*) ast)->b; return true;
+  case AST_Nil:     return true;
+  default:          return false;
+  }
+}
+
+static struct Ast* constant_create(struct Folder* folder, size_t line_num,
+                                   const struct Constant* constant) {
+  switch (constant->type) {
+  case AST_Integer: return ast_integer_create(folder->arena, line_num, constant->i);
+  case AST_Float:   return ast_float_create(folder->arena, line_num, constant->f);
+  case AST_Boolean: return ast_boolean_create(folder->arena, line_num, constant->b);
+  case AST_Nil:     return ast_nil_create(folder->arena, line_num);
+  default:          UNREACHABLE();
+  }
+}
+
+static struct Constant integer(int64_t i) {
+  return (struct Constant) { .type = AST_Integer, .i = i };
+}
+
+static struct Constant boolean(bool b) {
+  return (struct Constant) { .type = AST_Boolean, .b = b };
+}
+
+// Everything below mirrors the VM, which is the reference for how operations
+// behave. Whenever the VM would raise an error, folding gives up.
+
+static bool is_falsey(const struct Constant* constant) {
+  return constant->type == AST_Nil || (constant->type == AST_Boolean && !constant->b);
+}
+
+static bool is_number(const struct Constant* constant) {
+  return constant->type == AST_Integer || constant->type == AST_Float;
+}
+
+static double as_float(const struct Constant* constant) {
+  return constant->type == AST_Integer ? (double) constant->i : constant->f;
+}
+
+static int64_t wrapping_add(int64_t a, int64_t b) {
+  return (int64_t) ((uint64_t) a + (uint64_t) b);
+}
+
+static int64_t wrapping_sub(int64_t a, int64_t b) {
+  return (int64_t) ((uint64_t) a - (uint64_t) b);
+}
+
+static int64_t wrapping_mul(int64_t a, int64_t b) {
+  return (int64_t) ((uint64_t) a * (uint64_t) b);
+}
+
+// Same as value_equal
+static bool constants_equal(const struct Constant* a, const struct Constant* b) {
+  if (is_number(a) && is_number(b)) {
+    if (a->type == AST_Integer && b->type == AST_Integer) {
+      return a->i == b->i;
+    }
+    return as_float(a) == as_float(b);
+  }
+  if (a->type != b->type) {
+    return false;
+  }
+  return a->type == AST_Nil || a->b == b->b;
+}
+
+static bool fold_integers(enum BinaryOp op, int64_t a, int64_t b, struct Constant* out) {
+  switch (op) {
+  case BO_LessEqual:    *out = boolean(a <= b); return true;
+  case BO_LessThan:     *out = boolean(a < b); return true;
+  case BO_GreaterEqual: *out = boolean(a >= b); return true;
+  case BO_GreaterThan:  *out = boolean(a > b); return true;
+  case BO_Add:          *out = integer(wrapping_add(a, b)); return true;
+  case BO_Subtract:     *out = integer(wrapping_sub(a, b)); return true;
+  case BO_Multiply:     *out = integer(wrapping_mul(a, b)); return true;
+  case BO_BitOr:        *out = integer(a | b); return true;
+  case BO_BitAnd:       *out = integer(a & b); return true;
+  case BO_BitXor:       *out = integer(a ^ b); return true;
+  case BO_Divide:
+  case BO_Modulo:
+    if (b == 0) {
+      return false;
+    }
+    if (b == -1) {
+      *out = integer(op == BO_Divide ? wrapping_sub(0, a) : 0);
+    } else {
+      *out = integer(op == BO_Divide ? a / b : a % b);
+    }
+    return true;
+  case BO_ShiftLeft:
+  case BO_ShiftRight:
+    if (b < 0 || b > 63) {
+      return false;
+    }
+    *out = integer(op == BO_ShiftLeft ? (int64_t) ((uint64_t) a << b) : a >> b);
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool fold_floats(enum BinaryOp op, double a, double b, struct Constant* out) {
+  out->type = AST_Float;
+  switch (op) {
+  case BO_LessEqual:    *out = boolean(a <= b); return true;
+  case BO_LessThan:     *out = boolean(a < b); return true;
+  case BO_GreaterEqual: *out = boolean(a >= b); return true;
+  case BO_GreaterThan:  *out = boolean(a > b); return true;
+  case BO_Add:          out->f = a + b; return true;
+  case BO_Subtract:     out->f = a - b; return true;
+  case BO_Multiply:     out->f = a * b; return true;
+  case BO_Divide:       out->f = a / b; return true;
+  default:              return false;
+  }
+}
+
+static bool fold_binary_constants(enum BinaryOp op, const struct Constant* a,
+                                  const struct Constant* b, struct Constant* out) {
+  switch (op) {
+  case BO_Equal:    *out = boolean(constants_equal(a, b)); return true;
+  case BO_NotEqual: *out = boolean(!constants_equal(a, b)); return true;
+  default:          break;
+  }
+  if (a->type == AST_Integer && b->type == AST_Integer) {
+    return fold_integers(op, a->i, b->i, out);
+  }
+  if (is_number(a) && is_number(b)) {
+    return fold_floats(op, as_float(a), as_float(b), out);
+  }
+  return false;
+}
+
+static bool fold_unary_constant(enum UnaryOp op, const struct Constant* a, struct Constant* out) {
+  switch (op) {
+  case UO_Minus:
+    if (a->type == AST_Integer) {
+      *out = integer(wrapping_sub(0, a->i));
+      return true;
+    }
+    if (a->type == AST_Float) {
+      out->type = AST_Float;
+      out->f = -a->f;
+      return true;
+    }
+    return false;
+  case UO_BitNot:
+    if (a->type == AST_Integer) {
+      *out = integer(~a->i);
+      return true;
+    }
+    return false;
+  case UO_LogicalNot:
+    *out = boolean(is_falsey(a));
+    return true;
+  }
+  UNREACHABLE();
+}
+
+// What's known about the type of an expression's value, before running it
+enum Kind {
+  K_Unknown,
+  K_Boolean,
+  K_Integer,
+  K_Number,  // Integer or float
+};
+
+static bool is_numeric_kind(enum Kind kind) {
+  return kind == K_Integer || kind == K_Number;
+}
+
+static enum Kind kind_of(const struct Ast* ast) {
+  switch (ast->type) {
+  case AST_Integer: return K_Integer;
+  case AST_Float:   return K_Number;
+  case AST_Boolean: return K_Boolean;
+  case AST_Binary: {
+    const struct AstBinary* binary = (const struct AstBinary*) ast;
+    enum Kind lhs = kind_of(binary->lhs), rhs = kind_of(binary->rhs);
+    switch (binary->operation) {
+    case BO_Equal:
+    case BO_NotEqual:
+    case BO_LessEqual:
+    case BO_LessThan:
+    case BO_GreaterEqual:
+    case BO_GreaterThan:
+      return K_Boolean;
+    case BO_Add:
+    case BO_Subtract:
+    case BO_Multiply:
+    case BO_Divide:
+      if (lhs == K_Integer && rhs == K_Integer) {
+        return K_Integer;
+      }
+      return is_numeric_kind(lhs) && is_numeric_kind(rhs) ? K_Number : K_Unknown;
+    case BO_Modulo:
+    case BO_ShiftLeft:
+    case BO_ShiftRight:
+    case BO_BitOr:
+    case BO_BitAnd:
+    case BO_BitXor:
+      return lhs == K_Integer && rhs == K_Integer ? K_Integer : K_Unknown;
+    case BO_LogicalAnd:
+    case BO_LogicalOr:
+      return K_Unknown;
+    }
+    UNREACHABLE();
+  }
+  case AST_Unary: {
+    const struct AstUnary* unary = (const struct AstUnary*) ast;
+    enum Kind rhs = kind_of(unary->rhs);
+    switch (unary->operation) {
+    case UO_Minus:      return is_numeric_kind(rhs) ? rhs : K_Unknown;
+    case UO_BitNot:     return rhs == K_Integer ? K_Integer : K_Unknown;
+    case UO_LogicalNot: return K_Boolean;
+    }
+    UNREACHABLE();
+  }
+  default:
+    return K_Unknown;
+  }
+}
+
+static bool is_integer(const struct Ast* ast, int64_t i) {
+  return ast->type == AST_Integer && ((const struct AstInteger*) ast)->i == i;
+}
+
+static bool is_boolean(const struct Ast* ast, bool b) {
+  return ast->type == AST_Boolean && ((const struct AstBoolean*) ast)->b == b;
+}
+
+// If "lhs OP rhs" always has the same value as `lhs`, return `lhs`, or NULL
+// otherwise. Identities never drop an operand which isn't a literal, since
+// that could skip an error or a call. Adding zero isn't an identity for
+// floats, since -0.0 + 0 is 0.0.
+static struct Ast* right_identity(enum BinaryOp op, struct Ast* lhs, const struct Ast* rhs) {
+  enum Kind kind = kind_of(lhs);
+  switch (op) {
+  case BO_Add:
+  case BO_BitOr:
+  case BO_BitXor:
+  case BO_ShiftLeft:
+  case BO_ShiftRight:
+    return kind == K_Integer && is_integer(rhs, 0) ? lhs : NULL;
+  case BO_Subtract:
+    return is_numeric_kind(kind) && is_integer(rhs, 0) ? lhs : NULL;
+  case BO_Multiply:
+  case BO_Divide:
+    return is_numeric_kind(kind) && is_integer(rhs, 1) ? lhs : NULL;
+  case BO_Equal:
+    return kind == K_Boolean && is_boolean(rhs, true) ? lhs : NULL;
+  case BO_NotEqual:
+    return kind == K_Boolean && is_boolean(rhs, false) ? lhs : NULL;
+  default:
+    return NULL;
+  }
+}
+
+// Same as `right_identity`, for "lhs OP rhs" which is always `rhs`
+static struct Ast* left_identity(enum BinaryOp op, const struct Ast* lhs, struct Ast* rhs) {
+  enum Kind kind = kind_of(rhs);
+  switch (op) {
+  case BO_Add:
+  case BO_BitOr:
+  case BO_BitXor:
+    return kind == K_Integer && is_integer(lhs, 0) ? rhs : NULL;
+  case BO_Multiply:
+    return is_numeric_kind(kind) && is_integer(lhs, 1) ? rhs : NULL;
+  case BO_Equal:
+    return kind == K_Boolean && is_boolean(lhs, true) ? rhs : NULL;
+  case BO_NotEqual:
+    return kind == K_Boolean && is_boolean(lhs, false) ? rhs : NULL;
+  default:
+    return NULL;
+  }
+}
+
+static struct Ast* fold_binary(struct Folder* folder, struct AstBinary* ast) {
+  struct Constant lhs, rhs, result;
+  bool lhs_constant = as_constant(ast->lhs, &lhs);
+  // "and" and "or" short-circuit to one of their operands, so a constant on
+  // the left picks which one
+  if (ast->operation == BO_LogicalAnd || ast->operation == BO_LogicalOr) {
+    if (!lhs_constant) {
+      return (struct Ast*) ast;
+    }
+    bool take_lhs = is_falsey(&lhs) == (ast->operation == BO_LogicalAnd);
+    folder->stats.simplified++;
+    return take_lhs ? ast->lhs : ast->rhs;
+  }
+  if (lhs_constant && as_constant(ast->rhs, &rhs)) {
+    if (!fold_binary_constants(ast->operation, &lhs, &rhs, &result)) {
+      return (struct Ast*) ast;
+    }
+    folder->stats.folded++;
+    return constant_create(folder, ast->ast.line_num, &result);
+  }
+  struct Ast* simplified = right_identity(ast->operation, ast->lhs, ast->rhs);
+  if (!simplified) {
+    simplified = left_identity(ast->operation, ast->lhs, ast->rhs);
+  }
+  if (!simplified) {
+    return (struct Ast*) ast;
+  }
+  folder->stats.simplified++;
+  return simplified;
+}
+
+static struct Ast* fold_unary(struct Folder* folder, struct AstUnary* ast) {
+  struct Constant rhs, result;
+  if (as_constant(ast->rhs, &rhs)) {
+    if (!fold_unary_constant(ast->operation, &rhs, &result)) {
+      return (struct Ast*) ast;
+    }
+    folder->stats.folded++;
+    return constant_create(folder, ast->ast.line_num, &result);
+  }
+  // "not not x" is "x" if it's already a boolean
+  if (ast->operation == UO_LogicalNot && ast->rhs->type == AST_Unary) {
+    const struct AstUnary* inner = (const struct AstUnary*) ast->rhs;
+    if (inner->operation == UO_LogicalNot && kind_of(inner->rhs) == K_Boolean) {
+      folder->stats.simplified++;
+      return inner->rhs;
+    }
+  }
+  return (struct Ast*) ast;
+}
+
+// An "if" without an "else" has no value when its condition is false
+static struct Ast* fold_if(struct Folder* folder, struct AstIf* ast) {
+  struct Constant condition;
+  if (!as_constant(ast->condition, &condition)) {
+    return (struct Ast*) ast;
+  }
+  folder->stats.branches++;
+  if (!is_falsey(&condition)) {
+    return ast->body;
+  }
+  return ast->else_part ? ast->else_part : ast_nil_create(folder->arena, ast->ast.line_num);
+}
+
+static struct Ast* fold_while(struct Folder* folder, struct AstWhile* ast) {
+  struct Constant condition;
+  if (!as_constant(ast->condition, &condition) || !is_falsey(&condition)) {
+    return (struct Ast*) ast;
+  }
+  folder->stats.branches++;
+  return ast_nil_create(folder->arena, ast->ast.line_num);
+}
+
+static struct Ast* fold(struct Folder* folder, struct Ast* ast);
+
+static void fold_vec(struct Folder* folder, struct AstVec* vec) {
+  for (size_t i = 0; i < vec->length; i++) {
+    vec->data[i] = fold(folder, vec->data[i]);
+  }
+}
+
+// Children are folded first, so that constants bubble up
+static struct Ast* fold(struct Folder* folder, struct Ast* ast) {
+#define FOLD(AST) AST = fold(folder, AST)
+
+  if (!ast) {
+    return NULL;
+  }
+
+  switch (ast->type) {
+  case AST_Program: fold_vec(folder, &((struct AstProgram*) ast)->statements); break;
+  case AST_Block:   fold_vec(folder, &((struct AstBlock*) ast)->statements); break;
+  case AST_Struct:  FOLD(((struct AstStruct*) ast)->body); break;
+  case AST_Function:
+    // Lazily parsed functions are folded when their body is parsed
+    FOLD(((struct AstFunction*) ast)->body);
+    break;
+  case AST_If: {
+    struct AstIf* node = (struct AstIf*) ast;
+    FOLD(node->condition);
+    FOLD(node->body);
+    FOLD(node->else_part);
+    return fold_if(folder, node);
+  }
+  case AST_While: {
+    struct AstWhile* node = (struct AstWhile*) ast;
+    FOLD(node->condition);
+    FOLD(node->body);
+    return fold_while(folder, node);
+  }
+  case AST_For: {
+    struct AstFor* node = (struct AstFor*) ast;
+    FOLD(node->iterable);
+    FOLD(node->body);
+    break;
+  }
+  case AST_Let:    FOLD(((struct AstLet*) ast)->rhs); break;
+  case AST_Yield:  FOLD(((struct AstYield*) ast)->value); break;
+  case AST_Return: FOLD(((struct AstReturn*) ast)->value); break;
+  case AST_Member: FOLD(((struct AstMember*) ast)->lhs); break;
+  case AST_Index: {
+    struct AstIndex* node = (struct AstIndex*) ast;
+    FOLD(node->lhs);
+    FOLD(node->index);
+    break;
+  }
+  case AST_Assignment: {
+    struct AstAssignment* node = (struct AstAssignment*) ast;
+    FOLD(node->lhs);
+    FOLD(node->rhs);
+    break;
+  }
+  case AST_CompoundAssignment: {
+    struct AstCompoundAssignment* node = (struct AstCompoundAssignment*) ast;
+    FOLD(node->lhs);
+    FOLD(node->rhs);
+    break;
+  }
+  case AST_Binary: {
+    struct AstBinary* node = (struct AstBinary*) ast;
+    FOLD(node->lhs);
+    FOLD(node->rhs);
+    return fold_binary(folder, node);
+  }
+  case AST_Unary: {
+    struct AstUnary* node = (struct AstUnary*) ast;
+    FOLD(node->rhs);
+    return fold_unary(folder, node);
+  }
+  case AST_Call: {
+    struct AstCall* node = (struct AstCall*) ast;
+    FOLD(node->function);
+    fold_vec(folder, &node->arguments);
+    break;
+  }
+  case AST_Array: fold_vec(folder, &((struct AstArray*) ast)->elements); break;
+  case AST_Set:   fold_vec(folder, &((struct AstSet*) ast)->elements); break;
+  case AST_Dictionary: {
+    struct AstPairVec* pairs = &((struct AstDictionary*) ast)->pairs;
+    for (size_t i = 0; i < pairs->length; i++) {
+      FOLD(pairs->data[i].key);
+      FOLD(pairs->data[i].value);
+    }
+    break;
+  }
+  case AST_Require:
+  case AST_Break:
+  case AST_Continue:
+  case AST_Self:
+  case AST_Varargs:
+  case AST_String:
+  case AST_Identifier:
+  case AST_Float:
+  case AST_Integer:
+  case AST_Boolean:
+  case AST_Ellipsis:
+  case AST_Nil:
+    break;
+  default: UNREACHABLE();
+  }
+  return ast;
+
+#undef FOLD
+}
+
+struct Ast* fold_ast(struct Arena* arena, struct Ast* ast, struct FoldStats* stats) {
+  struct Folder folder = { arena, { 0, 0, 0 } };
+  struct Ast* ret = fold(&folder, ast);
+  if (stats) {
+    stats->folded += folder.stats.folded;
+    stats->branches += folder.stats.branches;
+    stats->simplified += folder.stats.simplified;
+  }
+  return ret;
+}
+
+int fold_stats_print(const struct FoldStats* stats, struct Writer* writer) {
+  return writer->writef(writer, "folded %lu constants, %lu dead branches, %lu identities",
+                        stats->folded, stats->branches, stats->simplified);
+}
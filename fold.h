@@ -0,0 +1,31 @@
+#ifndef __BS_FOLD_H__
+#define __BS_FOLD_H__
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "ast.h"
+#include "writer.h"
+
+// What a folding pass changed
+struct FoldStats {
+  size_t folded;     // Operations on constants replaced by their result
+  size_t branches;   // Dead branches of "if" and "while" removed
+  size_t simplified; // Operations simplified by an identity, like "x * 1"
+};
+
+// Optimize an AST in place, between parsing and code generation. Binary and
+// unary operations on integer, float, boolean and nil literals are replaced
+// by their result, with exactly the semantics of the VM. Operations which
+// would fail at runtime, like dividing an integer by zero, are left alone so
+// that they still fail there. "if" and "while" with a constant condition lose
+// their dead branches, and identities like "x * 1" are simplified when the
+// type of "x" is known. New nodes are allocated from `arena`, which should be
+// the one the AST lives in. Returns the new root, and adds to the counts in
+// `stats` if it isn't NULL.
+struct Ast* fold_ast(struct Arena* arena, struct Ast* ast, struct FoldStats* stats);
+
+// Print the counts from a folding pass, for debug output
+int fold_stats_print(const struct FoldStats* stats, struct Writer* writer);
+
+#endif  // __BS_FOLD_H__
@@ -0,0 +1,174 @@
+// Generates "keywords.h", with a minimal perfect hash over the keywords of the
+// language. This runs at build time, so adding a keyword is just a matter of
+// adding it to the table below (and to `enum TokenType`).
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keyword-hash.h"
+
+// Keywords, along with the name of their token type
+static const struct {
+  const char* text;
+  const char* type;
+} KEYWORDS[] = {
+  { "true",     "TOK_True" },
+  { "false",    "TOK_False" },
+  { "nil",      "TOK_Nil" },
+  { "fn",       "TOK_Fn" },
+  { "and",      "TOK_And" },
+  { "or",       "TOK_Or" },
+  { "not",      "TOK_Not" },
+  { "pub",      "TOK_Pub" },
+  { "let",      "TOK_Let" },
+  { "for",      "TOK_For" },
+  { "in",       "TOK_In" },
+  { "if",       "TOK_If" },
+  { "else",     "TOK_Else" },
+  { "while",    "TOK_While" },
+  { "struct",   "TOK_Struct" },
+  { "break",    "TOK_Break" },
+  { "continue", "TOK_Continue" },
+  { "self",     "TOK_Self" },
+  { "require",  "TOK_Require" },
+  { "return",   "TOK_Return" },
+  { "yield",    "TOK_Yield" },
+  { "varargs",  "TOK_Varargs" },
+};
+
+#define NUM_KEYWORDS (sizeof(KEYWORDS) / sizeof(KEYWORDS[0]))
+#define NUM_BUCKETS (1 << KEYWORD_BUCKET_BITS)
+
+// Number of multipliers to try before giving up
+#define MAX_ATTEMPTS 100000
+
+// Result of a successful search
+struct PerfectHash {
+  uint64_t multiplier;
+  uint32_t displacements[NUM_BUCKETS];
+  size_t slots[NUM_KEYWORDS]; // Index of the keyword in each slot
+};
+
+// Deterministic, so that the generated header doesn't change between builds
+static uint64_t next_random(uint64_t* state) {
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return *state;
+}
+
+// Try to place all the keywords with the given multiplier. Buckets are placed
+// largest first, since those are the hardest to fit.
+static bool try_multiplier(uint64_t multiplier, struct PerfectHash* hash) {
+  uint32_t hashes[NUM_KEYWORDS];
+  size_t bucket_sizes[NUM_BUCKETS] = { 0 };
+  for (size_t i = 0; i < NUM_KEYWORDS; i++) {
+    hashes[i] = keyword_hash(KEYWORDS[i].text, strlen(KEYWORDS[i].text), multiplier);
+    bucket_sizes[keyword_bucket(hashes[i])]++;
+  }
+  bool used[NUM_KEYWORDS] = { false };
+  bool placed[NUM_BUCKETS] = { false };
+  for (size_t n = 0; n < NUM_BUCKETS; n++) {
+    size_t bucket = 0;
+    for (size_t b = 0; b < NUM_BUCKETS; b++) {
+      if (!placed[b] && (placed[bucket] || bucket_sizes[b] > bucket_sizes[bucket])) {
+        bucket = b;
+      }
+    }
+    placed[bucket] = true;
+    hash->displacements[bucket] = 0;
+    if (bucket_sizes[bucket] == 0) {
+      continue;
+    }
+    bool found = false;
+    for (uint32_t displacement = 0; displacement < NUM_KEYWORDS && !found; displacement++) {
+      found = true;
+      size_t slots[NUM_KEYWORDS], keywords[NUM_KEYWORDS];
+      size_t num_slots = 0;
+      for (size_t i = 0; i < NUM_KEYWORDS && found; i++) {
+        if (keyword_bucket(hashes[i]) != bucket) {
+          continue;
+        }
+        size_t slot = keyword_slot(hashes[i], displacement, NUM_KEYWORDS);
+        for (size_t j = 0; j < num_slots; j++) {
+          found = found && slots[j] != slot;
+        }
+        found = found && !used[slot];
+        keywords[num_slots] = i;
+        slots[num_slots++] = slot;
+      }
+      if (found) {
+        hash->displacements[bucket] = displacement;
+        for (size_t j = 0; j < num_slots; j++) {
+          used[slots[j]] = true;
+          hash->slots[slots[j]] = keywords[j];
+        }
+      }
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  hash->multiplier = multiplier;
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUTPUT\n", argv[0]);
+    return 1;
+  }
+  size_t min_length = SIZE_MAX, max_length = 0;
+  for (size_t i = 0; i < NUM_KEYWORDS; i++) {
+    size_t length = strlen(KEYWORDS[i].text);
+    min_length = length < min_length ? length : min_length;
+    max_length = length > max_length ? length : max_length;
+  }
+  if (min_length < 2 || max_length > KEYWORD_MAX_SIZE) {
+    fprintf(stderr, "ERROR: keywords must be 2 to %d bytes long\n", KEYWORD_MAX_SIZE);
+    return 1;
+  }
+
+  struct PerfectHash hash;
+  uint64_t state = 0;
+  bool found = false;
+  for (size_t attempt = 0; attempt < MAX_ATTEMPTS && !found; attempt++) {
+    // Odd multipliers lose no bits of the key
+    found = try_multiplier(next_random(&state) | 1, &hash);
+  }
+  if (!found) {
+    fprintf(stderr, "ERROR: couldn't find a perfect hash for the keywords\n");
+    return 1;
+  }
+
+  FILE* file = fopen(argv[1], "w");
+  if (!file) {
+    perror("fopen()");
+    return 1;
+  }
+  // This is written to the build directory, where it can't find
+  // "keyword-hash.h". That has to be included first instead.
+  fprintf(file, "// Generated by gen-keywords.c. Do not edit. Include after keyword-hash.h.\n\n");
+  fprintf(file, "#ifndef __BS_KEYWORDS_H__\n#define __BS_KEYWORDS_H__\n\n");
+  fprintf(file, "#define NUM_KEYWORDS %zu\n", NUM_KEYWORDS);
+  fprintf(file, "#define KEYWORD_MIN_LENGTH %zu\n", min_length);
+  fprintf(file, "#define KEYWORD_MAX_LENGTH %zu\n", max_length);
+  fprintf(file, "#define KEYWORD_MULTIPLIER UINT64_C(0x%016llx)\n\n",
+          (unsigned long long) hash.multiplier);
+  fprintf(file, "static const uint32_t KEYWORD_DISPLACEMENTS[%d] = {\n", NUM_BUCKETS);
+  for (size_t b = 0; b < NUM_BUCKETS; b++) {
+    fprintf(file, "  %u,\n", hash.displacements[b]);
+  }
+  fprintf(file, "};\n\n");
+  fprintf(file, "static const struct Keyword KEYWORDS[NUM_KEYWORDS] = {\n");
+  for (size_t slot = 0; slot < NUM_KEYWORDS; slot++) {
+    size_t i = hash.slots[slot];
+    fprintf(file, "  { \"%s\", %s },\n", KEYWORDS[i].text, KEYWORDS[i].type);
+  }
+  fprintf(file, "};\n\n#endif  // __BS_KEYWORDS_H__\n");
+  if (fclose(file) != 0) {
+    perror("fclose()");
+    return 1;
+  }
+  return 0;
+}
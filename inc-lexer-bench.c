@@ -0,0 +1,64 @@
+#include "inc-lexer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "log.h"
+
+#define NUM_KEYSTROKES 2000
+
+static char* build_source(size_t num_lines, size_t* length) {
+  size_t capacity = num_lines * 64;
+  char* source = malloc(capacity);
+  CHECK(source != NULL);
+  *length = 0;
+  for (size_t i = 0; i < num_lines; i++) {
+    *length += snprintf(source + *length, capacity - *length,
+                        "let value%zu = compute(%zu, \"name\") * 2.5; // note\n", i, i);
+    CHECK(*length < capacity);
+  }
+  return source;
+}
+
+// Edit a character in the middle of the buffer, like an editor does on every
+// keystroke, and compare with lexing the whole buffer again
+static void keystrokes(size_t num_lines) {
+  size_t length;
+  char* source = build_source(num_lines, &length);
+  struct IncLexer lexer;
+  inc_lexer_init(&lexer, source);
+  size_t offset = length / 2;
+  char original = source[offset];
+  uint64_t start = bench_now_ns();
+  for (size_t i = 0; i < NUM_KEYSTROKES; i++) {
+    // Overwrite a character in the middle of an identifier, and put it back
+    source[offset] = 'x';
+    inc_lexer_edit(&lexer, source, offset, 1, 1);
+    source[offset] = original;
+    inc_lexer_edit(&lexer, source, offset, 1, 1);
+  }
+  uint64_t mid = bench_now_ns();
+  for (size_t i = 0; i < NUM_KEYSTROKES / 100; i++) {
+    struct Lexer full;
+    struct Token token;
+    lexer_init(&full, source);
+    while (lexer_tok(&full, &token)) {
+      bench_consume(&token);
+    }
+  }
+  uint64_t end = bench_now_ns();
+  char label[64];
+  snprintf(label, sizeof(label), "%zu lines incremental", num_lines);
+  bench_report(label, (double) (mid - start) / (2 * NUM_KEYSTROKES) / 1000.0, "us/edit");
+  snprintf(label, sizeof(label), "%zu lines full re-lex", num_lines);
+  bench_report(label, (double) (end - mid) / (NUM_KEYSTROKES / 100) / 1000.0, "us/edit");
+  inc_lexer_fini(&lexer);
+  free(source);
+}
+
+BENCH(IncLexer, KeystrokeLatency) {
+  keystrokes(1000);
+  keystrokes(10000);
+  keystrokes(100000);
+}
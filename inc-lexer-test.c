@@ -0,0 +1,108 @@
+#include "inc-lexer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "string.h"
+#include "test.h"
+
+// The incremental lexer must produce exactly the tokens of a full re-lex
+#define ASSERT_SAME_AS_FULL_LEX(INC) do {                      \
+    struct Lexer full;                                         \
+    struct IncLexerCursor cursor = { 0, 0 };                   \
+    struct Token expected, actual;                             \
+    bool more;                                                 \
+    lexer_init(&full, (INC)->source);                          \
+    do {                                                       \
+      more = lexer_tok(&full, &expected);                      \
+      ASSERT(inc_lexer_next((INC), &cursor, &actual) == more); \
+      ASSERT(actual.type == expected.type);                    \
+      ASSERT_INT_EQ(actual.line_num, expected.line_num);       \
+    } while (more && str_equal(&actual.text, &expected.text)); \
+    ASSERT(!more);                                             \
+  } while (0)
+
+// Apply an edit to a buffer, and then to the lexer
+static size_t edit(struct IncLexer* lexer, char* buffer, size_t offset, size_t removed_length,
+                   const char* inserted) {
+  size_t length = strlen(buffer), inserted_length = strlen(inserted);
+  memmove(buffer + offset + inserted_length, buffer + offset + removed_length,
+          length - offset - removed_length + 1);
+  memcpy(buffer + offset, inserted, inserted_length);
+  return inc_lexer_edit(lexer, buffer, offset, removed_length, inserted_length);
+}
+
+TEST(IncLexer, SmallEdits) {
+  char buffer[256] = "fn fib(n) {\n  if n <= 1 {\n    return 1;\n  }\n"
+    "  fib(n - 1) + fib(n - 2)\n}\n";
+  struct IncLexer lexer;
+  inc_lexer_init(&lexer, buffer);
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  // Extend an identifier, split it, and join it back
+  edit(&lexer, buffer, 6, 0, "o");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  edit(&lexer, buffer, 5, 0, " ");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  edit(&lexer, buffer, 5, 1, "");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  // Operators which merge with their neighbours
+  edit(&lexer, buffer, 21, 0, "<");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  // Lines
+  edit(&lexer, buffer, 12, 0, "\n\n// comment\n");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  edit(&lexer, buffer, 0, 3, "");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  // An open string swallows everything after it, and closing it restores it
+  edit(&lexer, buffer, 20, 0, "\"");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  edit(&lexer, buffer, 22, 0, "\"");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  // Edits at the very end, and emptying the buffer
+  edit(&lexer, buffer, strlen(buffer), 0, "1.");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  edit(&lexer, buffer, strlen(buffer), 0, "5");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  edit(&lexer, buffer, 0, strlen(buffer), "");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  ASSERT(lexer.num_tokens == 0);
+  edit(&lexer, buffer, 0, 0, "x");
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  inc_lexer_fini(&lexer);
+}
+
+TEST(IncLexer, EditsAreLocal) {
+  size_t num_lines = 4 * INC_LEXER_BLOCK_TOKENS, capacity = num_lines * 64, length = 0;
+  char* buffer = malloc(capacity);
+  ASSERT(buffer != NULL);
+  for (size_t i = 0; i < num_lines; i++) {
+    length += snprintf(buffer + length, capacity - length, "let x%zu = %zu + y;\n", i, i);
+  }
+  struct IncLexer lexer;
+  inc_lexer_init(&lexer, buffer);
+  size_t num_tokens = lexer.num_tokens;
+  // Typing in the middle of the buffer only re-lexes around the edit
+  size_t middle = length / 2;
+  while (buffer[middle] != '\n') {
+    middle++;
+  }
+  ASSERT(edit(&lexer, buffer, middle, 0, " let z = 1;") <= 8);
+  ASSERT_INT_EQ(lexer.num_tokens, num_tokens + 5);
+  ASSERT(edit(&lexer, buffer, middle + 9, 1, "22") <= 3);
+  ASSERT_SAME_AS_FULL_LEX(&lexer);
+  // Pseudo-random edits all over the buffer
+  srand(42);
+  const char* snippets[] = { "", "a", " ", "\n", "\"", "//", "1.", "..", "=", "fn" };
+  for (size_t i = 0; i < 200; i++) {
+    size_t offset = rand() % (strlen(buffer) + 1);
+    size_t removed = rand() % 4;
+    if (offset + removed > strlen(buffer)) {
+      removed = strlen(buffer) - offset;
+    }
+    edit(&lexer, buffer, offset, removed, snippets[rand() % 10]);
+    ASSERT_SAME_AS_FULL_LEX(&lexer);
+  }
+  inc_lexer_fini(&lexer);
+  free(buffer);
+}
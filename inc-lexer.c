@@ -0,0 +1,288 @@
+#include "inc-lexer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define REALLOC(PTR, SIZE) do {        \
+    if (!(PTR = realloc(PTR, SIZE))) { \
+      DIE_ERR("realloc()");            \
+    }                                  \
+  } while (0)
+
+// Tokens with absolute positions, while blocks are being rebuilt
+struct TokenRun {
+  struct LexedToken* tokens;
+  size_t length;
+  size_t capacity;
+};
+
+static void run_push(struct TokenRun* run, enum TokenType type, size_t end, size_t line_num) {
+  if (run->length == run->capacity) {
+    run->capacity = run->capacity == 0 ? INC_LEXER_BLOCK_TOKENS : run->capacity * 2;
+    REALLOC(run->tokens, run->capacity * sizeof(struct LexedToken));
+  }
+  struct LexedToken* token = &run->tokens[run->length++];
+  token->type = type;
+  token->end = end;
+  token->line_num = line_num;
+}
+
+// Actual position of the checkpoint of a block
+static size_t block_offset(const struct IncLexer* lexer, size_t block) {
+  size_t shift = block >= lexer->shift_from ? lexer->shift_offset : 0;
+  return lexer->blocks[block]->offset + shift;
+}
+
+static size_t block_line(const struct IncLexer* lexer, size_t block) {
+  size_t shift = block >= lexer->shift_from ? lexer->shift_lines : 0;
+  return lexer->blocks[block]->line_num + shift;
+}
+
+// Actual end of a token
+static size_t token_end(const struct IncLexer* lexer, size_t block, size_t index) {
+  return block_offset(lexer, block) + lexer->blocks[block]->tokens[index].end;
+}
+
+// Lexer state before the token at `index` in a block
+static void state_before(const struct IncLexer* lexer, size_t block, size_t index,
+                         size_t* offset, size_t* line_num) {
+  *offset = block_offset(lexer, block);
+  *line_num = block_line(lexer, block);
+  if (index > 0) {
+    *offset += lexer->blocks[block]->tokens[index - 1].end;
+    *line_num += lexer->blocks[block]->tokens[index - 1].line_num;
+  }
+}
+
+// Append tokens [from, to) of a block, moved by the given deltas
+static void run_push_block(struct TokenRun* run, const struct IncLexer* lexer, size_t block,
+                           size_t from, size_t to, size_t offset_delta, size_t line_delta) {
+  size_t offset = block_offset(lexer, block) + offset_delta;
+  size_t line_num = block_line(lexer, block) + line_delta;
+  for (size_t i = from; i < to; i++) {
+    const struct LexedToken* token = &lexer->blocks[block]->tokens[i];
+    run_push(run, token->type, offset + token->end, line_num + token->line_num);
+  }
+}
+
+// Add a shift to the checkpoints of blocks [from, to)
+static void shift_blocks(struct IncLexer* lexer, size_t from, size_t to, size_t offset_delta,
+                         size_t line_delta) {
+  for (size_t i = from; i < to; i++) {
+    lexer->blocks[i]->offset += offset_delta;
+    lexer->blocks[i]->line_num += line_delta;
+  }
+}
+
+// Replace blocks [first, last) with blocks holding the tokens in `run`. The
+// lexer state before the first token in the run is at `offset`, `line_num`.
+// The new blocks have no pending shift.
+static void replace_blocks(struct IncLexer* lexer, size_t first, size_t last,
+                           const struct TokenRun* run, size_t offset, size_t line_num) {
+  size_t num_new = (run->length + INC_LEXER_BLOCK_TOKENS - 1) / INC_LEXER_BLOCK_TOKENS;
+  size_t num_blocks = lexer->num_blocks - (last - first) + num_new;
+  if (num_blocks > lexer->blocks_capacity) {
+    lexer->blocks_capacity = num_blocks * 2;
+    REALLOC(lexer->blocks, lexer->blocks_capacity * sizeof(struct TokenBlock*));
+  }
+  for (size_t i = first; i < last; i++) {
+    lexer->num_tokens -= lexer->blocks[i]->num_tokens;
+    free(lexer->blocks[i]);
+  }
+  if (num_new != last - first) {
+    memmove(lexer->blocks + first + num_new, lexer->blocks + last,
+            (lexer->num_blocks - last) * sizeof(struct TokenBlock*));
+  }
+  lexer->num_blocks = num_blocks;
+  lexer->num_tokens += run->length;
+  if (lexer->shift_from >= last) {
+    lexer->shift_from = lexer->shift_from - (last - first) + num_new;
+  }
+
+  size_t next = 0;
+  for (size_t b = 0; b < num_new; b++) {
+    struct TokenBlock* block = malloc(sizeof(struct TokenBlock));
+    if (!block) {
+      DIE_ERR("malloc()");
+    }
+    block->offset = offset;
+    block->line_num = line_num;
+    block->num_tokens = 0;
+    for (; next < run->length && block->num_tokens < INC_LEXER_BLOCK_TOKENS; next++) {
+      struct LexedToken* token = &block->tokens[block->num_tokens++];
+      token->type = run->tokens[next].type;
+      token->end = run->tokens[next].end - block->offset;
+      token->line_num = run->tokens[next].line_num - block->line_num;
+      offset = run->tokens[next].end;
+      line_num = run->tokens[next].line_num;
+    }
+    lexer->blocks[first + b] = block;
+  }
+}
+
+void inc_lexer_init(struct IncLexer* lexer, const char* source) {
+  lexer->source = source;
+  lexer->blocks = NULL;
+  lexer->num_blocks = lexer->blocks_capacity = lexer->num_tokens = 0;
+  lexer->shift_from = lexer->shift_offset = lexer->shift_lines = 0;
+
+  struct TokenRun run = { NULL, 0, 0 };
+  struct Lexer full;
+  struct Token token;
+  lexer_init(&full, source);
+  while (lexer_tok(&full, &token)) {
+    run_push(&run, token.type, full.current_offset, full.line_num);
+  }
+  replace_blocks(lexer, 0, 0, &run, 0, 0);
+  free(run.tokens);
+}
+
+void inc_lexer_fini(struct IncLexer* lexer) {
+  for (size_t i = 0; i < lexer->num_blocks; i++) {
+    free(lexer->blocks[i]);
+  }
+  free(lexer->blocks);
+}
+
+// Find the first block whose last token ends after `offset`
+static size_t find_block(const struct IncLexer* lexer, size_t offset) {
+  size_t low = 0, high = lexer->num_blocks;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (token_end(lexer, mid, lexer->blocks[mid]->num_tokens - 1) > offset) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return low;
+}
+
+size_t inc_lexer_edit(struct IncLexer* lexer, const char* source, size_t offset,
+                      size_t removed_length, size_t inserted_length) {
+  size_t removed_end = offset + removed_length;
+
+  // Lexing a token looks at most one byte past its end, so the first token
+  // which could have changed is the first one that ends at `offset - 1` or
+  // later. Re-lex from the state just before it.
+  size_t first = find_block(lexer, offset < 2 ? 0 : offset - 2), index = 0;
+  if (first < lexer->num_blocks) {
+    while (token_end(lexer, first, index) + 1 < offset) {
+      index++;
+    }
+  } else if (first > 0) {
+    first--;
+    index = lexer->blocks[first]->num_tokens;
+  }
+  size_t restart_offset = 0, restart_line = 0;
+  size_t checkpoint_offset = 0, checkpoint_line = 0;
+  struct TokenRun run = { NULL, 0, 0 };
+  if (first < lexer->num_blocks) {
+    state_before(lexer, first, index, &restart_offset, &restart_line);
+    checkpoint_offset = block_offset(lexer, first);
+    checkpoint_line = block_line(lexer, first);
+    run_push_block(&run, lexer, first, 0, index, 0, 0);
+  }
+
+  // Re-lex until a new token ends at the same place as an old token past the
+  // edit. Everything after that is lexed exactly as before, just moved.
+  size_t old_block = first, old_index = index, num_relexed = 0, line_delta = 0;
+  if (old_block < lexer->num_blocks && old_index == lexer->blocks[old_block]->num_tokens) {
+    old_block++;
+    old_index = 0;
+  }
+  bool resynced = false;
+  struct Lexer relexer;
+  struct Token token;
+  lexer->source = source;
+  lexer_init_at(&relexer, source, restart_offset, restart_line);
+  while (!resynced && lexer_tok(&relexer, &token)) {
+    run_push(&run, token.type, relexer.current_offset, relexer.line_num);
+    num_relexed++;
+    // Skip old tokens which end before this one. Both ends are offset so that
+    // they can be compared without going negative.
+    size_t new_end = relexer.current_offset + removed_length;
+    while (old_block < lexer->num_blocks) {
+      size_t old_end = token_end(lexer, old_block, old_index) + inserted_length;
+      if (old_end > new_end) {
+        break;
+      }
+      if (old_end == new_end && old_end >= removed_end + inserted_length) {
+        resynced = true;
+        line_delta = relexer.line_num - block_line(lexer, old_block)
+          - lexer->blocks[old_block]->tokens[old_index].line_num;
+      }
+      if (++old_index == lexer->blocks[old_block]->num_tokens) {
+        old_block++;
+        old_index = 0;
+      }
+      if (old_end == new_end) {
+        break;
+      }
+    }
+  }
+
+  // Keep the rest of the block we stopped in, and move all the blocks after
+  size_t last = lexer->num_blocks, offset_delta = inserted_length - removed_length;
+  if (resynced && old_block < lexer->num_blocks) {
+    last = old_block;
+    if (old_index > 0) {
+      run_push_block(&run, lexer, old_block, old_index, lexer->blocks[old_block]->num_tokens,
+                     offset_delta, line_delta);
+      last++;
+    }
+  }
+  // Keep a single range of blocks with a pending shift. Only the blocks
+  // between the previous edit and this one are touched.
+  if (lexer->shift_from >= lexer->num_blocks
+      || (lexer->shift_offset == 0 && lexer->shift_lines == 0)) {
+    lexer->shift_from = last;
+    lexer->shift_offset = lexer->shift_lines = 0;
+  }
+  if (lexer->shift_from < last) {
+    shift_blocks(lexer, lexer->shift_from, last, lexer->shift_offset, lexer->shift_lines);
+    lexer->shift_from = last;
+  } else {
+    shift_blocks(lexer, last, lexer->shift_from, offset_delta, line_delta);
+  }
+  lexer->shift_offset += offset_delta;
+  lexer->shift_lines += line_delta;
+  replace_blocks(lexer, first, last, &run, checkpoint_offset, checkpoint_line);
+  free(run.tokens);
+  return num_relexed;
+}
+
+void inc_lexer_seek(const struct IncLexer* lexer, size_t offset, struct IncLexerCursor* cursor) {
+  cursor->block = find_block(lexer, offset);
+  cursor->index = 0;
+  if (cursor->block < lexer->num_blocks) {
+    while (token_end(lexer, cursor->block, cursor->index) <= offset) {
+      cursor->index++;
+    }
+  }
+}
+
+bool inc_lexer_next(const struct IncLexer* lexer, struct IncLexerCursor* cursor,
+                    struct Token* token) {
+  size_t offset = 0, line_num = 0;
+  if (cursor->block < lexer->num_blocks) {
+    state_before(lexer, cursor->block, cursor->index, &offset, &line_num);
+  } else if (lexer->num_blocks > 0) {
+    size_t last = lexer->num_blocks - 1;
+    state_before(lexer, last, lexer->blocks[last]->num_tokens, &offset, &line_num);
+  }
+  struct Lexer relexer;
+  lexer_init_at(&relexer, lexer->source, offset, line_num);
+  if (!lexer_tok(&relexer, token)) {
+    return false;
+  }
+  if (++cursor->index == lexer->blocks[cursor->block]->num_tokens) {
+    cursor->block++;
+    cursor->index = 0;
+  }
+  return true;
+}
+
+#undef REALLOC
@@ -0,0 +1,74 @@
+#ifndef __BS_INC_LEXER_H__
+#define __BS_INC_LEXER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lexer.h"
+
+// Maximum number of tokens in a block
+#define INC_LEXER_BLOCK_TOKENS 256
+
+// Token remembered by the incremental lexer. Lexing of a token starts where
+// the previous one ended, so only the end of each token is stored.
+struct LexedToken {
+  enum TokenType type; // Type of token
+  size_t end;          // Offset just past the token, relative to the block
+  size_t line_num;     // Line number of the token, relative to the block
+};
+
+// A run of tokens, along with a checkpoint of the lexer state before the
+// first of them. Positions of tokens are relative to the checkpoint, so an
+// edit only has to move the checkpoints of the blocks after it.
+struct TokenBlock {
+  size_t offset;     // Source offset where lexing of the first token starts
+  size_t line_num;   // Line number at `offset`
+  size_t num_tokens; // Number of tokens in the block, never zero
+  struct LexedToken tokens[INC_LEXER_BLOCK_TOKENS];
+};
+
+// Lexer for a buffer which is edited in place, like in an editor. Edits only
+// re-lex from the closest token before the edit, until the token stream is the
+// same as before. With repeated edits in one place, like when typing, their
+// cost depends on the size of the edit rather than the size of the buffer.
+struct IncLexer {
+  const char* source;         // Buffer being lexed, owned by the caller
+  struct TokenBlock** blocks; // Tokens of the buffer, in order
+  size_t num_blocks;          // Number of blocks
+  size_t blocks_capacity;     // Allocated capacity of `blocks`
+  size_t num_tokens;          // Total number of tokens, not counting EOF
+  // An edit moves all the blocks after it. That is done lazily: blocks from
+  // `shift_from` onwards are `shift_offset` bytes and `shift_lines` lines
+  // further than their checkpoint says. These wrap around when moving back.
+  size_t shift_from;
+  size_t shift_offset;
+  size_t shift_lines;
+};
+
+// Position of a token in an incremental lexer
+struct IncLexerCursor {
+  size_t block; // Index of the block
+  size_t index; // Index of the token in the block
+};
+
+// Initialize the lexer, and lex all of `source`
+void inc_lexer_init(struct IncLexer* lexer, const char* source);
+
+// Free memory for the lexer
+void inc_lexer_fini(struct IncLexer* lexer);
+
+// Update the tokens after `removed_length` bytes at `offset` were replaced by
+// `inserted_length` bytes. `source` is the whole buffer after the edit, which
+// may have moved. Returns the number of tokens which were re-lexed.
+size_t inc_lexer_edit(struct IncLexer* lexer, const char* source, size_t offset,
+                      size_t removed_length, size_t inserted_length);
+
+// Point the cursor at the first token which ends after `offset`
+void inc_lexer_seek(const struct IncLexer* lexer, size_t offset, struct IncLexerCursor* cursor);
+
+// Get the token at the cursor, and advance it. This behaves like `lexer_tok`
+// on the current source.
+bool inc_lexer_next(const struct IncLexer* lexer, struct IncLexerCursor* cursor,
+                    struct Token* token);
+
+#endif  // __BS_INC_LEXER_H__
@@ -0,0 +1,51 @@
+#ifndef __BS_KEYWORD_HASH_H__
+#define __BS_KEYWORD_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lexer.h"
+
+// Keywords are recognized with a minimal perfect hash, which is generated at
+// build time by gen-keywords.c into "keywords.h". The hash splits keywords
+// into buckets, and each bucket has a displacement which moves all of its
+// keywords to free slots. Every identifier of the right length hashes to
+// exactly one slot, so it takes a single compare to tell if it's a keyword.
+
+// Number of buckets is 1 << KEYWORD_BUCKET_BITS
+#define KEYWORD_BUCKET_BITS 4
+
+// Longest keyword which fits in the table
+#define KEYWORD_MAX_SIZE 8
+
+// Entry in the keyword table. The text is padded with zeroes, so it can be
+// compared as a single word.
+struct Keyword {
+  char text[KEYWORD_MAX_SIZE]; // Text of the keyword
+  enum TokenType type;         // Token type for the keyword
+};
+
+// Hash an identifier by its length and first, second and last bytes. These
+// are different for every keyword, and cheap to get at. The identifier must
+// be at least 2 bytes long.
+static inline uint32_t keyword_hash(const char* text, size_t length, uint64_t multiplier) {
+  uint64_t key = (uint64_t) (uint8_t) text[0]
+    | ((uint64_t) (uint8_t) text[1] << 8)
+    | ((uint64_t) (uint8_t) text[length - 1] << 16)
+    | ((uint64_t) length << 24);
+  return (uint32_t) ((key * multiplier) >> 32);
+}
+
+static inline size_t keyword_bucket(uint32_t hash) {
+  return hash >> (32 - KEYWORD_BUCKET_BITS);
+}
+
+// Slot in the keyword table, given the displacement of the bucket, which is
+// less than `num_keywords`. The low bits of the hash are scaled to a slot with
+// a multiply rather than a modulo, and the displacement wraps around.
+static inline size_t keyword_slot(uint32_t hash, uint32_t displacement, size_t num_keywords) {
+  size_t slot = (((hash & 0xffff) * num_keywords) >> 16) + displacement;
+  return slot >= num_keywords ? slot - num_keywords : slot;
+}
+
+#endif  // __BS_KEYWORD_HASH_H__
@@ -0,0 +1,143 @@
+#include "lexer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "log.h"
+
+#define NUM_FUNCTIONS 20000
+#define NUM_RUNS 20
+
+// Generate a large script, with a realistic mix of indentation, comments,
+// identifiers and strings
+static char* build_code_source(size_t* length) {
+  size_t capacity = NUM_FUNCTIONS * 512;
+  char* source = malloc(capacity);
+  CHECK(source != NULL);
+  *length = 0;
+  for (size_t i = 0; i < NUM_FUNCTIONS; i++) {
+    *length += snprintf(source + *length, capacity - *length,
+                        "// Compute the configuration value for entry number %zu\n"
+                        "fn configuration_value_%zu(argument_one, argument_two) {\n"
+                        "    let description = \"entry %zu: a fairly long string literal\";\n"
+                        "    if argument_one < %zu {\n"
+                        "        return argument_two * %zu.25; // scale it\n"
+                        "    }\n"
+                        "    log_message(description, argument_one + argument_two);\n"
+                        "}\n\n", i, i, i, i, i);
+    CHECK(*length < capacity);
+  }
+  return source;
+}
+
+// Generate a script which is mostly documentation and messages, where the
+// lexer spends its time in long runs of the same kind of byte
+static char* build_prose_source(size_t* length) {
+  size_t capacity = NUM_FUNCTIONS * 512;
+  char* source = malloc(capacity);
+  CHECK(source != NULL);
+  *length = 0;
+  for (size_t i = 0; i < NUM_FUNCTIONS; i++) {
+    *length += snprintf(source + *length, capacity - *length,
+                        "// Entry %zu. The value below is shown to the user when the\n"
+                        "// configuration could not be loaded, so keep it readable.\n"
+                        "let message_%zu = \"The configuration file could not be loaded, "
+                        "please check that it exists and is readable by this user.\";\n"
+                        "                                    // (aligned note)\n", i, i);
+    CHECK(*length < capacity);
+  }
+  return source;
+}
+
+// Generate a script which is mostly identifiers and keywords, so that telling
+// them apart is a large part of lexing
+static char* build_identifier_source(size_t* length) {
+  static const char* const WORDS[] = {
+    "let", "value", "if", "index", "return", "result", "for", "item", "in", "items",
+    "while", "count", "not", "nil", "fn", "f", "self", "struct", "node", "true",
+    "and", "or", "else", "element", "yield", "configuration", "break", "x",
+  };
+  size_t num_words = sizeof(WORDS) / sizeof(WORDS[0]);
+  size_t capacity = NUM_FUNCTIONS * 512;
+  char* source = malloc(capacity);
+  CHECK(source != NULL);
+  *length = 0;
+  uint64_t state = 1;
+  for (size_t i = 0; i < NUM_FUNCTIONS * 40; i++) {
+    // Pick words in a pseudo-random order, so that the branch predictor can't
+    // learn the sequence
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    *length += snprintf(source + *length, capacity - *length, "%s%s",
+                        WORDS[(state >> 33) % num_words], i % 12 == 11 ? "\n" : " ");
+    CHECK(*length < capacity);
+  }
+  return source;
+}
+
+// Lex the whole source a few times, and report the best run, since a single
+// pass is short enough to be noisy
+static void lex(const char* label, char* source, size_t length) {
+  size_t num_tokens = 0;
+  uint64_t best_ns = UINT64_MAX;
+  for (size_t i = 0; i < NUM_RUNS; i++) {
+    struct Lexer lexer;
+    struct Token token;
+    num_tokens = 0;
+    uint64_t start = bench_now_ns();
+    lexer_init(&lexer, source);
+    while (lexer_tok(&lexer, &token)) {
+      bench_consume(&token);
+      num_tokens++;
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    if (elapsed < best_ns) {
+      best_ns = elapsed;
+    }
+  }
+  char report[64];
+  bench_report(label, (double) length * 1000.0 / (double) best_ns, "MB/s");
+  snprintf(report, sizeof(report), "%s per token", label);
+  bench_report(report, (double) best_ns / (double) num_tokens, "ns");
+}
+
+// Like `lex`, but into a token buffer in windows, the way the parser does
+static void lex_buffered(const char* label, const char* source, size_t length) {
+  uint64_t best_ns = UINT64_MAX;
+  for (size_t i = 0; i < NUM_RUNS; i++) {
+    struct Lexer lexer;
+    struct TokenBuffer buffer;
+    token_buffer_init(&buffer, source);
+    uint64_t start = bench_now_ns();
+    lexer_init(&lexer, source);
+    while (token_buffer_lex(&buffer, &lexer, 1024)) {
+      bench_consume(buffer.types);
+      token_buffer_discard(&buffer, buffer.length);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    if (elapsed < best_ns) {
+      best_ns = elapsed;
+    }
+    token_buffer_fini(&buffer);
+  }
+  bench_report(label, (double) length * 1000.0 / (double) best_ns, "MB/s");
+}
+
+BENCH(Lexer, Throughput) {
+  size_t length;
+  char* source = build_code_source(&length);
+  lex("code", source, length);
+  lex_buffered("code, into a token buffer", source, length);
+  free(source);
+  source = build_prose_source(&length);
+  lex("comments and strings", source, length);
+  free(source);
+}
+
+BENCH(Lexer, Identifiers) {
+  size_t length;
+  char* source = build_identifier_source(&length);
+  lex("identifiers and keywords", source, length);
+  free(source);
+}
@@ -1,5 +1,7 @@
 #include "lexer.h"
 
+#include <string.h>
+
 #include "string.h"
 #include "test.h"
 
@@ -38,6 +40,51 @@ TEST(Lexer, Primitives) {
   ASSERT_LEXER_AT_END();
 }
 
+TEST(Lexer, Keywords) {
+  struct Lexer lexer;
+  struct Str token_str;
+  struct Token token;
+  lexer_init(&lexer, "true false nil fn and or not pub let for in if else while struct break "
+             "continue self require return yield varargs");
+  ASSERT_NEXT_IS_TOKEN(TOK_True, "true", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_False, "false", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Nil, "nil", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Fn, "fn", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_And, "and", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Or, "or", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Not, "not", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Pub, "pub", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Let, "let", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_For, "for", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_In, "in", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_If, "if", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Else, "else", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_While, "while", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Struct, "struct", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Break, "break", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Continue, "continue", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Self, "self", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Require, "require", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Return, "return", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Yield, "yield", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Varargs, "varargs", 0);
+  ASSERT_LEXER_AT_END();
+  // Identifiers which are close to keywords
+  lexer_init(&lexer, "nii ni nils f fo fnn iff _if lets continues returns");
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "nii", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "ni", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "nils", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "f", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "fo", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "fnn", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "iff", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "_if", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "lets", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "continues", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "returns", 0);
+  ASSERT_LEXER_AT_END();
+}
+
 TEST(Lexer, FibFunction) {
   struct Lexer lexer;
   struct Str token_str;
@@ -80,3 +127,92 @@ TEST(Lexer, FibFunction) {
   ASSERT_NEXT_IS_TOKEN(TOK_RightCurBr, "}", 6);
   ASSERT_LEXER_AT_END();
 }
+
+TEST(Lexer, IntegerFollowedByDot) {
+  struct Lexer lexer;
+  struct Str token_str;
+  struct Token token;
+  lexer_init(&lexer, "1.x 2.");
+  ASSERT_NEXT_IS_TOKEN(TOK_Integer, "1", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Dot, ".", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "x", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Integer, "2", 0);
+  ASSERT_NEXT_IS_TOKEN(TOK_Dot, ".", 0);
+  ASSERT_LEXER_AT_END();
+}
+
+TEST(Lexer, LineLexer) {
+  struct LineLexer lexer;
+  line_lexer_init(&lexer);
+  ASSERT(!line_lexer_feed(&lexer, "fn f(a) {\n"));
+  ASSERT(!line_lexer_feed(&lexer, "fn f(a) {\n  let s = \"{\n"));
+  ASSERT(!line_lexer_feed(&lexer, "fn f(a) {\n  let s = \"{\n\";\n  [a, (a\n"));
+  ASSERT(!line_lexer_feed(&lexer, "fn f(a) {\n  let s = \"{\n\";\n  [a, (a\n)]\n"));
+  ASSERT(line_lexer_feed(&lexer, "fn f(a) {\n  let s = \"{\n\";\n  [a, (a\n)]\n}\n"));
+  ASSERT_INT_EQ(lexer.line_num, 5);
+  // A token at the end of the input is lexed again, in case it goes on
+  line_lexer_init(&lexer);
+  ASSERT(!line_lexer_feed(&lexer, "(a"));
+  ASSERT(!line_lexer_feed(&lexer, "(ab"));
+  ASSERT(line_lexer_feed(&lexer, "(ab)"));
+  // Stray closing brackets are left for the parser to complain about
+  line_lexer_init(&lexer);
+  ASSERT(line_lexer_feed(&lexer, "}\n"));
+}
+
+TEST(Lexer, LongRuns) {
+  struct Lexer lexer;
+  struct Str token_str;
+  struct Token token;
+  // Runs cross vector blocks, and the source starts at every alignment
+  char buffer[256];
+  const char* source = "  \t  // a comment that is longer than a single vector block\n"
+    "   an_identifier_which_is_longer_than_thirty_two_bytes\r\n"
+    "\"a string \\\" with an escaped quote,\n and a newline\" x";
+  for (size_t shift = 0; shift < 32; shift++) {
+    memcpy(buffer + shift, source, strlen(source) + 1);
+    lexer_init(&lexer, buffer + shift);
+    ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "an_identifier_which_is_longer_than_thirty_two_bytes", 1);
+    ASSERT_NEXT_IS_TOKEN(TOK_String, "a string \\\" with an escaped quote,\n and a newline", 3);
+    ASSERT_NEXT_IS_TOKEN(TOK_Identifier, "x", 3);
+    ASSERT_LEXER_AT_END();
+  }
+}
+
+TEST(Lexer, TokenBuffer) {
+  struct Lexer lexer;
+  struct Str token_str;
+  struct Token token, buffered;
+  const char* source = "let s = \"a\nb\" @ x;\n  y";
+  struct TokenBuffer buffer;
+  token_buffer_init(&buffer, source);
+  lexer_init(&lexer, source);
+  // Lex in small batches, which each end with the EOF token at the end
+  while (token_buffer_lex(&buffer, &lexer, 3)) {}
+  ASSERT_INT_EQ(buffer.length, 9);
+  ASSERT_INT_EQ(buffer.num_errors, 1);
+  // The range of a string includes its quotes
+  ASSERT_INT_EQ(buffer.offsets[3], 8);
+  ASSERT_INT_EQ(token_buffer_end(&buffer, 3), 13);
+  // Tokens are the same as those from `lexer_tok`
+  lexer_init(&lexer, source);
+  for (size_t i = 0; i < buffer.length; i++) {
+    token_buffer_get(&buffer, i, &buffered);
+    if (i + 1 < buffer.length) {
+      ASSERT(lexer_tok(&lexer, &token));
+    } else {
+      ASSERT_LEXER_AT_END();
+    }
+    ASSERT(buffered.type == token.type);
+    ASSERT_INT_EQ(buffered.line_num, token.line_num);
+    ASSERT_STR_EQ(buffered.text, token.text);
+  }
+  // Discarding tokens keeps the error message with its token
+  token_buffer_discard(&buffer, 2);
+  ASSERT(buffer.types[2] == TOK_Error);
+  ASSERT(str_init(&token_str, "unexpected character", SIZE_MAX));
+  ASSERT_STR_EQ(token_buffer_text(&buffer, 2), token_str);
+  ASSERT(str_init(&token_str, "y", SIZE_MAX));
+  ASSERT_STR_EQ(token_buffer_text(&buffer, 5), token_str);
+  token_buffer_fini(&buffer);
+}
@@ -2,12 +2,22 @@
 
 #include <ctype.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "keyword-hash.h"
+#include "keywords.h"
 #include "log.h"
+#include "simd.h"
 #include "string.h"
 
+#define REALLOC(PTR, SIZE) do {        \
+    if (!(PTR = realloc(PTR, SIZE))) { \
+      DIE_ERR("realloc()");            \
+    }                                  \
+  } while (0)
+
 const char* token_type_to_string(enum TokenType token_type) {
   switch (token_type) {
   case TOK_Integer:          return "integer";
@@ -89,9 +99,17 @@ void token_init_undefined(struct Token* token) {
 
 void lexer_init(struct Lexer* lexer, const char *source) {
   lexer->source = source;
+  lexer->valid_utf8 = utf8_validate((const uint8_t*) source, strlen(source));
   lexer->start_offset = lexer->current_offset = lexer->line_num = 0;
 }
 
+void lexer_init_at(struct Lexer* lexer, const char* source, size_t offset, size_t line_num) {
+  lexer->source = source;
+  lexer->valid_utf8 = false;
+  lexer->start_offset = lexer->current_offset = offset;
+  lexer->line_num = line_num;
+}
+
 static bool is_at_end(const struct Lexer* lexer) {
   return lexer->source[lexer->current_offset] == '\0';
 }
@@ -120,20 +138,98 @@ static bool match(struct Lexer* lexer, char c) {
   return false;
 }
 
+// Scanners for runs of bytes that belong to the same token. Each returns the
+// length of the run at `start`, and always stops at the NUL terminator. Runs
+// are classified a whole vector at a time where SIMD is available.
+static inline bool is_identifier_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Whitespace other than newlines, which have to be counted
+static inline bool is_blank_char(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool ends_comment(char c) {
+  return c == '\n' || c == '\0';
+}
+
+// Characters in a string literal which need a closer look
+static inline bool is_special_string_char(char c) {
+  return c == '"' || c == '\\' || c == '\n' || c == '\0';
+}
+
+#if SIMD_WIDTH > 0
+static inline uint32_t identifier_stops(SimdBytes v) {
+  // Setting 0x20 folds upper case letters onto lower case
+  SimdBytes letter = SIMD_IN_RANGE(SIMD_OR(v, SIMD_SPLAT(0x20)), 'a', 'z');
+  SimdBytes digit = SIMD_IN_RANGE(v, '0', '9');
+  return ~SIMD_MASK(SIMD_OR(SIMD_OR(letter, digit), SIMD_EQ(v, SIMD_SPLAT('_')))) & SIMD_FULL_MASK;
+}
+
+static inline uint32_t blank_stops(SimdBytes v) {
+  SimdBytes blank = SIMD_OR(SIMD_EQ(v, SIMD_SPLAT(' ')), SIMD_EQ(v, SIMD_SPLAT('\t')));
+  blank = SIMD_OR(blank, SIMD_IN_RANGE(v, '\v', '\r'));
+  return ~SIMD_MASK(blank) & SIMD_FULL_MASK;
+}
+
+static inline uint32_t comment_stops(SimdBytes v) {
+  return SIMD_MASK(SIMD_OR(SIMD_EQ(v, SIMD_SPLAT('\n')), SIMD_EQ(v, SIMD_SPLAT('\0'))));
+}
+
+static inline uint32_t string_stops(SimdBytes v) {
+  SimdBytes quote = SIMD_OR(SIMD_EQ(v, SIMD_SPLAT('"')), SIMD_EQ(v, SIMD_SPLAT('\\')));
+  SimdBytes end = SIMD_OR(SIMD_EQ(v, SIMD_SPLAT('\n')), SIMD_EQ(v, SIMD_SPLAT('\0')));
+  return SIMD_MASK(SIMD_OR(quote, end));
+}
+
+// Loads are aligned, with the bytes before `start` in the first block masked
+// off, so that we never read into a page past the terminator.
+#define DEFINE_SCAN(NAME, VECTOR_STOPS, SCALAR_CONTINUES)                     \
+  SIMD_NO_SANITIZE static size_t NAME(const char* start) {                    \
+    size_t misalign = (uintptr_t) start % SIMD_WIDTH;                         \
+    const char* block = start - misalign;                                     \
+    uint32_t stops = VECTOR_STOPS(SIMD_LOAD(block)) >> misalign << misalign;  \
+    while (!stops) {                                                          \
+      block += SIMD_WIDTH;                                                    \
+      stops = VECTOR_STOPS(SIMD_LOAD(block));                                 \
+    }                                                                         \
+    return (size_t) (block + simd_first(stops) - start);                      \
+  }
+#else
+#define DEFINE_SCAN(NAME, VECTOR_STOPS, SCALAR_CONTINUES) \
+  static size_t NAME(const char* start) {                 \
+    const char* end = start;                              \
+    while (SCALAR_CONTINUES(*end)) {                      \
+      end++;                                              \
+    }                                                     \
+    return (size_t) (end - start);                        \
+  }
+#endif
+
+#define NOT_SPECIAL_STRING_CHAR(C) !is_special_string_char(C)
+#define NOT_END_OF_COMMENT(C) !ends_comment(C)
+
+DEFINE_SCAN(scan_identifier, identifier_stops, is_identifier_char)
+DEFINE_SCAN(scan_blanks, blank_stops, is_blank_char)
+DEFINE_SCAN(scan_comment, comment_stops, NOT_END_OF_COMMENT)
+DEFINE_SCAN(scan_string, string_stops, NOT_SPECIAL_STRING_CHAR)
+
+#undef NOT_END_OF_COMMENT
+#undef NOT_SPECIAL_STRING_CHAR
+#undef DEFINE_SCAN
+
 static void skip_whitespace_and_comments(struct Lexer* lexer) {
-  while (!is_at_end(lexer)) {
+  while (true) {
+    lexer->current_offset += scan_blanks(lexer->source + lexer->current_offset);
     char c = peek(lexer);
-    if (isspace(c)) {
-      if (c == '\n') {
-        lexer->line_num++;
-      }
+    if (c == '\n') {
+      lexer->line_num++;
       advance(lexer);
     } else if (c == '/' && peek2(lexer) == '/') {
       advance(lexer);
       advance(lexer);
-      while (!is_at_end(lexer) && peek(lexer) != '\n') {
-        advance(lexer);
-      }
+      lexer->current_offset += scan_comment(lexer->source + lexer->current_offset);
     } else {
       break;
     }
@@ -148,62 +244,38 @@ static inline size_t tok_len(const struct Lexer* lexer) {
   return lexer->current_offset - lexer->start_offset;
 }
 
-static bool make_invalid_utf8_error(const struct Lexer* lexer, struct Token* token) {
-  token->type = TOK_Error;
-  token->line_num = lexer->line_num;
-  str_init(&token->text, "invalid UTF-8", SIZE_MAX);
-  return true;
-}
-
-static bool make_unexpected_char_error(const struct Lexer* lexer, struct Token* token) {
-  token->type = TOK_Error;
-  token->line_num = lexer->line_num;
-  str_init(&token->text, "unexpected character", SIZE_MAX);
-  return true;
-}
-
-static bool make_unterminated_string_error(const struct Lexer* lexer, struct Token* token) {
-  token->type = TOK_Error;
-  token->line_num = lexer->line_num;
-  str_init(&token->text, "unterminated string", SIZE_MAX);
-  return true;
-}
-
-static bool make_tok(const struct Lexer* lexer, struct Token* token, enum TokenType type) {
-  token->type = type;
-  token->line_num = lexer->line_num;
-  if (!str_init(&token->text, tok_start(lexer), tok_len(lexer))) {
-    return make_invalid_utf8_error(lexer, token);
-  }
-  return true;
-}
-
-static bool string(struct Lexer* lexer, struct Token* token) {
-  while (!is_at_end(lexer) && peek(lexer) != '"') {
+// Lex the rest of a string, after the opening quote
+static enum TokenType string(struct Lexer* lexer, const char** error) {
+  while (true) {
+    lexer->current_offset += scan_string(lexer->source + lexer->current_offset);
+    if (is_at_end(lexer) || peek(lexer) == '"') {
+      break;
+    }
     char c = advance(lexer);
     if (c == '\\') {
       if (is_at_end(lexer)) {
         break;
       }
       advance(lexer);
-    } else if (c == '\n') {
+    } else {
       lexer->line_num++;
     }
   }
   if (is_at_end(lexer)) {
-    return make_unterminated_string_error(lexer, token);
+    *error = "unterminated string";
+    return TOK_Error;
   }
   advance(lexer);
-  // Need to trim off opening and closing quotes, so we can't use `make_tok`
-  token->type = TOK_String;
-  token->line_num = lexer->line_num;
-  if (!str_init(&token->text, tok_start(lexer) + 1, tok_len(lexer) - 2)) {
-    return make_invalid_utf8_error(lexer, token);
+  // Strings are the only tokens which can have non-ASCII characters
+  if (!lexer->valid_utf8
+      && !utf8_validate((const uint8_t*) tok_start(lexer) + 1, tok_len(lexer) - 2)) {
+    *error = "invalid UTF-8";
+    return TOK_Error;
   }
-  return true;
+  return TOK_String;
 }
 
-static bool number(struct Lexer* lexer, struct Token* token) {
+static enum TokenType number(struct Lexer* lexer) {
   bool found_point = false;
   while (!is_at_end(lexer)) {
     char c = peek(lexer);
@@ -211,229 +283,380 @@ static bool number(struct Lexer* lexer, struct Token* token) {
       if (found_point) {
         break;
       }
-      if (isdigit(peek2(lexer))) {
-        advance(lexer);
-        advance(lexer);
-        found_point = true;
+      if (!isdigit(peek2(lexer))) {
+        break;
       }
+      advance(lexer);
+      advance(lexer);
+      found_point = true;
     } else if (isdigit(c)) {
       advance(lexer);
     } else {
       break;
     }
   }
-  if (found_point) {
-    return make_tok(lexer, token, TOK_Float);
-  }
-  return make_tok(lexer, token, TOK_Integer);
+  return found_point ? TOK_Float : TOK_Integer;
 }
 
-static enum TokenType check_keyword(const struct Lexer* lexer, size_t offset, size_t len,
-                                    const char *rem, enum TokenType type) {
-  if (tok_len(lexer) == offset + len && !memcmp(tok_start(lexer) + offset, rem, len)) {
-    return type;
+// Load an identifier into a word, padded with zeroes like the keyword table.
+// Loading a whole word can read past the end of the source, which is fine as
+// long as it doesn't cross into the next page.
+SIMD_NO_SANITIZE static inline uint64_t identifier_word(const char* text, size_t length) {
+  static const uint8_t MASK_BYTES[2 * KEYWORD_MAX_SIZE] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0, 0, 0, 0, 0,
+  };
+  uint64_t word = 0, mask;
+  if (((uintptr_t) text & 4095) <= 4096 - sizeof(word)) {
+    memcpy(&word, text, sizeof(word));
+  } else {
+    memcpy(&word, text, length);
   }
-  return TOK_Identifier;
+  memcpy(&mask, MASK_BYTES + KEYWORD_MAX_SIZE - length, sizeof(mask));
+  return word & mask;
 }
 
+// Keywords are looked up in a perfect hash table, which is generated at build
+// time. Identifiers have no zero bytes, so comparing the padded words also
+// compares the lengths.
 static enum TokenType keyword_or_identifier(const struct Lexer* lexer) {
-#define BYTE(I) (lexer->source[lexer->start_offset + (I)])
-
-  switch (BYTE(0)) {
-  case 'a': return check_keyword(lexer, 1, 2, "nd", TOK_And);
-  case 'b': return check_keyword(lexer, 1, 4, "reak", TOK_Break);
-  case 'c': return check_keyword(lexer, 1, 7, "ontinue", TOK_Continue);
-  case 'e': return check_keyword(lexer, 1, 3, "lse", TOK_Else);
-  case 'f':
-    if (tok_len(lexer) >= 2) {
-      switch (BYTE(1)) {
-      case 'a': return check_keyword(lexer, 2, 3, "lse", TOK_False);
-      case 'n':
-        if (tok_len(lexer) == 2) {
-          return TOK_Fn;
-        }
-        return TOK_Identifier;
-      case 'o':
-        if (tok_len(lexer) == 3 && BYTE(2) == 'r') {
-          return TOK_For;
-        }
-        return TOK_Identifier;
-      }
-    }
-    return TOK_Identifier;
-  case 'i':
-    if (tok_len(lexer) == 2) {
-      switch (BYTE(1)) {
-      case 'n': return TOK_In;
-      case 'f': return TOK_If;
-      }
-    }
-    return TOK_Identifier;
-  case 'l': return check_keyword(lexer, 1, 2, "et", TOK_Let);
-  case 'n':
-    if (tok_len(lexer) == 3) {
-      switch (BYTE(1)) {
-      case 'o': return BYTE(2) == 't' ? TOK_Not : TOK_Identifier;
-      case 'i': return BYTE(2) == 'i' ? TOK_Nil : TOK_Identifier;
-      }
-    }
-    return TOK_Identifier;
-  case 'o':
-    if (tok_len(lexer) == 2 && BYTE(1) == 'r') {
-      return TOK_Or;
-    }
-    return TOK_Identifier;
-  case 'p': return check_keyword(lexer, 1, 2, "ub", TOK_Pub);
-  case 'r':
-    if (tok_len(lexer) > 2 && BYTE(1) == 'e') {
-      switch (BYTE(2)) {
-      case 't': return check_keyword(lexer, 3, 3, "urn", TOK_Return);
-      case 'q': return check_keyword(lexer, 3, 4, "uire", TOK_Require);
-      }
-    }
-    return TOK_Identifier;
-  case 's':
-    if (tok_len(lexer) >= 4) {
-      switch (BYTE(1)) {
-      case 'e': return check_keyword(lexer, 2, 2, "lf", TOK_Self);
-      case 't': return check_keyword(lexer, 2, 4, "ruct", TOK_Struct);
-      }
-    }
-    return TOK_Identifier;
-  case 't': return check_keyword(lexer, 1, 3, "rue", TOK_True);
-  case 'v': return check_keyword(lexer, 1, 6, "arargs", TOK_Varargs);
-  case 'w': return check_keyword(lexer, 1, 4, "hile", TOK_While);
-  case 'y': return check_keyword(lexer, 1, 4, "ield", TOK_Yield);
-  default:
+  size_t length = tok_len(lexer);
+  if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH) {
     return TOK_Identifier;
   }
-
-#undef BYTE
+  const char* text = tok_start(lexer);
+  uint32_t hash = keyword_hash(text, length, KEYWORD_MULTIPLIER);
+  size_t slot = keyword_slot(hash, KEYWORD_DISPLACEMENTS[keyword_bucket(hash)], NUM_KEYWORDS);
+  uint64_t keyword;
+  memcpy(&keyword, KEYWORDS[slot].text, sizeof(keyword));
+  return identifier_word(text, length) == keyword ? KEYWORDS[slot].type : TOK_Identifier;
 }
 
-static bool identifier(struct Lexer* lexer, struct Token* token) {
-  while (!is_at_end(lexer)) {
-    char c = peek(lexer);
-    if (c == '_' || isalnum(c)) {
-      advance(lexer);
-    } else {
-      break;
-    }
-  }
-  return make_tok(lexer, token, keyword_or_identifier(lexer));
+static enum TokenType identifier(struct Lexer* lexer) {
+  lexer->current_offset += scan_identifier(lexer->source + lexer->current_offset);
+  return keyword_or_identifier(lexer);
 }
 
-bool lexer_tok(struct Lexer* lexer, struct Token* token) {
-#define MAKE_TOK(TYP) make_tok(lexer, token, TYP)
+// Lex the next token, which is left between `start_offset` and
+// `current_offset`. For errors, `*error` is set to what went wrong.
+static enum TokenType lex(struct Lexer* lexer, const char** error) {
 #define MATCH(C) match(lexer, C)
 
   skip_whitespace_and_comments(lexer);
+  lexer->start_offset = lexer->current_offset;
   if (is_at_end(lexer)) {
-    make_tok(lexer, token, TOK_EOF);
-    return false;
+    return TOK_EOF;
   }
-  lexer->start_offset = lexer->current_offset;
   char c = advance(lexer);
   switch (c) {
-  case ';': return MAKE_TOK(TOK_SemiColon);
-  case '{': return MAKE_TOK(TOK_LeftCurBr);
-  case '}': return MAKE_TOK(TOK_RightCurBr);
-  case '[': return MAKE_TOK(TOK_LeftSqBr);
-  case ']': return MAKE_TOK(TOK_RightSqBr);
-  case '(': return MAKE_TOK(TOK_LeftParen);
-  case ')': return MAKE_TOK(TOK_RightParen);
-  case ':': return MAKE_TOK(TOK_Colon);
-  case ',': return MAKE_TOK(TOK_Comma);
+  case ';': return TOK_SemiColon;
+  case '{': return TOK_LeftCurBr;
+  case '}': return TOK_RightCurBr;
+  case '[': return TOK_LeftSqBr;
+  case ']': return TOK_RightSqBr;
+  case '(': return TOK_LeftParen;
+  case ')': return TOK_RightParen;
+  case ':': return TOK_Colon;
+  case ',': return TOK_Comma;
   case '.':
     if (peek(lexer) == '.' && peek2(lexer) == '.') {
       advance(lexer);
       advance(lexer);
-      return MAKE_TOK(TOK_Ellipsis);
+      return TOK_Ellipsis;
     }
-    return MAKE_TOK(TOK_Dot);
+    return TOK_Dot;
   case '=':
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_Equal);
+      return TOK_Equal;
     }
-    return MAKE_TOK(TOK_Assign);
+    return TOK_Assign;
   case '!':
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_NotEqual);
+      return TOK_NotEqual;
     }
-    return MAKE_TOK(TOK_BitNot);
+    return TOK_BitNot;
   case '<':
     if (MATCH('<')) {
       if (MATCH('=')) {
-        return MAKE_TOK(TOK_ShiftLeftAssign);
+        return TOK_ShiftLeftAssign;
       }
-      return MAKE_TOK(TOK_ShiftLeft);
+      return TOK_ShiftLeft;
     }
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_LessEqual);
+      return TOK_LessEqual;
     }
-    return MAKE_TOK(TOK_LessThan);
+    return TOK_LessThan;
   case '>':
     if (MATCH('>')) {
       if (MATCH('=')) {
-        return MAKE_TOK(TOK_ShiftRightAssign);
+        return TOK_ShiftRightAssign;
       }
-      return MAKE_TOK(TOK_ShiftRight);
+      return TOK_ShiftRight;
     }
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_GreaterEqual);
+      return TOK_GreaterEqual;
     }
-    return MAKE_TOK(TOK_GreaterThan);
+    return TOK_GreaterThan;
   case '|':
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_BitOrAssign);
+      return TOK_BitOrAssign;
     }
-    return MAKE_TOK(TOK_BitOr);
+    return TOK_BitOr;
   case '^':
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_BitXorAssign);
+      return TOK_BitXorAssign;
     }
-    return MAKE_TOK(TOK_BitXor);
+    return TOK_BitXor;
   case '&':
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_BitAndAssign);
+      return TOK_BitAndAssign;
     }
-    return MAKE_TOK(TOK_BitAnd);
+    return TOK_BitAnd;
   case '+':
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_AddAssign);
+      return TOK_AddAssign;
     }
-    return MAKE_TOK(TOK_Plus);
+    return TOK_Plus;
   case '-':
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_SubAssign);
+      return TOK_SubAssign;
     }
-    return MAKE_TOK(TOK_Minus);
+    return TOK_Minus;
   case '*':
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_MulAssign);
+      return TOK_MulAssign;
     }
-    return MAKE_TOK(TOK_Star);
+    return TOK_Star;
   case '/':
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_DivAssign);
+      return TOK_DivAssign;
     }
-    return MAKE_TOK(TOK_Slash);
+    return TOK_Slash;
   case '%':
     if (MATCH('=')) {
-      return MAKE_TOK(TOK_ModAssign);
+      return TOK_ModAssign;
     }
-    return MAKE_TOK(TOK_Percent);
-  case '"': return string(lexer, token);
+    return TOK_Percent;
+  case '"': return string(lexer, error);
   default:
     if (isdigit(c)) {
-      return number(lexer, token);
+      return number(lexer);
     }
     if (c == '_' || isalpha(c)) {
-      return identifier(lexer, token);
+      return identifier(lexer);
     }
-    return make_unexpected_char_error(lexer, token);
+    *error = "unexpected character";
+    return TOK_Error;
   }
 
 #undef MATCH
-#undef MAKE_TOK
 }
+
+bool lexer_tok(struct Lexer* lexer, struct Token* token) {
+  const char* error;
+  token->type = lex(lexer, &error);
+  token->line_num = lexer->line_num;
+  switch (token->type) {
+  case TOK_Error:
+    str_init(&token->text, error, SIZE_MAX);
+    return true;
+  case TOK_String:
+    // Trim off the quotes
+    str_init_valid(&token->text, tok_start(lexer) + 1, tok_len(lexer) - 2);
+    return true;
+  default:
+    // Everything else is ASCII
+    str_init_valid(&token->text, tok_start(lexer), tok_len(lexer));
+    return token->type != TOK_EOF;
+  }
+}
+
+void token_buffer_init(struct TokenBuffer* buffer, const char* source) {
+  buffer->source = source;
+  buffer->types = NULL;
+  buffer->offsets = buffer->lengths = buffer->line_nums = NULL;
+  buffer->length = buffer->capacity = 0;
+  buffer->errors = NULL;
+  buffer->num_errors = buffer->errors_capacity = 0;
+}
+
+void token_buffer_fini(struct TokenBuffer* buffer) {
+  free(buffer->types);
+  free(buffer->offsets);
+  free(buffer->lengths);
+  free(buffer->line_nums);
+  free(buffer->errors);
+}
+
+static void grow(struct TokenBuffer* buffer) {
+  buffer->capacity = buffer->capacity == 0 ? 64 : buffer->capacity * 2;
+  REALLOC(buffer->types, buffer->capacity * sizeof(uint8_t));
+  REALLOC(buffer->offsets, buffer->capacity * sizeof(uint32_t));
+  REALLOC(buffer->lengths, buffer->capacity * sizeof(uint32_t));
+  REALLOC(buffer->line_nums, buffer->capacity * sizeof(uint32_t));
+}
+
+void token_buffer_push(struct TokenBuffer* buffer, enum TokenType type, size_t offset,
+                       size_t length, size_t line_num) {
+  CHECK(offset + length <= UINT32_MAX);
+  if (buffer->length == buffer->capacity) {
+    grow(buffer);
+  }
+  buffer->types[buffer->length] = type;
+  buffer->offsets[buffer->length] = offset;
+  buffer->lengths[buffer->length] = length;
+  buffer->line_nums[buffer->length] = line_num;
+  buffer->length++;
+}
+
+static void push_error(struct TokenBuffer* buffer, const char* error) {
+  if (buffer->num_errors == buffer->errors_capacity) {
+    buffer->errors_capacity = buffer->errors_capacity == 0 ? 4 : buffer->errors_capacity * 2;
+    REALLOC(buffer->errors, buffer->errors_capacity * sizeof(struct TokenError));
+  }
+  buffer->errors[buffer->num_errors].index = buffer->length;
+  str_init(&buffer->errors[buffer->num_errors].message, error, SIZE_MAX);
+  buffer->num_errors++;
+}
+
+bool token_buffer_lex(struct TokenBuffer* buffer, struct Lexer* lexer, size_t max_tokens) {
+  CHECK(lexer->source == buffer->source);
+  const char* error;
+  bool more = true;
+  // Stores through a `uint8_t*` may alias anything, so keep the arrays in
+  // locals, or they would be loaded again for every token
+  size_t length = buffer->length;
+  uint8_t* types = buffer->types;
+  uint32_t* offsets = buffer->offsets;
+  uint32_t* lengths = buffer->lengths;
+  uint32_t* line_nums = buffer->line_nums;
+  for (size_t i = 0; i < max_tokens && more; i++) {
+    if (length == buffer->capacity) {
+      grow(buffer);
+      types = buffer->types;
+      offsets = buffer->offsets;
+      lengths = buffer->lengths;
+      line_nums = buffer->line_nums;
+    }
+    enum TokenType type = lex(lexer, &error);
+    if (type == TOK_Error) {
+      buffer->length = length;
+      push_error(buffer, error);
+    }
+    types[length] = type;
+    offsets[length] = lexer->start_offset;
+    lengths[length] = tok_len(lexer);
+    line_nums[length] = lexer->line_num;
+    length++;
+    more = type != TOK_EOF;
+  }
+  buffer->length = length;
+  // Offsets only grow, so checking the last one is enough
+  CHECK(lexer->current_offset <= UINT32_MAX);
+  return more;
+}
+
+void token_buffer_discard(struct TokenBuffer* buffer, size_t num_tokens) {
+  CHECK(num_tokens <= buffer->length);
+  size_t length = buffer->length - num_tokens;
+  memmove(buffer->types, buffer->types + num_tokens, length * sizeof(uint8_t));
+  memmove(buffer->offsets, buffer->offsets + num_tokens, length * sizeof(uint32_t));
+  memmove(buffer->lengths, buffer->lengths + num_tokens, length * sizeof(uint32_t));
+  memmove(buffer->line_nums, buffer->line_nums + num_tokens, length * sizeof(uint32_t));
+  buffer->length = length;
+
+  size_t first_error = 0;
+  while (first_error < buffer->num_errors && buffer->errors[first_error].index < num_tokens) {
+    first_error++;
+  }
+  buffer->num_errors -= first_error;
+  for (size_t i = 0; i < buffer->num_errors; i++) {
+    buffer->errors[i] = buffer->errors[first_error + i];
+    buffer->errors[i].index -= num_tokens;
+  }
+}
+
+size_t token_buffer_end(const struct TokenBuffer* buffer, size_t index) {
+  return (size_t) buffer->offsets[index] + buffer->lengths[index];
+}
+
+// Error tokens are rare, so just search for the message
+static const struct Str* error_message(const struct TokenBuffer* buffer, size_t index) {
+  size_t low = 0, high = buffer->num_errors;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (buffer->errors[mid].index < index) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  CHECK(low < buffer->num_errors && buffer->errors[low].index == index);
+  return &buffer->errors[low].message;
+}
+
+struct Str token_buffer_text(const struct TokenBuffer* buffer, size_t index) {
+  struct Str text;
+  const char* start = buffer->source + buffer->offsets[index];
+  switch ((enum TokenType) buffer->types[index]) {
+  case TOK_Error:
+    return *error_message(buffer, index);
+  case TOK_String:
+    // Trim off the quotes
+    str_init_valid(&text, start + 1, buffer->lengths[index] - 2);
+    return text;
+  default:
+    // Only tokens which were valid UTF-8 make it past the lexer
+    str_init_valid(&text, start, buffer->lengths[index]);
+    return text;
+  }
+}
+
+void token_buffer_get(const struct TokenBuffer* buffer, size_t index, struct Token* token) {
+  token->type = buffer->types[index];
+  token->text = token_buffer_text(buffer, index);
+  token->line_num = buffer->line_nums[index];
+}
+
+void line_lexer_init(struct LineLexer* lexer) {
+  lexer->offset = lexer->line_num = 0;
+  lexer->depth = 0;
+}
+
+bool line_lexer_feed(struct LineLexer* lexer, const char* source) {
+  struct Lexer resumed;
+  struct Token token;
+  int64_t depth = lexer->depth;
+  lexer_init_at(&resumed, source, lexer->offset, lexer->line_num);
+  while (lexer_tok(&resumed, &token)) {
+    switch (token.type) {
+    case TOK_LeftCurBr:
+    case TOK_LeftSqBr:
+    case TOK_LeftParen:
+      depth++;
+      break;
+    case TOK_RightCurBr:
+    case TOK_RightSqBr:
+    case TOK_RightParen:
+      depth--;
+      break;
+    case TOK_Error:
+      // Only an open string runs into the end of the input. Lex it again once
+      // there's more input.
+      if (is_at_end(&resumed)) {
+        return false;
+      }
+      break;
+    default:
+      break;
+    }
+    // The last token might go on in the next line, so don't skip past it
+    if (!is_at_end(&resumed)) {
+      lexer->offset = resumed.current_offset;
+      lexer->line_num = resumed.line_num;
+      lexer->depth = depth;
+    }
+  }
+  return depth <= 0;
+}
+
+#undef REALLOC
@@ -1,7 +1,9 @@
 #ifndef __BS_LEXER_H__
 #define __BS_LEXER_H__
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "string.h"
 
@@ -97,17 +99,97 @@ void token_init_undefined(struct Token* token);
 // Pull-based lexer. Call `lexer_tok` to advance
 struct Lexer {
   const char* source;  // Input source
+  bool valid_utf8;     // Whether all of the source is known to be valid UTF-8
   // Offsets to be used by the next call to `lexer_tok`
   size_t start_offset;
   size_t current_offset;
   size_t line_num;
 };
 
-// Initialize the lexer with input source code.
+// Initialize the lexer with input source code. This validates all of the
+// source once, so that tokens needn't be validated one by one.
 void lexer_init(struct Lexer* lexer, const char* source);
 
+// Initialize the lexer to resume from a position in the source. The lexer has
+// no state between tokens besides the offset and the line number, so this
+// continues exactly like a lexer which had lexed up to `offset`. Since only
+// part of the source may be lexed, tokens are validated one by one.
+void lexer_init_at(struct Lexer* lexer, const char* source, size_t offset, size_t line_num);
+
 // Get the next token (or error) from the lexer. Returns `false` if we're at
 // EOF, otherwise returns `true` regardless of token or error.
 bool lexer_tok(struct Lexer* lexer, struct Token* token);
 
+// Message for an error token
+struct TokenError {
+  size_t index;        // Index of the token in the buffer
+  struct Str message;  // What went wrong
+};
+
+// Tokens lexed ahead of time, as parallel arrays. That's far more compact than
+// an array of `struct Token`, and looking at the type of any token is a single
+// byte load. Offsets are 32-bit, so the source must be under 4 GiB.
+//
+// The range of a token covers all of its source, so the range of a string
+// includes its quotes, and the range of an error covers whatever the lexer
+// gave up on. That makes the buffer usable for highlighting as well.
+struct TokenBuffer {
+  const char* source;        // Source which the tokens are from
+  uint8_t* types;            // Type of each token
+  uint32_t* offsets;         // Source offset of the first byte of each token
+  uint32_t* lengths;         // Length of each token in the source
+  uint32_t* line_nums;       // Line number at the end of each token
+  size_t length;             // Number of tokens
+  size_t capacity;           // Allocated capacity of the arrays
+  struct TokenError* errors; // Messages for the error tokens, in order
+  size_t num_errors;         // Number of error messages
+  size_t errors_capacity;    // Allocated capacity of `errors`
+};
+
+// Initialize an empty buffer for tokens from `source`
+void token_buffer_init(struct TokenBuffer* buffer, const char* source);
+
+// Free memory for the buffer
+void token_buffer_fini(struct TokenBuffer* buffer);
+
+// Append a token
+void token_buffer_push(struct TokenBuffer* buffer, enum TokenType type, size_t offset,
+                       size_t length, size_t line_num);
+
+// Lex up to `max_tokens` tokens from `lexer`, which must be lexing the same
+// source, and append them. This skips building a `struct Token` for each, so
+// it's faster than calling `lexer_tok` in a loop. The EOF token is appended
+// too, and then this returns `false`.
+bool token_buffer_lex(struct TokenBuffer* buffer, struct Lexer* lexer, size_t max_tokens);
+
+// Drop the first `num_tokens` tokens, and move the rest to the front
+void token_buffer_discard(struct TokenBuffer* buffer, size_t num_tokens);
+
+// Offset just past the token at `index`
+size_t token_buffer_end(const struct TokenBuffer* buffer, size_t index);
+
+// Get the text of the token at `index`, like `lexer_tok` would
+struct Str token_buffer_text(const struct TokenBuffer* buffer, size_t index);
+
+// Get the token at `index`, like `lexer_tok` would have returned it
+void token_buffer_get(const struct TokenBuffer* buffer, size_t index, struct Token* token);
+
+// Lexer for source code which is typed in line by line, like in a REPL. Each
+// call picks up lexing where the previous one stopped, and keeps track of the
+// brackets which are still open. That tells whether the input could be
+// complete, without having to parse all of it again after every line.
+struct LineLexer {
+  size_t offset;   // Offset to resume lexing from
+  size_t line_num; // Line number at `offset`
+  int64_t depth;   // Number of brackets opened before `offset` and not closed yet
+};
+
+// Initialize the lexer, for empty input
+void line_lexer_init(struct LineLexer* lexer);
+
+// Lex the input up to its end, which has grown since the last call. Returns
+// `false` if the input is definitely incomplete, because a bracket or a string
+// is still open.
+bool line_lexer_feed(struct LineLexer* lexer, const char* source);
+
 #endif  // __BS_LEXER_H__
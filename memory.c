@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "object.h"
+
 #define MEM_DIE(FMT, ...) do {                                          \
     fprintf(stderr, "ERROR: %s:%d: " FMT "\n", file, line, __VA_ARGS__); \
     exit(1);                                                            \
@@ -22,6 +24,17 @@ void* mem_alloc(struct Memory* mem, size_t size, const char *file, int line) {
 
 void mem_init(struct Memory* mem) {
   mem->mem_used = 0;
+  mem->objects = NULL;
+}
+
+void mem_fini(struct Memory* mem) {
+  struct Object* obj = mem->objects;
+  while (obj) {
+    struct Object* next = obj->next;
+    object_free(mem, obj);
+    obj = next;
+  }
+  mem->objects = NULL;
 }
 
 // Free managed memory.
@@ -5,16 +5,23 @@
 
 #include "util.h"
 
+struct Object;
+
 // Handle to the "managed heap". This tracks allocations and frees to figure out
 // how much memory is in use. This will also track all allocated objects and act
 // as an entrypoint for the garbage collector.
 struct Memory {
-  size_t mem_used;  // Current amount of memory used for this BS instance
+  size_t mem_used;        // Current amount of memory used for this BS instance
+  struct Object* objects; // List of all allocated objects
 };
 
 // Initialize memory tracker
 void mem_init(struct Memory* mem);
 
+// Free all objects which are still allocated. Until there is a garbage
+// collector, this is the only point at which objects are freed.
+void mem_fini(struct Memory* mem);
+
 // Allocate managed memory.
 void* mem_alloc(struct Memory* mem, size_t size, const char *file, int line);
 
@@ -0,0 +1,28 @@
+#include "object.h"
+
+#include "log.h"
+
+static struct Object* object_alloc(struct Memory* mem, enum ObjectType type, size_t size) {
+  struct Object* obj = MEM_ALLOC(mem, size);
+  obj->type = type;
+  obj->next = mem->objects;
+  mem->objects = obj;
+  return obj;
+}
+
+struct ObjInteger* obj_integer_create(struct Memory* mem, int64_t i) {
+  struct ObjInteger* obj =
+    (struct ObjInteger*) object_alloc(mem, OBJ_Integer, sizeof(struct ObjInteger));
+  obj->i = i;
+  return obj;
+}
+
+void object_free(struct Memory* mem, struct Object* obj) {
+  switch (obj->type) {
+  case OBJ_Integer:
+    MEM_FREE(mem, obj, sizeof(struct ObjInteger));
+    break;
+  default:
+    UNREACHABLE();
+  }
+}
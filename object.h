@@ -0,0 +1,32 @@
+#ifndef __BS_OBJECT_H__
+#define __BS_OBJECT_H__
+
+#include <stdint.h>
+
+#include "memory.h"
+
+// Types of heap-allocated objects
+enum ObjectType {
+  OBJ_Integer,
+};
+
+// Header shared by all heap-allocated objects. Every object is linked into
+// the list in `struct Memory`, so that they can all be found and freed.
+struct Object {
+  enum ObjectType type; // Type of object
+  struct Object* next;  // Next object in the list of all objects
+};
+
+// An integer that's too large to be stored in an immediate NaN-boxed value
+struct ObjInteger {
+  struct Object obj;
+  int64_t i;
+};
+
+// Allocate a boxed integer
+struct ObjInteger* obj_integer_create(struct Memory* mem, int64_t i);
+
+// Free memory for an object. This doesn't unlink it from the object list.
+void object_free(struct Memory* mem, struct Object* obj);
+
+#endif  // __BS_OBJECT_H__
@@ -0,0 +1,327 @@
+#include "parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "bench.h"
+#include "lexer.h"
+#include "log.h"
+#include "writer.h"
+
+#define NUM_ENTRIES 20000
+#define NUM_RUNS 20
+
+// Generate a large config-like script, with lots of small nodes
+static char* build_config_source(size_t* length) {
+  size_t capacity = NUM_ENTRIES * 128;
+  char* source = malloc(capacity);
+  CHECK(source != NULL);
+  *length = 0;
+  for (size_t i = 0; i < NUM_ENTRIES; i++) {
+    *length += snprintf(source + *length, capacity - *length,
+                        "let entry = { \"id\": %zu, \"tags\": [1, 2, 3], "
+                        "\"scale\": %zu.5 * (2 + x) };\n", i, i);
+    CHECK(*length < capacity);
+  }
+  return source;
+}
+
+BENCH(Parser, ParseAndFreeLargeScript) {
+  size_t length;
+  char* source = build_config_source(&length);
+  struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+  uint64_t parse_ns = 0, free_ns = 0;
+  size_t num_pages = 0;
+  for (size_t i = 0; i < NUM_RUNS; i++) {
+    struct Arena arena;
+    bool incomplete_input = false;
+    arena_init(&arena);
+    uint64_t start = bench_now_ns();
+    struct Ast* ast = parse(&arena, source, writer, &incomplete_input);
+    uint64_t mid = bench_now_ns();
+    CHECK(ast != NULL);
+    bench_consume(ast);
+    num_pages = arena.num_pages;
+    arena_fini(&arena);
+    uint64_t end = bench_now_ns();
+    parse_ns += mid - start;
+    free_ns += end - mid;
+  }
+  bench_report("parse", (double) length * NUM_RUNS * 1000.0 / (double) parse_ns, "MB/s");
+  bench_report("free", (double) free_ns / NUM_RUNS / 1000.0, "us");
+  bench_report("arena pages", (double) num_pages, "pages");
+  file_writer_free((struct FileWriter*) writer);
+  free(source);
+}
+
+#define NUM_EXPRESSIONS 20000
+
+static const char* const BINARY_OPERATORS[] = {
+  "+", "-", "*", "/", "%", "<<", ">>", "&", "|", "^", "==", "<", ">=", "and", "or",
+};
+
+// Append a random expression with `depth` levels of operators. Arithmetic
+// operators come up more often than the rest, like in real code.
+static void random_expression(char* source, size_t* length, size_t capacity, uint64_t* state,
+                              size_t depth) {
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  uint32_t random = (uint32_t) (*state >> 33);
+  if (depth == 0) {
+    switch (random % 4) {
+    case 0:  *length += snprintf(source + *length, capacity - *length, "%u", random % 1000); break;
+    case 1:  *length += snprintf(source + *length, capacity - *length, "x%u", random % 16); break;
+    case 2:  *length += snprintf(source + *length, capacity - *length, "-y"); break;
+    default: *length += snprintf(source + *length, capacity - *length, "v.f(z)"); break;
+    }
+    return;
+  }
+  size_t num_operators = sizeof(BINARY_OPERATORS) / sizeof(BINARY_OPERATORS[0]);
+  size_t op = random % 2 ? random % 5 : random % num_operators;
+  bool parenthesize = random % 8 == 0;
+  if (parenthesize) {
+    source[(*length)++] = '(';
+  }
+  random_expression(source, length, capacity, state, depth - 1);
+  *length += snprintf(source + *length, capacity - *length, " %s ", BINARY_OPERATORS[op]);
+  random_expression(source, length, capacity, state, depth - 1);
+  if (parenthesize) {
+    source[(*length)++] = ')';
+  }
+}
+
+// Generate a script of `let` statements with arithmetic-heavy expressions
+static char* build_expression_source(size_t* length) {
+  size_t capacity = NUM_EXPRESSIONS * 256;
+  char* source = malloc(capacity);
+  CHECK(source != NULL);
+  uint64_t state = 0;
+  *length = 0;
+  for (size_t i = 0; i < NUM_EXPRESSIONS; i++) {
+    *length += snprintf(source + *length, capacity - *length, "let e = ");
+    random_expression(source, length, capacity, &state, 3);
+    *length += snprintf(source + *length, capacity - *length, ";\n");
+    CHECK(*length < capacity);
+  }
+  return source;
+}
+
+BENCH(Parser, Expressions) {
+  size_t length;
+  char* source = build_expression_source(&length);
+  struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+  uint64_t best_ns = UINT64_MAX;
+  for (size_t i = 0; i < NUM_RUNS; i++) {
+    struct Arena arena;
+    bool incomplete_input = false;
+    arena_init(&arena);
+    uint64_t start = bench_now_ns();
+    struct Ast* ast = parse(&arena, source, writer, &incomplete_input);
+    uint64_t ns = bench_now_ns() - start;
+    CHECK(ast != NULL);
+    bench_consume(ast);
+    arena_fini(&arena);
+    best_ns = ns < best_ns ? ns : best_ns;
+  }
+  bench_report("parse", (double) length * 1000.0 / (double) best_ns, "MB/s");
+  bench_report("expressions", (double) NUM_EXPRESSIONS * 1000.0 / (double) best_ns, "M/s");
+  file_writer_free((struct FileWriter*) writer);
+  free(source);
+}
+
+#define NUM_FUNCTIONS 2000
+
+// Generate an init script which declares lots of functions and methods, like
+// an editor config, with a few lines of top-level code which use some of them
+static char* build_init_source(size_t* length) {
+  size_t capacity = NUM_FUNCTIONS * 512;
+  char* source = malloc(capacity);
+  CHECK(source != NULL);
+  *length = 0;
+  for (size_t i = 0; i < NUM_FUNCTIONS; i++) {
+    const char* header = i % 4 == 0 ? "struct S%zu {\n  fn f(self, x) {\n" : "fn f%zu(x) {\n";
+    *length += snprintf(source + *length, capacity - *length, header, i);
+    *length += snprintf(source + *length, capacity - *length,
+                        "    let total = 0;\n"
+                        "    for i in range(x) {\n"
+                        "      if i %% 3 == 0 { total += i * %zu; } else { total -= 1; }\n"
+                        "    }\n"
+                        "    let cb = fn(y) { y + total };\n"
+                        "    return { \"total\": total, \"cb\": cb, \"tags\": [1, 2, 3] };\n"
+                        "  }\n", i);
+    if (i % 4 == 0) {
+      *length += snprintf(source + *length, capacity - *length, "}\n");
+    }
+    CHECK(*length < capacity);
+  }
+  *length += snprintf(source + *length, capacity - *length, "f1(10); f2(20); f3(30);\n");
+  CHECK(*length < capacity);
+  return source;
+}
+
+// Parse the init script with every function body, and with function bodies
+// skipped, only parsing the ones which are called
+BENCH(Parser, LazyFunctions) {
+  size_t length;
+  char* source = build_init_source(&length);
+  struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+  uint64_t eager_ns = UINT64_MAX, lazy_ns = UINT64_MAX, used_ns = UINT64_MAX;
+  for (size_t i = 0; i < NUM_RUNS; i++) {
+    for (int lazy = 0; lazy < 2; lazy++) {
+      struct Arena arena;
+      bool incomplete_input = false;
+      arena_init(&arena);
+      struct ParseOptions options = { NULL, lazy };
+      uint64_t start = bench_now_ns();
+      struct Ast* ast = parse_with_options(&arena, source, &options, writer, &incomplete_input);
+      uint64_t mid = bench_now_ns();
+      CHECK(ast != NULL);
+      if (lazy) {
+        // Parse the functions called at the end
+        struct AstVec* statements = &((struct AstProgram*) ast)->statements;
+        for (size_t j = 1; j <= 3; j++) {
+          struct AstLet* let = (struct AstLet*) statements->data[j];
+          CHECK(parse_function_body(&arena, (struct AstFunction*) let->rhs, &options, writer));
+        }
+      }
+      uint64_t end = bench_now_ns();
+      bench_consume(ast);
+      arena_fini(&arena);
+      if (lazy) {
+        lazy_ns = mid - start < lazy_ns ? mid - start : lazy_ns;
+        used_ns = end - start < used_ns ? end - start : used_ns;
+      } else {
+        eager_ns = mid - start < eager_ns ? mid - start : eager_ns;
+      }
+    }
+  }
+  bench_report("eager", (double) eager_ns / 1000.0, "us");
+  bench_report("lazy", (double) lazy_ns / 1000.0, "us");
+  bench_report("lazy, then parse 3 used functions", (double) used_ns / 1000.0, "us");
+  file_writer_free((struct FileWriter*) writer);
+  free(source);
+}
+
+#define NUM_KEYSTROKES 2000
+
+// Edit a top-level statement in the middle of the script, like an editor does
+// on every keystroke, and compare with parsing the whole script again
+BENCH(Parser, IncrementalKeystroke) {
+  size_t length;
+  char* source = build_config_source(&length);
+  char* buffer = malloc(length + 2);
+  CHECK(buffer != NULL);
+  memcpy(buffer, source, length + 1);
+  struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+  struct IncParser parser;
+  inc_parser_init(&parser, buffer, writer);
+  bool incomplete_input = false;
+  CHECK(inc_parser_program(&parser, &incomplete_input) != NULL);
+
+  // Overwrite a digit within the line, and put it back
+  size_t offset = strstr(buffer + length / 2, "\"id\": ") - buffer + 6;
+  char original = buffer[offset];
+  uint64_t start = bench_now_ns();
+  for (size_t i = 0; i < NUM_KEYSTROKES; i++) {
+    buffer[offset] = '9';
+    inc_parser_edit(&parser, buffer, offset, 1, 1);
+    buffer[offset] = original;
+    inc_parser_edit(&parser, buffer, offset, 1, 1);
+  }
+  uint64_t same_line_ns = bench_now_ns() - start;
+  CHECK(inc_parser_program(&parser, &incomplete_input) != NULL);
+
+  // Insert a newline, which moves the line numbers of everything after it
+  uint64_t new_line_ns = 0;
+  for (size_t i = 0; i < NUM_KEYSTROKES / 10; i++) {
+    memmove(buffer + offset + 1, buffer + offset, length - offset + 1);
+    buffer[offset] = '\n';
+    start = bench_now_ns();
+    inc_parser_edit(&parser, buffer, offset, 0, 1);
+    new_line_ns += bench_now_ns() - start;
+    memmove(buffer + offset, buffer + offset + 1, length - offset + 1);
+    start = bench_now_ns();
+    inc_parser_edit(&parser, buffer, offset, 1, 0);
+    new_line_ns += bench_now_ns() - start;
+  }
+  CHECK(inc_parser_program(&parser, &incomplete_input) != NULL);
+
+  uint64_t full_ns = 0;
+  for (size_t i = 0; i < NUM_RUNS; i++) {
+    struct Arena arena;
+    arena_init(&arena);
+    start = bench_now_ns();
+    bench_consume(parse(&arena, buffer, writer, &incomplete_input));
+    full_ns += bench_now_ns() - start;
+    arena_fini(&arena);
+  }
+  bench_report("incremental, same line", (double) same_line_ns / (2 * NUM_KEYSTROKES) / 1000.0,
+               "us/edit");
+  bench_report("incremental, new line", (double) new_line_ns / (NUM_KEYSTROKES / 5) / 1000.0,
+               "us/edit");
+  bench_report("full re-parse", (double) full_ns / NUM_RUNS / 1000.0, "us/edit");
+  inc_parser_fini(&parser);
+  file_writer_free((struct FileWriter*) writer);
+  free(buffer);
+  free(source);
+}
+
+// Build a function with `num_lines` lines in its body, as it would be pasted
+// into the REPL
+static char* build_function_source(size_t num_lines, size_t* length) {
+  size_t capacity = (num_lines + 2) * 64;
+  char* source = malloc(capacity);
+  CHECK(source != NULL);
+  *length = snprintf(source, capacity, "fn pasted(x) {\n");
+  for (size_t i = 0; i < num_lines; i++) {
+    *length += snprintf(source + *length, capacity - *length,
+                        "  let v%zu = [x, %zu, \"text\"];\n", i, i);
+  }
+  *length += snprintf(source + *length, capacity - *length, "}\n");
+  CHECK(*length < capacity);
+  return source;
+}
+
+// Feed a pasted function to the parser line by line, parsing everything so far
+// after every line, or only once the line lexer says it could be complete
+static void paste(size_t num_lines) {
+  size_t length;
+  char* source = build_function_source(num_lines, &length);
+  struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+  uint64_t reparse_ns = 0, resume_ns = 0;
+  for (int resume = 0; resume < 2; resume++) {
+    struct LineLexer line_lexer;
+    line_lexer_init(&line_lexer);
+    uint64_t start = bench_now_ns();
+    for (char* end = strchr(source, '\n'); end; end = strchr(end + 1, '\n')) {
+      char saved = end[1];
+      end[1] = '\0';
+      if (!resume || line_lexer_feed(&line_lexer, source)) {
+        struct Arena arena;
+        bool incomplete_input = false;
+        arena_init(&arena);
+        bench_consume(parse(&arena, source, writer, &incomplete_input));
+        arena_fini(&arena);
+      }
+      end[1] = saved;
+    }
+    if (resume) {
+      resume_ns = bench_now_ns() - start;
+    } else {
+      reparse_ns = bench_now_ns() - start;
+    }
+  }
+  char label[64];
+  snprintf(label, sizeof(label), "%zu lines re-parsing every line", num_lines);
+  bench_report(label, (double) reparse_ns / 1000.0, "us");
+  snprintf(label, sizeof(label), "%zu lines with line lexer", num_lines);
+  bench_report(label, (double) resume_ns / 1000.0, "us");
+  file_writer_free((struct FileWriter*) writer);
+  free(source);
+}
+
+BENCH(Parser, ReplPaste) {
+  paste(500);
+  paste(2000);
+}
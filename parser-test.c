@@ -1,18 +1,25 @@
 #include "parser.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flat-ast.h"
 #include "test.h"
 #include "util.h"
 #include "writer.h"
 
 #define SETUP()                                                         \
+  struct Arena arena;                                                   \
   struct String ast_buf;                                                \
+  arena_init(&arena);                                                   \
   struct Str target_str;                                                \
   string_init(&ast_buf, "");                                            \
   struct Writer* err_writer = (struct Writer*) file_writer_create(stderr); \
   struct Writer* ast_writer = (struct Writer*) string_writer_create(&ast_buf);
 
 #define TEARDOWN() do {                                                 \
-    ast_free(ast);                                                      \
+    arena_fini(&arena);                                                 \
     file_writer_free((struct FileWriter*) err_writer);                  \
     string_writer_free((struct StringWriter*) ast_writer);              \
     string_fini(&ast_buf);                                              \
@@ -29,7 +36,7 @@
 #define E2E_TEST(INPUT, TARGET) do {                               \
     SETUP()                                                        \
     bool incomplete_input = false;                                 \
-    struct Ast* ast = parse(INPUT, err_writer, &incomplete_input); \
+    struct Ast* ast = parse(&arena, INPUT, err_writer, &incomplete_input); \
     ASSERT(ast != NULL);                                           \
     ASSERT(!incomplete_input);                                     \
     COMPARE_TO(TARGET);                                            \
@@ -40,7 +47,7 @@
     SETUP()                                                        \
     UNUSED(target_str);                                            \
     bool incomplete_input = false;                                 \
-    struct Ast* ast = parse(INPUT, err_writer, &incomplete_input); \
+    struct Ast* ast = parse(&arena, INPUT, err_writer, &incomplete_input); \
     ASSERT(ast == NULL);                                           \
     ASSERT(incomplete_input);                                      \
     TEARDOWN();                                                    \
@@ -53,9 +60,10 @@ TEST(Parser, SimpleIfElse) {
 
 TEST(Parser, SimpleForLoop) {
   E2E_TEST("for i in range(10) { print(i); }",
-           "(program (block <noret> (let __iter <private> (call range 10)) (let i <private> "
-           "(call next __iter)) (while (!= i nil) (block <noret> (call print i) "
-           "(= i (call next __iter))))))");
+           "(program (for i (call range 10) (block <noret> (call print i))))");
+  // The body is kept as written, so "continue" skips nothing but the rest of it
+  E2E_TEST("for x in xs { if x { continue; } f(x); }",
+           "(program (for x xs (block <noret> (if x (block <noret> (continue))) (call f x))))");
 }
 
 TEST(Parser, FibonacciFunction) {
@@ -97,7 +105,86 @@ TEST(Parser, BasicExpressions) {
   E2E_TEST("not a == b and not a ^ b != c",
            "(program (and (not (== a b)) (not (!= (^ a b) c))))");
   E2E_TEST("a ^= b; c /= d; e <<= f; g >>= h;",
-           "(program (= a (^ a b)) (= c (/ c d)) (= e (<< e f)) (= g (>> g h)))");
+           "(program (^= a b) (/= c d) (<<= e f) (>>= g h))");
+}
+
+// The target isn't copied into a binary expression, so it's only evaluated once
+TEST(Parser, CompoundAssignment) {
+  E2E_TEST("a.b[c()] += 1; self.x *= y - 1;",
+           "(program (+= ([] (. a b) (call c)) 1) (*= (. self x) (- y 1)))");
+}
+
+TEST(Parser, Precedence) {
+  E2E_TEST("a or b and c == d | e ^ f & g << h + i * -j",
+           "(program (or a (and b (== c (| d (^ e (& f (<< g (+ h (* i (- j)))))))))))");
+  E2E_TEST("-a * b - c >> d & e ^ f | g < h and i or j",
+           "(program (or (and (< (| (^ (& (>> (- (* (- a) b) c) d) e) f) g) h) i) j))");
+  E2E_TEST("a < b < c; a - b - c; !-+a.b(c)[d]",
+           "(program (< (< a b) c) (- (- a b) c) (! (- ([] (call (. a b) c) d))))");
+  E2E_TEST("not not a < b or c",
+           "(program (or (not (not (< a b))) c))");
+}
+
+TEST_FAIL(Parser, NotInsideComparison) {
+  E2E_TEST("a == not b", "(program (== a (not b)))");
+}
+
+// Print an AST to a fresh string, and compare it
+#define ASSERT_PRINTS(AST, TARGET) do {                                \
+    struct String printed;                                              \
+    string_init(&printed, "");                                          \
+    struct StringWriter* writer = string_writer_create(&printed);       \
+    ast_print(AST, (struct Writer*) writer);                            \
+    str_init(&target_str, TARGET, SIZE_MAX);                            \
+    ASSERT_STR_EQ(((struct Str) { printed.data, printed.length }), target_str); \
+    string_writer_free(writer);                                         \
+    string_fini(&printed);                                              \
+  } while (0)
+
+TEST(Parser, LazyFunctions) {
+  SETUP();
+  UNUSED(ast_writer);
+  struct ParseOptions options = { NULL, true };
+  bool incomplete_input = false;
+  struct Ast* ast = parse_with_options(&arena,
+                                       "fn f(a) { let g = fn() { a + 1 }; g() }\n"
+                                       "struct S { fn m(self) { self.x } }\n"
+                                       "fn broken() { 1 + }",
+                                       &options, err_writer, &incomplete_input);
+  ASSERT(ast != NULL);
+  ASSERT_PRINTS(ast, "(program (let f <private> (fn (params a) <lazy>)) "
+                "(let S <private> (struct (block <noret> (let m <private> (fn (params self) <lazy>))))) "
+                "(let broken <private> (fn (params) <lazy>)))");
+
+  // Bodies are parsed one level at a time
+  struct AstVec* statements = &((struct AstProgram*) ast)->statements;
+  struct AstFunction* f = (struct AstFunction*) ((struct AstLet*) statements->data[0])->rhs;
+  ASSERT(parse_function_body(&arena, f, &options, err_writer));
+  ASSERT_PRINTS((struct Ast*) f, "(fn (params a) (block <ret> (let g <private> (fn (params) <lazy>)) "
+                "(call g)))");
+  struct AstBlock* body = (struct AstBlock*) f->body;
+  struct AstFunction* g = (struct AstFunction*) ((struct AstLet*) body->statements.data[0])->rhs;
+  ASSERT(parse_function_body(&arena, g, &options, err_writer));
+  ASSERT_PRINTS((struct Ast*) g, "(fn (params) (block <ret> (+ a 1)))");
+  ASSERT_INT_EQ(g->body->line_num, 0);
+
+  // Syntax errors only show up once the body is parsed
+  struct AstFunction* broken = (struct AstFunction*) ((struct AstLet*) statements->data[2])->rhs;
+  ASSERT(!parse_function_body(&arena, broken, &options, err_writer));
+  ASSERT(broken->body == NULL);
+  TEARDOWN();
+}
+
+TEST(Parser, LazyFunctionsIncomplete) {
+  SETUP();
+  UNUSED(target_str);
+  UNUSED(ast_writer);
+  struct ParseOptions options = { NULL, true };
+  bool incomplete_input = false;
+  ASSERT(parse_with_options(&arena, "fn f() { if x { 1 }", &options, err_writer,
+                            &incomplete_input) == NULL);
+  ASSERT(incomplete_input);
+  TEARDOWN();
 }
 
 TEST(Parser, SetDictArr) {
@@ -137,3 +224,148 @@ TEST_FAIL(Parser, PubLetInsideBlock) {
 TEST(Parser, Incomplete) {
   E2E_INCOMPLETE("fn f1() {");
 }
+
+// The incremental parser must produce exactly the AST of a full parse, down to
+// line numbers
+#define ASSERT_SAME_AS_FULL_PARSE(INC, SOURCE) do {                    \
+    struct Arena arena;                                                \
+    struct String expected_buf, actual_buf;                            \
+    arena_init(&arena);                                                \
+    string_init(&expected_buf, "");                                    \
+    string_init(&actual_buf, "");                                      \
+    struct Writer* expected_writer = (struct Writer*) string_writer_create(&expected_buf); \
+    struct Writer* actual_writer = (struct Writer*) string_writer_create(&actual_buf); \
+    bool expected_incomplete = false, actual_incomplete = false;       \
+    struct Ast* expected = parse(&arena, SOURCE, expected_writer, &expected_incomplete); \
+    struct Ast* actual = inc_parser_program(INC, &actual_incomplete);  \
+    ASSERT((expected == NULL) == (actual == NULL));                    \
+    ASSERT(expected_incomplete == actual_incomplete);                  \
+    if (expected) {                                                    \
+      ast_print(expected, expected_writer);                            \
+      ast_print(actual, actual_writer);                                \
+      ASSERT_STR_EQ(((struct Str) { expected_buf.data, expected_buf.length }), \
+                    ((struct Str) { actual_buf.data, actual_buf.length })); \
+      struct FlatAst expected_flat, actual_flat;                       \
+      flat_ast_init(&expected_flat);                                   \
+      flat_ast_init(&actual_flat);                                     \
+      flat_ast_build(&expected_flat, expected);                        \
+      flat_ast_build(&actual_flat, actual);                            \
+      ASSERT_INT_EQ(expected_flat.num_nodes, actual_flat.num_nodes);   \
+      for (size_t i = 0; i < expected_flat.num_nodes; i++) {           \
+        ASSERT_INT_EQ(expected_flat.lines[i], actual_flat.lines[i]);   \
+      }                                                                \
+      flat_ast_fini(&expected_flat);                                   \
+      flat_ast_fini(&actual_flat);                                     \
+    }                                                                  \
+    string_writer_free((struct StringWriter*) expected_writer);        \
+    string_writer_free((struct StringWriter*) actual_writer);          \
+    string_fini(&expected_buf);                                        \
+    string_fini(&actual_buf);                                          \
+    arena_fini(&arena);                                                \
+  } while (0)
+
+// Apply an edit to a buffer, and then to the parser
+static size_t edit(struct IncParser* parser, char* buffer, size_t offset, size_t removed_length,
+                   const char* inserted) {
+  size_t length = strlen(buffer), inserted_length = strlen(inserted);
+  memmove(buffer + offset + inserted_length, buffer + offset + removed_length,
+          length - offset - removed_length + 1);
+  memcpy(buffer + offset, inserted, inserted_length);
+  return inc_parser_edit(parser, buffer, offset, removed_length, inserted_length);
+}
+
+TEST(IncParser, SmallEdits) {
+  char buffer[512] = "let a = 1;\nfn fib(n) {\n  if n <= 1 {\n    return 1;\n  }\n"
+    "  fib(n - 1) + fib(n - 2)\n}\nwhile a { a = a - 1; }\nlet b = \"str\";\nfib(a)";
+  struct String err_buf;
+  string_init(&err_buf, "");
+  struct Writer* err_writer = (struct Writer*) string_writer_create(&err_buf);
+  struct IncParser parser;
+  inc_parser_init(&parser, buffer, err_writer);
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  // Edits inside a statement only re-parse that statement
+  ASSERT_INT_EQ(edit(&parser, buffer, 9, 0, "2"), 1);
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  ASSERT_INT_EQ(edit(&parser, buffer, 33, 0, "\n\n"), 1);
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  ASSERT_INT_EQ(edit(&parser, buffer, 19, 0, "o"), 1);
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  // Break a statement, and then fix it again
+  edit(&parser, buffer, 10, 1, "");
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  ASSERT(parser.num_errors > 0);
+  edit(&parser, buffer, 10, 0, ";");
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  // Merge two statements, and split them again
+  edit(&parser, buffer, 12, 0, "x = ");
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  edit(&parser, buffer, 12, 4, "");
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  // An open string swallows everything after it, and closing it restores it
+  edit(&parser, buffer, 4, 0, "\"");
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  edit(&parser, buffer, 4, 1, "");
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  // Edits at the very end, and emptying the buffer
+  edit(&parser, buffer, strlen(buffer), 0, " + (");
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  edit(&parser, buffer, strlen(buffer), 0, "1)");
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  edit(&parser, buffer, 0, strlen(buffer), "");
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  edit(&parser, buffer, 0, 0, "x");
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  inc_parser_fini(&parser);
+  string_writer_free((struct StringWriter*) err_writer);
+  string_fini(&err_buf);
+}
+
+TEST(IncParser, EditsAreLocal) {
+  size_t num_functions = 200, capacity = num_functions * 128, length = 0;
+  char* buffer = malloc(capacity);
+  ASSERT(buffer != NULL);
+  for (size_t i = 0; i < num_functions; i++) {
+    length += snprintf(buffer + length, capacity - length,
+                       "fn f%zu(x) {\n  let y = x * %zu;\n  y + \"s%zu\"\n}\n", i, i, i);
+  }
+  struct String err_buf;
+  string_init(&err_buf, "");
+  struct Writer* err_writer = (struct Writer*) string_writer_create(&err_buf);
+  struct IncParser parser;
+  inc_parser_init(&parser, buffer, err_writer);
+  // Typing in the middle of a function only re-parses that function
+  char* middle = strstr(buffer + length / 2, "let y");
+  ASSERT(middle != NULL);
+  size_t offset = middle - buffer + 4;
+  ASSERT_INT_EQ(edit(&parser, buffer, offset, 1, "z"), 1);
+  ASSERT_INT_EQ(edit(&parser, buffer, offset, 0, "z"), 1);
+  ASSERT_INT_EQ(edit(&parser, buffer, offset, 0, "\n"), 1);
+  ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+  // Pseudo-random edits all over the buffer, each of which is undone again.
+  // This goes through recovery from errors, and starting afresh.
+  srand(42);
+  const char* snippets[] = { "", "a", " ", "\n", "\"", "{", "}", ";", "fn ", "1 +" };
+  for (size_t i = 0; i < 300; i++) {
+    size_t offset = rand() % (strlen(buffer) + 1);
+    size_t removed = rand() % 4;
+    if (offset + removed > strlen(buffer)) {
+      removed = strlen(buffer) - offset;
+    }
+    const char* inserted = snippets[rand() % 10];
+    char removed_text[4] = { 0 };
+    memcpy(removed_text, buffer + offset, removed);
+    edit(&parser, buffer, offset, removed, inserted);
+    // Getting the program fixes up line numbers, so let some edits pile up
+    if (i % 3 == 0) {
+      ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+    }
+    edit(&parser, buffer, offset, strlen(inserted), removed_text);
+    if (i % 5 == 0) {
+      ASSERT_SAME_AS_FULL_PARSE(&parser, buffer);
+    }
+  }
+  inc_parser_fini(&parser);
+  string_writer_free((struct StringWriter*) err_writer);
+  string_fini(&err_buf);
+  free(buffer);
+}
@@ -1,26 +1,72 @@
 #include "parser.h"
 
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "ast.h"
 #include "lexer.h"
 #include "log.h"
 #include "string.h"
+#include "symbol.h"
 #include "util.h"
 #include "writer.h"
 
-// Parser state. This maintains 2 tokens of look-ahead
+#define REALLOC(PTR, SIZE) do {        \
+    if (!(PTR = realloc(PTR, SIZE))) { \
+      DIE_ERR("realloc()");            \
+    }                                  \
+  } while (0)
+
+// Parser state. This maintains 2 tokens of look-ahead. They're pulled from
+// the lexer one at a time: filling a `TokenBuffer` ahead of the parser and
+// reading the tokens back out of it was slower. Anything that needs every
+// token, like highlighting, can fill its own buffer with `token_buffer_lex`.
 struct Parser {
-  struct Lexer lexer;    // Handle to the lexer
-  struct Token previous; // Token that just passed us by
-  struct Token current;  // Current token
-  struct Writer* writer; // Writer for error messages
-  bool had_error;        // Whether we had an error while parsing
-  bool panic_mode;       // Whether we're in panic mode and need to recover
-  bool incomplete_input; // Whether the error was because we had incomplete input
-  bool inside_block;     // Whether we're inside a block statement
+  struct Lexer lexer;          // Handle to the lexer
+  struct Token previous;       // Token that just passed us by
+  struct Token current;        // Current token
+  size_t previous_end;         // Source offset just past the previous token
+  size_t current_end;          // Source offset just past the current token
+  struct Writer* writer;       // Writer for error messages
+  struct Arena* arena;         // Arena which AST nodes are allocated from
+  struct SymbolTable* symbols; // Table to intern identifiers into, if not NULL
+  bool lazy_functions;         // Whether to skip function bodies
+  bool had_error;              // Whether we had an error while parsing
+  bool panic_mode;             // Whether we're in panic mode and need to recover
+  bool incomplete_input;       // Whether the error was because we had incomplete input
+  bool inside_block;           // Whether we're inside a block statement
 };
 
+static inline enum TokenType current_type(const struct Parser* parser) {
+  return parser->current.type;
+}
+
+static inline enum TokenType previous_type(const struct Parser* parser) {
+  return parser->previous.type;
+}
+
+static inline size_t current_line(const struct Parser* parser) {
+  return parser->current.line_num;
+}
+
+static inline size_t previous_line(const struct Parser* parser) {
+  return parser->previous.line_num;
+}
+
+static inline struct Str current_text(const struct Parser* parser) {
+  return parser->current.text;
+}
+
+static inline struct Str previous_text(const struct Parser* parser) {
+  return parser->previous.text;
+}
+
+// Symbol ID for an identifier, or SYMBOL_NONE if there's no symbol table
+static inline uint32_t intern(struct Parser* parser, struct Str text) {
+  return parser->symbols ? symbol_intern(parser->symbols, text) : SYMBOL_NONE;
+}
+
 // Prints error messages to the parsers "writer", and indicates that we've
 // encountered an error.
 static void error_at(struct Parser* parser, const struct Token* token, const char *msg, va_list ap) {
@@ -49,12 +95,18 @@ static void error_at_current(struct Parser* parser, const char *msg, ...) {
   va_end(ap);
 }
 
-// Advances the parser - moves `next` to `current`, and fills the next token
-// from the lexer into `next`.
+// Advances the parser - moves `current` to `previous`, and fills `current`
+// with the next token from the lexer which isn't an error. At EOF, `current`
+// stays where it is.
 static void advance(struct Parser* parser) {
   parser->previous = parser->current;
+  parser->previous_end = parser->current_end;
+  if (parser->current.type == TOK_EOF) {
+    return;
+  }
   while (true) {
     lexer_tok(&parser->lexer, &parser->current);
+    parser->current_end = parser->lexer.current_offset;
     if (parser->current.type != TOK_Error) {
       break;
     }
@@ -65,7 +117,7 @@ static void advance(struct Parser* parser) {
 // Checks if the next token's type is `type`. If yes, advances the parser.
 // Otherwise just returns false.
 static bool match(struct Parser* parser, enum TokenType type) {
-  if (parser->current.type == type) {
+  if (current_type(parser) == type) {
     advance(parser);
     return true;
   }
@@ -75,7 +127,7 @@ static bool match(struct Parser* parser, enum TokenType type) {
 // Checks if the next token's type is `type`. If yes, advances the parser.
 // Otherwise trigers an error.
 static void consume(struct Parser* parser, enum TokenType type) {
-  if (parser->current.type == TOK_EOF) {
+  if (current_type(parser) == TOK_EOF) {
     parser->incomplete_input = true;
     return;
   }
@@ -94,7 +146,7 @@ static void expressions(struct Parser* parser, struct AstVec* vec, enum TokenTyp
     return;
   }
   while (true) {
-    switch (parser->current.type) {
+    switch (current_type(parser)) {
     case TOK_EOF:
       parser->incomplete_input = true;
       return;
@@ -110,9 +162,9 @@ static void expressions(struct Parser* parser, struct AstVec* vec, enum TokenTyp
 
 static struct Ast* integer(struct Parser* parser) {
   int64_t value = 0;
-  const struct Str* text = &parser->previous.text;
-  for (size_t i = 0; i < text->length; i++) {
-    int64_t digit = text->data[i] - '0';
+  struct Str text = previous_text(parser);
+  for (size_t i = 0; i < text.length; i++) {
+    int64_t digit = text.data[i] - '0';
     int64_t new_value = (value * 10) + digit;
     if (new_value < value) {
       error_at_previous(parser, "integer is too large, we only support 64-bit signed integers");
@@ -120,18 +172,19 @@ static struct Ast* integer(struct Parser* parser) {
     }
     value = new_value;
   }
-  return ast_integer_create(parser->previous.line_num, value);
+  return ast_integer_create(parser->arena, previous_line(parser), value);
 }
 
 static struct Ast* float_node(struct Parser* parser) {
   char *end_ptr;
-  double value = strtod((const char*) parser->previous.text.data, &end_ptr);
-  size_t length = end_ptr - (const char*) parser->previous.text.data;
-  if (length != parser->previous.text.length) {
+  struct Str text = previous_text(parser);
+  double value = strtod((const char*) text.data, &end_ptr);
+  size_t length = end_ptr - (const char*) text.data;
+  if (length != text.length) {
     error_at_previous(parser, "float is not in a format we can parse (yet)");
     return NULL;
   }
-  return ast_float_create(parser->previous.line_num, value);
+  return ast_float_create(parser->arena, previous_line(parser), value);
 }
 
 static void parameters(struct Parser* parser, struct AstVec* vec, enum TokenType terminator,
@@ -141,7 +194,7 @@ static void parameters(struct Parser* parser, struct AstVec* vec, enum TokenType
   }
   if (can_have_self) {
     if (match(parser, TOK_Self)) {
-      ast_vec_push(vec, ast_self_create(parser->previous.line_num));
+      ast_vec_push(vec, ast_self_create(parser->arena, previous_line(parser)));
       if (match(parser, terminator)) {
         return;
       } else {
@@ -150,12 +203,14 @@ static void parameters(struct Parser* parser, struct AstVec* vec, enum TokenType
     }
   }
   while (true) {
-    switch (parser->current.type) {
+    switch (current_type(parser)) {
     case TOK_EOF:
       parser->incomplete_input = true;
       return;
-    case TOK_Identifier:
-      ast_vec_push(vec, ast_identifier_create(parser->current.line_num, parser->current.text));
+    case TOK_Identifier: {
+      struct Str text = current_text(parser);
+      ast_vec_push(vec, ast_identifier_create(parser->arena, current_line(parser), text,
+                                              intern(parser, text)));
       advance(parser);
       if (match(parser, terminator)) {
         return;
@@ -163,8 +218,9 @@ static void parameters(struct Parser* parser, struct AstVec* vec, enum TokenType
         consume(parser, TOK_Comma);
       }
       break;
+    }
     case TOK_Ellipsis:
-      ast_vec_push(vec, ast_ellipsis_create(parser->current.line_num));
+      ast_vec_push(vec, ast_ellipsis_create(parser->arena, current_line(parser)));
       advance(parser);
       if (!match(parser, terminator)) {
         error_at_current(parser, "expected '%s' after '...', found: '",
@@ -179,39 +235,64 @@ static void parameters(struct Parser* parser, struct AstVec* vec, enum TokenType
   }
 }
 
+// Parse the body of a function, and create the function. With lazy functions,
+// the body is only brace-matched, and its text kept for `parse_function_body`.
+// Errors inside it besides those from the lexer show up once it's parsed.
+static struct Ast* function_body(struct Parser* parser, size_t line_num, struct AstVec params) {
+  if (!parser->lazy_functions || current_type(parser) != TOK_LeftCurBr) {
+    struct Ast* body = block_statement(parser);
+    return ast_function_create(parser->arena, line_num, params, body);
+  }
+  size_t body_line_num = current_line(parser);
+  size_t start = (const char*) parser->current.text.data - parser->lexer.source;
+  size_t depth = 0;
+  do {
+    switch (current_type(parser)) {
+    case TOK_LeftCurBr:  depth++; break;
+    case TOK_RightCurBr: depth--; break;
+    case TOK_EOF:
+      parser->incomplete_input = true;
+      return NULL;
+    default:             break;
+    }
+    advance(parser);
+  } while (depth > 0);
+  struct Str body = { (const uint8_t*) parser->lexer.source + start, parser->previous_end - start };
+  return ast_lazy_function_create(parser->arena, line_num, params, body, body_line_num);
+}
+
 static struct Ast* lambda(struct Parser* parser) {
   struct AstVec params;
-  ast_vec_init(&params);
-  size_t line_num = parser->current.line_num;
+  ast_vec_init(&params, parser->arena);
+  size_t line_num = current_line(parser);
   consume(parser, TOK_LeftParen);
   parameters(parser, &params, TOK_RightParen, false);
-  struct Ast* body = block_statement(parser);
-  return ast_function_create(line_num, params, body);
+  return function_body(parser, line_num, params);
 }
 
 static struct Ast* array(struct Parser* parser) {
   struct AstVec elements;
-  size_t line_num = parser->previous.line_num;
-  ast_vec_init(&elements);
+  size_t line_num = previous_line(parser);
+  ast_vec_init(&elements, parser->arena);
   expressions(parser, &elements, TOK_RightSqBr);
-  return ast_array_create(line_num, elements);
+  return ast_array_create(parser->arena, line_num, elements);
 }
 
 static struct Ast* dictionary_or_set(struct Parser* parser) {
   struct AstPairVec kvpairs;
   struct AstVec elements;
-  ast_pair_vec_init(&kvpairs);
-  ast_vec_init(&elements);
-  size_t line_num = parser->previous.line_num;
+  ast_pair_vec_init(&kvpairs, parser->arena);
+  ast_vec_init(&elements, parser->arena);
+  size_t line_num = previous_line(parser);
   if (match(parser, TOK_RightCurBr)) {
-    return ast_dictionary_create(line_num, kvpairs);
+    return ast_dictionary_create(parser->arena, line_num, kvpairs);
   }
   struct Ast* key = expression(parser);
   if (match(parser, TOK_Colon)) {
     struct Ast* value = expression(parser);
     ast_pair_vec_push(&kvpairs, key, value);
     while (!match(parser, TOK_RightCurBr)) {
-      if (parser->current.type == TOK_EOF) {
+      if (current_type(parser) == TOK_EOF) {
         parser->incomplete_input = true;
         break;
       }
@@ -221,47 +302,47 @@ static struct Ast* dictionary_or_set(struct Parser* parser) {
       value = expression(parser);
       ast_pair_vec_push(&kvpairs, key, value);
     }
-    return ast_dictionary_create(line_num, kvpairs);
+    return ast_dictionary_create(parser->arena, line_num, kvpairs);
   } else {
     ast_vec_push(&elements, key);
     while (!match(parser, TOK_RightCurBr)) {
-      if (parser->current.type == TOK_EOF) {
+      if (current_type(parser) == TOK_EOF) {
         parser->incomplete_input = true;
         break;
       }
       consume(parser, TOK_Comma);
       ast_vec_push(&elements, expression(parser));
     }
-    return ast_set_create(line_num, elements);
+    return ast_set_create(parser->arena, line_num, elements);
   }
 }
 
 static struct Ast* require(struct Parser* parser) {
-  size_t line_num = parser->previous.line_num;
+  size_t line_num = previous_line(parser);
   consume(parser, TOK_LeftParen);
   consume(parser, TOK_String);
-  struct Str module = parser->previous.text;
+  struct Str module = previous_text(parser);
   consume(parser, TOK_RightParen);
-  return ast_require_create(line_num, module);
+  return ast_require_create(parser->arena, line_num, module);
 }
 
 static struct Ast* yield(struct Parser* parser) {
-  size_t line_num = parser->previous.line_num;
+  size_t line_num = previous_line(parser);
   consume(parser, TOK_LeftParen);
   struct Ast* value = expression(parser);
   consume(parser, TOK_RightParen);
-  return ast_yield_create(line_num, value);
+  return ast_yield_create(parser->arena, line_num, value);
 }
 
 static struct Ast* if_statement_suffix(struct Parser* parser) {
-  size_t line_num = parser->previous.line_num;
+  size_t line_num = previous_line(parser);
   struct Ast* condition = expression(parser);
   struct Ast* body = block_statement(parser);
   struct Ast* else_part = NULL;
   if (match(parser, TOK_Else)) {
     else_part = block_statement(parser);
   }
-  return ast_if_create(line_num, condition, body, else_part);
+  return ast_if_create(parser->arena, line_num, condition, body, else_part);
 }
 
 static struct Ast* if_statement(struct Parser* parser) {
@@ -269,20 +350,25 @@ static struct Ast* if_statement(struct Parser* parser) {
   return if_statement_suffix(parser);
 }
 
+static struct Ast* identifier(struct Parser* parser, size_t line_num) {
+  struct Str text = previous_text(parser);
+  return ast_identifier_create(parser->arena, line_num, text, intern(parser, text));
+}
+
 static struct Ast* atom(struct Parser* parser) {
   struct Ast* ast;
-  size_t line_num = parser->current.line_num;
+  size_t line_num = current_line(parser);
   advance(parser);
-  switch (parser->previous.type) {
-  case TOK_Nil:        return ast_nil_create(line_num);
-  case TOK_True:       return ast_boolean_create(line_num, true);
-  case TOK_False:      return ast_boolean_create(line_num, false);
+  switch (previous_type(parser)) {
+  case TOK_Nil:        return ast_nil_create(parser->arena, line_num);
+  case TOK_True:       return ast_boolean_create(parser->arena, line_num, true);
+  case TOK_False:      return ast_boolean_create(parser->arena, line_num, false);
   case TOK_Integer:    return integer(parser);
   case TOK_Float:      return float_node(parser);
-  case TOK_Identifier: return ast_identifier_create(line_num, parser->previous.text);
-  case TOK_String:     return ast_string_create(line_num, parser->previous.text);
-  case TOK_Self:       return ast_self_create(line_num);
-  case TOK_Varargs:    return ast_varargs_create(line_num);
+  case TOK_Identifier: return identifier(parser, line_num);
+  case TOK_String:     return ast_string_create(parser->arena, line_num, previous_text(parser));
+  case TOK_Self:       return ast_self_create(parser->arena, line_num);
+  case TOK_Varargs:    return ast_varargs_create(parser->arena, line_num);
   case TOK_If:         return if_statement_suffix(parser);
   case TOK_Require:    return require(parser);
   case TOK_Yield:      return yield(parser);
@@ -307,25 +393,26 @@ static struct Ast* primary(struct Parser* parser) {
   struct Ast *ret, *index;
   struct AstVec arguments;
   ret = atom(parser);
-  ast_vec_init(&arguments);
+  ast_vec_init(&arguments, parser->arena);
   while (true) {
-    line_num = parser->current.line_num;
-    switch (parser->current.type) {
+    line_num = current_line(parser);
+    switch (current_type(parser)) {
     case TOK_Dot:
       advance(parser);
       consume(parser, TOK_Identifier);
-      ret = ast_member_create(line_num, ret, parser->previous.text);
+      struct Str member = previous_text(parser);
+      ret = ast_member_create(parser->arena, line_num, ret, member, intern(parser, member));
       break;
     case TOK_LeftParen:
       advance(parser);
       expressions(parser, &arguments, TOK_RightParen);
-      ret = ast_call_create(line_num, ret, arguments);
+      ret = ast_call_create(parser->arena, line_num, ret, arguments);
       break;
     case TOK_LeftSqBr:
       advance(parser);
       index = expression(parser);
       consume(parser, TOK_RightSqBr);
-      ret = ast_index_create(line_num, ret, index);
+      ret = ast_index_create(parser->arena, line_num, ret, index);
       break;
     default:
       return ret;
@@ -333,174 +420,104 @@ static struct Ast* primary(struct Parser* parser) {
   }
 }
 
-static struct Ast* unary(struct Parser* parser, struct Ast* opt_primary) {
-  if (opt_primary) {
-    return opt_primary;
-  }
-  size_t line_num = parser->current.line_num;
-  switch (parser->current.type) {
+// How tightly binary operators bind. Operators of higher precedence are
+// grouped first, and operators of the same precedence group to the left.
+enum Precedence {
+  PREC_None,       // Not a binary operator
+  PREC_Or,         // or
+  PREC_And,        // and
+  PREC_Not,        // Operand of prefix "not"
+  PREC_Comparison, // == != <= < >= >
+  PREC_BitOr,      // |
+  PREC_BitXor,     // ^
+  PREC_BitAnd,     // &
+  PREC_Shift,      // << >>
+  PREC_Sum,        // + -
+  PREC_Term,       // * / %
+  PREC_Unary,      // Operand of prefix "-", "+" and "!"
+};
+
+// How to parse a token which shows up after an operand
+struct BinaryRule {
+  uint8_t precedence; // enum Precedence
+  uint8_t operation;  // enum BinaryOp
+};
+
+static const struct BinaryRule BINARY_RULES[TOK_Undefined + 1] = {
+  [TOK_Or]           = { PREC_Or,         BO_LogicalOr },
+  [TOK_And]          = { PREC_And,        BO_LogicalAnd },
+  [TOK_Equal]        = { PREC_Comparison, BO_Equal },
+  [TOK_NotEqual]     = { PREC_Comparison, BO_NotEqual },
+  [TOK_LessEqual]    = { PREC_Comparison, BO_LessEqual },
+  [TOK_LessThan]     = { PREC_Comparison, BO_LessThan },
+  [TOK_GreaterEqual] = { PREC_Comparison, BO_GreaterEqual },
+  [TOK_GreaterThan]  = { PREC_Comparison, BO_GreaterThan },
+  [TOK_BitOr]        = { PREC_BitOr,      BO_BitOr },
+  [TOK_BitXor]       = { PREC_BitXor,     BO_BitXor },
+  [TOK_BitAnd]       = { PREC_BitAnd,     BO_BitAnd },
+  [TOK_ShiftLeft]    = { PREC_Shift,      BO_ShiftLeft },
+  [TOK_ShiftRight]   = { PREC_Shift,      BO_ShiftRight },
+  [TOK_Plus]         = { PREC_Sum,        BO_Add },
+  [TOK_Minus]        = { PREC_Sum,        BO_Subtract },
+  [TOK_Star]         = { PREC_Term,       BO_Multiply },
+  [TOK_Slash]        = { PREC_Term,       BO_Divide },
+  [TOK_Percent]      = { PREC_Term,       BO_Modulo },
+};
+
+static struct Ast* binary(struct Parser* parser, struct Ast* lhs, enum Precedence precedence);
+
+// Operand of a binary operator, with any prefix operators. "not" binds looser
+// than comparisons, so it's only allowed where `precedence` is low enough.
+static struct Ast* unary(struct Parser* parser, enum Precedence precedence) {
+  size_t line_num = current_line(parser);
+  switch (current_type(parser)) {
   case TOK_Plus:
     advance(parser);
-    return unary(parser, NULL);
+    return unary(parser, PREC_Unary);
   case TOK_Minus:
     advance(parser);
-    return ast_unary_create(line_num, UO_Minus, unary(parser, NULL));
+    return ast_unary_create(parser->arena, line_num, UO_Minus, unary(parser, PREC_Unary));
   case TOK_BitNot:
     advance(parser);
-    return ast_unary_create(line_num, UO_BitNot, unary(parser, NULL));
-  case TOK_EOF:
-    parser->incomplete_input = true;
-    return NULL;
-  default:      return primary(parser);
-  }
-}
-
-static struct Ast* term(struct Parser* parser, struct Ast* opt_primary) {
-  struct Ast* ret = unary(parser, opt_primary);
-  while (true) {
-    enum BinaryOp operation;
-    size_t line_num = parser->current.line_num;
-    switch (parser->current.type) {
-    case TOK_Star:    operation = BO_Multiply; break;
-    case TOK_Slash:   operation = BO_Divide; break;
-    case TOK_Percent: operation = BO_Modulo; break;
-    default:          return ret;
-    }
-    advance(parser);
-    struct Ast* rhs = unary(parser, NULL);
-    ret = ast_binary_create(line_num, operation, ret, rhs);
-  }
-  return ret;
-}
-
-static struct Ast* sum(struct Parser* parser, struct Ast* opt_primary) {
-  struct Ast* ret = term(parser, opt_primary);
-  while (true) {
-    enum BinaryOp operation;
-    size_t line_num = parser->current.line_num;
-    switch (parser->current.type) {
-    case TOK_Plus:  operation = BO_Add; break;
-    case TOK_Minus: operation = BO_Subtract; break;
-    default:        return ret;
-    }
-    advance(parser);
-    struct Ast* rhs = term(parser, NULL);
-    ret = ast_binary_create(line_num, operation, ret, rhs);
-  }
-  return ret;
-}
-
-static struct Ast* shift_expression(struct Parser* parser, struct Ast* opt_primary) {
-  struct Ast* ret = sum(parser, opt_primary);
-  while (true) {
-    enum BinaryOp operation;
-    size_t line_num = parser->current.line_num;
-    switch (parser->current.type) {
-    case TOK_ShiftLeft:  operation = BO_ShiftLeft; break;
-    case TOK_ShiftRight: operation = BO_ShiftRight; break;
-    default:             return ret;
-    }
-    advance(parser);
-    struct Ast* rhs = sum(parser, NULL);
-    ret = ast_binary_create(line_num, operation, ret, rhs);
-  }
-  return ret;
-}
-
-static struct Ast* bitwise_and(struct Parser* parser, struct Ast* opt_primary) {
-  struct Ast* ret = shift_expression(parser, opt_primary);
-  while (match(parser, TOK_BitAnd)) {
-    size_t line_num = parser->previous.line_num;
-    struct Ast* rhs = shift_expression(parser, NULL);
-    ret = ast_binary_create(line_num, BO_BitAnd, ret, rhs);
-  }
-  return ret;
-}
-
-static struct Ast* bitwise_xor(struct Parser* parser, struct Ast* opt_primary) {
-  struct Ast* ret = bitwise_and(parser, opt_primary);
-  while (match(parser, TOK_BitXor)) {
-    size_t line_num = parser->previous.line_num;
-    struct Ast* rhs = bitwise_and(parser, NULL);
-    ret = ast_binary_create(line_num, BO_BitXor, ret, rhs);
-  }
-  return ret;
-}
-
-static struct Ast* bitwise_or(struct Parser* parser, struct Ast* opt_primary) {
-  struct Ast* ret = bitwise_xor(parser, opt_primary);
-  while (match(parser, TOK_BitOr)) {
-    size_t line_num = parser->previous.line_num;
-    struct Ast* rhs = bitwise_xor(parser, NULL);
-    ret = ast_binary_create(line_num, BO_BitOr, ret, rhs);
-  }
-  return ret;
-}
-
-static struct Ast* comparison(struct Parser* parser, struct Ast* opt_primary) {
-  struct Ast* ret = bitwise_or(parser, opt_primary);
-  while (true) {
-    enum BinaryOp operation;
-    switch (parser->current.type) {
-    case TOK_Equal:        operation = BO_Equal; break;
-    case TOK_NotEqual:     operation = BO_NotEqual; break;
-    case TOK_LessEqual:    operation = BO_LessEqual; break;
-    case TOK_LessThan:     operation = BO_LessThan; break;
-    case TOK_GreaterEqual: operation = BO_GreaterEqual; break;
-    case TOK_GreaterThan:  operation = BO_GreaterThan; break;
-    default:               return ret;
-    }
-    size_t line_num = parser->current.line_num;
-    advance(parser);
-    struct Ast* rhs = bitwise_or(parser, NULL);
-    ret = ast_binary_create(line_num, operation, ret, rhs);
-  }
-  return ret;
-}
-
-static struct Ast* inversion(struct Parser* parser, struct Ast* opt_primary) {
-  if (opt_primary) {
-    return comparison(parser, opt_primary);
-  }
-  size_t line_num = parser->current.line_num;
-  switch (parser->current.type) {
+    return ast_unary_create(parser->arena, line_num, UO_BitNot, unary(parser, PREC_Unary));
   case TOK_Not:
+    if (precedence > PREC_Not) {
+      return primary(parser); // Which reports the error
+    }
     advance(parser);
-    return ast_unary_create(line_num, UO_LogicalNot, inversion(parser, NULL));
+    return ast_unary_create(parser->arena, line_num, UO_LogicalNot,
+                            binary(parser, unary(parser, PREC_Not), PREC_Not));
   case TOK_EOF:
     parser->incomplete_input = true;
     return NULL;
   default:
-    return comparison(parser, NULL);
+    return primary(parser);
   }
 }
 
-static struct Ast* conjunction(struct Parser* parser, struct Ast* opt_primary) {
-  struct Ast* ret = inversion(parser, opt_primary);
-  while (match(parser, TOK_And)) {
-    size_t line_num = parser->previous.line_num;
-    struct Ast* rhs = inversion(parser, NULL);
-    ret = ast_binary_create(line_num, BO_LogicalAnd, ret, rhs);
-  }
-  return ret;
-}
-
-static struct Ast* disjunction(struct Parser* parser, struct Ast* opt_primary) {
-  struct Ast* ret = conjunction(parser, opt_primary);
-  while (match(parser, TOK_Or)) {
-    size_t line_num = parser->previous.line_num;
-    struct Ast* rhs = conjunction(parser, NULL);
-    ret = ast_binary_create(line_num, BO_LogicalOr, ret, rhs);
+// Parse binary operators of at least `precedence` after `lhs`. Each operator
+// parses its right operand with only the operators which bind tighter, and
+// the loop takes care of the rest.
+static struct Ast* binary(struct Parser* parser, struct Ast* lhs, enum Precedence precedence) {
+  while (true) {
+    struct BinaryRule rule = BINARY_RULES[current_type(parser)];
+    if (rule.precedence < precedence) { // Which includes PREC_None
+      return lhs;
+    }
+    size_t line_num = current_line(parser);
+    advance(parser);
+    enum Precedence rhs_precedence = (enum Precedence) (rule.precedence + 1);
+    struct Ast* rhs = binary(parser, unary(parser, rhs_precedence), rhs_precedence);
+    lhs = ast_binary_create(parser->arena, line_num, (enum BinaryOp) rule.operation, lhs, rhs);
   }
-  return ret;
 }
 
 static struct Ast* expression_prime(struct Parser* parser, struct Ast* primary) {
-  return disjunction(parser, primary);
+  return binary(parser, primary, PREC_Or);
 }
 
 static struct Ast* expression(struct Parser* parser) {
-  return disjunction(parser, NULL);
+  return binary(parser, unary(parser, PREC_Or), PREC_Or);
 }
 
 static bool is_assignment_op(enum TokenType type) {
@@ -523,54 +540,35 @@ static bool is_assignment_op(enum TokenType type) {
 }
 
 static struct Ast* assignment_or_expression(struct Parser* parser) {
-  switch (parser->current.type) {
+  switch (current_type(parser)) {
   case TOK_Identifier:
   case TOK_Self: {
     struct Ast* lhs = primary(parser);
-    if (!is_assignment_op(parser->current.type)) {
+    if (!is_assignment_op(current_type(parser))) {
       return expression_prime(parser, lhs);
     }
-    size_t line_num = parser->current.line_num;
-    enum TokenType token_type = parser->current.type;
+    size_t line_num = current_line(parser);
+    enum TokenType token_type = current_type(parser);
     advance(parser);
     struct Ast* rhs = expression(parser);
+    struct Arena* arena = parser->arena;
+    enum BinaryOp operation;
     switch (token_type) {
-    case TOK_AddAssign:
-      rhs = ast_binary_create(line_num, BO_Add, ast_clone(lhs), rhs);
-      break;
-    case TOK_SubAssign:
-      rhs = ast_binary_create(line_num, BO_Subtract, ast_clone(lhs), rhs);
-      break;
-    case TOK_MulAssign:
-      rhs = ast_binary_create(line_num, BO_Multiply, ast_clone(lhs), rhs);
-      break;
-    case TOK_DivAssign:
-      rhs = ast_binary_create(line_num, BO_Divide, ast_clone(lhs), rhs);
-      break;
-    case TOK_ModAssign:
-      rhs = ast_binary_create(line_num, BO_Modulo, ast_clone(lhs), rhs);
-      break;
-    case TOK_ShiftLeftAssign:
-      rhs = ast_binary_create(line_num, BO_ShiftLeft, ast_clone(lhs), rhs);
-      break;
-    case TOK_ShiftRightAssign:
-      rhs = ast_binary_create(line_num, BO_ShiftRight, ast_clone(lhs), rhs);
-      break;
-    case TOK_BitOrAssign:
-      rhs = ast_binary_create(line_num, BO_BitOr, ast_clone(lhs), rhs);
-      break;
-    case TOK_BitXorAssign:
-      rhs = ast_binary_create(line_num, BO_BitXor, ast_clone(lhs), rhs);
-      break;
-    case TOK_BitAndAssign:
-      rhs = ast_binary_create(line_num, BO_BitAnd, ast_clone(lhs), rhs);
-      break;
-    case TOK_Assign:
-      break;
-    default:
-      UNREACHABLE();
+    case TOK_Assign:           return ast_assignment_create(arena, line_num, lhs, rhs);
+    case TOK_AddAssign:        operation = BO_Add; break;
+    case TOK_SubAssign:        operation = BO_Subtract; break;
+    case TOK_MulAssign:        operation = BO_Multiply; break;
+    case TOK_DivAssign:        operation = BO_Divide; break;
+    case TOK_ModAssign:        operation = BO_Modulo; break;
+    case TOK_ShiftLeftAssign:  operation = BO_ShiftLeft; break;
+    case TOK_ShiftRightAssign: operation = BO_ShiftRight; break;
+    case TOK_BitOrAssign:      operation = BO_BitOr; break;
+    case TOK_BitXorAssign:     operation = BO_BitXor; break;
+    case TOK_BitAndAssign:     operation = BO_BitAnd; break;
+    default:                   UNREACHABLE();
     }
-    return ast_assignment_create(line_num, lhs, rhs);
+    // The target isn't duplicated, so its receiver and key are evaluated once
+    return ast_compound_assignment_create(arena, line_num, operation, lhs, rhs);
   }
   default:
     return expression(parser);
@@ -581,17 +579,18 @@ static struct Ast* let_declaration(struct Parser* parser, bool public) {
   if (public && parser->inside_block) {
     error_at_previous(parser, "public let declaration inside a block: ");
   }
-  size_t line_num = parser->current.line_num;
+  size_t line_num = current_line(parser);
   consume(parser, TOK_Let);
   consume(parser, TOK_Identifier);
-  struct Str variable = parser->previous.text;
+  struct Str variable = previous_text(parser);
+  uint32_t symbol = intern(parser, variable);
   struct Ast* rhs = NULL;
   if (match(parser, TOK_Assign)) {
     rhs = expression(parser);
   } else {
-    rhs = ast_nil_create(line_num);
+    rhs = ast_nil_create(parser->arena, line_num);
   };
-  return ast_let_create(line_num, public, variable, rhs);
+  return ast_let_create(parser->arena, line_num, public, variable, symbol, rhs);
 }
 
 static struct Ast* function_declaration(struct Parser* parser, bool public, bool can_have_self) {
@@ -599,16 +598,16 @@ static struct Ast* function_declaration(struct Parser* parser, bool public, bool
     error_at_previous(parser, "public function declaration inside a block: ");
   }
   struct AstVec params;
-  ast_vec_init(&params);
-  size_t line_num = parser->current.line_num;
+  ast_vec_init(&params, parser->arena);
+  size_t line_num = current_line(parser);
   consume(parser, TOK_Fn);
   consume(parser, TOK_Identifier);
-  struct Str name = parser->previous.text;
+  struct Str name = previous_text(parser);
+  uint32_t symbol = intern(parser, name);
   consume(parser, TOK_LeftParen);
   parameters(parser, &params, TOK_RightParen, can_have_self);
-  struct Ast* body = block_statement(parser);
-  struct Ast* ast_function = ast_function_create(line_num, params, body);
-  return ast_let_create(line_num, public, name, ast_function);
+  struct Ast* ast_function = function_body(parser, line_num, params);
+  return ast_let_create(parser->arena, line_num, public, name, symbol, ast_function);
 }
 
 static struct Ast* struct_declaration(struct Parser* parser, bool public) {
@@ -616,36 +615,38 @@ static struct Ast* struct_declaration(struct Parser* parser, bool public) {
     error_at_current(parser, "struct declaration inside a block: ");
   }
   struct AstVec members;
-  ast_vec_init(&members);
-  size_t line_num = parser->current.line_num;
+  ast_vec_init(&members, parser->arena);
+  size_t line_num = current_line(parser);
   consume(parser, TOK_Struct);
   consume(parser, TOK_Identifier);
-  struct Str name = parser->previous.text;
+  struct Str name = previous_text(parser);
+  uint32_t symbol = intern(parser, name);
   struct Str parent;
   bool has_parent = false;
   if (match(parser, TOK_Colon)) {
     consume(parser, TOK_Identifier);
-    parent = parser->previous.text;
+    parent = previous_text(parser);
     has_parent = true;
   }
   consume(parser, TOK_LeftCurBr);
-  size_t body_line_num = parser->current.line_num;
+  size_t body_line_num = current_line(parser);
   while (!match(parser, TOK_RightCurBr)) {
-    if (parser->current.type == TOK_EOF) {
+    if (current_type(parser) == TOK_EOF) {
       parser->incomplete_input = true;
       break;
     }
     bool public = match(parser, TOK_Pub);
     ast_vec_push(&members, function_declaration(parser, public, true));
   }
-  struct Ast* ast_struct = ast_struct_create(line_num,
+  struct Ast* ast_struct = ast_struct_create(parser->arena, line_num,
                                              has_parent ? &parent : NULL,
-                                             ast_block_create(body_line_num, members, true));
-  return ast_let_create(line_num, public, name, ast_struct);
+                                             ast_block_create(parser->arena, body_line_num, members,
+                                                              true));
+  return ast_let_create(parser->arena, line_num, public, name, symbol, ast_struct);
 }
 
 static struct Ast* declaration(struct Parser* parser, bool public) {
-  switch (parser->current.type) {
+  switch (current_type(parser)) {
   case TOK_Fn:     return function_declaration(parser, public, false);
   case TOK_Struct: return struct_declaration(parser, public);
   case TOK_Let:    return let_declaration(parser, public);
@@ -654,7 +655,7 @@ static struct Ast* declaration(struct Parser* parser, bool public) {
     return NULL;
   default:
     error_at_current(parser, "expected fn, struct, or let, found '",
-                     token_type_to_string(parser->current.type));
+                     token_type_to_string(current_type(parser)));
     return NULL;
   }
 }
@@ -667,76 +668,36 @@ static struct Ast* block_statement(struct Parser* parser) {
   return ret;
 }
 
-// "for" loops are just syntactic sugar for a while loop calling an iterator
-// returned by a generator. For example -
-// Original:
+// "for" loops run the body once for every value produced by the iterable, with
+// the value bound to the loop variable. For example -
 //   for i in range(0, 10) {
 //     print(i);
 //   }
-// De-sugared:
-//   {
-//     let __iter = generator();
-//     let i = next(__iter);
-//     while (i != nil) {
-//       print(i);
-//       i = next(__iter);
-//     }
-//   }
 static struct Ast* for_statement(struct Parser* parser) {
-  size_t start_line_num = parser->previous.line_num;
+  size_t line_num = previous_line(parser);
   consume(parser, TOK_For);
   consume(parser, TOK_Identifier);
-  size_t identifier_line_num = parser->current.line_num;
-  struct Str identifier = parser->previous.text;
+  struct Str variable = previous_text(parser);
+  uint32_t symbol = intern(parser, variable);
   consume(parser, TOK_In);
-  size_t generator_line_num = parser->current.line_num;
-  struct Ast* generator = expression(parser);
-  struct AstBlock* body = (struct AstBlock*) block_statement(parser);
-  CHECK(body->ast.type == AST_Block);
-
-  struct AstVec statements, next_args;
-  ast_vec_init(&statements);
-  ast_vec_init(&next_args);
-
-  struct Str iterator = (struct Str) { (const uint8_t*)"__iter", 6 };
-  struct Str next = (struct Str) { (const uint8_t*)"next", 4 };
-  struct Ast* ast_iterator = ast_identifier_create(generator_line_num, iterator);
-  struct Ast* ast_identifier = ast_identifier_create(identifier_line_num, identifier);
-  struct Ast* ast_next = ast_identifier_create(generator_line_num, next);
-
-  ast_vec_push(&next_args, ast_clone(ast_iterator));
-  struct Ast* call_next = ast_call_create(generator_line_num, ast_clone(ast_next), next_args);
-
-  // let __iter = generator()
-  ast_vec_push(&statements, ast_let_create(generator_line_num, false, iterator, generator));
-  // let identifier = next(__iter)
-  ast_vec_push(&statements, ast_let_create(identifier_line_num, false, identifier, ast_clone(call_next)));
-  // identifer != nil
-  struct Ast* condition = ast_binary_create(generator_line_num, BO_NotEqual, ast_clone(ast_identifier),
-                                            ast_nil_create(identifier_line_num));
-  // identifer = next(__iter)
-  struct Ast* update = ast_assignment_create(generator_line_num, ast_identifier, call_next);
-  // Append "update" to the loop body
-  ast_vec_push(&body->statements, update);
-  // Create while loop
-  ast_vec_push(&statements, ast_while_create(start_line_num, condition, (struct Ast*) body));
-  // Return enclosing block
-  return ast_block_create(start_line_num, statements, true);
+  struct Ast* iterable = expression(parser);
+  struct Ast* body = block_statement(parser);
+  return ast_for_create(parser->arena, line_num, variable, symbol, iterable, body);
 }
 
 static struct Ast* while_statement(struct Parser* parser) {
-  size_t line_num = parser->previous.line_num;
+  size_t line_num = previous_line(parser);
   consume(parser, TOK_While);
   struct Ast* condition = expression(parser);
   struct Ast* body = block_statement(parser);
-  return ast_while_create(line_num, condition, body);
+  return ast_while_create(parser->arena, line_num, condition, body);
 }
 
 static void synchronize(struct Parser* parser) {
   parser->panic_mode = false;
-  while (parser->current.type != TOK_EOF) {
+  while (current_type(parser) != TOK_EOF) {
     // Check if the previous token was a good synchronization point
-    switch (parser->previous.type) {
+    switch (previous_type(parser)) {
     case TOK_SemiColon:
     case TOK_RightCurBr:
       return;
@@ -744,7 +705,7 @@ static void synchronize(struct Parser* parser) {
       break;
     }
     // Check the current token for a good synchronization point
-    switch (parser->current.type) {
+    switch (current_type(parser)) {
     case TOK_Fn:
     case TOK_Pub:
     case TOK_Let:
@@ -763,73 +724,74 @@ static void synchronize(struct Parser* parser) {
   }
 }
 
+// Parse a single statement. Sets `*is_semicolon_statement` if the statement
+// has to be followed by a semicolon, unless it's the last one.
+static struct Ast* statement(struct Parser* parser, bool* is_semicolon_statement) {
+  size_t line_num = current_line(parser);
+  struct Ast* ast;
+  *is_semicolon_statement = false;
+  switch (current_type(parser)) {
+  case TOK_Pub:
+    advance(parser);
+    *is_semicolon_statement = current_type(parser) == TOK_Let;
+    return declaration(parser, true);
+  case TOK_Fn:
+  case TOK_Struct: return declaration(parser, false);
+  case TOK_If:     return if_statement(parser);
+  case TOK_While:  return while_statement(parser);
+  case TOK_For:    return for_statement(parser);
+  case TOK_Let:
+    *is_semicolon_statement = true;
+    return let_declaration(parser, false);
+  case TOK_Break:
+    if (!parser->inside_block) {
+      error_at_current(parser, "'break' outside of a block: ");
+    }
+    advance(parser);
+    *is_semicolon_statement = true;
+    return ast_break_create(parser->arena, line_num);
+  case TOK_Continue:
+    if (!parser->inside_block) {
+      error_at_current(parser, "'continue' outside of a block: ");
+    }
+    advance(parser);
+    *is_semicolon_statement = true;
+    return ast_continue_create(parser->arena, line_num);
+  case TOK_Return:
+    if (!parser->inside_block) {
+      error_at_current(parser, "'return' outside of a block: ");
+    }
+    advance(parser);
+    switch (current_type(parser)) {
+    case TOK_SemiColon:
+    case TOK_RightCurBr:
+      ast = ast_return_create(parser->arena, line_num, NULL);
+      break;
+    default:
+      ast = ast_return_create(parser->arena, line_num, expression(parser));
+      break;
+    }
+    *is_semicolon_statement = true;
+    return ast;
+  default:
+    *is_semicolon_statement = true;
+    return assignment_or_expression(parser);
+  }
+}
+
 static struct Ast* statement_list(struct Parser* parser) {
   struct AstVec statements;
   bool is_semicolon_statement = false;
-  size_t start_line_num = parser->current.line_num, line_num = parser->current.line_num;
+  size_t start_line_num = current_line(parser);
   if (parser->inside_block) {
     consume(parser, TOK_LeftCurBr);
   }
-  ast_vec_init(&statements);
-  while (parser->current.type != TOK_EOF) {
-    if (parser->inside_block && parser->current.type == TOK_RightCurBr) {
+  ast_vec_init(&statements, parser->arena);
+  while (current_type(parser) != TOK_EOF) {
+    if (parser->inside_block && current_type(parser) == TOK_RightCurBr) {
       break;
     }
-    is_semicolon_statement = false;
-    line_num = parser->current.line_num;
-    switch (parser->current.type) {
-    case TOK_EOF:
-      break;
-    case TOK_Pub:
-      advance(parser);
-      is_semicolon_statement = parser->current.type == TOK_Let;
-      ast_vec_push(&statements, declaration(parser, true));
-      break;
-    case TOK_Fn:
-    case TOK_Struct: ast_vec_push(&statements, declaration(parser, false)); break;
-    case TOK_If:     ast_vec_push(&statements, if_statement(parser)); break;
-    case TOK_While:  ast_vec_push(&statements, while_statement(parser)); break;
-    case TOK_For:    ast_vec_push(&statements, for_statement(parser)); break;
-    case TOK_Let:
-      ast_vec_push(&statements, let_declaration(parser, false));
-      is_semicolon_statement = true;
-      break;
-    case TOK_Break:
-      if (!parser->inside_block) {
-        error_at_current(parser, "'break' outside of a block: ");
-      }
-      advance(parser);
-      ast_vec_push(&statements, ast_break_create(line_num));
-      is_semicolon_statement = true;
-      break;
-    case TOK_Continue:
-      if (!parser->inside_block) {
-        error_at_current(parser, "'continue' outside of a block: ");
-      }
-      advance(parser);
-      ast_vec_push(&statements, ast_continue_create(line_num));
-      is_semicolon_statement = true;
-      break;
-    case TOK_Return:
-      if (!parser->inside_block) {
-        error_at_current(parser, "'return' outside of a block: ");
-      }
-      advance(parser);
-      switch (parser->current.type) {
-      case TOK_SemiColon:
-      case TOK_RightCurBr:
-        ast_vec_push(&statements, ast_return_create(line_num, NULL));
-        break;
-      default:
-        ast_vec_push(&statements, ast_return_create(line_num, expression(parser)));
-        break;
-      }
-      is_semicolon_statement = true;
-      break;
-    default:
-      ast_vec_push(&statements, assignment_or_expression(parser));
-      is_semicolon_statement = true;
-    }
+    ast_vec_push(&statements, statement(parser, &is_semicolon_statement));
     // Error synchronization
     if (parser->panic_mode) {
       synchronize(parser);
@@ -843,17 +805,27 @@ static struct Ast* statement_list(struct Parser* parser) {
   }
   if (parser->inside_block) {
     consume(parser, TOK_RightCurBr);
-    return ast_block_create(start_line_num, statements, is_semicolon_statement);
+    return ast_block_create(parser->arena, start_line_num, statements, is_semicolon_statement);
   } else {
-    return ast_program_create(start_line_num, statements);
+    return ast_program_create(parser->arena, start_line_num, statements);
   }
 }
 
-// Initialize the parser
-static void parser_init(struct Parser* parser, const char* source, struct Writer* writer) {
-  lexer_init(&parser->lexer, source);
+// Initialize the parser to continue from where `lexer` is, right after a
+// token of type `previous_type`.
+static void parser_init_from(struct Parser* parser, struct Arena* arena,
+                             const struct Lexer* lexer, struct Writer* writer,
+                             enum TokenType previous_type) {
+  parser->lexer = *lexer;
   token_init_undefined(&parser->previous);
   token_init_undefined(&parser->current);
+  // This becomes the previous token once we jump-start parsing
+  parser->current.type = previous_type;
+  parser->current.line_num = lexer->line_num;
+  parser->current_end = lexer->current_offset;
+  parser->arena = arena;
+  parser->symbols = NULL;
+  parser->lazy_functions = false;
   parser->writer = writer;
   parser->had_error = false;
   parser->panic_mode = false;
@@ -862,22 +834,335 @@ static void parser_init(struct Parser* parser, const char* source, struct Writer
   advance(parser); // Jump-start parsing
 }
 
-struct Ast* parse(const char* source, struct Writer *err_writer, bool* incomplete_input) {
+// Initialize the parser at the start of a source
+static void parser_init(struct Parser* parser, struct Arena* arena, const char* source,
+                        struct Writer* writer) {
+  struct Lexer lexer;
+  lexer_init(&lexer, source);
+  parser_init_from(parser, arena, &lexer, writer, TOK_Undefined);
+}
+
+struct Ast* parse(struct Arena* arena, const char* source, struct Writer *err_writer,
+                 bool* incomplete_input) {
+  struct ParseOptions options = { NULL, false };
+  return parse_with_options(arena, source, &options, err_writer, incomplete_input);
+}
+
+struct Ast* parse_with_options(struct Arena* arena, const char* source,
+                               const struct ParseOptions* options, struct Writer *err_writer,
+                               bool* incomplete_input) {
   struct Parser parser;
-  parser_init(&parser, source, err_writer);
+  parser_init(&parser, arena, source, err_writer);
+  parser.symbols = options->symbols;
+  parser.lazy_functions = options->lazy_functions;
   struct Ast* ast = statement_list(&parser);
   *incomplete_input = !parser.had_error && parser.incomplete_input;
-  // If an error was encountered, free the AST and return NULL
+  // If an error was encountered, return NULL. Whatever was allocated is freed
+  // along with the arena.
   if (parser.had_error || parser.incomplete_input) {
-    ast_free(ast);
     ast = NULL;
   }
   // If there are more tokens from the lexer, that's also an error
-  if (ast && parser.current.type != TOK_EOF) {
-    ast_free(ast);
+  if (ast && current_type(&parser) != TOK_EOF) {
     ast = NULL;
     // Check if what the lexer returned is itself an error
     error_at_current(&parser, "we should have covered all tokens, found: ");
   }
   return ast;
 }
+
+bool parse_function_body(struct Arena* arena, struct AstFunction* function,
+                         const struct ParseOptions* options, struct Writer* err_writer) {
+  if (function->body) {
+    return true;
+  }
+  // The body is the start of the rest of the source, so it's lexed from there,
+  // and parsing stops at its closing brace
+  struct Lexer lexer;
+  lexer_init_at(&lexer, (const char*) function->lazy_body.data, 0, function->lazy_line_num);
+  struct Parser parser;
+  parser_init_from(&parser, arena, &lexer, err_writer, TOK_Undefined);
+  parser.symbols = options->symbols;
+  parser.lazy_functions = options->lazy_functions;
+  struct Ast* body = block_statement(&parser);
+  bool ok = !parser.had_error && !parser.incomplete_input;
+  if (ok) {
+    function->body = body;
+  }
+  return ok;
+}
+
+// Parse one top-level statement, along with the semicolon after it. Unlike
+// `statement_list`, this carries on after a missing semicolon, so that the
+// program is split into statements the same way wherever parsing started.
+static struct Ast* top_level_statement(struct Parser* parser, struct StatementSpan* span) {
+  bool is_semicolon_statement;
+  parser->had_error = parser->incomplete_input = false;
+  struct Ast* ast = statement(parser, &is_semicolon_statement);
+  if (!parser->panic_mode && is_semicolon_statement && !match(parser, TOK_SemiColon)
+      && current_type(parser) != TOK_EOF) {
+    error_at_current(parser, "expected ';', found '");
+  }
+  if (parser->panic_mode) {
+    synchronize(parser);
+  }
+  span->end = parser->previous_end;
+  span->line_num = previous_line(parser);
+  span->next_end = parser->current_end;
+  span->last = previous_type(parser);
+  if (parser->had_error) {
+    span->status = SS_Error;
+  } else if (parser->incomplete_input) {
+    span->status = SS_Incomplete;
+  } else {
+    span->status = SS_Ok;
+  }
+  return ast;
+}
+
+// Statements with absolute positions, while they're being re-parsed
+struct StatementRun {
+  struct Ast** statements;
+  struct StatementSpan* spans;
+  size_t length;
+  size_t capacity;
+};
+
+static void run_push(struct StatementRun* run, struct Ast* statement,
+                     const struct StatementSpan* span) {
+  if (run->length == run->capacity) {
+    run->capacity = run->capacity == 0 ? 8 : run->capacity * 2;
+    REALLOC(run->statements, run->capacity * sizeof(struct Ast*));
+    REALLOC(run->spans, run->capacity * sizeof(struct StatementSpan));
+  }
+  run->statements[run->length] = statement;
+  run->spans[run->length++] = *span;
+}
+
+// Actual position of the end of a statement
+static size_t span_end(const struct IncParser* parser, size_t index) {
+  size_t shift = index >= parser->shift_from ? parser->shift_offset : 0;
+  return parser->spans[index].end + shift;
+}
+
+static size_t span_next_end(const struct IncParser* parser, size_t index) {
+  size_t shift = index >= parser->shift_from ? parser->shift_offset : 0;
+  return parser->spans[index].next_end + shift;
+}
+
+static size_t span_line(const struct IncParser* parser, size_t index) {
+  size_t shift = index >= parser->shift_from ? parser->shift_lines : 0;
+  return parser->spans[index].line_num + shift;
+}
+
+// Add a shift to statements [from, to). Line numbers are also stored in the
+// AST itself, so those have to be moved too.
+static void shift_spans(struct IncParser* parser, size_t from, size_t to, size_t offset_delta,
+                        size_t line_delta) {
+  for (size_t i = from; i < to; i++) {
+    parser->spans[i].end += offset_delta;
+    parser->spans[i].next_end += offset_delta;
+    parser->spans[i].line_num += line_delta;
+    if (line_delta != 0) {
+      ast_relocate(parser->program->statements.data[i], line_delta, NULL, 0, NULL);
+    }
+  }
+}
+
+static void count_status(struct IncParser* parser, enum StatementStatus status, size_t delta) {
+  switch (status) {
+  case SS_Ok:         break;
+  case SS_Error:      parser->num_errors += delta; break;
+  case SS_Incomplete: parser->num_incomplete += delta; break;
+  }
+}
+
+// Replace statements [first, last) with the statements in `run`, which have no
+// pending shift
+static void replace_statements(struct IncParser* parser, size_t first, size_t last,
+                               const struct StatementRun* run) {
+  struct AstVec* statements = &parser->program->statements;
+  size_t length = statements->length - (last - first) + run->length;
+  if (length > statements->capacity) {
+    size_t capacity = length * 2;
+    statements->data = arena_realloc(&parser->arena, statements->data,
+                                     statements->capacity * sizeof(struct Ast*),
+                                     capacity * sizeof(struct Ast*));
+    statements->capacity = capacity;
+  }
+  if (length > parser->spans_capacity) {
+    parser->spans_capacity = length * 2;
+    REALLOC(parser->spans, parser->spans_capacity * sizeof(struct StatementSpan));
+  }
+  for (size_t i = first; i < last; i++) {
+    count_status(parser, parser->spans[i].status, -1);
+  }
+  if (run->length != last - first) {
+    memmove(statements->data + first + run->length, statements->data + last,
+            (statements->length - last) * sizeof(struct Ast*));
+    memmove(parser->spans + first + run->length, parser->spans + last,
+            (statements->length - last) * sizeof(struct StatementSpan));
+  }
+  for (size_t i = 0; i < run->length; i++) {
+    statements->data[first + i] = run->statements[i];
+    parser->spans[first + i] = run->spans[i];
+    count_status(parser, run->spans[i].status, 1);
+  }
+  statements->length = length;
+  if (parser->shift_from >= last) {
+    parser->shift_from = parser->shift_from - (last - first) + run->length;
+  }
+}
+
+// Find the first statement whose lookahead token ends at `offset` or later
+static size_t find_statement(const struct IncParser* parser, size_t offset) {
+  size_t low = 0, high = parser->program->statements.length;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (span_next_end(parser, mid) >= offset) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return low;
+}
+
+// Throw away the AST, so that the next edit parses everything
+static void inc_parser_reset(struct IncParser* parser) {
+  struct AstVec statements;
+  arena_init(&parser->arena);
+  ast_vec_init(&statements, &parser->arena);
+  parser->program = (struct AstProgram*) ast_program_create(&parser->arena, 0, statements);
+  parser->length = parser->garbage = 0;
+  parser->num_errors = parser->num_incomplete = 0;
+  parser->shift_from = parser->shift_offset = parser->shift_lines = 0;
+}
+
+void inc_parser_init(struct IncParser* parser, const char* source, struct Writer* err_writer) {
+  parser->writer = err_writer;
+  parser->spans = NULL;
+  parser->spans_capacity = 0;
+  inc_parser_reset(parser);
+  inc_parser_edit(parser, source, 0, 0, strlen(source));
+}
+
+void inc_parser_fini(struct IncParser* parser) {
+  arena_fini(&parser->arena);
+  free(parser->spans);
+}
+
+size_t inc_parser_edit(struct IncParser* parser, const char* source, size_t offset,
+                       size_t removed_length, size_t inserted_length) {
+  size_t removed_end = offset + removed_length;
+  size_t num_statements = parser->program->statements.length;
+
+  // Replaced statements stay in the arena. Once they take up more space than
+  // the live ones, start afresh, which keeps the cost amortized.
+  if (parser->garbage > parser->length) {
+    size_t length = parser->length + inserted_length - removed_length;
+    arena_fini(&parser->arena);
+    inc_parser_reset(parser);
+    return inc_parser_edit(parser, source, 0, 0, length);
+  }
+  parser->length += inserted_length - removed_length;
+
+  // Lexing the token after a statement looks at most one byte past it, so the
+  // first statement which could have changed is the first one whose lookahead
+  // ends at `offset - 1` or later. Re-parse from the state just before it.
+  size_t first = find_statement(parser, offset < 1 ? 0 : offset - 1);
+  size_t restart_offset = 0, restart_line = 0;
+  enum TokenType restart_type = TOK_Undefined;
+  if (first > 0) {
+    restart_offset = span_end(parser, first - 1);
+    restart_line = span_line(parser, first - 1);
+    restart_type = parser->spans[first - 1].last;
+  }
+
+  // Re-parse until a new statement ends at the same place as an old statement
+  // past the edit. Everything after that is parsed exactly as before.
+  struct Parser reparser;
+  struct StatementRun run = { NULL, NULL, 0, 0 };
+  size_t old = first, line_delta = 0;
+  bool resynced = false;
+  struct Lexer lexer;
+  lexer_init_at(&lexer, source, restart_offset, restart_line);
+  parser_init_from(&reparser, &parser->arena, &lexer, parser->writer, restart_type);
+  if (first == 0) {
+    parser->program->ast.line_num = current_line(&reparser);
+  }
+  while (!resynced && current_type(&reparser) != TOK_EOF) {
+    struct StatementSpan span;
+    struct Ast* statement = top_level_statement(&reparser, &span);
+    run_push(&run, statement, &span);
+    // Skip old statements which end before this one. Both ends are offset so
+    // that they can be compared without going negative.
+    size_t new_end = span.end + removed_length;
+    while (old < num_statements) {
+      size_t old_end = span_end(parser, old) + inserted_length;
+      if (old_end > new_end) {
+        break;
+      }
+      if (old_end == new_end && old_end >= removed_end + inserted_length
+          && parser->spans[old].last == span.last) {
+        resynced = true;
+        line_delta = span.line_num - span_line(parser, old);
+      }
+      old++;
+      if (old_end == new_end) {
+        break;
+      }
+    }
+  }
+  size_t last = resynced ? old : num_statements;
+  if (last > first) {
+    parser->garbage += span_end(parser, last - 1) - restart_offset;
+  }
+
+  // The new statements point into the caller's buffer. Move them to a copy.
+  if (run.length > 0) {
+    size_t length = run.spans[run.length - 1].end - restart_offset;
+    uint8_t* copy = arena_alloc(&parser->arena, length);
+    memcpy(copy, source + restart_offset, length);
+    for (size_t i = 0; i < run.length; i++) {
+      ast_relocate(run.statements[i], 0, (const uint8_t*) source + restart_offset, length, copy);
+    }
+  }
+  // Keep a single range of spans with a pending shift. Only the spans between
+  // the previous edit and this one are touched.
+  size_t offset_delta = inserted_length - removed_length;
+  if (parser->shift_from >= num_statements
+      || (parser->shift_offset == 0 && parser->shift_lines == 0)) {
+    parser->shift_from = last;
+    parser->shift_offset = parser->shift_lines = 0;
+  }
+  if (parser->shift_from < last) {
+    shift_spans(parser, parser->shift_from, last, parser->shift_offset, parser->shift_lines);
+    parser->shift_from = last;
+  } else {
+    shift_spans(parser, last, parser->shift_from, offset_delta, line_delta);
+  }
+  parser->shift_offset += offset_delta;
+  parser->shift_lines += line_delta;
+  replace_statements(parser, first, last, &run);
+  free(run.statements);
+  free(run.spans);
+  return run.length;
+}
+
+struct Ast* inc_parser_program(struct IncParser* parser, bool* incomplete_input) {
+  *incomplete_input = parser->num_errors == 0 && parser->num_incomplete > 0;
+  if (parser->num_errors > 0 || parser->num_incomplete > 0) {
+    return NULL;
+  }
+  size_t num_statements = parser->program->statements.length;
+  if (parser->shift_from < num_statements) {
+    shift_spans(parser, parser->shift_from, num_statements, parser->shift_offset,
+                parser->shift_lines);
+    parser->shift_from = num_statements;
+    parser->shift_offset = parser->shift_lines = 0;
+  }
+  return (struct Ast*) parser->program;
+}
+
+#undef REALLOC
@@ -1,15 +1,100 @@
 #ifndef __BS_PARSER_H__
 #define __BS_PARSER_H__
 
+#include "arena.h"
 #include "ast.h"
 #include "lexer.h"
 #include "string.h"
+#include "symbol.h"
 #include "writer.h"
 
 // Parse source source code and return an AST. Returns a NULL AST if the source
 // code provided was empty (just whitespace?), or there was an error. Writes
 // error messages out to `err_writer`. If the input was incomplete and there was
-// no other error, setes `*incomplete_input` to `true`.
-struct Ast* parse(const char* source, struct Writer *err_writer, bool* incomplete_input);
+// no other error, setes `*incomplete_input` to `true`. All AST nodes are
+// allocated from `arena`, and the tree is freed by destroying the arena.
+struct Ast* parse(struct Arena* arena, const char* source, struct Writer *err_writer,
+                  bool* incomplete_input);
+
+// Options for `parse_with_options`
+struct ParseOptions {
+  // If not NULL, all identifiers, declared names and member names are interned
+  // into this table, and their symbol IDs are set in the AST. The same table
+  // can be used for many parses, so that a name gets the same ID in all of them.
+  struct SymbolTable* symbols;
+  // Whether to skip over function bodies, only matching up their braces. The
+  // AST for a function then has no body, but the source text for it, which has
+  // to stay around until the body is parsed by `parse_function_body`.
+  bool lazy_functions;
+};
+
+// Like `parse`, with options
+struct Ast* parse_with_options(struct Arena* arena, const char* source,
+                               const struct ParseOptions* options, struct Writer *err_writer,
+                               bool* incomplete_input);
+
+// Parse the body of a function which was skipped by a lazy parse, with the
+// same options. Returns `true` if the function has a body now. Syntax errors
+// in the body are written to `err_writer` when this is called, rather than by
+// the parse which skipped it.
+bool parse_function_body(struct Arena* arena, struct AstFunction* function,
+                         const struct ParseOptions* options, struct Writer* err_writer);
+
+// Whether a top-level statement was parsed successfully
+enum StatementStatus {
+  SS_Ok,
+  SS_Error,
+  SS_Incomplete,
+};
+
+// Where a top-level statement ends, and what the parser saw there. Parsing of
+// the next statement starts from this state.
+struct StatementSpan {
+  size_t end;                  // Offset just past the last token of the statement
+  size_t line_num;             // Line number at `end`
+  size_t next_end;             // Offset just past the token after the statement
+  enum TokenType last;         // Type of the last token of the statement
+  enum StatementStatus status; // Whether there were errors in the statement
+};
+
+// Parser for a buffer which is edited in place, like in an editor. Edits only
+// re-parse the top-level statements around them, and reuse the rest of the
+// program. The AST doesn't point into the buffer, since that changes under it.
+struct IncParser {
+  struct Arena arena;            // Arena for the AST and copies of the source text
+  struct Writer* writer;         // Writer for error messages
+  struct AstProgram* program;    // The whole program, including broken statements
+  struct StatementSpan* spans;   // Span of each statement in the program
+  size_t spans_capacity;         // Allocated capacity of `spans`
+  size_t length;                 // Length of the source
+  size_t garbage;                // Bytes of source for replaced statements in the arena
+  size_t num_errors;             // Number of statements with errors
+  size_t num_incomplete;         // Number of incomplete statements
+  // Like with `IncLexer`, statements from `shift_from` onwards are
+  // `shift_offset` bytes and `shift_lines` lines further than their spans and
+  // AST say. These wrap around when moving back.
+  size_t shift_from;
+  size_t shift_offset;
+  size_t shift_lines;
+};
+
+// Initialize the parser, and parse all of `source`. Error messages for all the
+// statements are written to `err_writer`.
+void inc_parser_init(struct IncParser* parser, const char* source, struct Writer* err_writer);
+
+// Free the parser along with its AST
+void inc_parser_fini(struct IncParser* parser);
+
+// Update the AST after `removed_length` bytes at `offset` were replaced by
+// `inserted_length` bytes. `source` is the whole buffer after the edit, which
+// may have moved. Error messages are only written for re-parsed statements.
+// Returns the number of statements which were re-parsed.
+size_t inc_parser_edit(struct IncParser* parser, const char* source, size_t offset,
+                       size_t removed_length, size_t inserted_length);
+
+// Get the AST for the current source. Returns NULL under the same conditions as
+// `parse`. The AST is valid until the next edit. If edits changed the number of
+// lines, this has to fix up line numbers in the statements after them.
+struct Ast* inc_parser_program(struct IncParser* parser, bool* incomplete_input);
 
 #endif  // __BS_PARSER_H__
@@ -0,0 +1,341 @@
+#include "peephole.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "test-util.h"
+#include "test.h"
+#include "vm.h"
+#include "writer.h"
+
+// Compile a program into `chunk`, and optimize it if `stats` isn't NULL
+static void compile(const char* source, struct Chunk* chunk, struct PeepholeStats* stats) {
+  ASSERT(test_compile(source, 0, chunk));
+  if (stats) {
+    peephole_optimize(chunk, stats);
+  }
+}
+
+// Optimize a program, and compare the code with the given bytes. The counts
+// from the optimizer are left in `stats`.
+#define ASSERT_OPTIMIZES_TO(SOURCE, ...) do {                                     \
+    static const uint8_t expected[] = { __VA_ARGS__ };                            \
+    struct Memory mem;                                                            \
+    struct Chunk chunk;                                                           \
+    mem_init(&mem);                                                               \
+    chunk_init(&chunk, &mem);                                                     \
+    stats = (struct PeepholeStats) { { 0 } };                                     \
+    compile(SOURCE, &chunk, &stats);                                              \
+    ASSERT_INT_EQ(chunk.code.length, sizeof(expected));                           \
+    ASSERT(memcmp(chunk.code.code, expected, sizeof(expected)) == 0);             \
+    chunk_fini(&chunk);                                                           \
+    mem_fini(&mem);                                                               \
+  } while (0)
+
+TEST(Peephole, FoldUnary) {
+  struct PeepholeStats stats;
+  // The constant for 3 is still there, but unused
+  ASSERT_OPTIMIZES_TO("-(3)", OP_Const1B, 1, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_FoldUnary], 1);
+  ASSERT_OPTIMIZES_TO("not not nil", OP_False, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_FoldUnary], 2);
+  ASSERT_OPTIMIZES_TO("!-(1)", OP_Const1B, 2, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_FoldUnary], 2);
+  // Failures are left to runtime
+  ASSERT_OPTIMIZES_TO("-nil", OP_Nil, OP_Minus, OP_Return);
+  ASSERT_OPTIMIZES_TO("!1.5", OP_Const1B, 0, OP_BitNot, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_FoldUnary], 0);
+}
+
+TEST(Peephole, PushPop) {
+  struct PeepholeStats stats;
+  ASSERT_OPTIMIZES_TO("1; true; nil; 2", OP_Const1B, 1, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_PushPop], 3);
+  // A folded literal can be removed as well
+  ASSERT_OPTIMIZES_TO("-(1); 2", OP_Const1B, 1, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_PushPop], 1);
+  // Operations might fail, so they have to stay
+  ASSERT_OPTIMIZES_TO("1 * 2; 3", OP_Const1B, 0, OP_Const1B, 1, OP_Multiply, OP_Pop,
+                      OP_Const1B, 2, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_PushPop], 0);
+  // The body of the loop disappears, and the loop jumps back to itself
+  ASSERT_OPTIMIZES_TO("for i in range(10) { i; }",
+                      OP_Const1B, 0, OP_Const1B, 1, OP_Nil, OP_RangeStart, 0, 4, 0,
+                      OP_RangeLoop, 0, 4, 0, OP_Pop, OP_Pop, OP_Pop, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_PushPop], 1);
+}
+
+TEST(Peephole, Jumps) {
+  struct PeepholeStats stats;
+  // The loop jumps back to "continue", which jumps to the loop. The pop of the
+  // value of "continue" is dead, and then "continue" jumps to the next
+  // instruction.
+  ASSERT_OPTIMIZES_TO("for i in range(10) { continue; }",
+                      OP_Const1B, 0, OP_Const1B, 1, OP_Nil, OP_RangeStart, 0, 4, 0,
+                      OP_RangeLoop, 0, 4, 0, OP_Pop, OP_Pop, OP_Pop, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_ThreadJump], 1);
+  ASSERT_INT_EQ(stats.hits[PR_DeadCode], 1);
+  ASSERT_INT_EQ(stats.hits[PR_JumpToNext], 1);
+
+  // Build a chain of jumps by hand. Once the first one is threaded, the
+  // second one is dead, and the first one jumps to the next instruction.
+  struct Memory mem;
+  struct Chunk chunk;
+  mem_init(&mem);
+  chunk_init(&chunk, &mem);
+  static const uint8_t code[] = {
+    OP_Jump, 1, 0, OP_Nil, OP_Jump, 1, 0, OP_Nil, OP_True, OP_Return,
+  };
+  for (size_t i = 0; i < sizeof(code); i++) {
+    chunk_push_byte(&chunk, code[i]);
+  }
+  stats = (struct PeepholeStats) { { 0 } };
+  peephole_optimize(&chunk, &stats);
+  static const uint8_t expected[] = { OP_True, OP_Return };
+  ASSERT_INT_EQ(chunk.code.length, sizeof(expected));
+  ASSERT(memcmp(chunk.code.code, expected, sizeof(expected)) == 0);
+  ASSERT_INT_EQ(stats.hits[PR_ThreadJump], 1);
+  ASSERT_INT_EQ(stats.hits[PR_DeadCode], 3);
+  ASSERT_INT_EQ(stats.hits[PR_JumpToNext], 1);
+  chunk_fini(&chunk);
+  mem_fini(&mem);
+}
+
+// A window doesn't span an instruction which a jump lands on
+TEST(Peephole, JumpTargetsAreBarriers) {
+  struct Memory mem;
+  struct Chunk chunk;
+  mem_init(&mem);
+  chunk_init(&chunk, &mem);
+  // An empty range skips the "nil" and goes straight to the "pop"
+  static const uint8_t code[] = {
+    OP_True, OP_RangeStart, 0, 1, 0, OP_Nil, OP_Pop, OP_False, OP_Return,
+  };
+  for (size_t i = 0; i < sizeof(code); i++) {
+    chunk_push_byte(&chunk, code[i]);
+  }
+  struct PeepholeStats stats = { { 0 } };
+  peephole_optimize(&chunk, &stats);
+  ASSERT_INT_EQ(chunk.code.length, sizeof(code));
+  ASSERT(memcmp(chunk.code.code, code, sizeof(code)) == 0);
+  ASSERT_INT_EQ(stats.hits[PR_PushPop], 0);
+  chunk_fini(&chunk);
+  mem_fini(&mem);
+}
+
+TEST(Peephole, Superinstructions) {
+  struct PeepholeStats stats;
+  ASSERT_OPTIMIZES_TO("for i in range(10) { i + 1; }",
+                      OP_Const1B, 0, OP_Const1B, 1, OP_Nil, OP_RangeStart, 0, 7, 0,
+                      OP_AddLocalConst, 2, 2, OP_PopRangeLoop, 0, 7, 0,
+                      OP_Pop, OP_Pop, OP_Pop, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_Fuse], 2);
+  ASSERT_OPTIMIZES_TO("for i in range(2) { for j in range(3) { i * j + 1; } }",
+                      OP_Const1B, 0, OP_Const1B, 1, OP_Nil, OP_RangeStart, 0, 25, 0,
+                      OP_Const1B, 0, OP_Const1B, 2, OP_Nil, OP_RangeStart, 3, 10, 0,
+                      OP_GetLocal2, 2, 5, OP_Multiply, OP_AddConst, 3, OP_PopRangeLoop, 3, 10, 0,
+                      OP_Pop, OP_Pop, OP_PopRangeLoop, 0, 25, 0,
+                      OP_Pop, OP_Pop, OP_Pop, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_Fuse], 4);
+  // The comparison of a loop condition is fused with its jump out of the loop
+  ASSERT_OPTIMIZES_TO("let i = 0; while i < 10 { i += 1; }",
+                      OP_Const1B, 0, OP_SetGlobal, 0, 0, OP_Pop,
+                      OP_GetGlobal, 0, 0, OP_Const1B, 1, OP_LessThanJumpIfFalse, 10, 0,
+                      OP_Const1B, 2, OP_UpdateGlobal, 0, 0, OP_Add, OP_Pop,
+                      OP_JumpBack, 18, 0, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_Fuse], 1);
+}
+
+// Conditions jump straight to their targets. Without a condition, nested
+// "and" and "or" are threaded into each other.
+TEST(Peephole, ConditionalJumps) {
+  struct PeepholeStats stats;
+  ASSERT_OPTIMIZES_TO("for i in range(3) { if i < 3 and not (i == 1 or i == 2) { 1 } else { 2 } }",
+                      OP_Const1B, 0, OP_Const1B, 1, OP_Nil, OP_RangeStart, 0, 34, 0,
+                      OP_GetLocal, 2, OP_Const1B, 1, OP_LessThanJumpIfFalse, 21, 0,
+                      OP_GetLocal, 2, OP_Const1B, 2, OP_Equal, OP_JumpIfTrue, 13, 0,
+                      OP_GetLocal, 2, OP_Const1B, 3, OP_Equal, OP_JumpIfTrue, 5, 0,
+                      OP_Const1B, 2, OP_Jump, 2, 0, OP_Const1B, 3,
+                      OP_PopRangeLoop, 0, 34, 0, OP_Pop, OP_Pop, OP_Pop, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_ThreadJump], 0);
+  // When "i < 1" is false, the "or" would pop it and test "i == 2"
+  ASSERT_OPTIMIZES_TO("for i in range(3) { i < 1 and i > 0 or i == 2; }",
+                      OP_Const1B, 0, OP_Const1B, 1, OP_Nil, OP_RangeStart, 0, 24, 0,
+                      OP_GetLocal, 2, OP_Const1B, 2, OP_LessThanJumpIfFalse, 8, 0,
+                      OP_GetLocal, 2, OP_Const1B, 0, OP_GreaterThan, OP_JumpIfTrueOrPop, 5, 0,
+                      OP_GetLocal, 2, OP_Const1B, 3, OP_Equal,
+                      OP_PopRangeLoop, 0, 24, 0, OP_Pop, OP_Pop, OP_Pop, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_ThreadJump], 1);
+  // The "break" and the jump back are gone, and the condition's jump out of
+  // the loop goes to the next instruction, so it's a pop
+  ASSERT_OPTIMIZES_TO("for i in range(2) { while not (i < 1) { break; } }",
+                      OP_Const1B, 0, OP_Const1B, 1, OP_Nil, OP_RangeStart, 0, 9, 0,
+                      OP_GetLocal, 2, OP_Const1B, 2, OP_LessThan, OP_PopRangeLoop, 0, 9, 0,
+                      OP_Pop, OP_Pop, OP_Pop, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_JumpToNext], 2);
+}
+
+// A "not" before a jump which pops its condition is dropped, and the jump
+// tests the other way. Here the "or" is threaded into a JumpIfFalse first.
+TEST(Peephole, InvertJump) {
+  struct PeepholeStats stats;
+  ASSERT_OPTIMIZES_TO("for i in range(3) { not (i == 1) and i > 0 or i == 2; }",
+                      OP_Const1B, 0, OP_Const1B, 1, OP_Nil, OP_RangeStart, 0, 25, 0,
+                      OP_GetLocal, 2, OP_Const1B, 2, OP_Equal, OP_JumpIfTrue, 8, 0,
+                      OP_GetLocal, 2, OP_Const1B, 0, OP_GreaterThan, OP_JumpIfTrueOrPop, 5, 0,
+                      OP_GetLocal, 2, OP_Const1B, 3, OP_Equal,
+                      OP_PopRangeLoop, 0, 25, 0, OP_Pop, OP_Pop, OP_Pop, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_InvertJump], 1);
+  // A jump which keeps its value on the stack needs the "not"
+  ASSERT_OPTIMIZES_TO("for i in range(3) { not (i == 1) and i > 0; }",
+                      OP_Const1B, 0, OP_Const1B, 1, OP_Nil, OP_RangeStart, 0, 18, 0,
+                      OP_GetLocal, 2, OP_Const1B, 2, OP_Equal, OP_LogicalNot,
+                      OP_JumpIfFalseOrPop, 5, 0, OP_GetLocal, 2, OP_Const1B, 0, OP_GreaterThan,
+                      OP_PopRangeLoop, 0, 18, 0, OP_Pop, OP_Pop, OP_Pop, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_InvertJump], 0);
+
+  // Code-gen doesn't emit "not" twice before a jump, so build it by hand
+  struct Memory mem;
+  struct Chunk chunk;
+  mem_init(&mem);
+  chunk_init(&chunk, &mem);
+  static const uint8_t code[] = {
+    OP_GetLocal, 0, OP_LogicalNot, OP_LogicalNot, OP_JumpIfFalse, 1, 0, OP_Nil, OP_True,
+    OP_Return,
+  };
+  for (size_t i = 0; i < sizeof(code); i++) {
+    chunk_push_byte(&chunk, code[i]);
+  }
+  stats = (struct PeepholeStats) { { 0 } };
+  peephole_optimize(&chunk, &stats);
+  static const uint8_t expected[] = {
+    OP_GetLocal, 0, OP_JumpIfFalse, 1, 0, OP_Nil, OP_True, OP_Return,
+  };
+  ASSERT_INT_EQ(chunk.code.length, sizeof(expected));
+  ASSERT(memcmp(chunk.code.code, expected, sizeof(expected)) == 0);
+  ASSERT_INT_EQ(stats.hits[PR_InvertJump], 2);
+  chunk_fini(&chunk);
+  mem_fini(&mem);
+}
+
+// Variables are loaded and stored by slot or index, and unused loads are
+// removed like literals
+TEST(Peephole, Variables) {
+  struct PeepholeStats stats;
+  ASSERT_OPTIMIZES_TO("let x = 1; x = x + 1; x; x",
+                      OP_Const1B, 0, OP_SetGlobal, 0, 0, OP_Pop,
+                      OP_GetGlobal, 0, 0, OP_AddConst, 0, OP_SetGlobal, 0, 0, OP_Pop,
+                      OP_GetGlobal, 0, 0, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_PushPop], 2);
+  // The local's slot is the one above the loop variable
+  ASSERT_OPTIMIZES_TO("for i in range(3) { let a = i; a += 2; }",
+                      OP_Const1B, 0, OP_Const1B, 1, OP_Nil, OP_RangeStart, 0, 12, 0,
+                      OP_GetLocal, 2, OP_Const1B, 2, OP_UpdateLocal, 3, OP_Add, OP_Pop,
+                      OP_PopRangeLoop, 0, 12, 0, OP_Pop, OP_Pop, OP_Pop, OP_Nil, OP_Return);
+  ASSERT_INT_EQ(stats.hits[PR_Fuse], 1);
+}
+
+// Every iteration of a loop whose body is a single addition is two dispatches
+TEST(Peephole, SuperinstructionDispatchCount) {
+  struct Memory mem;
+  struct Vm vm;
+  struct Chunk chunk;
+  struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);
+  struct PeepholeStats stats = { { 0 } };
+  mem_init(&mem);
+  vm_init(&vm, &mem, err_writer);
+  chunk_init(&chunk, &mem);
+  compile("for i in range(10) { i + 1; }", &chunk, &stats);
+  struct Value result;
+  ASSERT(vm_run_with_dispatch(&vm, &chunk, VM_DispatchCounting, &result));
+  ASSERT(IS_NIL(result));
+  ASSERT_INT_EQ(vm.num_dispatches, 4 + 10 * 2 + 5);
+  ASSERT_INT_EQ(vm_pair_count(&vm, OP_AddLocalConst, OP_PopRangeLoop), 10);
+  ASSERT_INT_EQ(vm_pair_count(&vm, OP_PopRangeLoop, OP_AddLocalConst), 9);
+
+  // The disassembler knows the operands of superinstructions
+  struct String buf;
+  string_init(&buf, "");
+  struct Writer* writer = (struct Writer*) string_writer_create(&buf);
+  chunk_disassemble(&chunk, "loop", writer);
+  ASSERT(strstr((const char*) buf.data, "OP_AddLocalConst s2 (2) 1\n") != NULL);
+  ASSERT(strstr((const char*) buf.data, "OP_PopRangeLoop  s0 -> 9\n") != NULL);
+  string_writer_free((struct StringWriter*) writer);
+  string_fini(&buf);
+  chunk_fini(&chunk);
+  vm_fini(&vm);
+  mem_fini(&mem);
+  file_writer_free((struct FileWriter*) err_writer);
+}
+
+// The condition of a while loop is tested with one dispatch after its operands
+TEST(Peephole, CompareJumpDispatchCount) {
+  struct Memory mem;
+  struct Vm vm;
+  struct Chunk chunk;
+  struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);
+  struct PeepholeStats stats = { { 0 } };
+  mem_init(&mem);
+  vm_init(&vm, &mem, err_writer);
+  chunk_init(&chunk, &mem);
+  compile("let i = 0; while i < 10 { i += 1; } i", &chunk, &stats);
+  struct Value result;
+  ASSERT(vm_run_with_dispatch(&vm, &chunk, VM_DispatchCounting, &result));
+  ASSERT(IS_INT(result));
+  ASSERT_INT_EQ(AS_INT(result), 10);
+  ASSERT_INT_EQ(vm.num_dispatches, 3 + 10 * 7 + 3 + 2);
+  ASSERT_INT_EQ(vm_pair_count(&vm, OP_Const1B, OP_LessThanJumpIfFalse), 11);
+  ASSERT_INT_EQ(vm_pair_count(&vm, OP_LessThanJumpIfFalse, OP_Const1B), 10);
+
+  struct String buf;
+  string_init(&buf, "");
+  struct Writer* writer = (struct Writer*) string_writer_create(&buf);
+  chunk_disassemble(&chunk, "loop", writer);
+  ASSERT(strstr((const char*) buf.data, "OP_LessThanJumpIfFalse -> 24\n") != NULL);
+  string_writer_free((struct StringWriter*) writer);
+  string_fini(&buf);
+  chunk_fini(&chunk);
+  vm_fini(&vm);
+  mem_fini(&mem);
+  file_writer_free((struct FileWriter*) err_writer);
+}
+
+// Runtime errors are expected, so they aren't printed
+static bool run(struct Memory* mem, const char* source, bool optimize, struct Value* result) {
+  unsigned flags = TF_QuietErrors | (optimize ? TF_Peephole : 0);
+  return test_run(mem, source, CE_Stack, VM_DispatchThreaded, flags, result);
+}
+
+TEST(Peephole, SameResults) {
+  static const char* const sources[] = {
+    "-(3); -(2.5); !7; not 0; not nil", "-nil", "!2.5", "-(-9223372036854775807 - 1)",
+    "for i in range(3) { 1 / (i - 2); -i; }", "for i in range(2) { 1 / (i - 2); -i; }",
+    "for i in range(4) { for j in range(i) { continue; } break; }",
+    "for i in range(4) { for j in range(i) { break; 1 / 0; } 1 / (3 - i); }",
+    "for i in range(3) { for j in range(i) { 1 / (j - 2); continue; } }",
+    "for i in range(3) { for j in range(3) { 1 / (i * j + 1 - 5); i + 1; } }",
+    "for i in range(3) { 1 / (i + 1 - 3); }", "for i in range(3) { i + nil; }",
+    "for i in range(3) { i + 2.5; }", "for i in range(3) { i + 9223372036854775807; }",
+    "1.5 + 1", "nil + 1", "9223372036854775807 + 1",
+    "for i in range(4) { i < 1 and i > 0 or i == 2 and 1 / (i - 3); }",
+    "for i in range(4) { (i > 2 or i < 1) and 1 / (i - 2); }",
+    "for i in range(4) { if not (i == 1 or i == 2) { 1 / (i - 3) } else { nil and 1 / 0 } }",
+    "for i in range(4) { while i < 2 or nil { break; } 1 / (i - 3); }",
+    "let x = 1; x = x + 1; x; x", "let s = 0; for i in range(5) { let a = i * i; s += a + 1; } s",
+    "let i = 0; while i < 10 { i += 3; if i == 6 { continue; } } i",
+    "let n = 0; for i in range(4) { n += 1 + if i == 2 { break } else { let b = i; b }; } n",
+    "let x = 2; 1 + if x > 1 { let y = x * 3; y - 1 } else { 0 }",
+    "let n = 0; for i in range(4) { n += (not (i == 1) and i > 0 or i == 3) and 1 or 10; } n",
+    "let i = 0; while i < 2.5 { i += 1; } i", "let i = 0; while i < nil { i += 1; }",
+    "let x = nil; x += 1", "for i in range(3) { let a = i; a -= 1; a *= a; }",
+  };
+  struct Memory mem;
+  mem_init(&mem);
+  for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+    struct Value plain, optimized;
+    bool ok = run(&mem, sources[i], false, &plain);
+    ASSERT(ok == run(&mem, sources[i], true, &optimized));
+    ASSERT(!ok || test_same_value(plain, optimized));
+  }
+  mem_fini(&mem);
+}
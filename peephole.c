@@ -0,0 +1,614 @@
+#include "peephole.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "value.h"
+
+#define REALLOC(PTR, SIZE) do {        \
+    if (!(PTR = realloc(PTR, SIZE))) { \
+      DIE_ERR("realloc()");            \
+    }                                  \
+  } while (0)
+
+// A decoded instruction. Jump targets are indices of instructions, rather
+// than byte offsets, so that they can be relocated once the code is encoded
+// again. Constants are decoded to OP_Const1B, and encoded with whichever
+// width the index needs.
+struct Instruction {
+  uint8_t op;
+  uint8_t slot;   // Frame slot, for locals and the range loops
+  uint8_t slot2;  // Second frame slot, for OP_GetLocal2
+  uint8_t binary; // Binary opcode, for the compound assignments
+  size_t index;   // Index of the value, for constants and globals
+  size_t target;  // Index of the target instruction, for jumps
+  bool is_target; // Some jump lands on this instruction
+};
+
+const char* peephole_rule_to_str(enum PeepholeRule rule) {
+  switch (rule) {
+  case PR_FoldUnary:  return "fold-unary";
+  case PR_PushPop:    return "push-pop";
+  case PR_DeadCode:   return "dead-code";
+  case PR_ThreadJump: return "thread-jump";
+  case PR_JumpToNext: return "jump-to-next";
+  case PR_InvertJump: return "invert-jump";
+  case PR_Fuse:       return "superinstruction";
+  default:            UNREACHABLE();
+  }
+}
+
+static size_t read_u16(const uint8_t* ptr) {
+  return ((size_t) ptr[0]) | (((size_t) ptr[1]) << 8);
+}
+
+static size_t read_u32(const uint8_t* ptr) {
+  return read_u16(ptr) | (read_u16(ptr + 2) << 16);
+}
+
+static bool is_conditional_jump(uint8_t op) {
+  return op == OP_JumpIfFalse || op == OP_JumpIfTrue || op == OP_JumpIfFalseOrPop ||
+    op == OP_JumpIfTrueOrPop;
+}
+
+static bool is_jump(uint8_t op) {
+  return op == OP_Jump || op == OP_JumpBack || is_conditional_jump(op) || op == OP_RangeStart ||
+    op == OP_RangeLoop || op == OP_PopRangeLoop || op == OP_LessThanJumpIfFalse;
+}
+
+static bool is_backward_jump(uint8_t op) {
+  return op == OP_JumpBack || op == OP_RangeLoop || op == OP_PopRangeLoop;
+}
+
+static bool is_literal(uint8_t op) {
+  return op == OP_Nil || op == OP_True || op == OP_False || op == OP_Const1B;
+}
+
+// Number of bytes an instruction takes up when encoded
+static size_t encoded_length(const struct Instruction* instruction) {
+  switch (instruction->op) {
+  case OP_Const1B:
+    if (instruction->index <= 0xff) {
+      return 2;
+    }
+    return instruction->index <= 0xffff ? 3 : 5;
+  case OP_GetLocal:
+  case OP_SetLocal:            return 2;
+  case OP_GetGlobal:
+  case OP_SetGlobal:           return 3;
+  case OP_UpdateLocal:         return 3;
+  case OP_UpdateGlobal:        return 4;
+  case OP_Jump:
+  case OP_JumpBack:
+  case OP_JumpIfFalse:
+  case OP_JumpIfTrue:
+  case OP_JumpIfFalseOrPop:
+  case OP_JumpIfTrueOrPop:
+  case OP_LessThanJumpIfFalse: return 3;
+  case OP_RangeStart:          return 4;
+  case OP_RangeLoop:           return 4;
+  case OP_AddConst:            return 2;
+  case OP_AddLocalConst:       return 3;
+  case OP_GetLocal2:           return 3;
+  case OP_PopRangeLoop:        return 4;
+  default:                     return 1;
+  }
+}
+
+// Decode a whole chunk. `offsets` gets the byte offset of every instruction,
+// and jump targets are left as byte offsets, to be resolved by the caller.
+static size_t decode(const struct Chunk* chunk, struct Instruction** instructions,
+                     size_t** offsets) {
+  size_t num_instructions = 0, capacity = 0;
+  for (size_t offset = 0; offset < chunk->code.length;) {
+    if (num_instructions == capacity) {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      REALLOC(*instructions, capacity * sizeof(struct Instruction));
+      REALLOC(*offsets, capacity * sizeof(size_t));
+    }
+    const uint8_t* code = chunk->code.code + offset;
+    struct Instruction* instruction = &(*instructions)[num_instructions];
+    (*offsets)[num_instructions++] = offset;
+    *instruction = (struct Instruction) { code[0], 0, 0, 0, 0, 0, false };
+    switch (code[0]) {
+    case OP_Const1B:
+      instruction->index = code[1];
+      offset += 2;
+      break;
+    case OP_Const2B:
+      instruction->op = OP_Const1B;
+      instruction->index = read_u16(code + 1);
+      offset += 3;
+      break;
+    case OP_Const4B:
+      instruction->op = OP_Const1B;
+      instruction->index = read_u32(code + 1);
+      offset += 5;
+      break;
+    case OP_GetLocal:
+    case OP_SetLocal:
+      instruction->slot = code[1];
+      offset += 2;
+      break;
+    case OP_GetGlobal:
+    case OP_SetGlobal:
+      instruction->index = read_u16(code + 1);
+      offset += 3;
+      break;
+    case OP_UpdateLocal:
+      instruction->slot = code[1];
+      instruction->binary = code[2];
+      offset += 3;
+      break;
+    case OP_UpdateGlobal:
+      instruction->index = read_u16(code + 1);
+      instruction->binary = code[3];
+      offset += 4;
+      break;
+    case OP_Jump:
+    case OP_JumpIfFalse:
+    case OP_JumpIfTrue:
+    case OP_JumpIfFalseOrPop:
+    case OP_JumpIfTrueOrPop:
+    case OP_LessThanJumpIfFalse:
+      instruction->target = offset + 3 + read_u16(code + 1);
+      offset += 3;
+      break;
+    case OP_JumpBack:
+      instruction->target = offset + 3 - read_u16(code + 1);
+      offset += 3;
+      break;
+    case OP_RangeStart:
+      instruction->slot = code[1];
+      instruction->target = offset + 4 + read_u16(code + 2);
+      offset += 4;
+      break;
+    case OP_RangeLoop:
+    case OP_PopRangeLoop:
+      instruction->slot = code[1];
+      instruction->target = offset + 4 - read_u16(code + 2);
+      offset += 4;
+      break;
+    case OP_AddConst:
+      instruction->index = code[1];
+      offset += 2;
+      break;
+    case OP_AddLocalConst:
+      instruction->slot = code[1];
+      instruction->index = code[2];
+      offset += 3;
+      break;
+    case OP_GetLocal2:
+      instruction->slot = code[1];
+      instruction->slot2 = code[2];
+      offset += 3;
+      break;
+    default:
+      CHECK(code[0] >= OP_Nil && code[0] <= OP_Return);
+      offset++;
+      break;
+    }
+  }
+  return num_instructions;
+}
+
+// Turn the byte offset of a jump target into the index of the instruction
+static size_t find_instruction(const size_t* offsets, size_t num_instructions, size_t offset) {
+  size_t lo = 0, hi = num_instructions;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (offsets[mid] < offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  CHECK(lo < num_instructions && offsets[lo] == offset);
+  return lo;
+}
+
+static struct Value literal_value(const struct Chunk* chunk, const struct Instruction* literal) {
+  switch (literal->op) {
+  case OP_Nil:     return NIL_VAL();
+  case OP_True:    return BOOL_VAL(true);
+  case OP_False:   return BOOL_VAL(false);
+  case OP_Const1B: return chunk->values.values[literal->index];
+  default:         UNREACHABLE();
+  }
+}
+
+// Apply a unary operation to a literal, with the semantics of the VM. Fails
+// for anything the VM would raise an error for.
+static bool fold_unary(struct Chunk* chunk, struct Instruction* literal, uint8_t op) {
+  struct Value value = literal_value(chunk, literal);
+  struct Value result;
+  switch (op) {
+  case OP_Minus:
+    if (IS_INT(value)) {
+      result = INT_VAL(chunk->values.mem, (int64_t) (0 - (uint64_t) AS_INT(value)));
+    } else if (IS_FLOAT(value)) {
+      result = FLOAT_VAL(-AS_FLOAT(value));
+    } else {
+      return false;
+    }
+    break;
+  case OP_BitNot:
+    if (!IS_INT(value)) {
+      return false;
+    }
+    result = INT_VAL(chunk->values.mem, ~AS_INT(value));
+    break;
+  case OP_LogicalNot:
+    literal->op = value_is_falsey(value) ? OP_True : OP_False;
+    return true;
+  default:
+    return false;
+  }
+  literal->op = OP_Const1B;
+  literal->index = chunk_push_value(chunk, result);
+  return true;
+}
+
+// Retarget jumps which land on a jump whose outcome is already known. That's
+// any unconditional jump, and for the "OrPop" jumps, which leave a value of
+// known truthiness on the stack, any conditional jump which tests it. If that
+// one would pop the value, the first one pops it instead, which is how nested
+// "and" and "or" go straight to where they end up. Jumps only go in one
+// direction, so a target on the wrong side of the jump stops the chain.
+static void thread_jumps(struct Instruction* instructions, size_t num_instructions,
+                         struct PeepholeStats* stats) {
+  for (size_t i = 0; i < num_instructions; i++) {
+    struct Instruction* jump = &instructions[i];
+    if (!is_jump(jump->op)) {
+      continue;
+    }
+    uint8_t op = jump->op;
+    size_t target = jump->target;
+    // Bounded, in case of a cycle of jumps
+    for (size_t steps = 0; steps < num_instructions; steps++) {
+      const struct Instruction* next = &instructions[target];
+      uint8_t next_op = op;
+      size_t next_target;
+      if (next->op == OP_Jump || next->op == OP_JumpBack) {
+        next_target = next->target;
+      } else if ((op == OP_JumpIfFalseOrPop || op == OP_JumpIfTrueOrPop) &&
+                 is_conditional_jump(next->op) && target + 1 < num_instructions) {
+        bool falsey = op == OP_JumpIfFalseOrPop;
+        bool jumps = (next->op == OP_JumpIfFalse || next->op == OP_JumpIfFalseOrPop) == falsey;
+        bool pops = next->op == OP_JumpIfFalse || next->op == OP_JumpIfTrue || !jumps;
+        next_target = jumps ? next->target : target + 1;
+        if (pops) {
+          next_op = falsey ? OP_JumpIfFalse : OP_JumpIfTrue;
+        }
+      } else {
+        break;
+      }
+      if (is_backward_jump(op) ? next_target > i : next_target <= i) {
+        break;
+      }
+      op = next_op;
+      target = next_target;
+    }
+    if (target != jump->target) {
+      jump->op = op;
+      jump->target = target;
+      stats->hits[PR_ThreadJump]++;
+    }
+  }
+}
+
+static void mark_targets(struct Instruction* instructions, size_t num_instructions) {
+  for (size_t i = 0; i < num_instructions; i++) {
+    instructions[i].is_target = false;
+  }
+  for (size_t i = 0; i < num_instructions; i++) {
+    if (is_jump(instructions[i].op)) {
+      instructions[instructions[i].target].is_target = true;
+    }
+  }
+}
+
+// Rewrite windows of instructions, compacting the array in place. Every
+// instruction is checked against the ones already written out, so that a
+// rewrite can expose another one, like "1; -2;" becoming nothing at all.
+// Instructions after an unconditional jump are dropped, until one which a
+// jump lands on. `new_index` maps old indices to new ones. Removed
+// instructions map to whatever comes after them. Returns the new number of
+// instructions.
+static size_t rewrite(struct Chunk* chunk, struct Instruction* instructions,
+                      size_t num_instructions, size_t* new_index, struct PeepholeStats* stats) {
+  size_t length = 0;
+  // Instructions before this can't be part of a window, since a jump lands
+  // in between
+  size_t barrier = 0;
+  bool reachable = true;
+  for (size_t i = 0; i < num_instructions; i++) {
+    struct Instruction instruction = instructions[i];
+    if (instruction.is_target) {
+      barrier = length;
+      reachable = true;
+    }
+    new_index[i] = length;
+    if (!reachable) {
+      stats->hits[PR_DeadCode]++;
+      continue;
+    }
+    reachable = instruction.op != OP_Jump && instruction.op != OP_JumpBack &&
+      instruction.op != OP_Return;
+    struct Instruction* prev = length > barrier ? &instructions[length - 1] : NULL;
+    if (prev && is_literal(prev->op) && fold_unary(chunk, prev, instruction.op)) {
+      stats->hits[PR_FoldUnary]++;
+      continue;
+    }
+    if (prev && (is_literal(prev->op) || prev->op == OP_GetLocal || prev->op == OP_GetGlobal) &&
+        instruction.op == OP_Pop) {
+      length--;
+      stats->hits[PR_PushPop]++;
+      continue;
+    }
+    // "not" can't fail, and a jump which pops its condition only needs its
+    // truthiness. Jumps which keep the value on the stack need the "not".
+    while (prev && prev->op == OP_LogicalNot &&
+           (instruction.op == OP_JumpIfFalse || instruction.op == OP_JumpIfTrue)) {
+      instruction.op = instruction.op == OP_JumpIfFalse ? OP_JumpIfTrue : OP_JumpIfFalse;
+      new_index[i] = --length;
+      prev = length > barrier ? &instructions[length - 1] : NULL;
+      stats->hits[PR_InvertJump]++;
+    }
+    instructions[length++] = instruction;
+  }
+  new_index[num_instructions] = length;
+  return length;
+}
+
+// Remove unconditional jumps to the next instruction, which may have been
+// exposed by the other rules. A conditional jump there which pops its value
+// is just a pop. A jump over nothing but removed jumps goes to the next
+// instruction as well, so this works backwards, with `new_index[i]` counting
+// the instructions kept from `i` on, before the indices are assigned. Targets
+// have to be new indices.
+static size_t remove_jumps_to_next(struct Instruction* instructions, size_t num_instructions,
+                                   size_t* new_index, struct PeepholeStats* stats) {
+  new_index[num_instructions] = 0;
+  for (size_t i = num_instructions; i-- > 0;) {
+    struct Instruction* jump = &instructions[i];
+    bool to_next = is_jump(jump->op) && !is_backward_jump(jump->op) &&
+      jump->target > i && new_index[i + 1] == new_index[jump->target];
+    if (to_next && jump->op == OP_Jump) {
+      // Opcode 0 is invalid, so it marks removed instructions
+      jump->op = 0;
+      stats->hits[PR_JumpToNext]++;
+    } else if (to_next && (jump->op == OP_JumpIfFalse || jump->op == OP_JumpIfTrue)) {
+      jump->op = OP_Pop;
+      stats->hits[PR_JumpToNext]++;
+    }
+    new_index[i] = new_index[i + 1] + (jump->op != 0);
+  }
+  size_t length = 0;
+  for (size_t i = 0; i < num_instructions; i++) {
+    new_index[i] = length;
+    if (instructions[i].op != 0) {
+      instructions[length++] = instructions[i];
+    }
+  }
+  new_index[num_instructions] = length;
+  for (size_t i = 0; i < length; i++) {
+    if (is_jump(instructions[i].op)) {
+      instructions[i].target = new_index[instructions[i].target];
+    }
+  }
+  return length;
+}
+
+// Fuse a sequence starting at `instructions[i]` into a superinstruction, if
+// there's one for it. Returns the number of instructions fused, or 1 if there
+// was nothing to fuse.
+static size_t fuse_at(const struct Instruction* instructions, size_t num_instructions, size_t i,
+                      struct Instruction* fused) {
+  const struct Instruction* window = &instructions[i];
+  size_t available = num_instructions - i;
+  *fused = window[0];
+  if (available >= 2 && window[1].is_target) {
+    return 1;
+  }
+  if (available >= 3 && window[0].op == OP_GetLocal && window[1].op == OP_Const1B &&
+      window[1].index <= 0xff && window[2].op == OP_Add && !window[2].is_target) {
+    fused->op = OP_AddLocalConst;
+    fused->index = window[1].index;
+    return 3;
+  }
+  if (available >= 2 && window[0].op == OP_Const1B && window[0].index <= 0xff &&
+      window[1].op == OP_Add) {
+    fused->op = OP_AddConst;
+    return 2;
+  }
+  if (available >= 2 && window[0].op == OP_GetLocal && window[1].op == OP_GetLocal) {
+    fused->op = OP_GetLocal2;
+    fused->slot2 = window[1].slot;
+    return 2;
+  }
+  // The pop must not be part of the loop body's start, or it would run on
+  // every iteration instead of just the last one
+  if (available >= 2 && window[0].op == OP_Pop && window[1].op == OP_RangeLoop &&
+      window[1].target < i) {
+    *fused = window[1];
+    fused->op = OP_PopRangeLoop;
+    return 2;
+  }
+  if (available >= 2 && window[0].op == OP_LessThan && window[1].op == OP_JumpIfFalse) {
+    *fused = window[1];
+    fused->op = OP_LessThanJumpIfFalse;
+    return 2;
+  }
+  return 1;
+}
+
+// Fuse sequences into superinstructions. Targets have to be new indices.
+static size_t fuse(struct Instruction* instructions, size_t num_instructions, size_t* new_index,
+                   struct PeepholeStats* stats) {
+  mark_targets(instructions, num_instructions);
+  size_t length = 0;
+  for (size_t i = 0; i < num_instructions;) {
+    struct Instruction fused;
+    size_t num_fused = fuse_at(instructions, num_instructions, i, &fused);
+    if (num_fused > 1) {
+      stats->hits[PR_Fuse]++;
+    }
+    for (size_t j = 0; j < num_fused; j++) {
+      new_index[i + j] = length;
+    }
+    instructions[length++] = fused;
+    i += num_fused;
+  }
+  new_index[num_instructions] = length;
+  for (size_t i = 0; i < length; i++) {
+    if (is_jump(instructions[i].op)) {
+      instructions[i].target = new_index[instructions[i].target];
+    }
+  }
+  return length;
+}
+
+// Encode instructions back into the chunk. `offsets` must have room for the
+// byte offset of every instruction.
+static void encode(struct Chunk* chunk, const struct Instruction* instructions,
+                   size_t num_instructions, size_t* offsets) {
+  size_t offset = 0;
+  for (size_t i = 0; i < num_instructions; i++) {
+    offsets[i] = offset;
+    offset += encoded_length(&instructions[i]);
+  }
+  chunk->code.length = 0;
+  for (size_t i = 0; i < num_instructions; i++) {
+    const struct Instruction* instruction = &instructions[i];
+    size_t end = offsets[i] + encoded_length(instruction);
+    size_t jump = 0;
+    if (is_jump(instruction->op)) {
+      size_t target = offsets[instruction->target];
+      CHECK(is_backward_jump(instruction->op) ? target <= end : target >= end);
+      jump = is_backward_jump(instruction->op) ? end - target : target - end;
+      // The code only gets shorter, so the jump still fits
+      CHECK(jump <= 0xffff);
+    }
+    switch (instruction->op) {
+    case OP_Const1B:
+      if (instruction->index <= 0xff) {
+        chunk_push_byte(chunk, OP_Const1B);
+        chunk_push_byte(chunk, instruction->index);
+      } else if (instruction->index <= 0xffff) {
+        chunk_push_byte(chunk, OP_Const2B);
+        chunk_push_word(chunk, instruction->index);
+      } else {
+        chunk_push_byte(chunk, OP_Const4B);
+        chunk_push_dword(chunk, instruction->index);
+      }
+      break;
+    case OP_GetLocal:
+    case OP_SetLocal:
+      chunk_push_byte(chunk, instruction->op);
+      chunk_push_byte(chunk, instruction->slot);
+      break;
+    case OP_GetGlobal:
+    case OP_SetGlobal:
+      chunk_push_byte(chunk, instruction->op);
+      chunk_push_word(chunk, instruction->index);
+      break;
+    case OP_UpdateLocal:
+      chunk_push_byte(chunk, OP_UpdateLocal);
+      chunk_push_byte(chunk, instruction->slot);
+      chunk_push_byte(chunk, instruction->binary);
+      break;
+    case OP_UpdateGlobal:
+      chunk_push_byte(chunk, OP_UpdateGlobal);
+      chunk_push_word(chunk, instruction->index);
+      chunk_push_byte(chunk, instruction->binary);
+      break;
+    case OP_Jump:
+    case OP_JumpBack:
+    case OP_JumpIfFalse:
+    case OP_JumpIfTrue:
+    case OP_JumpIfFalseOrPop:
+    case OP_JumpIfTrueOrPop:
+    case OP_LessThanJumpIfFalse:
+      chunk_push_byte(chunk, instruction->op);
+      chunk_push_word(chunk, jump);
+      break;
+    case OP_RangeStart:
+    case OP_RangeLoop:
+    case OP_PopRangeLoop:
+      chunk_push_byte(chunk, instruction->op);
+      chunk_push_byte(chunk, instruction->slot);
+      chunk_push_word(chunk, jump);
+      break;
+    case OP_AddConst:
+      chunk_push_byte(chunk, OP_AddConst);
+      chunk_push_byte(chunk, instruction->index);
+      break;
+    case OP_AddLocalConst:
+      chunk_push_byte(chunk, OP_AddLocalConst);
+      chunk_push_byte(chunk, instruction->slot);
+      chunk_push_byte(chunk, instruction->index);
+      break;
+    case OP_GetLocal2:
+      chunk_push_byte(chunk, OP_GetLocal2);
+      chunk_push_byte(chunk, instruction->slot);
+      chunk_push_byte(chunk, instruction->slot2);
+      break;
+    default:
+      chunk_push_byte(chunk, instruction->op);
+      break;
+    }
+  }
+}
+
+void peephole_optimize(struct Chunk* chunk, struct PeepholeStats* stats) {
+  if (chunk->encoding != CE_Stack || chunk->code.length == 0) {
+    return;
+  }
+  struct PeepholeStats local_stats = { { 0 } };
+  if (!stats) {
+    stats = &local_stats;
+  }
+
+  struct Instruction* instructions = NULL;
+  size_t* offsets = NULL;
+  size_t num_instructions = decode(chunk, &instructions, &offsets);
+  for (size_t i = 0; i < num_instructions; i++) {
+    if (is_jump(instructions[i].op)) {
+      instructions[i].target = find_instruction(offsets, num_instructions,
+                                                instructions[i].target);
+    }
+  }
+
+  // Indices are remapped after every step which removes instructions
+  size_t* new_index = NULL;
+  REALLOC(new_index, (num_instructions + 1) * sizeof(size_t));
+  thread_jumps(instructions, num_instructions, stats);
+  mark_targets(instructions, num_instructions);
+  size_t length = rewrite(chunk, instructions, num_instructions, new_index, stats);
+  for (size_t i = 0; i < length; i++) {
+    if (is_jump(instructions[i].op)) {
+      instructions[i].target = new_index[instructions[i].target];
+    }
+  }
+  length = remove_jumps_to_next(instructions, length, new_index, stats);
+  length = fuse(instructions, length, new_index, stats);
+  encode(chunk, instructions, length, offsets);
+
+  free(new_index);
+  free(offsets);
+  free(instructions);
+}
+
+int peephole_stats_print(const struct PeepholeStats* stats, struct Writer* writer) {
+  int ret = 0;
+  for (int rule = 0; rule < PR_NumRules; rule++) {
+    ret += writer->writef(writer, "%s%s %lu", rule == 0 ? "" : ", ",
+                          peephole_rule_to_str(rule), stats->hits[rule]);
+  }
+  return ret;
+}
+
+#undef REALLOC
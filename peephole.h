@@ -0,0 +1,42 @@
+#ifndef __BS_PEEPHOLE_H__
+#define __BS_PEEPHOLE_H__
+
+#include <stddef.h>
+
+#include "bytecode.h"
+#include "writer.h"
+
+// Rewrites done by the peephole optimizer
+enum PeepholeRule {
+  PR_FoldUnary,  // A literal followed by a unary operation becomes one literal
+  PR_PushPop,    // A literal or local which is pushed and then popped is removed
+  PR_DeadCode,   // Unreachable code after an unconditional jump is removed
+  PR_ThreadJump, // A jump to a jump with a known outcome goes straight to its target
+  PR_JumpToNext, // A jump to the next instruction is removed, or becomes a pop
+  PR_InvertJump, // A "not" before a conditional jump is removed, and the jump inverted
+  PR_Fuse,       // A common sequence is fused into a superinstruction
+  PR_NumRules,
+};
+
+// How often each rule was applied
+struct PeepholeStats {
+  size_t hits[PR_NumRules];
+};
+
+// Get a short name for a rule, for debug output
+const char* peephole_rule_to_str(enum PeepholeRule rule);
+
+// Optimize stack-machine bytecode in place, after code generation. Short
+// windows of instructions are rewritten, and jump offsets are relocated to
+// match. A window never spans an instruction which a jump lands on, except
+// at its start. Unary operations which would fail at runtime are left alone,
+// and a "not" before a jump which pops its condition inverts the jump.
+// Finally, sequences with a superinstruction are fused into it.
+// Register-machine code isn't touched. Adds to the counts in `stats` if it
+// isn't NULL.
+void peephole_optimize(struct Chunk* chunk, struct PeepholeStats* stats);
+
+// Print the counts from the optimizer, for debug output
+int peephole_stats_print(const struct PeepholeStats* stats, struct Writer* writer);
+
+#endif  // __BS_PEEPHOLE_H__
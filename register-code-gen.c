@@ -0,0 +1,320 @@
+#include "code-gen.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "bytecode.h"
+#include "flat-ast.h"
+#include "log.h"
+#include "value.h"
+
+// Maximum number of frame slots addressable by a 2-byte operand
+#define MAX_REGISTERS 0x10000
+
+// A frame slot holding the result of an expression. Constants are numbered
+// by their index in the constant table, and temporaries from 0 upwards. The
+// final numbering is only known once all the constants have been collected,
+// so operands naming temporaries are patched at the end.
+struct Slot {
+  bool is_temp; // Whether this is a temporary or a constant
+  size_t index; // Index of the temporary or the constant
+};
+
+// State for the register code generator
+struct State {
+  struct Chunk* chunk;    // Chunk that we're writing to
+  struct Writer* writer;  // Sink for error messages
+  size_t num_temps;       // Number of temporaries currently live
+  size_t max_temps;       // Maximum number of temporaries live at once
+  size_t* fixups;         // Code offsets of operands which name temporaries
+  size_t num_fixups;      // Number of fixups
+  size_t fixups_capacity; // Allocated capacity for fixups
+};
+
+static void state_init(struct State* state, struct Chunk* chunk, struct Writer* writer) {
+  state->chunk = chunk;
+  state->writer = writer;
+  state->num_temps = state->max_temps = 0;
+  state->fixups = NULL;
+  state->num_fixups = state->fixups_capacity = 0;
+}
+
+static void state_fini(struct State* state) {
+  free(state->fixups);
+}
+
+// Print an error message, and return false to pass the failure up
+static bool error(struct State* state, size_t line_num, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  state->writer->writef(state->writer, "\x1b[1;31mERROR\x1b[0m: [%lu]: ", line_num);
+  state->writer->vwritef(state->writer, fmt, ap);
+  state->writer->writef(state->writer, "\n");
+  va_end(ap);
+  return false;
+}
+
+// Register code has no jumps yet, so it can only evaluate straight-line
+// expressions of constants
+static bool unsupported(struct State* state, size_t line_num, const char* what) {
+  return error(state, line_num, "%s isn't supported in the register encoding yet", what);
+}
+
+// "and" and "or" skip their right operand, which needs a jump
+static bool check_binary_op(struct State* state, size_t line_num, enum BinaryOp op) {
+  switch (op) {
+  case BO_LogicalAnd: return unsupported(state, line_num, "\"and\"");
+  case BO_LogicalOr:  return unsupported(state, line_num, "\"or\"");
+  default:            return true;
+  }
+}
+
+static struct Slot alloc_temp(struct State* state) {
+  struct Slot slot = { true, state->num_temps++ };
+  if (state->num_temps > state->max_temps) {
+    state->max_temps = state->num_temps;
+  }
+  return slot;
+}
+
+// Temporaries are allocated like a stack, so they must be released in the
+// reverse order of allocation.
+static void release(struct State* state, struct Slot slot) {
+  if (slot.is_temp) {
+    CHECK(slot.index + 1 == state->num_temps);
+    state->num_temps--;
+  }
+}
+
+static struct Slot constant(struct State* state, struct Value value) {
+  struct Slot slot = { false, chunk_push_value(state->chunk, value) };
+  return slot;
+}
+
+static void push_operand(struct State* state, struct Slot slot) {
+  if (slot.is_temp) {
+    if (state->num_fixups == state->fixups_capacity) {
+      state->fixups_capacity = state->fixups_capacity == 0 ? 8 : state->fixups_capacity * 2;
+      if (!(state->fixups = realloc(state->fixups, state->fixups_capacity * sizeof(size_t)))) {
+        DIE_ERR("realloc()");
+      }
+    }
+    state->fixups[state->num_fixups++] = state->chunk->code.length;
+  }
+  // Out-of-range indices are caught when finishing up, just truncate for now
+  chunk_push_word(state->chunk, slot.index & 0xffff);
+}
+
+// Forward declaration
+static bool emit(struct State* state, const struct Ast* ast, struct Slot* out);
+
+static bool emit_program(struct State* state, const struct AstProgram* ast) {
+  struct Slot result;
+  if (ast->statements.length == 0) {
+    result = constant(state, NIL_VAL());
+  }
+  for (size_t i = 0; i < ast->statements.length; i++) {
+    if (i > 0) {
+      release(state, result);
+    }
+    if (!emit(state, ast->statements.data[i], &result)) {
+      return false;
+    }
+  }
+  chunk_push_byte(state->chunk, OP_RReturn);
+  push_operand(state, result);
+  return true;
+}
+
+// Emit a binary operation on operands which have already been evaluated. The
+// operator must have passed check_binary_op.
+static void emit_binary_op(struct State* state, enum BinaryOp op, struct Slot lhs,
+                           struct Slot rhs, struct Slot* out) {
+  // The VM reads both operands before writing the result, so the result can
+  // reuse the slot of either operand.
+  release(state, rhs);
+  release(state, lhs);
+  *out = alloc_temp(state);
+  switch (op) {
+  case BO_Equal:        chunk_push_byte(state->chunk, OP_REqual); break;
+  case BO_NotEqual:     chunk_push_byte(state->chunk, OP_RNotEqual); break;
+  case BO_LessEqual:    chunk_push_byte(state->chunk, OP_RLessEqual); break;
+  case BO_LessThan:     chunk_push_byte(state->chunk, OP_RLessThan); break;
+  case BO_GreaterEqual: chunk_push_byte(state->chunk, OP_RGreaterEqual); break;
+  case BO_GreaterThan:  chunk_push_byte(state->chunk, OP_RGreaterThan); break;
+  case BO_ShiftLeft:    chunk_push_byte(state->chunk, OP_RShiftLeft); break;
+  case BO_ShiftRight:   chunk_push_byte(state->chunk, OP_RShiftRight); break;
+  case BO_Add:          chunk_push_byte(state->chunk, OP_RAdd); break;
+  case BO_Subtract:     chunk_push_byte(state->chunk, OP_RSubtract); break;
+  case BO_Multiply:     chunk_push_byte(state->chunk, OP_RMultiply); break;
+  case BO_Divide:       chunk_push_byte(state->chunk, OP_RDivide); break;
+  case BO_Modulo:       chunk_push_byte(state->chunk, OP_RModulo); break;
+  case BO_BitOr:        chunk_push_byte(state->chunk, OP_RBitOr); break;
+  case BO_BitAnd:       chunk_push_byte(state->chunk, OP_RBitAnd); break;
+  case BO_BitXor:       chunk_push_byte(state->chunk, OP_RBitXor); break;
+  case BO_LogicalAnd:
+  case BO_LogicalOr:
+    // TODO: Short-circuiting
+    UNREACHABLE();
+  }
+  push_operand(state, *out);
+  push_operand(state, lhs);
+  push_operand(state, rhs);
+}
+
+static bool emit_binary(struct State* state, const struct AstBinary* ast, struct Slot* out) {
+  struct Slot lhs, rhs;
+  if (!check_binary_op(state, ast->ast.line_num, ast->operation) ||
+      !emit(state, ast->lhs, &lhs)) {
+    return false;
+  }
+  if (!emit(state, ast->rhs, &rhs)) {
+    return false;
+  }
+  emit_binary_op(state, ast->operation, lhs, rhs, out);
+  return true;
+}
+
+static void emit_unary_op(struct State* state, enum UnaryOp op, struct Slot rhs,
+                          struct Slot* out) {
+  release(state, rhs);
+  *out = alloc_temp(state);
+  switch (op) {
+  case UO_Minus:      chunk_push_byte(state->chunk, OP_RMinus); break;
+  case UO_BitNot:     chunk_push_byte(state->chunk, OP_RBitNot); break;
+  case UO_LogicalNot: chunk_push_byte(state->chunk, OP_RLogicalNot); break;
+  }
+  push_operand(state, *out);
+  push_operand(state, rhs);
+}
+
+static bool emit_unary(struct State* state, const struct AstUnary* ast, struct Slot* out) {
+  struct Slot rhs;
+  if (!emit(state, ast->rhs, &rhs)) {
+    return false;
+  }
+  emit_unary_op(state, ast->operation, rhs, out);
+  return true;
+}
+
+static bool emit(struct State* state, const struct Ast* ast, struct Slot* out) {
+  switch (ast->type) {
+  case AST_Binary:  return emit_binary(state, (const struct AstBinary*) ast, out);
+  case AST_Unary:   return emit_unary(state, (const struct AstUnary*) ast, out);
+  case AST_Float:
+    *out = constant(state, FLOAT_VAL(((const struct AstFloat*) ast)->f));
+    return true;
+  case AST_Integer:
+    *out = constant(state, INT_VAL(state->chunk->values.mem, ((const struct AstInteger*) ast)->i));
+    return true;
+  case AST_Boolean:
+    *out = constant(state, BOOL_VAL(((const struct AstBoolean*) ast)->b));
+    return true;
+  case AST_Nil:
+    *out = constant(state, NIL_VAL());
+    return true;
+  case AST_Identifier:
+    return unsupported(state, ast->line_num, "a variable");
+  default:
+    return unsupported(state, ast->line_num, "this expression");
+  }
+}
+
+// Flat AST version of `emit`, which emits exactly the same code
+static bool emit_flat(struct State* state, const struct FlatAst* flat, uint32_t node,
+                      struct Slot* out) {
+  struct Slot lhs, rhs;
+  switch ((enum AstType) flat->types[node]) {
+  case AST_Binary:
+    if (!check_binary_op(state, flat->lines[node], flat->ops[node]) ||
+        !emit_flat(state, flat, flat->lhs[node], &lhs)) {
+      return false;
+    }
+    if (!emit_flat(state, flat, flat->rhs[node], &rhs)) {
+      return false;
+    }
+    emit_binary_op(state, flat->ops[node], lhs, rhs, out);
+    return true;
+  case AST_Unary:
+    if (!emit_flat(state, flat, flat->lhs[node], &rhs)) {
+      return false;
+    }
+    emit_unary_op(state, flat->ops[node], rhs, out);
+    return true;
+  case AST_Float:
+    *out = constant(state, FLOAT_VAL(flat_ast_float(flat, node)));
+    return true;
+  case AST_Integer:
+    *out = constant(state, INT_VAL(state->chunk->values.mem, flat_ast_integer(flat, node)));
+    return true;
+  case AST_Boolean:
+    *out = constant(state, BOOL_VAL(flat->ops[node]));
+    return true;
+  case AST_Nil:
+    *out = constant(state, NIL_VAL());
+    return true;
+  case AST_Identifier:
+    return unsupported(state, flat->lines[node], "a variable");
+  default:
+    return unsupported(state, flat->lines[node], "this expression");
+  }
+}
+
+static bool emit_flat_program(struct State* state, const struct FlatAst* flat, uint32_t node) {
+  size_t length;
+  const uint32_t* statements = flat_ast_list(flat, flat->lhs[node], &length);
+  struct Slot result;
+  if (length == 0) {
+    result = constant(state, NIL_VAL());
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (i > 0) {
+      release(state, result);
+    }
+    if (!emit_flat(state, flat, statements[i], &result)) {
+      return false;
+    }
+  }
+  chunk_push_byte(state->chunk, OP_RReturn);
+  push_operand(state, result);
+  return true;
+}
+
+// Now that all constants are known, move temporaries above them
+static bool finish(struct State* state) {
+  size_t num_constants = state->chunk->values.length;
+  if (num_constants + state->max_temps > MAX_REGISTERS) {
+    state->writer->writef(state->writer, "\x1b[1;31mERROR\x1b[0m: too many registers needed "
+                          "(%lu constants, %lu temporaries)\n", num_constants, state->max_temps);
+    return false;
+  }
+  uint8_t* code = state->chunk->code.code;
+  for (size_t i = 0; i < state->num_fixups; i++) {
+    size_t offset = state->fixups[i];
+    size_t slot = (code[offset] | (code[offset + 1] << 8)) + num_constants;
+    code[offset] = slot & 0xff;
+    code[offset + 1] = (slot >> 8) & 0xff;
+  }
+  state->chunk->num_registers = num_constants + state->max_temps;
+  return true;
+}
+
+bool generate_register_bytecode(const struct Ast* ast, struct Chunk* chunk,
+                                struct Writer* writer) {
+  CHECK(ast->type == AST_Program);
+  struct State state;
+  state_init(&state, chunk, writer);
+  bool ok = emit_program(&state, (const struct AstProgram*) ast) && finish(&state);
+  state_fini(&state);
+  return ok;
+}
+
+bool generate_register_bytecode_flat(const struct FlatAst* flat, struct Chunk* chunk,
+                                     struct Writer* writer) {
+  CHECK(flat->root != FLAT_NONE && flat->types[flat->root] == AST_Program);
+  struct State state;
+  state_init(&state, chunk, writer);
+  bool ok = emit_flat_program(&state, flat, flat->root) && finish(&state);
+  state_fini(&state);
+  return ok;
+}
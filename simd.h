@@ -0,0 +1,85 @@
+#ifndef __BS_SIMD_H__
+#define __BS_SIMD_H__
+
+#include <stdint.h>
+
+// A thin layer over the byte-wise vector operations we need, so that scanning
+// code can be written once for AVX2 and SSE2. Which one is used is decided at
+// compile time (e.g. AVX2 with -mavx2 or -march=native). Where neither is
+// available, or BS_NO_SIMD is defined, SIMD_WIDTH is 0 and callers use their
+// scalar fallback.
+//
+// Comparisons are on signed bytes, so bytes >= 0x80 compare less than all
+// ASCII characters.
+#if defined(BS_NO_SIMD)
+#define SIMD_WIDTH 0
+
+#elif defined(__AVX2__)
+#include <immintrin.h>
+
+#define SIMD_WIDTH 32
+typedef __m256i SimdBytes;
+#define SIMD_LOAD(PTR)   _mm256_load_si256((const __m256i*) (PTR))
+#define SIMD_LOADU(PTR)  _mm256_loadu_si256((const __m256i*) (PTR))
+#define SIMD_SPLAT(C)    _mm256_set1_epi8((char) (C))
+#define SIMD_EQ(A, B)    _mm256_cmpeq_epi8(A, B)
+#define SIMD_GT(A, B)    _mm256_cmpgt_epi8(A, B)
+#define SIMD_AND(A, B)   _mm256_and_si256(A, B)
+#define SIMD_OR(A, B)    _mm256_or_si256(A, B)
+#define SIMD_MASK(V)     ((uint32_t) _mm256_movemask_epi8(V))
+#define SIMD_FULL_MASK   UINT32_C(0xffffffff)
+
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+
+#define SIMD_WIDTH 16
+typedef __m128i SimdBytes;
+#define SIMD_LOAD(PTR)   _mm_load_si128((const __m128i*) (PTR))
+#define SIMD_LOADU(PTR)  _mm_loadu_si128((const __m128i*) (PTR))
+#define SIMD_SPLAT(C)    _mm_set1_epi8((char) (C))
+#define SIMD_EQ(A, B)    _mm_cmpeq_epi8(A, B)
+#define SIMD_GT(A, B)    _mm_cmpgt_epi8(A, B)
+#define SIMD_AND(A, B)   _mm_and_si128(A, B)
+#define SIMD_OR(A, B)    _mm_or_si128(A, B)
+#define SIMD_MASK(V)     ((uint32_t) _mm_movemask_epi8(V))
+#define SIMD_FULL_MASK   UINT32_C(0xffff)
+
+#else
+#define SIMD_WIDTH 0
+#endif
+
+#if SIMD_WIDTH > 0
+// Bytes which lie within [LOW, HIGH]
+#define SIMD_IN_RANGE(V, LOW, HIGH) \
+  SIMD_AND(SIMD_GT(V, SIMD_SPLAT((LOW) - 1)), SIMD_GT(SIMD_SPLAT((HIGH) + 1), V))
+
+// Index of the lowest set bit in a non-zero mask
+static inline unsigned simd_first(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned) __builtin_ctz(mask);
+#else
+  unsigned index = 0;
+  while (!(mask & 1)) {
+    mask >>= 1;
+    index++;
+  }
+  return index;
+#endif
+}
+#endif
+
+// Scans over NUL-terminated strings load whole aligned blocks, which can reach
+// past the terminator. That can't fault, since an aligned block never crosses
+// a page boundary, but AddressSanitizer would flag it.
+#if defined(__SANITIZE_ADDRESS__)
+#define SIMD_NO_SANITIZE __attribute__((no_sanitize_address))
+#elif defined(__clang__)
+#if __has_feature(address_sanitizer)
+#define SIMD_NO_SANITIZE __attribute__((no_sanitize_address))
+#endif
+#endif
+#ifndef SIMD_NO_SANITIZE
+#define SIMD_NO_SANITIZE
+#endif
+
+#endif  // __BS_SIMD_H__
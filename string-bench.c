@@ -0,0 +1,53 @@
+#include "string.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "log.h"
+
+#define BUFFER_SIZE (16 << 20)
+#define NUM_RUNS 20
+
+// Validate the buffer a few times, and report the best run
+static void validate(const char* label, const uint8_t* bytes, size_t length) {
+  uint64_t best_ns = UINT64_MAX;
+  for (size_t i = 0; i < NUM_RUNS; i++) {
+    uint64_t start = bench_now_ns();
+    bool valid = utf8_validate(bytes, length);
+    uint64_t elapsed = bench_now_ns() - start;
+    CHECK(valid);
+    bench_consume(&valid);
+    if (elapsed < best_ns) {
+      best_ns = elapsed;
+    }
+  }
+  bench_report(label, (double) length * 1000.0 / (double) best_ns, "MB/s");
+}
+
+BENCH(String, ValidateUTF8) {
+  uint8_t* bytes = malloc(BUFFER_SIZE);
+  CHECK(bytes != NULL);
+  // Source code, which is almost all ASCII
+  static const char line[] = "    let description = \"entry: a fairly long string literal\";\n";
+  for (size_t i = 0; i < BUFFER_SIZE; i++) {
+    bytes[i] = line[i % (sizeof(line) - 1)];
+  }
+  validate("ascii", bytes, BUFFER_SIZE);
+  // An ASCII line with one multi-byte character every so often
+  static const char mixed[] = "    print(\"caf\xc3\xa9 \xe2\x82\xac 12\"); // ok\n";
+  size_t length = BUFFER_SIZE - BUFFER_SIZE % (sizeof(mixed) - 1);
+  for (size_t i = 0; i < length; i++) {
+    bytes[i] = mixed[i % (sizeof(mixed) - 1)];
+  }
+  validate("mostly ascii", bytes, length);
+  // Text which is all multi-byte characters
+  static const char text[] = "\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82 \xe4\xb8\x96\xe7\x95\x8c ";
+  length = BUFFER_SIZE - BUFFER_SIZE % (sizeof(text) - 1);
+  for (size_t i = 0; i < length; i++) {
+    bytes[i] = text[i % (sizeof(text) - 1)];
+  }
+  validate("non-ascii", bytes, length);
+  free(bytes);
+}
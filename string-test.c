@@ -32,3 +32,37 @@ TEST(String, Writer) {
   ASSERT_INT_EQ(string.length, 17);
   ASSERT(!strncmp((const char*) string.data, "Hello, 123 world\n", 17));
 }
+
+TEST(String, ValidateUTF8) {
+  static const struct {
+    const char* bytes;
+    bool valid;
+  } cases[] = {
+    { "\xc2\xa9", true },          // U+00A9
+    { "\xe2\x82\xac", true },      // U+20AC
+    { "\xf0\x9f\x98\x80", true },  // U+1F600
+    { "\xf4\x8f\xbf\xbf", true },  // U+10FFFF
+    { "\xc0\xaf", false },         // Overlong '/'
+    { "\xe0\x80\xaf", false },     // Overlong '/'
+    { "\xed\xa0\x80", false },     // Surrogate U+D800
+    { "\xf4\x90\x80\x80", false }, // U+110000
+    { "\xe2\x82", false },         // Truncated
+    { "\xbf", false },             // Lone continuation byte
+    { "\xff", false },
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    ASSERT(utf8_validate((const uint8_t*) cases[i].bytes, strlen(cases[i].bytes))
+           == cases[i].valid);
+  }
+
+  // Multi-byte characters straddling every position of the ASCII fast path
+  uint8_t buf[128];
+  for (size_t i = 0; i + 4 <= sizeof(buf); i++) {
+    memset(buf, 'a', sizeof(buf));
+    memcpy(buf + i, "\xf0\x9f\x98\x80", 4);
+    ASSERT(utf8_validate(buf, sizeof(buf)));
+    ASSERT(!utf8_validate(buf, i + 3));
+    buf[i + 3] = 'a';
+    ASSERT(!utf8_validate(buf, sizeof(buf)));
+  }
+}
@@ -7,47 +7,67 @@
 #include <string.h>
 
 #include "log.h"
+#include "simd.h"
 #include "writer.h"
 
-// Checks if the sequence of bytes provided as argument is valid UTF-8. This
-// assumes that the sequence of bytes is NULL-terminated.
-static bool validate_null_terminated_utf8(const uint8_t* bytes, size_t length) {
+// Whether a byte is a continuation byte, 0b10xxxxxx
+static inline bool is_continuation(uint8_t byte) {
+  return (byte & 0xc0) == 0x80;
+}
+
+bool utf8_validate(const uint8_t* bytes, size_t length) {
   size_t i = 0;
   while (i < length) {
     if (bytes[i] <= 0x7f) {
-      // This is regular ASCII
       i++;
+#if SIMD_WIDTH > 0
+      // Skip over blocks of ASCII, where no byte has its high bit set. Only
+      // try this within a run of ASCII, since text which is mostly multi-byte
+      // characters would otherwise pay for a load per character.
+      while (i + SIMD_WIDTH <= length && bytes[i] <= 0x7f) {
+        uint32_t non_ascii = SIMD_MASK(SIMD_LOADU(bytes + i));
+        if (non_ascii) {
+          i += simd_first(non_ascii);
+          break;
+        }
+        i += SIMD_WIDTH;
+      }
+#endif
       continue;
     }
-    codepoint_t codepoint;
-    size_t num_bytes;
-    if ((bytes[i] & 0xe0) == 0xc0) {
+    // The length of a sequence is found with branches rather than a table
+    // lookup, so that the CPU can predict where the next one starts instead of
+    // waiting for the load. The first continuation byte has a narrower range
+    // after some leading bytes, which rules out overlong encodings, UTF-16
+    // surrogates and anything past U+10FFFF.
+    uint8_t lead = bytes[i];
+    if (lead < 0xc2) {
+      // Continuation byte without a leading byte, or an overlong encoding
+      return false;
+    } else if (lead < 0xe0) {
       // 0b110xxxxx 0b10xxxxxx
-      codepoint = bytes[i] & 0x1f;
-      num_bytes = 1;
-    } else if ((bytes[i] & 0xf0) == 0xe0) {
+      if (length - i < 2 || !is_continuation(bytes[i + 1])) {
+        return false;
+      }
+      i += 2;
+    } else if (lead < 0xf0) {
       // 0b1110xxxx 0b10xxxxxx 0b10xxxxxx
-      codepoint = bytes[i] & 0x0f;
-      num_bytes = 2;
-    } else if ((bytes[i] & 0xf8) == 0xf0) {
+      uint8_t low = lead == 0xe0 ? 0xa0 : 0x80, high = lead == 0xed ? 0x9f : 0xbf;
+      if (length - i < 3 || bytes[i + 1] < low || bytes[i + 1] > high
+          || !is_continuation(bytes[i + 2])) {
+        return false;
+      }
+      i += 3;
+    } else if (lead < 0xf5) {
       // 0b11110xxx 0b10xxxxxx 0b10xxxxxx 0b10xxxxxx
-      codepoint = bytes[i] & 0x07;
-      num_bytes = 3;
-    } else {
-      // Outside the bounds of UTF-8
-      return false;
-    }
-    i++;
-    while (num_bytes--) {
-      // Check if 0b10xxxxxx
-      if ((bytes[i] & 0xc0) != 0x80) {
+      uint8_t low = lead == 0xf0 ? 0x90 : 0x80, high = lead == 0xf4 ? 0x8f : 0xbf;
+      if (length - i < 4 || bytes[i + 1] < low || bytes[i + 1] > high
+          || !is_continuation(bytes[i + 2]) || !is_continuation(bytes[i + 3])) {
         return false;
       }
-      codepoint = (codepoint << 6) | (bytes[i] & 0xdf);
-      i++;
-    }
-    // Check if it's within the UTF-16 surrogates range
-    if (codepoint >= 0xd800 && codepoint <= 0xdfff) {
+      i += 4;
+    } else {
+      // Outside the bounds of UTF-8
       return false;
     }
   }
@@ -82,7 +102,7 @@ bool string_init(struct String* string, const char* c_string) {
     string->length = string->capacity = 0;
     return true;
   }
-  if (!validate_null_terminated_utf8((const uint8_t*) c_string, length)) {
+  if (!utf8_validate((const uint8_t*) c_string, length)) {
     return false;
   }
   if (!(string->data = malloc(length))) {
@@ -105,7 +125,7 @@ bool str_init(struct Str* str, const char* c_string, size_t length) {
   if (length == SIZE_MAX) {
     length = strlen(c_string);
   }
-  if (!validate_null_terminated_utf8((const uint8_t*) c_string, length)) {
+  if (!utf8_validate((const uint8_t*) c_string, length)) {
     return false;
   }
   str->data = (const uint8_t*) c_string;
@@ -113,6 +133,11 @@ bool str_init(struct Str* str, const char* c_string, size_t length) {
   return true;
 }
 
+void str_init_valid(struct Str* str, const char* data, size_t length) {
+  str->data = (const uint8_t*) data;
+  str->length = length;
+}
+
 bool str_equal(const struct Str* a, const struct Str* b) {
   if (a->length != b->length) {
     return false;
@@ -142,7 +167,7 @@ static int string_vwritef(struct Writer* writer, const char *fmt, va_list ap) {
   va_end(args);
 
   // Validate UTF-8
-  if (!validate_null_terminated_utf8((const uint8_t*) ptr, ret)) {
+  if (!utf8_validate((const uint8_t*) ptr, ret)) {
     return -1;
   }
   string->length += ret;
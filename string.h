@@ -10,6 +10,10 @@
 
 #define codepoint_t uint32_t
 
+// Check whether `length` bytes at `bytes` are valid UTF-8. Overlong encodings,
+// UTF-16 surrogates and code points past U+10FFFF are all invalid.
+bool utf8_validate(const uint8_t* bytes, size_t length);
+
 // Growable UTF-8 string
 struct String {
   uint8_t* data;   // Pointer to a buffer that holds the actual string data
@@ -37,6 +41,10 @@ struct Str {
 // be null-terminated, and the full length is used.
 bool str_init(struct Str* str, const char* c_string, size_t length);
 
+// Initialize string slice from data which is already known to be valid UTF-8,
+// such as a slice of a validated string which is cut at character boundaries
+void str_init_valid(struct Str* str, const char* data, size_t length);
+
 // Check if two string slices are equal. This is O(n) - it checks every byte.
 bool str_equal(const struct Str* a, const struct Str* b);
 
@@ -0,0 +1,91 @@
+#include "symbol.h"
+
+#include <stdio.h>
+
+#include "ast.h"
+#include "parser.h"
+#include "test.h"
+#include "writer.h"
+
+static struct Str str(const char* c_string) {
+  struct Str ret;
+  str_init(&ret, c_string, SIZE_MAX);
+  return ret;
+}
+
+TEST(Symbol, Intern) {
+  struct SymbolTable table;
+  symbol_table_init(&table);
+  ASSERT_INT_EQ(symbol_find(&table, str("foo")), SYMBOL_NONE);
+  uint32_t foo = symbol_intern(&table, str("foo"));
+  uint32_t bar = symbol_intern(&table, str("bar"));
+  ASSERT_INT_EQ(foo, 0);
+  ASSERT_INT_EQ(bar, 1);
+  ASSERT_INT_EQ(symbol_intern(&table, str("foo")), foo);
+  ASSERT_INT_EQ(symbol_find(&table, str("bar")), bar);
+  ASSERT_INT_EQ(symbol_find(&table, str("fo")), SYMBOL_NONE);
+  // The table keeps its own copy of the text
+  char buffer[] = "baz";
+  uint32_t baz = symbol_intern(&table, str(buffer));
+  buffer[0] = 'z';
+  ASSERT_STR_EQ(symbol_text(&table, baz), str("baz"));
+  ASSERT_STR_EQ(symbol_text(&table, foo), str("foo"));
+  symbol_table_fini(&table);
+}
+
+TEST(Symbol, Grow) {
+  struct SymbolTable table;
+  symbol_table_init(&table);
+  char name[16];
+  for (uint32_t i = 0; i < 1000; i++) {
+    snprintf(name, sizeof(name), "name%u", i);
+    ASSERT_INT_EQ(symbol_intern(&table, str(name)), i);
+  }
+  for (uint32_t i = 0; i < 1000; i++) {
+    snprintf(name, sizeof(name), "name%u", i);
+    ASSERT_INT_EQ(symbol_find(&table, str(name)), i);
+    ASSERT_STR_EQ(symbol_text(&table, i), str(name));
+  }
+  symbol_table_fini(&table);
+}
+
+// Names get the same ID in every parse which shares a table, like lines in
+// the REPL, even once the earlier source and AST are gone
+TEST(Symbol, StableAcrossParses) {
+  struct SymbolTable table;
+  symbol_table_init(&table);
+  struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);
+  struct ParseOptions options = { &table, false };
+  bool incomplete;
+
+  struct Arena arena;
+  arena_init(&arena);
+  struct Ast* ast = parse_with_options(&arena, "let x = y;", &options, err_writer, &incomplete);
+  ASSERT(ast != NULL && ast->type == AST_Program);
+  struct AstLet* let = (struct AstLet*) ((struct AstProgram*) ast)->statements.data[0];
+  ASSERT(let->ast.type == AST_Let);
+  uint32_t x_symbol = let->symbol;
+  uint32_t y_symbol = ((struct AstIdentifier*) let->rhs)->symbol;
+  ASSERT(x_symbol != y_symbol);
+  arena_fini(&arena);
+
+  arena_init(&arena);
+  ast = parse_with_options(&arena, "y.x;", &options, err_writer, &incomplete);
+  ASSERT(ast != NULL);
+  struct AstMember* member = (struct AstMember*) ((struct AstProgram*) ast)->statements.data[0];
+  ASSERT(member->ast.type == AST_Member);
+  ASSERT_INT_EQ(member->symbol, x_symbol);
+  ASSERT_INT_EQ(((struct AstIdentifier*) member->lhs)->symbol, y_symbol);
+  arena_fini(&arena);
+
+  // Without a table, nothing is interned
+  arena_init(&arena);
+  ast = parse(&arena, "x;", err_writer, &incomplete);
+  ASSERT(ast != NULL);
+  ASSERT_INT_EQ(((struct AstIdentifier*) ((struct AstProgram*) ast)->statements.data[0])->symbol,
+                SYMBOL_NONE);
+  arena_fini(&arena);
+
+  file_writer_free((struct FileWriter*) err_writer);
+  symbol_table_fini(&table);
+}
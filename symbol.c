@@ -0,0 +1,111 @@
+#include "symbol.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define REALLOC(PTR, SIZE) do {        \
+    if (!(PTR = realloc(PTR, SIZE))) { \
+      DIE_ERR("realloc()");            \
+    }                                  \
+  } while (0)
+
+// Initial number of slots in the hash table
+#define INITIAL_SLOTS 64
+
+void symbol_table_init(struct SymbolTable* table) {
+  arena_init(&table->text);
+  table->symbols = NULL;
+  table->num_symbols = table->symbols_capacity = 0;
+  table->slots = NULL;
+  table->slots_capacity = 0;
+}
+
+void symbol_table_fini(struct SymbolTable* table) {
+  arena_fini(&table->text);
+  free(table->symbols);
+  free(table->slots);
+}
+
+// FNV-1a
+uint32_t symbol_hash(struct Str text) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < text.length; i++) {
+    hash = (hash ^ text.data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// Find the slot for `text`, which is either the slot holding its ID or the
+// empty slot where it would go. There must be at least one empty slot.
+static size_t find_slot(const struct SymbolTable* table, struct Str text, uint32_t hash) {
+  size_t mask = table->slots_capacity - 1;
+  for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    uint32_t symbol = table->slots[slot];
+    if (symbol == SYMBOL_NONE) {
+      return slot;
+    }
+    const struct Symbol* entry = &table->symbols[symbol];
+    if (entry->hash == hash && str_equal(&entry->text, &text)) {
+      return slot;
+    }
+  }
+}
+
+// Double the number of slots. Stored hashes are used to place the symbols
+// again, so their text isn't touched.
+static void grow_slots(struct SymbolTable* table) {
+  table->slots_capacity = table->slots_capacity == 0 ? INITIAL_SLOTS : table->slots_capacity * 2;
+  REALLOC(table->slots, table->slots_capacity * sizeof(uint32_t));
+  for (size_t i = 0; i < table->slots_capacity; i++) {
+    table->slots[i] = SYMBOL_NONE;
+  }
+  size_t mask = table->slots_capacity - 1;
+  for (size_t symbol = 0; symbol < table->num_symbols; symbol++) {
+    size_t slot = table->symbols[symbol].hash & mask;
+    while (table->slots[slot] != SYMBOL_NONE) {
+      slot = (slot + 1) & mask;
+    }
+    table->slots[slot] = symbol;
+  }
+}
+
+uint32_t symbol_intern(struct SymbolTable* table, struct Str text) {
+  // Keep the load factor at most 1/2
+  if (2 * (table->num_symbols + 1) > table->slots_capacity) {
+    grow_slots(table);
+  }
+  uint32_t hash = symbol_hash(text);
+  size_t slot = find_slot(table, text, hash);
+  if (table->slots[slot] != SYMBOL_NONE) {
+    return table->slots[slot];
+  }
+  CHECK(table->num_symbols < SYMBOL_NONE);
+  if (table->num_symbols == table->symbols_capacity) {
+    table->symbols_capacity = table->symbols_capacity == 0 ? 32 : table->symbols_capacity * 2;
+    REALLOC(table->symbols, table->symbols_capacity * sizeof(struct Symbol));
+  }
+  char* copy = arena_alloc(&table->text, text.length + 1);
+  memcpy(copy, text.data, text.length);
+  copy[text.length] = '\0';
+  struct Symbol* symbol = &table->symbols[table->num_symbols];
+  str_init_valid(&symbol->text, copy, text.length);
+  symbol->hash = hash;
+  table->slots[slot] = table->num_symbols;
+  return table->num_symbols++;
+}
+
+uint32_t symbol_find(const struct SymbolTable* table, struct Str text) {
+  if (table->num_symbols == 0) {
+    return SYMBOL_NONE;
+  }
+  return table->slots[find_slot(table, text, symbol_hash(text))];
+}
+
+struct Str symbol_text(const struct SymbolTable* table, uint32_t symbol) {
+  CHECK(symbol < table->num_symbols);
+  return table->symbols[symbol].text;
+}
+
+#undef REALLOC
@@ -0,0 +1,52 @@
+#ifndef __BS_SYMBOL_H__
+#define __BS_SYMBOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "string.h"
+
+// ID for "no symbol", like for nodes from a parse without a symbol table
+#define SYMBOL_NONE UINT32_MAX
+
+// Interned name
+struct Symbol {
+  struct Str text; // Text of the symbol, owned by the table
+  uint32_t hash;   // Hash of the text
+};
+
+// Interner which maps names to small integer IDs, so that names can be
+// compared by ID rather than by their text. IDs are handed out in order from
+// 0, and are never reused, so they stay the same for the life of the table.
+// Symbols are found through an open-addressed hash table of IDs, which
+// compares the stored hash of each symbol before its text.
+struct SymbolTable {
+  struct Arena text;        // Copies of the text of all the symbols
+  struct Symbol* symbols;   // Symbols, indexed by ID
+  size_t num_symbols;       // Number of symbols
+  size_t symbols_capacity;  // Allocated capacity of `symbols`
+  uint32_t* slots;          // Hash table of IDs, with SYMBOL_NONE for empty slots
+  size_t slots_capacity;    // Number of slots, a power of 2
+};
+
+// Initialize an empty table
+void symbol_table_init(struct SymbolTable* table);
+
+// Free memory for the table, including the text of all the symbols
+void symbol_table_fini(struct SymbolTable* table);
+
+// Hash the text of a symbol
+uint32_t symbol_hash(struct Str text);
+
+// Get the ID for `text`, adding it to the table if it isn't there yet. The
+// text is copied, so it needn't outlive the call.
+uint32_t symbol_intern(struct SymbolTable* table, struct Str text);
+
+// Get the ID for `text`, or SYMBOL_NONE if it isn't in the table
+uint32_t symbol_find(const struct SymbolTable* table, struct Str text);
+
+// Get the text of a symbol. It lives as long as the table.
+struct Str symbol_text(const struct SymbolTable* table, uint32_t symbol);
+
+#endif  // __BS_SYMBOL_H__
@@ -0,0 +1,82 @@
+#include "test-util.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "code-gen.h"
+#include "fold.h"
+#include "parser.h"
+#include "peephole.h"
+#include "string.h"
+#include "test-macros.h"
+#include "writer.h"
+
+bool test_compile(const char* source, unsigned flags, struct Chunk* chunk) {
+  struct Arena arena;
+  bool incomplete_input = false;
+  struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);
+  arena_init(&arena);
+  struct Ast* ast = parse(&arena, source, err_writer, &incomplete_input);
+  ASSERT(ast != NULL);
+  if (flags & TF_Fold) {
+    ast = fold_ast(&arena, ast, NULL);
+  }
+  bool ok = generate_bytecode(ast, chunk, err_writer);
+  if (ok && (flags & TF_Peephole)) {
+    peephole_optimize(chunk, NULL);
+  }
+  arena_fini(&arena);
+  file_writer_free((struct FileWriter*) err_writer);
+  return ok;
+}
+
+bool test_compiles(const char* source) {
+  struct Memory mem;
+  struct Chunk chunk;
+  mem_init(&mem);
+  chunk_init(&chunk, &mem);
+  bool ok = test_compile(source, 0, &chunk);
+  chunk_fini(&chunk);
+  mem_fini(&mem);
+  return ok;
+}
+
+bool test_run(struct Memory* mem, const char* source, enum ChunkEncoding encoding,
+              enum VmDispatch dispatch, unsigned flags, struct Value* result) {
+  struct Vm vm;
+  struct Chunk chunk;
+  struct String errors;
+  struct Writer* vm_writer;
+  string_init(&errors, "");
+  if (flags & TF_QuietErrors) {
+    vm_writer = (struct Writer*) string_writer_create(&errors);
+  } else {
+    vm_writer = (struct Writer*) file_writer_create(stderr);
+  }
+  vm_init(&vm, mem, vm_writer);
+  chunk_init(&chunk, mem);
+  chunk.encoding = encoding;
+  ASSERT(test_compile(source, flags, &chunk));
+  bool ok = vm_run_with_dispatch(&vm, &chunk, dispatch, result);
+  chunk_fini(&chunk);
+  vm_fini(&vm);
+  if (flags & TF_QuietErrors) {
+    string_writer_free((struct StringWriter*) vm_writer);
+  } else {
+    file_writer_free((struct FileWriter*) vm_writer);
+  }
+  string_fini(&errors);
+  return ok;
+}
+
+bool test_same_value(struct Value a, struct Value b) {
+  if (VALUE_TYPE(a) != VALUE_TYPE(b)) {
+    return false;
+  }
+  if (IS_FLOAT(a)) {
+    return (isnan(AS_FLOAT(a)) && isnan(AS_FLOAT(b))) ||
+      (AS_FLOAT(a) == AS_FLOAT(b) && signbit(AS_FLOAT(a)) == signbit(AS_FLOAT(b)));
+  }
+  return value_equal(a, b);
+}
@@ -0,0 +1,35 @@
+#ifndef __BS_TEST_UTIL_H__
+#define __BS_TEST_UTIL_H__
+
+#include <stdbool.h>
+
+#include "bytecode.h"
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+
+// Optional steps between parsing and running a program
+enum TestFlags {
+  TF_Fold = 1 << 0,        // Fold constants in the AST before generating code
+  TF_Peephole = 1 << 1,    // Run the peephole optimizer over the code
+  TF_QuietErrors = 1 << 2, // Don't print runtime errors, for tests which expect them
+};
+
+// Parse a program and generate code for it into `chunk`, which must be
+// initialized with the encoding to use. The test fails if the program doesn't
+// parse. Returns whether code generation succeeded, and prints any errors.
+bool test_compile(const char* source, unsigned flags, struct Chunk* chunk);
+
+// Check if a program compiles to stack-machine code, without keeping the code
+bool test_compiles(const char* source);
+
+// Compile a program, and run it in a fresh VM. The test fails if the program
+// doesn't compile. The result can reference objects owned by `mem`.
+bool test_run(struct Memory* mem, const char* source, enum ChunkEncoding encoding,
+              enum VmDispatch dispatch, unsigned flags, struct Value* result);
+
+// Check if two values are the same. Unlike `value_equal`, this tells 0.0 and
+// -0.0 apart, and any NaN is the same as another one.
+bool test_same_value(struct Value a, struct Value b);
+
+#endif  // __BS_TEST_UTIL_H__
@@ -0,0 +1,120 @@
+#include "value.h"
+
+#include "bench.h"
+#include "bytecode.h"
+#include "log.h"
+#include "vm.h"
+
+#define ARRAY_LENGTH (1 << 22)
+#define RANDOM_ARRAY_LENGTH (1 << 17)
+#define NUM_RANDOM_READS (1 << 24)
+#define STACK_DEPTH (VM_STACK_MAX - 1)
+#define NUM_RUNS 20
+
+#ifdef BS_NAN_BOXING
+#define REPRESENTATION "nan-boxed"
+#else
+#define REPRESENTATION "tagged-union"
+#endif
+
+BENCH(Value, Size) {
+  bench_report(REPRESENTATION, (double) sizeof(struct Value), "bytes/value");
+}
+
+// Sum a value vector that is much larger than the cache, so the cost is
+// dominated by memory traffic.
+BENCH(Value, LargeArraySum) {
+  struct Memory mem;
+  struct ValueVec vec;
+  mem_init(&mem);
+  value_vec_init(&vec, &mem);
+  for (size_t i = 0; i < ARRAY_LENGTH; i++) {
+    value_vec_push(&vec, INT_VAL(&mem, i & 0xff));
+  }
+
+  int64_t sum = 0;
+  uint64_t start = bench_now_ns();
+  for (size_t run = 0; run < NUM_RUNS; run++) {
+    for (size_t i = 0; i < vec.length; i++) {
+      sum += AS_INT(vec.values[i]);
+    }
+    int64_t total = sum;
+    bench_consume(&total);
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  bench_report(REPRESENTATION " footprint",
+               (double) (vec.length * sizeof(struct Value)) / (1024.0 * 1024.0), "MiB");
+  bench_report(REPRESENTATION " time", (double) elapsed / (double) (ARRAY_LENGTH * NUM_RUNS),
+               "ns/value");
+
+  value_vec_fini(&vec);
+  mem_fini(&mem);
+}
+
+// Read random elements of an array which fits in L2 when NaN-boxed, but not
+// as a tagged union, so that the cost is dominated by cache misses.
+BENCH(Value, ArrayRandomAccess) {
+  struct Memory mem;
+  struct ValueVec vec;
+  mem_init(&mem);
+  value_vec_init(&vec, &mem);
+  for (size_t i = 0; i < RANDOM_ARRAY_LENGTH; i++) {
+    value_vec_push(&vec, INT_VAL(&mem, i & 0xff));
+  }
+
+  int64_t sum = 0;
+  uint32_t state = 12345;
+  uint64_t start = bench_now_ns();
+  for (size_t i = 0; i < NUM_RANDOM_READS; i++) {
+    // Linear congruential generator, cheap enough to not matter
+    state = state * 1664525u + 1013904223u;
+    sum += AS_INT(vec.values[(state >> 8) & (RANDOM_ARRAY_LENGTH - 1)]);
+  }
+  int64_t total = sum;
+  bench_consume(&total);
+  uint64_t elapsed = bench_now_ns() - start;
+  bench_report(REPRESENTATION " footprint",
+               (double) (vec.length * sizeof(struct Value)) / 1024.0, "KiB");
+  bench_report(REPRESENTATION " time", (double) elapsed / (double) NUM_RANDOM_READS, "ns/read");
+
+  value_vec_fini(&vec);
+  mem_fini(&mem);
+}
+
+// Fill the VM stack to nearly its full depth, then fold it back down
+BENCH(Value, DeepStack) {
+  struct Memory mem;
+  struct Vm vm;
+  struct Chunk chunk;
+  struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+  mem_init(&mem);
+  vm_init(&vm, &mem, writer);
+  chunk_init(&chunk, &mem);
+  size_t one = chunk_push_value(&chunk, INT_VAL(&mem, 1));
+  for (size_t i = 0; i < STACK_DEPTH; i++) {
+    chunk_push_byte(&chunk, OP_Const1B);
+    chunk_push_byte(&chunk, one);
+  }
+  for (size_t i = 1; i < STACK_DEPTH; i++) {
+    chunk_push_byte(&chunk, OP_Add);
+  }
+  chunk_push_byte(&chunk, OP_Return);
+
+  struct Value result;
+  uint64_t start = bench_now_ns();
+  for (size_t i = 0; i < NUM_RUNS * 10; i++) {
+    CHECK(vm_run(&vm, &chunk, &result));
+    bench_consume(&result);
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  CHECK(AS_INT(result) == STACK_DEPTH);
+  bench_report(REPRESENTATION " footprint",
+               (double) (STACK_DEPTH * sizeof(struct Value)) / 1024.0, "KiB");
+  bench_report(REPRESENTATION " time",
+               (double) elapsed / (double) ((2 * STACK_DEPTH) * NUM_RUNS * 10), "ns/instruction");
+
+  chunk_fini(&chunk);
+  vm_fini(&vm);
+  mem_fini(&mem);
+  file_writer_free((struct FileWriter*) writer);
+}
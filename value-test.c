@@ -0,0 +1,45 @@
+#include "value.h"
+
+#include "memory.h"
+#include "test.h"
+
+TEST(Value, IntegerRoundTrip) {
+  struct Memory mem;
+  mem_init(&mem);
+  const int64_t ints[] = {
+    0, 1, -1, (int64_t) 1 << 47, -((int64_t) 1 << 47) - 1, INT64_MAX, INT64_MIN,
+  };
+  for (size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+    struct Value value = INT_VAL(&mem, ints[i]);
+    ASSERT(IS_INT(value));
+    ASSERT(!IS_FLOAT(value) && !IS_BOOL(value) && !IS_NIL(value));
+    ASSERT(VALUE_TYPE(value) == V_Integer);
+    ASSERT(AS_INT(value) == ints[i]);
+  }
+  mem_fini(&mem);
+  ASSERT(mem.mem_used == 0);
+}
+
+TEST(Value, Floats) {
+  struct Value value = FLOAT_VAL(-1.5);
+  ASSERT(IS_FLOAT(value) && AS_FLOAT(value) == -1.5);
+  double zero = 0.0;
+  value = FLOAT_VAL(zero / zero);
+  ASSERT(IS_FLOAT(value));
+  ASSERT(!IS_NIL(value) && !IS_BOOL(value) && !IS_INT(value));
+  ASSERT(!value_equal(value, value));
+}
+
+TEST(Value, Equality) {
+  struct Memory mem;
+  mem_init(&mem);
+  ASSERT(value_equal(NIL_VAL(), NIL_VAL()));
+  ASSERT(!value_equal(NIL_VAL(), BOOL_VAL(false)));
+  ASSERT(value_equal(BOOL_VAL(true), BOOL_VAL(true)));
+  ASSERT(value_equal(INT_VAL(&mem, 2), FLOAT_VAL(2.0)));
+  ASSERT(value_equal(INT_VAL(&mem, INT64_MAX), INT_VAL(&mem, INT64_MAX)));
+  ASSERT(!value_equal(INT_VAL(&mem, 0), BOOL_VAL(false)));
+  ASSERT(value_is_falsey(NIL_VAL()) && value_is_falsey(BOOL_VAL(false)));
+  ASSERT(!value_is_falsey(INT_VAL(&mem, 0)));
+  mem_fini(&mem);
+}
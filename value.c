@@ -3,6 +3,38 @@
 #include "log.h"
 #include "memory.h"
 
+// External definitions for the inline functions in the header
+bool value_is_falsey(const struct Value value);
+
+#ifdef BS_NAN_BOXING
+struct Value value_int(struct Memory* mem, int64_t i);
+struct Value value_float(double f);
+bool value_is_int(const struct Value value);
+int64_t value_as_int(const struct Value value);
+double value_as_float(const struct Value value);
+
+struct Value value_box_int(struct Memory* mem, int64_t i) {
+  struct ObjInteger* obj = obj_integer_create(mem, i);
+  uint64_t ptr = (uint64_t) (uintptr_t) obj;
+  CHECK((ptr & VALUE_PAYLOAD_MASK) == ptr);
+  return (struct Value) { VALUE_TAG_OBJECT | ptr };
+}
+
+enum ValueType value_type(const struct Value value) {
+  if (IS_FLOAT(value)) {
+    return V_Float;
+  }
+  if (IS_INT(value)) {
+    return V_Integer;
+  }
+  if (IS_BOOL(value)) {
+    return V_Boolean;
+  }
+  CHECK(IS_NIL(value));
+  return V_Nil;
+}
+#endif  // BS_NAN_BOXING
+
 void value_vec_init(struct ValueVec* vec, struct Memory* mem) {
   vec->values = NULL;
   vec->length = vec->capacity = 0;
@@ -26,12 +58,42 @@ void value_vec_fini(struct ValueVec* vec) {
   MEM_FREE(vec->mem, vec->values, vec->capacity * sizeof(struct Value));
 }
 
+const char* value_type_to_str(enum ValueType type) {
+  switch (type) {
+  case V_Nil:     return "nil";
+  case V_Boolean: return "boolean";
+  case V_Integer: return "integer";
+  case V_Float:   return "float";
+  default:
+    UNREACHABLE();
+  }
+}
+
+bool value_equal(const struct Value a, const struct Value b) {
+  switch (VALUE_TYPE(a)) {
+  case V_Nil:     return IS_NIL(b);
+  case V_Boolean: return IS_BOOL(b) && AS_BOOL(a) == AS_BOOL(b);
+  case V_Integer:
+    if (IS_INT(b)) {
+      return AS_INT(a) == AS_INT(b);
+    }
+    return IS_FLOAT(b) && (double) AS_INT(a) == AS_FLOAT(b);
+  case V_Float:
+    if (IS_FLOAT(b)) {
+      return AS_FLOAT(a) == AS_FLOAT(b);
+    }
+    return IS_INT(b) && AS_FLOAT(a) == (double) AS_INT(b);
+  default:
+    UNREACHABLE();
+  }
+}
+
 int value_print(const struct Value value, struct Writer* writer) {
-  switch (value.type) {
+  switch (VALUE_TYPE(value)) {
   case V_Nil:     return writer->writef(writer, "nil");
-  case V_Boolean: return writer->writef(writer, value.b ? "true" : "false");
-  case V_Integer: return writer->writef(writer, "%lld", value.i);
-  case V_Float:   return writer->writef(writer, "%lf", value.f);
+  case V_Boolean: return writer->writef(writer, AS_BOOL(value) ? "true" : "false");
+  case V_Integer: return writer->writef(writer, "%lld", (long long) AS_INT(value));
+  case V_Float:   return writer->writef(writer, "%lf", AS_FLOAT(value));
   default:
     UNREACHABLE();
   }
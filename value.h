@@ -4,8 +4,10 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "memory.h"
+#include "object.h"
 #include "writer.h"
 
 enum ValueType {
@@ -15,6 +17,99 @@ enum ValueType {
   V_Float,
 };
 
+#ifdef BS_NAN_BOXING
+
+// NaN-boxed representation, enabled with the BS_NAN_BOXING CMake option.
+// Floats are stored as-is. Every other value is hidden in the payload of a
+// quiet NaN, and the top 16 bits tell the types apart. Integers which don't
+// fit in 48 bits are boxed on the heap. NaNs produced by arithmetic are
+// canonicalized, so that they are never mistaken for a tagged value.
+struct Value {
+  uint64_t bits;
+};
+
+#define VALUE_QNAN         0x7ffc000000000000ull
+#define VALUE_TAG_MASK     0xffff000000000000ull
+#define VALUE_PAYLOAD_MASK 0x0000ffffffffffffull
+#define VALUE_TAG_SPECIAL  0x7ffc000000000000ull // nil, false and true
+#define VALUE_TAG_INT      0x7ffd000000000000ull // 48-bit signed integer
+#define VALUE_TAG_OBJECT   0x7ffe000000000000ull // 48-bit object pointer
+#define VALUE_NIL_BITS     (VALUE_TAG_SPECIAL | 1)
+#define VALUE_FALSE_BITS   (VALUE_TAG_SPECIAL | 2)
+#define VALUE_TRUE_BITS    (VALUE_TAG_SPECIAL | 3)
+#define VALUE_CANONICAL_NAN 0x7ff8000000000000ull
+
+// Range of integers that are stored without boxing
+#define VALUE_INT_MIN (-((int64_t) 1 << 47))
+#define VALUE_INT_MAX (((int64_t) 1 << 47) - 1)
+
+// Box an integer which doesn't fit in 48 bits
+struct Value value_box_int(struct Memory* mem, int64_t i);
+
+inline struct Value value_int(struct Memory* mem, int64_t i) {
+  if (i < VALUE_INT_MIN || i > VALUE_INT_MAX) {
+    return value_box_int(mem, i);
+  }
+  return (struct Value) { VALUE_TAG_INT | ((uint64_t) i & VALUE_PAYLOAD_MASK) };
+}
+
+inline struct Value value_float(double f) {
+  struct Value value;
+  if (f != f) {
+    value.bits = VALUE_CANONICAL_NAN;
+  } else {
+    memcpy(&value.bits, &f, sizeof(double));
+  }
+  return value;
+}
+
+inline bool value_is_int(const struct Value value) {
+  uint64_t tag = value.bits & VALUE_TAG_MASK;
+  if (tag == VALUE_TAG_INT) {
+    return true;
+  }
+  return tag == VALUE_TAG_OBJECT &&
+    ((const struct Object*) (uintptr_t) (value.bits & VALUE_PAYLOAD_MASK))->type == OBJ_Integer;
+}
+
+inline int64_t value_as_int(const struct Value value) {
+  if ((value.bits & VALUE_TAG_MASK) == VALUE_TAG_INT) {
+    // Sign-extend the 48-bit payload
+    return ((int64_t) (value.bits << 16)) >> 16;
+  }
+  return ((const struct ObjInteger*) (uintptr_t) (value.bits & VALUE_PAYLOAD_MASK))->i;
+}
+
+inline double value_as_float(const struct Value value) {
+  double f;
+  memcpy(&f, &value.bits, sizeof(double));
+  return f;
+}
+
+// Get the type of a value
+enum ValueType value_type(const struct Value value);
+
+#define NIL_VAL()         ((struct Value) { VALUE_NIL_BITS })
+#define BOOL_VAL(B)       ((struct Value) { (B) ? VALUE_TRUE_BITS : VALUE_FALSE_BITS })
+#define INT_VAL(MEM, I)   value_int(MEM, I)
+#define FLOAT_VAL(F)      value_float(F)
+
+#define IS_NIL(V)   ((V).bits == VALUE_NIL_BITS)
+#define IS_BOOL(V)  (((V).bits | 1) == VALUE_TRUE_BITS)
+#define IS_INT(V)   value_is_int(V)
+#define IS_FLOAT(V) (((V).bits & VALUE_QNAN) != VALUE_QNAN)
+
+// Cheaper than IS_INT, but false for boxed integers
+#define IS_SMALL_INT(V) (((V).bits & VALUE_TAG_MASK) == VALUE_TAG_INT)
+
+#define AS_BOOL(V)  ((V).bits == VALUE_TRUE_BITS)
+#define AS_INT(V)   value_as_int(V)
+#define AS_FLOAT(V) value_as_float(V)
+
+#define VALUE_TYPE(V) value_type(V)
+
+#else  // BS_NAN_BOXING
+
 struct Value {
   enum ValueType type;
   union {
@@ -24,24 +119,41 @@ struct Value {
   };
 };
 
-// Print a value out to a writer
-int value_print(const struct Value value, struct Writer* writer);
-
-#define NIL_VAL()    ((struct Value) { .type = V_Nil, .b = false })
-#define BOOL_VAL(B)  ((struct Value) { .type = V_Boolean, .b = B })
-#define INT_VAL(I)   ((struct Value) { .type = V_Integer, .i = I })
-#define FLOAT_VAL(F) ((struct Value) { .type = V_Float, .f = F })
+// `MEM` is only needed for boxing large integers with BS_NAN_BOXING
+#define NIL_VAL()       ((struct Value) { .type = V_Nil, .b = false })
+#define BOOL_VAL(B)     ((struct Value) { .type = V_Boolean, .b = B })
+#define INT_VAL(MEM, I) ((void) (MEM), (struct Value) { .type = V_Integer, .i = I })
+#define FLOAT_VAL(F)    ((struct Value) { .type = V_Float, .f = F })
 
 #define IS_NIL(V)   ((V).type == V_Nil)
 #define IS_BOOL(V)  ((V).type == V_Boolean)
 #define IS_INT(V)   ((V).type == V_Integer)
 #define IS_FLOAT(V) ((V).type == V_Float)
 
+#define IS_SMALL_INT(V) IS_INT(V)
+
+#define AS_BOOL(V)  ((V).b)
+#define AS_INT(V)   ((V).i)
+#define AS_FLOAT(V) ((V).f)
+
+#define VALUE_TYPE(V) ((V).type)
+
+#endif  // BS_NAN_BOXING
+
+// Get a human-readable name for a value type
+const char* value_type_to_str(enum ValueType type);
+
+// Print a value out to a writer
+int value_print(const struct Value value, struct Writer* writer);
+
 // Check if a value is "false-y"
 inline bool value_is_falsey(const struct Value value) {
-  return IS_NIL(value) || (IS_BOOL(value) && value.b == false);
+  return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+// Check if two values are equal. Integers and floats compare by numeric value.
+bool value_equal(const struct Value a, const struct Value b);
+
 // A growable array of values
 struct ValueVec {
   struct Memory* mem;   // Handle to memory manager
@@ -0,0 +1,258 @@
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "bytecode.h"
+#include "code-gen.h"
+#include "fold.h"
+#include "log.h"
+#include "parser.h"
+#include "peephole.h"
+
+#define NUM_OPERATIONS 100000
+#define NUM_RUNS 200
+
+// Build a long straight-line chunk of cheap instructions, so that the cost of
+// executing it is dominated by instruction dispatch.
+static size_t build_dispatch_chunk(struct Chunk* chunk) {
+  size_t one = chunk_push_value(chunk, INT_VAL(chunk->values.mem, 1));
+  size_t num_dispatches = 0;
+  chunk_push_byte(chunk, OP_Const1B);
+  chunk_push_byte(chunk, one);
+  num_dispatches++;
+  for (size_t i = 0; i < NUM_OPERATIONS; i++) {
+    chunk_push_byte(chunk, OP_Const1B);
+    chunk_push_byte(chunk, one);
+    switch (i % 4) {
+    case 0: chunk_push_byte(chunk, OP_Add); break;
+    case 1: chunk_push_byte(chunk, OP_BitXor); break;
+    case 2: chunk_push_byte(chunk, OP_Subtract); break;
+    case 3: chunk_push_byte(chunk, OP_BitOr); break;
+    }
+    chunk_push_byte(chunk, OP_BitNot);
+    num_dispatches += 3;
+  }
+  chunk_push_byte(chunk, OP_Return);
+  return num_dispatches + 1;
+}
+
+static void bench_dispatch(enum VmDispatch dispatch, const char* label) {
+  struct Memory mem;
+  struct Vm vm;
+  struct Chunk chunk;
+  struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+  mem_init(&mem);
+  vm_init(&vm, &mem, writer);
+  chunk_init(&chunk, &mem);
+  size_t num_dispatches = build_dispatch_chunk(&chunk);
+
+  struct Value result;
+  uint64_t start = bench_now_ns();
+  for (size_t i = 0; i < NUM_RUNS; i++) {
+    CHECK(vm_run_with_dispatch(&vm, &chunk, dispatch, &result));
+    bench_consume(&result);
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  bench_report(label, (double) elapsed / (double) (num_dispatches * NUM_RUNS), "ns/dispatch");
+
+  chunk_fini(&chunk);
+  vm_fini(&vm);
+  mem_fini(&mem);
+  file_writer_free((struct FileWriter*) writer);
+}
+
+BENCH(Vm, SwitchVsThreadedDispatch) {
+  bench_dispatch(VM_DispatchSwitch, "switch");
+  bench_dispatch(VM_DispatchThreaded, "threaded");
+}
+
+#define NUM_STATEMENTS 2000
+
+// Generate a script of many arithmetic-heavy statements, where most operands
+// are literals.
+static char* build_arithmetic_source() {
+  size_t capacity = NUM_STATEMENTS * 64;
+  char* source = malloc(capacity);
+  CHECK(source != NULL);
+  size_t length = 0;
+  for (size_t i = 0; i < NUM_STATEMENTS; i++) {
+    length += snprintf(source + length, capacity - length,
+                       "(%zu + 3) * (%zu - 1) ^ (%zu << 2) | %zu %% 7;\n", i, i, i, i);
+    CHECK(length < capacity);
+  }
+  return source;
+}
+
+static void bench_encoding(const struct Ast* ast, enum ChunkEncoding encoding, const char* label) {
+  struct Memory mem;
+  struct Vm vm;
+  struct Chunk chunk;
+  struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+  mem_init(&mem);
+  vm_init(&vm, &mem, writer);
+  chunk_init(&chunk, &mem);
+  chunk.encoding = encoding;
+  CHECK(generate_bytecode(ast, &chunk, writer));
+
+  struct Value result;
+  CHECK(vm_run_with_dispatch(&vm, &chunk, VM_DispatchCounting, &result));
+  size_t num_dispatches = vm.num_dispatches;
+  uint64_t start = bench_now_ns();
+  for (size_t i = 0; i < NUM_RUNS; i++) {
+    CHECK(vm_run(&vm, &chunk, &result));
+    bench_consume(&result);
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%s dispatches", label);
+  bench_report(buf, (double) num_dispatches, "dispatches/run");
+  snprintf(buf, sizeof(buf), "%s bytes", label);
+  bench_report(buf, (double) chunk.code.length, "bytes");
+  snprintf(buf, sizeof(buf), "%s time", label);
+  bench_report(buf, (double) elapsed / (double) NUM_RUNS / 1000.0, "us/run");
+
+  chunk_fini(&chunk);
+  vm_fini(&vm);
+  mem_fini(&mem);
+  file_writer_free((struct FileWriter*) writer);
+}
+
+BENCH(Vm, StackVsRegisterEncoding) {
+  char* source = build_arithmetic_source();
+  struct Arena arena;
+  struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+  bool incomplete_input = false;
+  arena_init(&arena);
+  struct Ast* ast = parse(&arena, source, writer, &incomplete_input);
+  CHECK(ast != NULL);
+  bench_encoding(ast, CE_Stack, "stack");
+  bench_encoding(ast, CE_Register, "register");
+  arena_fini(&arena);
+  file_writer_free((struct FileWriter*) writer);
+  free(source);
+}
+
+#define NUM_ITERATIONS 10000000
+
+static void bench_loop(const char* source, const char* label) {
+  struct Arena arena;
+  struct Memory mem;
+  struct Vm vm;
+  struct Chunk chunk;
+  struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+  bool incomplete_input = false;
+  arena_init(&arena);
+  mem_init(&mem);
+  vm_init(&vm, &mem, writer);
+  chunk_init(&chunk, &mem);
+  struct Ast* ast = parse(&arena, source, writer, &incomplete_input);
+  CHECK(ast != NULL);
+  CHECK(generate_bytecode(ast, &chunk, writer));
+  peephole_optimize(&chunk, NULL);
+
+  struct Value result;
+  uint64_t start = bench_now_ns();
+  CHECK(vm_run(&vm, &chunk, &result));
+  bench_consume(&result);
+  uint64_t elapsed = bench_now_ns() - start;
+  bench_report(label, (double) elapsed / (double) NUM_ITERATIONS, "ns/iteration");
+
+  chunk_fini(&chunk);
+  vm_fini(&vm);
+  mem_fini(&mem);
+  arena_fini(&arena);
+  file_writer_free((struct FileWriter*) writer);
+}
+
+#define STRINGIFY(X) #X
+#define TO_STRING(X) STRINGIFY(X)
+
+// Loops over integer ranges count in a frame slot, with one instruction per
+// iteration on top of the body
+BENCH(Vm, RangeLoop) {
+  bench_loop("for i in range(" TO_STRING(NUM_ITERATIONS) ") { }", "empty body");
+  bench_loop("for i in range(" TO_STRING(NUM_ITERATIONS) ") { i * 2 + 1; }", "arithmetic body");
+  bench_loop("for i in range(" TO_STRING(NUM_ITERATIONS) ") { i + 1; }", "increment body");
+  bench_loop("for i in range(" TO_STRING(NUM_ITERATIONS) ") { 2.5 * 1.5 < 4.0; }", "float body");
+  bench_loop("for i in range(" TO_STRING(NUM_ITERATIONS) ") "
+             "{ if i < 3 or i > 5 and not (i == 7) { 1 } }", "condition body");
+  bench_loop("for i in std.range(0, " TO_STRING(NUM_ITERATIONS) ") { for j in range(0) { } }",
+             "nested empty loop");
+  bench_loop("let total = 0; for i in range(" TO_STRING(NUM_ITERATIONS) ") { total += i; }",
+             "global accumulator");
+  bench_loop("if true { let total = 0; for i in range(" TO_STRING(NUM_ITERATIONS) ") "
+             "{ total += i; } }", "local accumulator");
+}
+
+#define NUM_PROFILE_ITERATIONS 1000
+#define NUM_TOP_PAIRS 8
+
+// Loops like the ones we expect in scripts, compiled like bs.c does
+static const char* const profile_sources[] = {
+  "for i in range(" TO_STRING(NUM_PROFILE_ITERATIONS) ") { i * 2 + 1; }",
+  "for i in range(" TO_STRING(NUM_PROFILE_ITERATIONS) ") { (i + 1) * (i - 1); }",
+  "for i in range(" TO_STRING(NUM_PROFILE_ITERATIONS) ") { i << 2 | i & 3; }",
+  // 10 * 100 iterations of the inner loop
+  "for i in range(10) { for j in range(100) { i * j + 1; } }",
+  "for i in range(" TO_STRING(NUM_PROFILE_ITERATIONS) ") { i < 500; i == 7; }",
+  "let i = 0; while i < " TO_STRING(NUM_PROFILE_ITERATIONS) " { i += 1; }",
+  "for i in range(" TO_STRING(NUM_PROFILE_ITERATIONS) ") { if i < 500 { 1 } else { 2 } }",
+};
+
+// Count pairs of opcodes over all the sources, and report the most common
+// ones per loop iteration. This is what superinstructions are picked from.
+BENCH(Vm, OpcodePairs) {
+  size_t num_sources = sizeof(profile_sources) / sizeof(profile_sources[0]);
+  size_t* totals = calloc((size_t) OP_NumOpcodes * OP_NumOpcodes, sizeof(size_t));
+  CHECK(totals != NULL);
+  for (size_t i = 0; i < num_sources; i++) {
+    struct Arena arena;
+    struct Memory mem;
+    struct Vm vm;
+    struct Chunk chunk;
+    struct Writer* writer = (struct Writer*) file_writer_create(stderr);
+    bool incomplete_input = false;
+    arena_init(&arena);
+    mem_init(&mem);
+    vm_init(&vm, &mem, writer);
+    chunk_init(&chunk, &mem);
+    struct Ast* ast = parse(&arena, profile_sources[i], writer, &incomplete_input);
+    CHECK(ast != NULL);
+    ast = fold_ast(&arena, ast, NULL);
+    CHECK(generate_bytecode(ast, &chunk, writer));
+    peephole_optimize(&chunk, NULL);
+
+    struct Value result;
+    CHECK(vm_run_with_dispatch(&vm, &chunk, VM_DispatchCounting, &result));
+    for (size_t first = 0; first < OP_NumOpcodes; first++) {
+      for (size_t second = 0; second < OP_NumOpcodes; second++) {
+        totals[first * OP_NumOpcodes + second] += vm_pair_count(&vm, first, second);
+      }
+    }
+
+    chunk_fini(&chunk);
+    vm_fini(&vm);
+    mem_fini(&mem);
+    arena_fini(&arena);
+    file_writer_free((struct FileWriter*) writer);
+  }
+
+  for (size_t rank = 0; rank < NUM_TOP_PAIRS; rank++) {
+    size_t best = 0;
+    for (size_t pair = 1; pair < (size_t) OP_NumOpcodes * OP_NumOpcodes; pair++) {
+      if (totals[pair] > totals[best]) {
+        best = pair;
+      }
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%s %s", opcode_to_str(best / OP_NumOpcodes),
+             opcode_to_str(best % OP_NumOpcodes));
+    bench_report(label, (double) totals[best] / (double) (num_sources * NUM_PROFILE_ITERATIONS),
+                 "pairs/iteration");
+    totals[best] = 0;
+  }
+  free(totals);
+}
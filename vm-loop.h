@@ -0,0 +1,400 @@
+// The bytecode interpreter loop. This file is deliberately included more than
+// once from vm.c, to instantiate the loop with different dispatch strategies.
+// Before including it, define:
+//   VM_LOOP_NAME     - Name of the function to generate
+//   VM_LOOP_THREADED - 1 for computed-goto dispatch, 0 for a switch
+// And optionally:
+//   VM_LOOP_COUNTING - 1 to count dispatches in `vm->num_dispatches`, and
+//                      pairs of opcodes in `vm->pair_counts` (switch only)
+// These macros are undefined at the end of this file.
+
+#ifndef VM_LOOP_COUNTING
+#define VM_LOOP_COUNTING 0
+#endif
+
+static bool VM_LOOP_NAME(struct Vm* vm, struct Chunk* chunk, struct Value* result) {
+  // Quickened operations rewrite their opcode in place
+  uint8_t* ip = chunk->code.code;
+  const struct Value* constants = chunk->values.values;
+  struct Value* sp = vm->stack;
+  struct Value* const stack_end = vm->stack + VM_STACK_MAX;
+  // Local variables live in the slots at the bottom of the stack
+  struct Value* const frame = vm->stack;
+  // Sized for the chunk before the loop starts
+  struct Value* const globals = vm->globals.values;
+
+  // Register code addresses the frame directly, with constants in the
+  // lowest slots, followed by temporaries.
+  struct Value* const regs = vm->stack;
+  if (chunk->encoding == CE_Register) {
+    if (chunk->num_registers > VM_STACK_MAX) {
+      goto stack_overflow;
+    }
+    for (size_t i = 0; i < chunk->values.length; i++) {
+      regs[i] = constants[i];
+    }
+  }
+
+#if VM_LOOP_THREADED
+  // Every opcode must have an entry here. We trust the bytecode generator to
+  // never emit anything else.
+  static const void* const dispatch_table[] = {
+    [0]                         = &&invalid_opcode,
+    [OP_Nil]                    = &&op_Nil,
+    [OP_True]                   = &&op_True,
+    [OP_False]                  = &&op_False,
+    [OP_Const1B]                = &&op_Const1B,
+    [OP_Const2B]                = &&op_Const2B,
+    [OP_Const4B]                = &&op_Const4B,
+    [OP_Equal]                  = &&op_Equal,
+    [OP_NotEqual]               = &&op_NotEqual,
+    [OP_LessEqual]              = &&op_LessEqual,
+    [OP_LessThan]               = &&op_LessThan,
+    [OP_GreaterEqual]           = &&op_GreaterEqual,
+    [OP_GreaterThan]            = &&op_GreaterThan,
+    [OP_ShiftLeft]              = &&op_ShiftLeft,
+    [OP_ShiftRight]             = &&op_ShiftRight,
+    [OP_Add]                    = &&op_Add,
+    [OP_Subtract]               = &&op_Subtract,
+    [OP_Multiply]               = &&op_Multiply,
+    [OP_Divide]                 = &&op_Divide,
+    [OP_Modulo]                 = &&op_Modulo,
+    [OP_BitOr]                  = &&op_BitOr,
+    [OP_BitAnd]                 = &&op_BitAnd,
+    [OP_BitXor]                 = &&op_BitXor,
+    [OP_Minus]                  = &&op_Minus,
+    [OP_BitNot]                 = &&op_BitNot,
+    [OP_LogicalNot]             = &&op_LogicalNot,
+    [OP_Pop]                    = &&op_Pop,
+    [OP_GetLocal]               = &&op_GetLocal,
+    [OP_SetLocal]               = &&op_SetLocal,
+    [OP_GetGlobal]              = &&op_GetGlobal,
+    [OP_SetGlobal]              = &&op_SetGlobal,
+    [OP_UpdateLocal]            = &&op_UpdateLocal,
+    [OP_UpdateGlobal]           = &&op_UpdateGlobal,
+    [OP_Jump]                   = &&op_Jump,
+    [OP_JumpBack]               = &&op_JumpBack,
+    [OP_JumpIfFalse]            = &&op_JumpIfFalse,
+    [OP_JumpIfTrue]             = &&op_JumpIfTrue,
+    [OP_JumpIfFalseOrPop]       = &&op_JumpIfFalseOrPop,
+    [OP_JumpIfTrueOrPop]        = &&op_JumpIfTrueOrPop,
+    [OP_RangeStart]             = &&op_RangeStart,
+    [OP_RangeLoop]              = &&op_RangeLoop,
+    [OP_AddConst]               = &&op_AddConst,
+    [OP_AddLocalConst]          = &&op_AddLocalConst,
+    [OP_GetLocal2]              = &&op_GetLocal2,
+    [OP_PopRangeLoop]           = &&op_PopRangeLoop,
+    [OP_LessThanJumpIfFalse]    = &&op_LessThanJumpIfFalse,
+    [OP_LessEqualIntInt]        = &&op_LessEqualIntInt,
+    [OP_LessEqualFloatFloat]    = &&op_LessEqualFloatFloat,
+    [OP_LessThanIntInt]         = &&op_LessThanIntInt,
+    [OP_LessThanFloatFloat]     = &&op_LessThanFloatFloat,
+    [OP_GreaterEqualIntInt]     = &&op_GreaterEqualIntInt,
+    [OP_GreaterEqualFloatFloat] = &&op_GreaterEqualFloatFloat,
+    [OP_GreaterThanIntInt]      = &&op_GreaterThanIntInt,
+    [OP_GreaterThanFloatFloat]  = &&op_GreaterThanFloatFloat,
+    [OP_AddIntInt]              = &&op_AddIntInt,
+    [OP_AddFloatFloat]          = &&op_AddFloatFloat,
+    [OP_SubtractIntInt]         = &&op_SubtractIntInt,
+    [OP_SubtractFloatFloat]     = &&op_SubtractFloatFloat,
+    [OP_MultiplyIntInt]         = &&op_MultiplyIntInt,
+    [OP_MultiplyFloatFloat]     = &&op_MultiplyFloatFloat,
+    [OP_Return]                 = &&op_Return,
+    [OP_REqual]                 = &&op_REqual,
+    [OP_RNotEqual]              = &&op_RNotEqual,
+    [OP_RLessEqual]             = &&op_RLessEqual,
+    [OP_RLessThan]              = &&op_RLessThan,
+    [OP_RGreaterEqual]          = &&op_RGreaterEqual,
+    [OP_RGreaterThan]           = &&op_RGreaterThan,
+    [OP_RShiftLeft]             = &&op_RShiftLeft,
+    [OP_RShiftRight]            = &&op_RShiftRight,
+    [OP_RAdd]                   = &&op_RAdd,
+    [OP_RSubtract]              = &&op_RSubtract,
+    [OP_RMultiply]              = &&op_RMultiply,
+    [OP_RDivide]                = &&op_RDivide,
+    [OP_RModulo]                = &&op_RModulo,
+    [OP_RBitOr]                 = &&op_RBitOr,
+    [OP_RBitAnd]                = &&op_RBitAnd,
+    [OP_RBitXor]                = &&op_RBitXor,
+    [OP_RMinus]                 = &&op_RMinus,
+    [OP_RBitNot]                = &&op_RBitNot,
+    [OP_RLogicalNot]            = &&op_RLogicalNot,
+    [OP_RReturn]                = &&op_RReturn,
+  };
+#define CASE(OP) op_##OP:
+#define DISPATCH() goto *dispatch_table[*ip++]
+  DISPATCH();
+#else
+#define CASE(OP) case OP_##OP:
+#define DISPATCH() continue
+#if VM_LOOP_COUNTING
+  uint8_t prev_op = 0;
+#endif
+  while (true) {
+#if VM_LOOP_COUNTING
+    vm->num_dispatches++;
+    if (*ip < OP_NumOpcodes) {
+      vm->pair_counts[prev_op * OP_NumOpcodes + *ip]++;
+      prev_op = *ip;
+    }
+#endif
+    switch (*ip++) {
+#endif
+
+  CASE(Nil) {
+    PUSH(NIL_VAL());
+    DISPATCH();
+  }
+  CASE(True) {
+    PUSH(BOOL_VAL(true));
+    DISPATCH();
+  }
+  CASE(False) {
+    PUSH(BOOL_VAL(false));
+    DISPATCH();
+  }
+  CASE(Const1B) {
+    size_t index = *ip++;
+    PUSH(constants[index]);
+    DISPATCH();
+  }
+  CASE(Const2B) {
+    size_t index = READ_U16();
+    PUSH(constants[index]);
+    DISPATCH();
+  }
+  CASE(Const4B) {
+    size_t index = READ_U32();
+    PUSH(constants[index]);
+    DISPATCH();
+  }
+
+  BINARY_OP_SLOW(Equal)
+  BINARY_OP_SLOW(NotEqual)
+  QUICKENED_BINARY_OP(LessEqual, BOOL_VAL(x <= y), BOOL_VAL(x <= y))
+  QUICKENED_BINARY_OP(LessThan, BOOL_VAL(x < y), BOOL_VAL(x < y))
+  QUICKENED_BINARY_OP(GreaterEqual, BOOL_VAL(x >= y), BOOL_VAL(x >= y))
+  QUICKENED_BINARY_OP(GreaterThan, BOOL_VAL(x > y), BOOL_VAL(x > y))
+  BINARY_OP_SLOW(ShiftLeft)
+  BINARY_OP_SLOW(ShiftRight)
+  QUICKENED_BINARY_OP(Add, INT_VAL(vm->mem, wrapping_add(x, y)), FLOAT_VAL(x + y))
+  QUICKENED_BINARY_OP(Subtract, INT_VAL(vm->mem, wrapping_sub(x, y)), FLOAT_VAL(x - y))
+  QUICKENED_BINARY_OP(Multiply, INT_VAL(vm->mem, wrapping_mul(x, y)), FLOAT_VAL(x * y))
+  BINARY_OP_SLOW(Divide)
+  BINARY_OP_SLOW(Modulo)
+  BINARY_OP(BitOr, INT_VAL(vm->mem, x | y))
+  BINARY_OP(BitAnd, INT_VAL(vm->mem, x & y))
+  BINARY_OP(BitXor, INT_VAL(vm->mem, x ^ y))
+
+  UNARY_OP(Minus)
+  UNARY_OP(BitNot)
+  UNARY_OP(LogicalNot)
+
+  CASE(Pop) {
+    sp--;
+    DISPATCH();
+  }
+  CASE(GetLocal) {
+    struct Value value = frame[*ip++];
+    PUSH(value);
+    DISPATCH();
+  }
+  CASE(SetLocal) {
+    frame[*ip++] = sp[-1];
+    DISPATCH();
+  }
+  CASE(GetGlobal) {
+    size_t index = READ_U16();
+    PUSH(globals[index]);
+    DISPATCH();
+  }
+  CASE(SetGlobal) {
+    size_t index = READ_U16();
+    globals[index] = sp[-1];
+    DISPATCH();
+  }
+  CASE(UpdateLocal) {
+    struct Value* variable = &frame[*ip++];
+    UPDATE_VARIABLE(variable);
+    DISPATCH();
+  }
+  CASE(UpdateGlobal) {
+    struct Value* variable = &globals[READ_U16()];
+    UPDATE_VARIABLE(variable);
+    DISPATCH();
+  }
+  CASE(Jump) {
+    size_t offset = READ_U16();
+    ip += offset;
+    DISPATCH();
+  }
+  CASE(JumpBack) {
+    size_t offset = READ_U16();
+    ip -= offset;
+    DISPATCH();
+  }
+  CASE(JumpIfFalse) {
+    size_t offset = READ_U16();
+    if (value_is_falsey(*--sp)) {
+      ip += offset;
+    }
+    DISPATCH();
+  }
+  CASE(JumpIfTrue) {
+    size_t offset = READ_U16();
+    if (!value_is_falsey(*--sp)) {
+      ip += offset;
+    }
+    DISPATCH();
+  }
+  CASE(JumpIfFalseOrPop) {
+    size_t offset = READ_U16();
+    if (value_is_falsey(sp[-1])) {
+      ip += offset;
+    } else {
+      sp--;
+    }
+    DISPATCH();
+  }
+  CASE(JumpIfTrueOrPop) {
+    size_t offset = READ_U16();
+    if (!value_is_falsey(sp[-1])) {
+      ip += offset;
+    } else {
+      sp--;
+    }
+    DISPATCH();
+  }
+  CASE(RangeStart) {
+    struct Value* slots = &frame[*ip++];
+    size_t offset = READ_U16();
+    if (!IS_INT(slots[0]) || !IS_INT(slots[1])) {
+      runtime_error(vm, "range bounds must be integers, not %s and %s",
+                    value_type_to_str(VALUE_TYPE(slots[0])),
+                    value_type_to_str(VALUE_TYPE(slots[1])));
+      goto error;
+    }
+    if (AS_INT(slots[0]) < AS_INT(slots[1])) {
+      slots[2] = slots[0];
+    } else {
+      ip += offset;
+    }
+    DISPATCH();
+  }
+  // Shares the loop step with OP_RangeLoop
+  CASE(PopRangeLoop) {
+    sp--;
+    goto range_loop;
+  }
+  CASE(RangeLoop) {
+  range_loop: ;
+    struct Value* slots = &frame[*ip++];
+    size_t offset = READ_U16();
+    // The counter is below the end, so this can't overflow
+    int64_t counter = AS_INT(slots[0]) + 1;
+    if (counter < AS_INT(slots[1])) {
+      // Separate stores, since a chained assignment compiles to reading the
+      // whole value back from the first slot, which stalls on the store
+      slots[0] = INT_VAL(vm->mem, counter);
+      slots[2] = INT_VAL(vm->mem, counter);
+      ip -= offset;
+    }
+    DISPATCH();
+  }
+  CASE(AddConst) {
+    struct Value a = sp[-1], b = constants[*ip++];
+    if (IS_SMALL_INT(a) && IS_SMALL_INT(b)) {
+      sp[-1] = INT_VAL(vm->mem, wrapping_add(AS_INT(a), AS_INT(b)));
+    } else if (!binary_op(vm, OP_Add, a, b, &sp[-1])) {
+      goto error;
+    }
+    DISPATCH();
+  }
+  CASE(AddLocalConst) {
+    struct Value a = frame[ip[0]], b = constants[ip[1]], sum;
+    ip += 2;
+    if (IS_SMALL_INT(a) && IS_SMALL_INT(b)) {
+      sum = INT_VAL(vm->mem, wrapping_add(AS_INT(a), AS_INT(b)));
+    } else if (!binary_op(vm, OP_Add, a, b, &sum)) {
+      goto error;
+    }
+    PUSH(sum);
+    DISPATCH();
+  }
+  CASE(GetLocal2) {
+    // The first push can land in the second slot, when that's a local which
+    // was just declared, so the second slot is read after it
+    PUSH(frame[ip[0]]);
+    PUSH(frame[ip[1]]);
+    ip += 2;
+    DISPATCH();
+  }
+  // Checks for integers inline, since there's no quickened variant. Anything
+  // else goes through the generic comparison.
+  CASE(LessThanJumpIfFalse) {
+    struct Value a = sp[-2], b = sp[-1], less;
+    size_t offset = READ_U16();
+    sp -= 2;
+    if (IS_SMALL_INT(a) && IS_SMALL_INT(b)) {
+      less = BOOL_VAL(AS_INT(a) < AS_INT(b));
+    } else if (!binary_op(vm, OP_LessThan, a, b, &less)) {
+      goto error;
+    }
+    if (value_is_falsey(less)) {
+      ip += offset;
+    }
+    DISPATCH();
+  }
+  CASE(Return) {
+    *result = sp[-1];
+    return true;
+  }
+
+  R_BINARY_OP_SLOW(Equal)
+  R_BINARY_OP_SLOW(NotEqual)
+  R_BINARY_OP(LessEqual, BOOL_VAL(x <= y))
+  R_BINARY_OP(LessThan, BOOL_VAL(x < y))
+  R_BINARY_OP(GreaterEqual, BOOL_VAL(x >= y))
+  R_BINARY_OP(GreaterThan, BOOL_VAL(x > y))
+  R_BINARY_OP_SLOW(ShiftLeft)
+  R_BINARY_OP_SLOW(ShiftRight)
+  R_BINARY_OP(Add, INT_VAL(vm->mem, wrapping_add(x, y)))
+  R_BINARY_OP(Subtract, INT_VAL(vm->mem, wrapping_sub(x, y)))
+  R_BINARY_OP(Multiply, INT_VAL(vm->mem, wrapping_mul(x, y)))
+  R_BINARY_OP_SLOW(Divide)
+  R_BINARY_OP_SLOW(Modulo)
+  R_BINARY_OP(BitOr, INT_VAL(vm->mem, x | y))
+  R_BINARY_OP(BitAnd, INT_VAL(vm->mem, x & y))
+  R_BINARY_OP(BitXor, INT_VAL(vm->mem, x ^ y))
+
+  R_UNARY_OP(Minus)
+  R_UNARY_OP(BitNot)
+  R_UNARY_OP(LogicalNot)
+
+  CASE(RReturn) {
+    *result = REG(0);
+    return true;
+  }
+
+#if VM_LOOP_THREADED
+invalid_opcode:
+  DIE("invalid opcode: %u", ip[-1]);
+#else
+    default:
+      DIE("invalid opcode: %u", ip[-1]);
+    }
+  }
+#endif
+
+stack_overflow:
+  runtime_error(vm, "stack overflow");
+error:
+  return false;
+
+#undef DISPATCH
+#undef CASE
+}
+
+#undef VM_LOOP_COUNTING
+#undef VM_LOOP_THREADED
+#undef VM_LOOP_NAME
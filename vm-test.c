@@ -0,0 +1,547 @@
+#include "vm.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bs.h"
+#include "code-gen.h"
+#include "parser.h"
+#include "test-util.h"
+#include "test.h"
+#include "writer.h"
+
+// Run a program only for its success or failure
+static bool run_source(const char* source, enum ChunkEncoding encoding, enum VmDispatch dispatch) {
+  struct Memory mem;
+  struct Value result;
+  mem_init(&mem);
+  bool ok = test_run(&mem, source, encoding, dispatch, 0, &result);
+  mem_fini(&mem);
+  return ok;
+}
+
+// Both encodings and all dispatch strategies must agree on the result
+#define ASSERT_EVAL(SOURCE, CHECK_RESULT) do {                                            \
+    struct Memory mem;                                                                    \
+    struct Value result;                                                                  \
+    mem_init(&mem);                                                                       \
+    ASSERT(test_run(&mem, SOURCE, CE_Stack, VM_DispatchSwitch, 0, &result));              \
+    ASSERT(CHECK_RESULT);                                                                 \
+    ASSERT(test_run(&mem, SOURCE, CE_Stack, VM_DispatchThreaded, 0, &result));            \
+    ASSERT(CHECK_RESULT);                                                                 \
+    ASSERT(test_run(&mem, SOURCE, CE_Register, VM_DispatchSwitch, 0, &result));           \
+    ASSERT(CHECK_RESULT);                                                                 \
+    ASSERT(test_run(&mem, SOURCE, CE_Register, VM_DispatchThreaded, 0, &result));         \
+    ASSERT(CHECK_RESULT);                                                                 \
+    mem_fini(&mem);                                                                       \
+  } while (0)
+
+#define ASSERT_EVAL_INT(SOURCE, I) \
+  ASSERT_EVAL(SOURCE, IS_INT(result) && AS_INT(result) == (I))
+
+#define ASSERT_EVAL_BOOL(SOURCE, B) \
+  ASSERT_EVAL(SOURCE, IS_BOOL(result) && AS_BOOL(result) == (B))
+
+TEST(Vm, IntegerArithmetic) {
+  ASSERT_EVAL_INT("1 + 2 * 3 / 4 - 5 % 6", -3);
+  ASSERT_EVAL_INT("-(3 - 10) * 2", 14);
+  ASSERT_EVAL_INT("(1 << 10) | 3 ^ 1", 1026);
+  ASSERT_EVAL_INT("!0 & 7", 7);
+  ASSERT_EVAL_INT("9223372036854775807 + 1", INT64_MIN);
+  ASSERT_EVAL_INT("140737488355327 + 1", (int64_t) 1 << 47);
+}
+
+TEST(Vm, FloatArithmetic) {
+  ASSERT_EVAL("1.5 * 2", IS_FLOAT(result) && AS_FLOAT(result) == 3.0);
+  ASSERT_EVAL("1 / 4.0", IS_FLOAT(result) && AS_FLOAT(result) == 0.25);
+}
+
+TEST(Vm, Comparisons) {
+  ASSERT_EVAL_BOOL("1 < 2", true);
+  ASSERT_EVAL_BOOL("2 <= 1.5", false);
+  ASSERT_EVAL_BOOL("1 == 1.0", true);
+  ASSERT_EVAL_BOOL("true != false", true);
+  ASSERT_EVAL_BOOL("not false", true);
+  ASSERT_EVAL_BOOL("not 0", false);
+}
+
+TEST(Vm, LastStatementIsResult) {
+  ASSERT_EVAL_INT("1; 2; 3", 3);
+  ASSERT_EVAL("", IS_NIL(result));
+}
+
+TEST(Vm, RuntimeErrors) {
+  ASSERT(!run_source("1 / 0", CE_Stack, VM_DispatchThreaded));
+  ASSERT(!run_source("1 % 0", CE_Stack, VM_DispatchSwitch));
+  ASSERT(!run_source("1 + true", CE_Stack, VM_DispatchThreaded));
+  ASSERT(!run_source("1 << 64", CE_Stack, VM_DispatchSwitch));
+  ASSERT(!run_source("-true", CE_Stack, VM_DispatchThreaded));
+}
+
+TEST(Vm, RegisterRuntimeErrors) {
+  ASSERT(!run_source("1 / 0", CE_Register, VM_DispatchThreaded));
+  ASSERT(!run_source("2 * (1 + true)", CE_Register, VM_DispatchSwitch));
+  ASSERT(!run_source("-true", CE_Register, VM_DispatchThreaded));
+}
+
+// Register code has no jumps or variables yet, so programs which need them
+// fail to compile instead
+TEST(Vm, RegisterUnsupported) {
+  const char* sources[] = { "true and false", "1 + (nil or 2)", "let x = 1", "x" };
+  for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+    struct Memory mem;
+    struct Chunk chunk;
+    mem_init(&mem);
+    chunk_init(&chunk, &mem);
+    chunk.encoding = CE_Register;
+    ASSERT(!test_compile(sources[i], 0, &chunk));
+    chunk_fini(&chunk);
+    mem_fini(&mem);
+  }
+}
+
+// Register code only dispatches operations, never loads of constants
+TEST(Vm, RegisterDispatchCount) {
+  struct Memory mem;
+  struct Vm vm;
+  struct Chunk stack_chunk, register_chunk;
+  struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);
+  mem_init(&mem);
+  vm_init(&vm, &mem, err_writer);
+  chunk_init(&stack_chunk, &mem);
+  chunk_init(&register_chunk, &mem);
+  register_chunk.encoding = CE_Register;
+  ASSERT(test_compile("(1 + 2) * (3 - 4)", 0, &stack_chunk));
+  ASSERT(test_compile("(1 + 2) * (3 - 4)", 0, &register_chunk));
+  ASSERT(register_chunk.num_registers == 6);
+
+  struct Value result;
+  ASSERT(vm_run_with_dispatch(&vm, &stack_chunk, VM_DispatchCounting, &result));
+  ASSERT(IS_INT(result) && AS_INT(result) == -3);
+  ASSERT(vm.num_dispatches == 8);
+  ASSERT(vm_run_with_dispatch(&vm, &register_chunk, VM_DispatchCounting, &result));
+  ASSERT(IS_INT(result) && AS_INT(result) == -3);
+  ASSERT(vm.num_dispatches == 4);
+
+  chunk_fini(&register_chunk);
+  chunk_fini(&stack_chunk);
+  vm_fini(&vm);
+  mem_fini(&mem);
+  file_writer_free((struct FileWriter*) err_writer);
+}
+
+// Only stack-machine code has loops and local variables
+static bool run_stack_source(struct Memory* mem, const char* source, struct Value* result) {
+  return test_run(mem, source, CE_Stack, VM_DispatchSwitch, 0, result) &&
+    test_run(mem, source, CE_Stack, VM_DispatchThreaded, 0, result);
+}
+
+// The body divides by zero on the first value which shouldn't be reached
+TEST(Vm, RangeLoops) {
+  struct Memory mem;
+  struct Value result;
+  mem_init(&mem);
+  ASSERT(run_stack_source(&mem, "for i in range(3) { i; }", &result) && IS_NIL(result));
+  ASSERT(run_stack_source(&mem, "for i in range(2) { 1 / (i - 2); }", &result));
+  ASSERT(!run_stack_source(&mem, "for i in range(3) { 1 / (i - 2); }", &result));
+  ASSERT(run_stack_source(&mem, "for i in std.range(-2, 0) { 1 / i; }", &result));
+  ASSERT(!run_stack_source(&mem, "for i in std.range(-2, 1) { 1 / i; }", &result));
+  ASSERT(run_stack_source(&mem, "for i in range(5, 5) { 1 / 0; }", &result));
+  ASSERT(run_stack_source(&mem, "for i in range(3) { for j in range(i) { 1 / (j - 2); } }",
+                          &result));
+  ASSERT(!run_stack_source(&mem, "for i in range(4) { for j in range(i) { 1 / (j - 2); } }",
+                           &result));
+  // The inner variable shadows the outer one
+  ASSERT(run_stack_source(&mem, "for i in range(1) { for i in range(2, 3) { 1 / i; } }",
+                          &result));
+  ASSERT(!run_stack_source(&mem, "for i in range(1.5) { }", &result));
+  mem_fini(&mem);
+}
+
+// "std" is usually a variable bound to the module, rather than left unbound
+TEST(Vm, RangeLoopsOverStdModule) {
+  struct Memory mem;
+  struct Value result;
+  mem_init(&mem);
+  ASSERT(run_stack_source(&mem, "let std = require(\"std\"); let n = 0; "
+                          "for i in std.range(1, 4) { n += i; } n", &result));
+  ASSERT(IS_INT(result) && AS_INT(result) == 6);
+  ASSERT(run_stack_source(&mem, "let n = 0; if true { let s = require(\"std\"); "
+                          "for i in s.range(3) { n += i; } } n", &result));
+  ASSERT(IS_INT(result) && AS_INT(result) == 3);
+  ASSERT(!run_stack_source(&mem, "let std = require(\"std\"); for i in std.range(3) { 1 / 0; }",
+                           &result));
+  mem_fini(&mem);
+  // Anything else which is called "std" has no range
+  ASSERT(!test_compiles("let std = 1; for i in std.range(0, 3) { i; }"));
+  ASSERT(!test_compiles("let std = require(\"std\"); if true { let std = 1; "
+                        "for i in std.range(3) { } }"));
+  // The module has no value at runtime yet
+  ASSERT(!test_compiles("let std = require(\"std\"); std"));
+  ASSERT(!test_compiles("let std = require(\"std\"); std = 1"));
+  ASSERT(!test_compiles("let bed = require(\"bed\")"));
+  ASSERT(!test_compiles("require(\"std\")"));
+}
+
+TEST(Vm, BreakAndContinue) {
+  struct Memory mem;
+  struct Value result;
+  mem_init(&mem);
+  // "continue" still steps the counter, or this would never finish
+  ASSERT(run_stack_source(&mem, "for i in range(3) { continue; 1 / 0; }", &result));
+  ASSERT(run_stack_source(&mem, "for i in range(3) { 1 / (i - 1); break; }", &result));
+  ASSERT(run_stack_source(&mem, "for i in range(3) { for j in range(3) { break; } 1 / (i - 3); }",
+                          &result));
+  mem_fini(&mem);
+  ASSERT(!test_compiles("for i in range(3) { j; }"));
+  ASSERT(!test_compiles("for i in range(3) { } i;"));
+  ASSERT(!test_compiles("for i in 3 { }"));
+  ASSERT(!test_compiles("let r = 3; for i in r { }"));
+}
+
+// "and" and "or" have the value of the operand which decided them, and skip
+// the right one if the left one decides
+TEST(Vm, ShortCircuit) {
+  struct Memory mem;
+  struct Value result;
+  mem_init(&mem);
+  ASSERT(run_stack_source(&mem, "1 and 2", &result) && IS_INT(result) && AS_INT(result) == 2);
+  ASSERT(run_stack_source(&mem, "nil and 1 / 0", &result) && IS_NIL(result));
+  ASSERT(run_stack_source(&mem, "false or 3", &result) && IS_INT(result) && AS_INT(result) == 3);
+  ASSERT(run_stack_source(&mem, "0 or 1 / 0", &result) && IS_INT(result) && AS_INT(result) == 0);
+  ASSERT(run_stack_source(&mem, "nil or false", &result) && IS_BOOL(result) && !AS_BOOL(result));
+  ASSERT(run_stack_source(&mem, "1 and nil or 2.5", &result) && IS_FLOAT(result));
+  ASSERT(run_stack_source(&mem, "(1 or 1 / 0) and (nil or 1 < 2)", &result) &&
+         IS_BOOL(result) && AS_BOOL(result));
+  ASSERT(run_stack_source(&mem, "not (1 and nil)", &result) && IS_BOOL(result) && AS_BOOL(result));
+  ASSERT(!run_stack_source(&mem, "true and 1 / 0", &result));
+  mem_fini(&mem);
+}
+
+TEST(Vm, IfAndWhile) {
+  struct Memory mem;
+  struct Value result;
+  mem_init(&mem);
+  ASSERT(run_stack_source(&mem, "if 1 < 2 { 3 } else { 4 }", &result) &&
+         IS_INT(result) && AS_INT(result) == 3);
+  ASSERT(run_stack_source(&mem, "if 2 < 1 { 3 } else { 4 }", &result) &&
+         IS_INT(result) && AS_INT(result) == 4);
+  ASSERT(run_stack_source(&mem, "if nil { 3 }", &result) && IS_NIL(result));
+  ASSERT(run_stack_source(&mem, "if 1 { 2; }", &result) && IS_NIL(result));
+  ASSERT(run_stack_source(&mem, "if not (1 < 2 and 2 < 1) { 5 } else { 1 / 0 }", &result) &&
+         IS_INT(result) && AS_INT(result) == 5);
+  ASSERT(run_stack_source(&mem, "for i in range(4) { if i < 1 or i > 2 { } else { 1 / (i - 3); } }",
+                          &result));
+  ASSERT(!run_stack_source(&mem, "for i in range(4) { if i == 2 and not (i != 2) { 1 / 0 } }",
+                           &result));
+  ASSERT(run_stack_source(&mem, "while true { break; 1 / 0; }", &result) && IS_NIL(result));
+  ASSERT(run_stack_source(&mem, "while 1 < 2 and nil { 1 / 0 }", &result) && IS_NIL(result));
+  ASSERT(run_stack_source(&mem, "for i in range(3) { while i < 2 or i > 5 { break; } }", &result));
+  ASSERT(!run_stack_source(&mem, "for i in range(3) { while i == 2 { 1 / 0 } }", &result));
+  ASSERT(run_stack_source(&mem, "for i in range(3) { while i > 5 { continue; } }", &result));
+  mem_fini(&mem);
+}
+
+static bool runs_to_int(struct Memory* mem, const char* source, int64_t expected) {
+  struct Value result;
+  return run_stack_source(mem, source, &result) && IS_INT(result) &&
+    AS_INT(result) == expected;
+}
+
+// "let" outside of any block declares a global, and inside one declares a
+// local, which goes out of scope at the end of the block
+TEST(Vm, Variables) {
+  struct Memory mem;
+  struct Value result;
+  mem_init(&mem);
+  ASSERT(runs_to_int(&mem, "let x = 1; let y = x + 2; y", 3));
+  ASSERT(runs_to_int(&mem, "let x = 1; x = x + 1; x += 3; x", 5));
+  ASSERT(runs_to_int(&mem, "let x = 1; let x = x + 1; x", 2));
+  ASSERT(run_stack_source(&mem, "let x; x", &result) && IS_NIL(result));
+  ASSERT(run_stack_source(&mem, "let x = 1", &result) && IS_NIL(result));
+  ASSERT(runs_to_int(&mem, "let x = 1; x = 7", 7));
+  ASSERT(runs_to_int(&mem, "let total = 0; for i in range(10) { total += i; } total", 45));
+  ASSERT(runs_to_int(&mem, "let i = 0; while i < 5 { i += 1; } i", 5));
+  ASSERT(runs_to_int(&mem, "let i = 0; let odd = 0; "
+                     "while i < 10 { i += 1; if i % 2 == 0 { continue; } odd += 1; } odd", 5));
+  // Locals shadow globals and outer locals, and the RHS still sees them
+  ASSERT(runs_to_int(&mem, "let x = 10; let y = 0; "
+                     "for i in range(3) { let x = x + i; let i = x * 2; y += i; } y + x", 76));
+  ASSERT(runs_to_int(&mem, "let x = 3; if true { let x = 4; x = x * 2; } x", 3));
+  // A local's slot is wherever its value is, even above temporaries
+  ASSERT(runs_to_int(&mem, "1 + if true { let a = 2; a * 10 } else { 0 }", 21));
+  ASSERT(runs_to_int(&mem, "let s = 0; for i in range(3) { s += 100 + if i > 0 { let a = i; "
+                     "let b = a * a; a + b } else { 0 }; } s", 308));
+  // "break" drops the temporaries under it along with the locals
+  ASSERT(runs_to_int(&mem, "let s = 0; for i in range(5) { let j = i; "
+                     "s += 1 + if j == 3 { break } else { j }; } s", 6));
+  ASSERT(runs_to_int(&mem, "let n = 0; while true { let a = 1; n += a; if n > 3 { break; } } n",
+                     4));
+  mem_fini(&mem);
+  ASSERT(!test_compiles("x"));
+  ASSERT(!test_compiles("x = 1"));
+  ASSERT(!test_compiles("x += 1"));
+  ASSERT(!test_compiles("let x = x"));
+  ASSERT(!test_compiles("if true { let a = 1; } a"));
+  ASSERT(!test_compiles("for i in range(3) { let a = i; } a"));
+}
+
+// A compound assignment whose RHS can't change the variable is a single
+// instruction after the RHS. Otherwise the variable is read before the RHS.
+TEST(Vm, CompoundAssignment) {
+  struct Memory mem;
+  struct Value result;
+  mem_init(&mem);
+  ASSERT(runs_to_int(&mem, "let x = 7; x += 3; x -= 1; x *= 4; x /= 3; x %= 7; x <<= 3; "
+                     "x >>= 1; x |= 1; x &= 13; x ^= 6; x", 3));
+  ASSERT(runs_to_int(&mem, "let y = 0; for i in range(1) { let x = 7; x += 3; x -= 1; x *= 4; "
+                     "x /= 3; x %= 7; x <<= 3; x >>= 1; x |= 1; x &= 13; x ^= 6; y = x; } y",
+                     3));
+  ASSERT(runs_to_int(&mem, "let x = 1; x += x * 2 + -x", 2));
+  ASSERT(runs_to_int(&mem, "let x = 1; x += if true { x = 5 } else { 0 }; x", 6));
+  ASSERT(run_stack_source(&mem, "let x = 1; x /= 4.0; x", &result));
+  ASSERT(IS_FLOAT(result) && AS_FLOAT(result) == 0.25);
+  ASSERT(!test_run(&mem, "let x = nil; x += 1", CE_Stack, VM_DispatchThreaded, TF_QuietErrors,
+                   &result));
+  mem_fini(&mem);
+  ASSERT(!test_compiles("let x = 1; x.a += 1"));
+  ASSERT(!test_compiles("let x = 1; x[0] *= 2"));
+  ASSERT(!test_compiles("let x = 1; x.a = 1"));
+
+  struct Memory chunk_mem;
+  struct Chunk chunk;
+  struct String buf;
+  mem_init(&chunk_mem);
+  chunk_init(&chunk, &chunk_mem);
+  string_init(&buf, "");
+  struct Writer* writer = (struct Writer*) string_writer_create(&buf);
+  ASSERT(test_compile("let g = 1; g -= 2; for i in range(3) { let a = i; a <<= g; } "
+                      "g += if true { g = 5 } else { 0 }", 0, &chunk));
+  chunk_disassemble(&chunk, "update", writer);
+  ASSERT(strstr((const char*) buf.data, "OP_UpdateGlobal  g0 OP_Subtract\n") != NULL);
+  ASSERT(strstr((const char*) buf.data, "OP_UpdateLocal   s3 OP_ShiftLeft\n") != NULL);
+  ASSERT(strstr((const char*) buf.data, "OP_UpdateGlobal  g0 OP_Add\n") == NULL);
+  string_writer_free((struct StringWriter*) writer);
+  string_fini(&buf);
+  chunk_fini(&chunk);
+  mem_fini(&chunk_mem);
+}
+
+// Code compiled in pieces sees the globals declared by the pieces before it,
+// like the lines typed into the REPL
+TEST(Vm, GlobalsAcrossChunks) {
+  static const char* const sources[] = { "let x = 40", "x + 2", "let y = x; x = 1; y + x" };
+  static const int64_t expected[] = { 0, 42, 41 };
+  struct Arena arena;
+  struct Memory mem;
+  struct Vm vm;
+  struct ModuleGlobals globals;
+  bool incomplete_input = false;
+  struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);
+  mem_init(&mem);
+  vm_init(&vm, &mem, err_writer);
+  module_globals_init(&globals);
+  for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+    struct Chunk chunk;
+    struct Value result;
+    arena_init(&arena);
+    chunk_init(&chunk, &mem);
+    struct Ast* ast = parse(&arena, sources[i], err_writer, &incomplete_input);
+    ASSERT(ast != NULL);
+    ASSERT(generate_module_bytecode(ast, &globals, &chunk, err_writer));
+    ASSERT_INT_EQ(chunk.num_globals, (i < 2 ? 1 : 2));
+    ASSERT(vm_run(&vm, &chunk, &result));
+    ASSERT(i == 0 ? IS_NIL(result) : IS_INT(result) && AS_INT(result) == expected[i]);
+    chunk_fini(&chunk);
+    arena_fini(&arena);
+  }
+  ASSERT_INT_EQ(globals.length, 2);
+  module_globals_fini(&globals);
+  vm_fini(&vm);
+  mem_fini(&mem);
+  file_writer_free((struct FileWriter*) err_writer);
+}
+
+// A line which fails doesn't leave its globals behind, whether it fails to
+// compile or at runtime, so later lines can't see them
+TEST(Vm, GlobalsRolledBack) {
+  static const char* const sources[] = {
+    "let x = 40", "let z = 1; w", "z", "let y = x; 1 / 0", "y", "let y = x + 2; y",
+  };
+  static const enum BsStatus expected[] = { BS_Ok, BS_Error, BS_Error, BS_Error, BS_Error, BS_Ok };
+  static const size_t num_globals[] = { 1, 1, 1, 1, 1, 2 };
+  struct String buf;
+  struct Bs bs;
+  string_init(&buf, "");
+  struct Writer* writer = (struct Writer*) string_writer_create(&buf);
+  bs_init(&bs, writer);
+  for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+    ASSERT_INT_EQ(bs_interpret(&bs, sources[i]), expected[i]);
+    ASSERT_INT_EQ(bs.globals.length, num_globals[i]);
+    ASSERT_INT_EQ(bs.vm.globals.length, num_globals[i]);
+  }
+  ASSERT(strstr((const char*) buf.data, "undefined variable 'z'") != NULL);
+  ASSERT(strstr((const char*) buf.data, "undefined variable 'y'") != NULL);
+  ASSERT(strstr((const char*) buf.data, "\n42\n") != NULL);
+  bs_fini(&bs);
+  string_writer_free((struct StringWriter*) writer);
+  string_fini(&buf);
+}
+
+// Every iteration dispatches the body and a single instruction to step the
+// counter and jump back
+TEST(Vm, RangeLoopDispatchCount) {
+  struct Memory mem;
+  struct Vm vm;
+  struct Chunk chunk;
+  struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);
+  mem_init(&mem);
+  vm_init(&vm, &mem, err_writer);
+  chunk_init(&chunk, &mem);
+  ASSERT(test_compile("for i in range(10) { i; }", 0, &chunk));
+
+  struct Value result;
+  ASSERT(vm_run_with_dispatch(&vm, &chunk, VM_DispatchCounting, &result));
+  ASSERT(IS_NIL(result));
+  // Setup: 0, 10, nil, OP_RangeStart. Body: OP_GetLocal, OP_Pop, OP_RangeLoop.
+  // Exit: 3 pops, nil, OP_Return.
+  ASSERT(vm.num_dispatches == 4 + 10 * 3 + 5);
+
+  chunk_fini(&chunk);
+  vm_fini(&vm);
+  mem_fini(&mem);
+  file_writer_free((struct FileWriter*) err_writer);
+}
+
+// Constants with the same type and bits share an index
+TEST(Vm, SharedConstants) {
+  struct Memory mem;
+  struct Chunk chunk;
+  mem_init(&mem);
+  chunk_init(&chunk, &mem);
+  ASSERT_INT_EQ(chunk_push_value(&chunk, INT_VAL(&mem, 0)), 0);
+  ASSERT_INT_EQ(chunk_push_value(&chunk, FLOAT_VAL(0.0)), 1);
+  ASSERT_INT_EQ(chunk_push_value(&chunk, FLOAT_VAL(-0.0)), 2);
+  ASSERT_INT_EQ(chunk_push_value(&chunk, BOOL_VAL(false)), 3);
+  ASSERT_INT_EQ(chunk_push_value(&chunk, NIL_VAL()), 4);
+  ASSERT_INT_EQ(chunk_push_value(&chunk, INT_VAL(&mem, 0)), 0);
+  ASSERT_INT_EQ(chunk_push_value(&chunk, FLOAT_VAL(-0.0)), 2);
+  ASSERT_INT_EQ(chunk_push_value(&chunk, NIL_VAL()), 4);
+  // Large integers might be boxed, but still compare by value
+  size_t big = chunk_push_value(&chunk, INT_VAL(&mem, INT64_MAX));
+  ASSERT_INT_EQ(chunk_push_value(&chunk, INT_VAL(&mem, INT64_MAX)), big);
+  size_t nan = chunk_push_value(&chunk, FLOAT_VAL(0.0 / 0.0));
+  ASSERT_INT_EQ(chunk_push_value(&chunk, FLOAT_VAL(0.0 / 0.0)), nan);
+  // Indices survive the index growing
+  for (int64_t i = 1; i <= 1000; i++) {
+    chunk_push_value(&chunk, INT_VAL(&mem, i));
+  }
+  ASSERT_INT_EQ(chunk.values.length, 1007);
+  for (int64_t i = 1; i <= 1000; i++) {
+    ASSERT_INT_EQ(chunk_push_value(&chunk, INT_VAL(&mem, i)), 6 + i);
+  }
+  ASSERT_INT_EQ(chunk_push_value(&chunk, FLOAT_VAL(0.0)), 1);
+  chunk_fini(&chunk);
+
+  // A literal used many times stays in the 1-byte constant instruction
+  char source[1024] = "1";
+  for (int i = 1; i < 300; i++) {
+    strcat(source, "+1");
+  }
+  chunk_init(&chunk, &mem);
+  ASSERT(test_compile(source, 0, &chunk));
+  ASSERT_INT_EQ(chunk.values.length, 1);
+  // 300 OP_Const1B, 299 OP_Add, OP_Return
+  ASSERT_INT_EQ(chunk.code.length, 300 * 2 + 299 + 1);
+  chunk_fini(&chunk);
+  mem_fini(&mem);
+}
+
+// Binary operations rewrite themselves for the types they see, and back when
+// the types change
+TEST(Vm, Quickening) {
+  struct Memory mem;
+  struct Vm vm;
+  struct Chunk chunk;
+  struct Writer* err_writer = (struct Writer*) file_writer_create(stderr);
+  mem_init(&mem);
+  vm_init(&vm, &mem, err_writer);
+  chunk_init(&chunk, &mem);
+  // OP_Const1B 0, OP_Const1B 1, OP_Add, OP_Const1B 2, OP_LessThan, OP_Return
+  ASSERT(test_compile("1 + 2 < 4", 0, &chunk));
+  ASSERT(chunk.code.code[4] == OP_Add && chunk.code.code[7] == OP_LessThan);
+  struct Value result;
+  ASSERT(vm_run(&vm, &chunk, &result));
+  ASSERT(IS_BOOL(result) && AS_BOOL(result));
+  ASSERT(chunk.code.code[4] == OP_AddIntInt && chunk.code.code[7] == OP_LessThanIntInt);
+  ASSERT(vm_run(&vm, &chunk, &result));
+  ASSERT(IS_BOOL(result) && AS_BOOL(result));
+
+  // A float and an integer have no variant, so both operations go back to
+  // the generic ones, with one more dispatch each
+  chunk.values.values[0] = FLOAT_VAL(1.5);
+  ASSERT(vm_run_with_dispatch(&vm, &chunk, VM_DispatchCounting, &result));
+  ASSERT(IS_BOOL(result) && AS_BOOL(result));
+  ASSERT_INT_EQ(vm.num_dispatches, 6 + 2);
+  ASSERT(chunk.code.code[4] == OP_Add && chunk.code.code[7] == OP_LessThan);
+
+  chunk.values.values[1] = FLOAT_VAL(2.5);
+  chunk.values.values[2] = FLOAT_VAL(3.5);
+  ASSERT(vm_run_with_dispatch(&vm, &chunk, VM_DispatchSwitch, &result));
+  ASSERT(IS_BOOL(result) && !AS_BOOL(result));
+  ASSERT(chunk.code.code[4] == OP_AddFloatFloat && chunk.code.code[7] == OP_LessThanFloatFloat);
+
+  // The disassembler knows the quickened opcodes
+  struct String buf;
+  string_init(&buf, "");
+  struct Writer* writer = (struct Writer*) string_writer_create(&buf);
+  chunk_disassemble(&chunk, "quickened", writer);
+  ASSERT(strstr((const char*) buf.data, "OP_AddFloatFloat\n") != NULL);
+  string_writer_free((struct StringWriter*) writer);
+  string_fini(&buf);
+  chunk_fini(&chunk);
+  vm_fini(&vm);
+  mem_fini(&mem);
+  file_writer_free((struct FileWriter*) err_writer);
+}
+
+// Running a chunk a second time goes through the quickened operations, which
+// must behave like the generic ones did the first time
+TEST(Vm, QuickenedSameResults) {
+  static const char* const operands[] = {
+    "0", "(-1)", "9223372036854775807", "(-9223372036854775807 - 1)", "2.5", "(-0.0)",
+    "(0.0 / 0)", "true", "nil",
+  };
+  static const char* const binary_ops[] = { "<=", "<", ">=", ">", "+", "-", "*" };
+  static const enum VmDispatch dispatches[] = { VM_DispatchSwitch, VM_DispatchThreaded };
+  size_t num_operands = sizeof(operands) / sizeof(operands[0]);
+  char source[128];
+  struct Memory mem;
+  struct Vm vm;
+  struct String errors;
+  mem_init(&mem);
+  string_init(&errors, "");
+  struct Writer* vm_writer = (struct Writer*) string_writer_create(&errors);
+  vm_init(&vm, &mem, vm_writer);
+  for (size_t i = 0; i < num_operands; i++) {
+    for (size_t j = 0; j < num_operands; j++) {
+      for (size_t k = 0; k < sizeof(binary_ops) / sizeof(binary_ops[0]); k++) {
+        for (size_t d = 0; d < sizeof(dispatches) / sizeof(dispatches[0]); d++) {
+          struct Chunk chunk;
+          struct Value first, second;
+          chunk_init(&chunk, &mem);
+          snprintf(source, sizeof(source), "%s %s %s", operands[i], binary_ops[k], operands[j]);
+          ASSERT(test_compile(source, 0, &chunk));
+          bool ok = vm_run_with_dispatch(&vm, &chunk, dispatches[d], &first);
+          ASSERT(ok == vm_run_with_dispatch(&vm, &chunk, dispatches[d], &second));
+          ASSERT(!ok || test_same_value(first, second));
+          chunk_fini(&chunk);
+        }
+      }
+    }
+  }
+  vm_fini(&vm);
+  string_writer_free((struct StringWriter*) vm_writer);
+  string_fini(&errors);
+  mem_fini(&mem);
+}
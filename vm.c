@@ -0,0 +1,394 @@
+#include "vm.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "log.h"
+#include "memory.h"
+#include "value.h"
+#include "writer.h"
+
+void vm_init(struct Vm* vm, struct Memory* mem, struct Writer* writer) {
+  vm->mem = mem;
+  vm->writer = writer;
+  vm->stack = MEM_ALLOC(mem, VM_STACK_MAX * sizeof(struct Value));
+  vm->num_dispatches = 0;
+  vm->pair_counts = NULL;
+  value_vec_init(&vm->globals, mem);
+}
+
+// Number of entries in the histogram of opcode pairs
+#define VM_NUM_PAIRS ((size_t) OP_NumOpcodes * OP_NumOpcodes)
+
+void vm_fini(struct Vm* vm) {
+  MEM_FREE(vm->mem, vm->stack, VM_STACK_MAX * sizeof(struct Value));
+  value_vec_fini(&vm->globals);
+  if (vm->pair_counts) {
+    MEM_FREE(vm->mem, vm->pair_counts, VM_NUM_PAIRS * sizeof(size_t));
+  }
+}
+
+size_t vm_pair_count(const struct Vm* vm, uint8_t first, uint8_t second) {
+  CHECK(first < OP_NumOpcodes && second < OP_NumOpcodes);
+  if (!vm->pair_counts) {
+    return 0;
+  }
+  return vm->pair_counts[first * OP_NumOpcodes + second];
+}
+
+static void runtime_error(struct Vm* vm, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vm->writer->writef(vm->writer, "\x1b[1;31mERROR\x1b[0m: runtime error: ");
+  vm->writer->vwritef(vm->writer, fmt, ap);
+  vm->writer->writef(vm->writer, "\n");
+  va_end(ap);
+}
+
+static const char* binary_op_symbol(uint8_t op) {
+  switch (op) {
+  case OP_Equal:        return "==";
+  case OP_NotEqual:     return "!=";
+  case OP_LessEqual:    return "<=";
+  case OP_LessThan:     return "<";
+  case OP_GreaterEqual: return ">=";
+  case OP_GreaterThan:  return ">";
+  case OP_ShiftLeft:    return "<<";
+  case OP_ShiftRight:   return ">>";
+  case OP_Add:          return "+";
+  case OP_Subtract:     return "-";
+  case OP_Multiply:     return "*";
+  case OP_Divide:       return "/";
+  case OP_Modulo:       return "%";
+  case OP_BitOr:        return "|";
+  case OP_BitAnd:       return "&";
+  case OP_BitXor:       return "^";
+  default:
+    UNREACHABLE();
+  }
+}
+
+// Integer arithmetic wraps around on overflow. Do it on unsigned integers,
+// since signed overflow is undefined behavior in C.
+static inline int64_t wrapping_add(int64_t a, int64_t b) {
+  return (int64_t) ((uint64_t) a + (uint64_t) b);
+}
+
+static inline int64_t wrapping_sub(int64_t a, int64_t b) {
+  return (int64_t) ((uint64_t) a - (uint64_t) b);
+}
+
+static inline int64_t wrapping_mul(int64_t a, int64_t b) {
+  return (int64_t) ((uint64_t) a * (uint64_t) b);
+}
+
+static bool integer_binary_op(struct Vm* vm, uint8_t op, int64_t a, int64_t b, struct Value* out) {
+  switch (op) {
+  case OP_LessEqual:    *out = BOOL_VAL(a <= b); return true;
+  case OP_LessThan:     *out = BOOL_VAL(a < b); return true;
+  case OP_GreaterEqual: *out = BOOL_VAL(a >= b); return true;
+  case OP_GreaterThan:  *out = BOOL_VAL(a > b); return true;
+  case OP_Add:          *out = INT_VAL(vm->mem, wrapping_add(a, b)); return true;
+  case OP_Subtract:     *out = INT_VAL(vm->mem, wrapping_sub(a, b)); return true;
+  case OP_Multiply:     *out = INT_VAL(vm->mem, wrapping_mul(a, b)); return true;
+  case OP_BitOr:        *out = INT_VAL(vm->mem, a | b); return true;
+  case OP_BitAnd:       *out = INT_VAL(vm->mem, a & b); return true;
+  case OP_BitXor:       *out = INT_VAL(vm->mem, a ^ b); return true;
+  case OP_Divide:
+  case OP_Modulo:
+    if (b == 0) {
+      runtime_error(vm, "integer division by zero");
+      return false;
+    }
+    // INT64_MIN / -1 overflows, and traps on x86
+    if (b == -1) {
+      *out = INT_VAL(vm->mem, op == OP_Divide ? wrapping_sub(0, a) : 0);
+    } else {
+      *out = INT_VAL(vm->mem, op == OP_Divide ? a / b : a % b);
+    }
+    return true;
+  case OP_ShiftLeft:
+  case OP_ShiftRight:
+    if (b < 0 || b > 63) {
+      runtime_error(vm, "shift count out of range: %lld", (long long) b);
+      return false;
+    }
+    *out = INT_VAL(vm->mem, op == OP_ShiftLeft ? (int64_t) ((uint64_t) a << b) : a >> b);
+    return true;
+  default:
+    UNREACHABLE();
+  }
+}
+
+// Returns `false` if the operation isn't supported on floats
+static bool float_binary_op(uint8_t op, double a, double b, struct Value* out) {
+  switch (op) {
+  case OP_LessEqual:    *out = BOOL_VAL(a <= b); return true;
+  case OP_LessThan:     *out = BOOL_VAL(a < b); return true;
+  case OP_GreaterEqual: *out = BOOL_VAL(a >= b); return true;
+  case OP_GreaterThan:  *out = BOOL_VAL(a > b); return true;
+  case OP_Add:          *out = FLOAT_VAL(a + b); return true;
+  case OP_Subtract:     *out = FLOAT_VAL(a - b); return true;
+  case OP_Multiply:     *out = FLOAT_VAL(a * b); return true;
+  case OP_Divide:       *out = FLOAT_VAL(a / b); return true;
+  default:              return false;
+  }
+}
+
+static inline bool is_number(const struct Value value) {
+  return IS_INT(value) || IS_FLOAT(value);
+}
+
+static inline double as_float(const struct Value value) {
+  return IS_INT(value) ? (double) AS_INT(value) : AS_FLOAT(value);
+}
+
+// Generic implementation of all binary operations. The interpreter loop
+// handles the common integer cases inline, and falls back to this.
+static bool binary_op(struct Vm* vm, uint8_t op, struct Value a, struct Value b,
+                      struct Value* out) {
+  switch (op) {
+  case OP_Equal:    *out = BOOL_VAL(value_equal(a, b)); return true;
+  case OP_NotEqual: *out = BOOL_VAL(!value_equal(a, b)); return true;
+  default:          break;
+  }
+  if (IS_INT(a) && IS_INT(b)) {
+    return integer_binary_op(vm, op, AS_INT(a), AS_INT(b), out);
+  }
+  if (is_number(a) && is_number(b) && float_binary_op(op, as_float(a), as_float(b), out)) {
+    return true;
+  }
+  runtime_error(vm, "unsupported operand types for %s: %s and %s", binary_op_symbol(op),
+                value_type_to_str(VALUE_TYPE(a)), value_type_to_str(VALUE_TYPE(b)));
+  return false;
+}
+
+static bool unary_op(struct Vm* vm, uint8_t op, struct Value a, struct Value* out) {
+  switch (op) {
+  case OP_Minus:
+    if (IS_INT(a)) {
+      *out = INT_VAL(vm->mem, wrapping_sub(0, AS_INT(a)));
+      return true;
+    }
+    if (IS_FLOAT(a)) {
+      *out = FLOAT_VAL(-AS_FLOAT(a));
+      return true;
+    }
+    runtime_error(vm, "unsupported operand type for -: %s", value_type_to_str(VALUE_TYPE(a)));
+    return false;
+  case OP_BitNot:
+    if (IS_INT(a)) {
+      *out = INT_VAL(vm->mem, ~AS_INT(a));
+      return true;
+    }
+    runtime_error(vm, "unsupported operand type for !: %s", value_type_to_str(VALUE_TYPE(a)));
+    return false;
+  case OP_LogicalNot:
+    *out = BOOL_VAL(value_is_falsey(a));
+    return true;
+  default:
+    UNREACHABLE();
+  }
+}
+
+// Helpers shared by all instantiations of the interpreter loop in vm-loop.h
+#define READ_U16() (ip += 2, (size_t) ip[-2] | ((size_t) ip[-1] << 8))
+#define READ_U32() (ip += 4, (size_t) ip[-4] | ((size_t) ip[-3] << 8) | \
+                    ((size_t) ip[-2] << 16) | ((size_t) ip[-1] << 24))
+#define PUSH(V) do {              \
+    if (sp == stack_end) {        \
+      goto stack_overflow;        \
+    }                             \
+    *sp++ = (V);                  \
+  } while (0)
+
+// Binary operation with an inline fast path for two (unboxed) integers
+#define BINARY_OP(OP, INT_EXPR)                                   \
+  CASE(OP) {                                                      \
+    struct Value a = sp[-2], b = sp[-1];                          \
+    if (IS_SMALL_INT(a) && IS_SMALL_INT(b)) {                     \
+      int64_t x = AS_INT(a), y = AS_INT(b);                       \
+      sp[-2] = INT_EXPR;                                          \
+    } else if (!binary_op(vm, OP_##OP, a, b, &sp[-2])) {          \
+      goto error;                                                 \
+    }                                                             \
+    sp--;                                                         \
+    DISPATCH();                                                   \
+  }
+
+// Binary operation which quickens itself. The generic opcode runs once with
+// an inline path for two (unboxed) integers or two floats, and then rewrites
+// itself into the variant for those types. The variants guard on the types,
+// and otherwise rewrite the generic opcode back, and dispatch to it.
+#define QUICKENED_BINARY_OP(OP, INT_EXPR, FLOAT_EXPR)             \
+  CASE(OP) {                                                      \
+    struct Value a = sp[-2], b = sp[-1];                          \
+    if (IS_SMALL_INT(a) && IS_SMALL_INT(b)) {                     \
+      int64_t x = AS_INT(a), y = AS_INT(b);                       \
+      sp[-2] = INT_EXPR;                                          \
+      ip[-1] = OP_##OP##IntInt;                                   \
+    } else if (IS_FLOAT(a) && IS_FLOAT(b)) {                      \
+      double x = AS_FLOAT(a), y = AS_FLOAT(b);                    \
+      sp[-2] = FLOAT_EXPR;                                        \
+      ip[-1] = OP_##OP##FloatFloat;                               \
+    } else if (!binary_op(vm, OP_##OP, a, b, &sp[-2])) {          \
+      goto error;                                                 \
+    }                                                             \
+    sp--;                                                         \
+    DISPATCH();                                                   \
+  }                                                               \
+  CASE(OP##IntInt) {                                              \
+    struct Value a = sp[-2], b = sp[-1];                          \
+    if (!IS_SMALL_INT(a) || !IS_SMALL_INT(b)) {                   \
+      *--ip = OP_##OP;                                            \
+      DISPATCH();                                                 \
+    }                                                             \
+    int64_t x = AS_INT(a), y = AS_INT(b);                         \
+    sp[-2] = INT_EXPR;                                            \
+    sp--;                                                         \
+    DISPATCH();                                                   \
+  }                                                               \
+  CASE(OP##FloatFloat) {                                          \
+    struct Value a = sp[-2], b = sp[-1];                          \
+    if (!IS_FLOAT(a) || !IS_FLOAT(b)) {                           \
+      *--ip = OP_##OP;                                            \
+      DISPATCH();                                                 \
+    }                                                             \
+    double x = AS_FLOAT(a), y = AS_FLOAT(b);                      \
+    sp[-2] = FLOAT_EXPR;                                          \
+    sp--;                                                         \
+    DISPATCH();                                                   \
+  }
+
+// Binary operation that always goes through the generic implementation
+#define BINARY_OP_SLOW(OP)                                        \
+  CASE(OP) {                                                      \
+    if (!binary_op(vm, OP_##OP, sp[-2], sp[-1], &sp[-2])) {       \
+      goto error;                                                 \
+    }                                                             \
+    sp--;                                                         \
+    DISPATCH();                                                   \
+  }
+
+#define UNARY_OP(OP)                                              \
+  CASE(OP) {                                                      \
+    if (!unary_op(vm, OP_##OP, sp[-1], &sp[-1])) {                \
+      goto error;                                                 \
+    }                                                             \
+    DISPATCH();                                                   \
+  }
+
+// Compound assignment to the variable which VAR points to, with the binary
+// opcode read from the next operand. Adding two (unboxed) integers is inline.
+#define UPDATE_VARIABLE(VAR) do {                                 \
+    uint8_t op = *ip++;                                           \
+    struct Value a = *(VAR), b = sp[-1];                          \
+    if (op == OP_Add && IS_SMALL_INT(a) && IS_SMALL_INT(b)) {     \
+      int64_t sum = wrapping_add(AS_INT(a), AS_INT(b));           \
+      sp[-1] = INT_VAL(vm->mem, sum);                             \
+    } else if (!binary_op(vm, op, a, b, &sp[-1])) {               \
+      goto error;                                                 \
+    }                                                             \
+    *(VAR) = sp[-1];                                              \
+  } while (0)
+
+// Register-machine versions of the above. Operands are 2-byte frame slots,
+// and the operation is the same as the stack-machine opcode without the "R".
+#define REG(I) regs[(size_t) ip[2 * (I)] | ((size_t) ip[2 * (I) + 1] << 8)]
+
+#define R_BINARY_OP(OP, INT_EXPR)                                 \
+  CASE(R##OP) {                                                   \
+    struct Value a = REG(1), b = REG(2);                          \
+    if (IS_SMALL_INT(a) && IS_SMALL_INT(b)) {                     \
+      int64_t x = AS_INT(a), y = AS_INT(b);                       \
+      REG(0) = INT_EXPR;                                          \
+    } else if (!binary_op(vm, OP_##OP, a, b, &REG(0))) {          \
+      goto error;                                                 \
+    }                                                             \
+    ip += 6;                                                      \
+    DISPATCH();                                                   \
+  }
+
+#define R_BINARY_OP_SLOW(OP)                                      \
+  CASE(R##OP) {                                                   \
+    if (!binary_op(vm, OP_##OP, REG(1), REG(2), &REG(0))) {       \
+      goto error;                                                 \
+    }                                                             \
+    ip += 6;                                                      \
+    DISPATCH();                                                   \
+  }
+
+#define R_UNARY_OP(OP)                                            \
+  CASE(R##OP) {                                                   \
+    if (!unary_op(vm, OP_##OP, REG(1), &REG(0))) {                \
+      goto error;                                                 \
+    }                                                             \
+    ip += 4;                                                      \
+    DISPATCH();                                                   \
+  }
+
+#define VM_LOOP_NAME run_switch
+#define VM_LOOP_THREADED 0
+#include "vm-loop.h"
+
+#define VM_LOOP_NAME run_counting
+#define VM_LOOP_THREADED 0
+#define VM_LOOP_COUNTING 1
+#include "vm-loop.h"
+
+#if VM_HAS_COMPUTED_GOTO
+// Labels-as-values are a GNU extension, which -pedantic complains about
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define VM_LOOP_NAME run_threaded
+#define VM_LOOP_THREADED 1
+#include "vm-loop.h"
+#pragma GCC diagnostic pop
+#endif
+
+#undef R_UNARY_OP
+#undef R_BINARY_OP_SLOW
+#undef R_BINARY_OP
+#undef REG
+#undef UPDATE_VARIABLE
+#undef UNARY_OP
+#undef BINARY_OP_SLOW
+#undef QUICKENED_BINARY_OP
+#undef BINARY_OP
+#undef PUSH
+#undef READ_U32
+#undef READ_U16
+
+bool vm_run_with_dispatch(struct Vm* vm, struct Chunk* chunk, enum VmDispatch dispatch,
+                          struct Value* result) {
+  // Globals declared since the last run start out as nil
+  while (vm->globals.length < chunk->num_globals) {
+    value_vec_push(&vm->globals, NIL_VAL());
+  }
+  switch (dispatch) {
+  case VM_DispatchSwitch:
+    return run_switch(vm, chunk, result);
+  case VM_DispatchThreaded:
+#if VM_HAS_COMPUTED_GOTO
+    return run_threaded(vm, chunk, result);
+#else
+    return run_switch(vm, chunk, result);
+#endif
+  case VM_DispatchCounting:
+    vm->num_dispatches = 0;
+    // Only allocated for counting runs, since it's large
+    if (!vm->pair_counts) {
+      vm->pair_counts = MEM_ALLOC(vm->mem, VM_NUM_PAIRS * sizeof(size_t));
+    }
+    memset(vm->pair_counts, 0, VM_NUM_PAIRS * sizeof(size_t));
+    return run_counting(vm, chunk, result);
+  default:
+    UNREACHABLE();
+  }
+}
+
+bool vm_run(struct Vm* vm, struct Chunk* chunk, struct Value* result) {
+  return vm_run_with_dispatch(vm, chunk, VM_DispatchThreaded, result);
+}
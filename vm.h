@@ -0,0 +1,63 @@
+#ifndef __BS_VM_H__
+#define __BS_VM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bytecode.h"
+#include "memory.h"
+#include "value.h"
+#include "writer.h"
+
+// Maximum number of values on the VM stack
+#define VM_STACK_MAX (1 << 16)
+
+// Computed-goto ("threaded") dispatch needs the GCC/Clang labels-as-values
+// extension. Everywhere else we fall back to a portable switch.
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_HAS_COMPUTED_GOTO 1
+#else
+#define VM_HAS_COMPUTED_GOTO 0
+#endif
+
+// How the interpreter loop jumps from one instruction to the next
+enum VmDispatch {
+  VM_DispatchSwitch,   // A single `switch` inside a loop
+  VM_DispatchThreaded, // `goto *label` at the end of every instruction
+  VM_DispatchCounting, // Switch dispatch, counting every dispatch in `num_dispatches`
+};
+
+// State for the stack-based bytecode interpreter
+struct Vm {
+  struct Memory* mem;      // Handle to memory manager
+  struct Writer* writer;   // Sink for runtime error messages
+  struct Value* stack;     // Value stack, holds VM_STACK_MAX values
+  size_t num_dispatches;   // Instructions dispatched by the last VM_DispatchCounting run
+  size_t* pair_counts;     // Histogram of opcode pairs from the same run, or NULL before one
+  struct ValueVec globals; // Globals of the module being run, indexed like its ModuleGlobals
+};
+
+// Initialize the VM
+void vm_init(struct Vm* vm, struct Memory* mem, struct Writer* writer);
+
+// Free memory for the VM
+void vm_fini(struct Vm* vm);
+
+// How often `second` was dispatched right after `first` in the last
+// VM_DispatchCounting run. `first` is 0 for the first instruction of the
+// chunk. This is how superinstructions are picked.
+size_t vm_pair_count(const struct Vm* vm, uint8_t first, uint8_t second);
+
+// Execute a chunk of bytecode with the fastest dispatch available on this
+// compiler. Returns `false` on a runtime error (which is written out to the
+// VM's writer), otherwise stores the returned value in `*result`. Binary
+// operations are quickened in place, which is why the chunk isn't const. Its
+// code may come back with different opcodes, which behave the same.
+bool vm_run(struct Vm* vm, struct Chunk* chunk, struct Value* result);
+
+// Same as `vm_run`, but with an explicit choice of dispatch. Threaded dispatch
+// silently falls back to the switch if it isn't supported by the compiler.
+bool vm_run_with_dispatch(struct Vm* vm, struct Chunk* chunk, enum VmDispatch dispatch,
+                          struct Value* result);
+
+#endif  // __BS_VM_H__